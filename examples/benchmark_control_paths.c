@@ -0,0 +1,117 @@
+/*
+NOTE:
+This program needs no Teensy, no trigger and no msr module. It runs the library on the
+memory backend, which stands in for the hardware and timestamps every write, and prints
+latency and throughput of the control paths:
+    - plundervolt_software_undervolt() (one msr write per plane and package)
+    - plundervolt_configure_glitch(), plundervolt_arm_glitch() and plundervolt_fire_glitch()
+      (a configure with the configuration Teensy has already sends nothing, and is timed on its own)
+The numbers measure the library itself, not the devices behind it.
+ */
+#include "../lib/plundervolt.h"
+#include <stdlib.h>
+#include <time.h>
+
+#define SAMPLES 10000
+
+uint64_t samples[SAMPLES];
+
+uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+/* Sort the samples and print their distribution. */
+void report(const char* name) {
+    uint64_t total = 0;
+    for (int i = 0; i < SAMPLES; i++) {
+        total += samples[i];
+    }
+    qsort(samples, SAMPLES, sizeof samples[0], compare);
+    printf("%-32s min %6lu ns  p50 %6lu ns  p99 %6lu ns  max %8lu ns  %10.0f calls/s\n", name,
+        samples[0], samples[SAMPLES / 2], samples[SAMPLES * 99 / 100], samples[SAMPLES - 1],
+        1e9 * SAMPLES / (double) total);
+}
+
+void nothing(void* arguments) {
+}
+
+int main() {
+    plundervolt_set_backend(&plundervolt_memory_backend);
+    plundervolt_instrument_enable(1); // The library's own histograms, dumped at the end for comparison.
+
+    plundervolt_specification_t spec = plundervolt_init();
+    spec.function = nothing;
+    spec.loop = 0;
+    spec.start_undervoltage = -1;
+    spec.end_undervoltage = -200;
+    spec.u_type = software;
+    plundervolt_error_t error_maybe = plundervolt_set_specification(spec);
+    if (!error_maybe) {
+        error_maybe = plundervolt_open_file();
+    }
+    if (error_maybe) {
+        plundervolt_print_error(error_maybe);
+        return -1;
+    }
+
+    for (int i = 0; i < SAMPLES; i++) {
+        uint64_t start = now_ns();
+        plundervolt_software_undervolt(-(i % 200));
+        samples[i] = now_ns() - start;
+    }
+    report("plundervolt_software_undervolt");
+    printf("Voltage read back at the last offset: %f V\n\n", plundervolt_read_voltage());
+
+    spec.u_type = hardware;
+    spec.teensy_serial = "teensy";
+    spec.trigger_serial = "trigger";
+    error_maybe = plundervolt_set_specification(spec);
+    if (!error_maybe) {
+        error_maybe = plundervolt_open_file();
+    }
+    if (error_maybe) {
+        plundervolt_print_error(error_maybe);
+        return -1;
+    }
+
+    uint64_t configure[SAMPLES], unchanged[SAMPLES], arm[SAMPLES], fire[SAMPLES];
+    for (int i = 0; i < SAMPLES; i++) {
+        spec.undervolting_voltage = 0.8 + (i % 2) * 0.001; // A new configuration every try, so none is skipped.
+        plundervolt_set_specification(spec);
+        uint64_t start = now_ns();
+        plundervolt_configure_glitch();
+        uint64_t configured = now_ns();
+        plundervolt_configure_glitch(); // The same again: Teensy has it, so nothing is sent.
+        unchanged[i] = now_ns() - configured;
+        configured = now_ns();
+        plundervolt_arm_glitch();
+        uint64_t armed = now_ns();
+        plundervolt_fire_glitch();
+        fire[i] = now_ns() - armed;
+        arm[i] = armed - configured;
+        configure[i] = configured - start;
+        plundervolt_reset_voltage();
+    }
+
+    for (int i = 0; i < SAMPLES; i++) samples[i] = configure[i];
+    report("plundervolt_configure_glitch");
+    for (int i = 0; i < SAMPLES; i++) samples[i] = unchanged[i];
+    report("  same configuration again");
+    for (int i = 0; i < SAMPLES; i++) samples[i] = arm[i];
+    report("plundervolt_arm_glitch");
+    for (int i = 0; i < SAMPLES; i++) samples[i] = fire[i];
+    report("plundervolt_fire_glitch");
+    printf("\nWrites recorded by the memory backend: %lu\n", plundervolt_memory_backend_record_count());
+    printf("\nPhases timed by the library:\n");
+    plundervolt_instrument_dump(stdout);
+
+    plundervolt_cleanup();
+    return 0;
+}
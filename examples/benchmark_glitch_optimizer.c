@@ -0,0 +1,170 @@
+/*
+NOTE:
+This program needs no Teensy, no trigger and no msr module. It compares three ways to search the
+hardware glitch parameters on a simulated target, by the tries they need to find a reproducible
+fault:
+    - the grid schedule of plundervolt_grid_point(), point by point
+    - random points in the same bounds (the optimizer, never past its initial points)
+    - the surrogate-model optimizer, plundervolt_optimizer_propose() and plundervolt_optimizer_observe()
+All measure a point with TRIES tries, and measure it again if it faulted; the fault is
+reproducible if it faults again. The simulated target faults only in a window of the delay, and
+more the deeper the glitch (lower voltage, longer durations), until it crashes. Where the window
+and the threshold voltage lie is drawn anew for every seed.
+ */
+#include "../lib/plundervolt_grid.h"
+#include "../lib/plundervolt_optimizer.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define SEEDS 30
+#define TRIES 10
+#define MOST_TRIES 200000
+
+typedef struct target_t {
+    double threshold; // Voltage at which half the tries in the window fault.
+    double window; // First delay of the window.
+    uint64_t random;
+} target_t;
+
+double uniform(target_t* target) {
+    target->random ^= target->random >> 12;
+    target->random ^= target->random << 25;
+    target->random ^= target->random >> 27;
+    return ((target->random * 0x2545F4914F6CDD1Dull) >> 11) * (1.0 / (1ull << 53));
+}
+
+/* Run TRIES simulated tries at a point. */
+void measure(target_t* target, const double* value, uint64_t* faults, uint64_t* crashes) {
+    double depth = target->threshold - value[PLUNDERVOLT_GLITCH_VOLTAGE]
+        + 0.0005 * value[PLUNDERVOLT_GLITCH_DURATION_START] + 0.001 * value[PLUNDERVOLT_GLITCH_DURATION_DURING];
+    double delay = value[PLUNDERVOLT_GLITCH_DELAY];
+    int in_window = delay >= target->window && delay <= target->window + 2;
+    double fault = in_window ? 0.8 / (1 + exp(-depth / 0.004)) : 0;
+    double crash = 1 / (1 + exp(-(depth - 0.015) / 0.003));
+    *faults = 0;
+    *crashes = 0;
+    for (int i = 0; i < TRIES; i++) {
+        double u = uniform(target);
+        if (u < crash) {
+            (*crashes)++;
+        } else if (u < crash + (1 - crash) * fault) {
+            (*faults)++;
+        }
+    }
+}
+
+/* Measure a point, and again if it faulted. Returns 1 if both faulted. */
+int reproducible(target_t* target, const double* value, uint64_t* tries, uint64_t* faults, uint64_t* crashes) {
+    uint64_t confirm_faults, confirm_crashes;
+    measure(target, value, faults, crashes);
+    *tries = TRIES;
+    if (*faults == 0) {
+        return 0;
+    }
+    measure(target, value, &confirm_faults, &confirm_crashes);
+    *tries += TRIES;
+    *faults += confirm_faults;
+    *crashes += confirm_crashes;
+    return confirm_faults > 0;
+}
+
+void set_bounds(plundervolt_grid_t* grid, plundervolt_optimizer_t* optimizer) {
+    grid->axis[PLUNDERVOLT_GLITCH_VOLTAGE] = (plundervolt_grid_axis_t) {1.05, 0.85, -0.005};
+    grid->axis[PLUNDERVOLT_GLITCH_DURATION_START] = (plundervolt_grid_axis_t) {0, 35, 5};
+    grid->axis[PLUNDERVOLT_GLITCH_DURATION_DURING] = (plundervolt_grid_axis_t) {0, 35, 5};
+    grid->axis[PLUNDERVOLT_GLITCH_DELAY] = (plundervolt_grid_axis_t) {0, 30, 2};
+    for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        optimizer->lower[parameter] = fmin(grid->axis[parameter].first, grid->axis[parameter].last);
+        optimizer->upper[parameter] = fmax(grid->axis[parameter].first, grid->axis[parameter].last);
+    }
+}
+
+/* Tries the grid needs to a reproducible fault, or 0 if it finds none. */
+uint64_t search_grid(target_t* target, const plundervolt_specification_t* spec) {
+    plundervolt_grid_t grid = plundervolt_grid_init();
+    plundervolt_optimizer_t unused = plundervolt_optimizer_init();
+    set_bounds(&grid, &unused);
+    uint64_t total = 0;
+    for (uint64_t index = 0; index < plundervolt_grid_points(&grid) && total < MOST_TRIES; index++) {
+        double value[PLUNDERVOLT_GLITCH_PARAMETERS];
+        uint64_t tries, faults, crashes;
+        plundervolt_grid_point(&grid, spec, index, value);
+        int found = reproducible(target, value, &tries, &faults, &crashes);
+        total += tries;
+        if (found) {
+            plundervolt_grid_free(&grid);
+            return total;
+        }
+    }
+    plundervolt_grid_free(&grid);
+    return 0;
+}
+
+/* Tries the optimizer needs to a reproducible fault, or 0 if it finds none. */
+uint64_t search_optimizer(target_t* target, const plundervolt_specification_t* spec, uint64_t seed, int initial) {
+    plundervolt_grid_t unused = plundervolt_grid_init();
+    plundervolt_optimizer_t optimizer = plundervolt_optimizer_init();
+    set_bounds(&unused, &optimizer);
+    optimizer.seed = seed;
+    optimizer.initial = initial;
+    uint64_t total = 0;
+    while (total < MOST_TRIES) {
+        double value[PLUNDERVOLT_GLITCH_PARAMETERS];
+        uint64_t tries, faults, crashes;
+        plundervolt_optimizer_propose(&optimizer, spec, value);
+        int found = reproducible(target, value, &tries, &faults, &crashes);
+        total += tries;
+        if (found) {
+            plundervolt_optimizer_free(&optimizer);
+            return total;
+        }
+        plundervolt_optimizer_observe(&optimizer, value, tries, faults, crashes);
+    }
+    plundervolt_optimizer_free(&optimizer);
+    return 0;
+}
+
+int compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+/* Print the distribution of the tries; a search which found nothing counts as MOST_TRIES. */
+void report(const char* name, uint64_t* tries) {
+    double total = 0;
+    int missed = 0;
+    for (int i = 0; i < SEEDS; i++) {
+        if (tries[i] == 0) {
+            tries[i] = MOST_TRIES;
+            missed++;
+        }
+        total += tries[i];
+    }
+    qsort(tries, SEEDS, sizeof tries[0], compare);
+    printf("%-10s mean %8.0f  p50 %7lu  p90 %7lu  max %7lu tries  (%d of %d found nothing)\n", name,
+        total / SEEDS, tries[SEEDS / 2], tries[SEEDS * 9 / 10], tries[SEEDS - 1], missed, SEEDS);
+}
+
+int main() {
+    plundervolt_specification_t spec = plundervolt_init();
+    uint64_t grid_tries[SEEDS], random_tries[SEEDS], optimizer_tries[SEEDS];
+    printf("Tries to the first reproducible fault, over %d simulated targets:\n", SEEDS);
+    for (int seed = 0; seed < SEEDS; seed++) {
+        target_t target = {0, 0, 0x9E3779B97F4A7C15ull * (seed + 1)};
+        target.threshold = 0.90 + 0.08 * uniform(&target);
+        target.window = 2 * floor(12 * uniform(&target));
+        uint64_t random = target.random;
+        grid_tries[seed] = search_grid(&target, &spec);
+        target.random = random; // The same tries for all.
+        random_tries[seed] = search_optimizer(&target, &spec, seed + 1, INT_MAX);
+        target.random = random;
+        optimizer_tries[seed] = search_optimizer(&target, &spec, seed + 1, plundervolt_optimizer_init().initial);
+        printf("  target %2d: threshold %.3f V, delay %2.0f to %2.0f ms: grid %7lu, random %7lu, optimizer %7lu\n", seed,
+            target.threshold, target.window, target.window + 2, grid_tries[seed], random_tries[seed], optimizer_tries[seed]);
+    }
+    report("grid", grid_tries);
+    report("random", random_tries);
+    report("optimizer", optimizer_tries);
+    return 0;
+}
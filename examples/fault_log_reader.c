@@ -0,0 +1,137 @@
+/*
+NOTE:
+This program reads a fault log (see plundervolt_specification_t.fault_log) and prints
+    - with --csv, every record as a CSV line
+    - with --bits, which bits flip, by kernel and voltage (see plundervolt_analysis.h)
+    - otherwise, the faults and flipped bits of every run
+It needs no Teensy and no msr module.
+ */
+#include "../lib/plundervolt.h"
+#include "../lib/plundervolt_analysis.h"
+#include "../lib/plundervolt_fault_log.h"
+#include "../lib/plundervolt_kernels.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct run_summary_t {
+    uint64_t faults;
+    uint64_t flipped_bits;
+    int64_t shallowest; // Software undervoltage of the run's faults, in mV.
+    int64_t deepest;
+    double voltage; // Hardware voltage of the run's faults, in V.
+} run_summary_t;
+
+typedef struct summary_t {
+    run_summary_t* runs;
+    uint32_t run_count;
+} summary_t;
+
+plundervolt_fault_log_t log_file;
+
+int print_csv(const plundervolt_fault_record_t* record, void* unused) {
+    printf("%lu,%u,%d,%d,%s,%016lx,%016lx,%ld,%.4f,%d,%d,%d\n", record->time_ns, record->run,
+        record->thread, record->cpu, record->kernel == PLUNDERVOLT_FAULT_NO_KERNEL ? "-" : plundervolt_kernel_name(record->kernel), record->expected,
+        record->observed, record->undervoltage, record->voltage, record->duration_start, record->duration_during, record->delay);
+    return 0;
+}
+
+int summarise(const plundervolt_fault_record_t* record, void* context) {
+    summary_t* summary = (summary_t*) context;
+    if (record->run >= summary->run_count) {
+        return 0; // Written by a run started after the log was opened here.
+    }
+    run_summary_t* run = &summary->runs[record->run];
+    if (run->faults == 0 || record->undervoltage > run->shallowest) {
+        run->shallowest = record->undervoltage;
+    }
+    if (run->faults == 0 || record->undervoltage < run->deepest) {
+        run->deepest = record->undervoltage;
+    }
+    run->voltage = record->voltage;
+    run->faults++;
+    run->flipped_bits += __builtin_popcountll(record->expected ^ record->observed);
+    return 0;
+}
+
+/* Print an aggregate: its faults, their weight and direction, and the bits which flip most. */
+void print_bits(const char* name, const plundervolt_bit_stats_t* stats) {
+    int top[3] = {-1, -1, -1};
+    for (int bit = 0; bit < 64; bit++) {
+        for (int rank = 0; rank < 3; rank++) {
+            if (stats->bit[bit] > 0 && (top[rank] == -1 || stats->bit[bit] > stats->bit[top[rank]])) {
+                memmove(top + rank + 1, top + rank, sizeof(int) * (2 - rank));
+                top[rank] = bit;
+                break;
+            }
+        }
+    }
+    printf("  %-28s %9lu faults  %5.2f bits/fault  %5.1f %% 0->1  any %016lx  every %016lx  top bits", name, stats->faults,
+        stats->faults ? (double) stats->flipped_bits / stats->faults : 0,
+        stats->flipped_bits ? 100.0 * stats->set_bits / stats->flipped_bits : 0, stats->any_mask, stats->faults ? stats->every_mask : 0);
+    for (int rank = 0; rank < 3 && top[rank] != -1; rank++) {
+        printf(" %d (%lu)", top[rank], stats->bit[top[rank]]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        printf("Usage: %s log [--csv | --bits]\n", argv[0]);
+        return -1;
+    }
+    if (plundervolt_fault_log_open_read(&log_file, argv[1])) {
+        plundervolt_print_error(PLUNDERVOLT_FAULT_LOG_ERROR);
+        return -1;
+    }
+    if (argc > 2 && strcmp(argv[2], "--csv") == 0) {
+        printf("time_ns,run,thread,cpu,kernel,expected,observed,undervoltage,voltage,duration_start,duration_during,delay\n");
+        plundervolt_fault_log_scan(&log_file, 0, print_csv, NULL);
+        plundervolt_fault_log_close(&log_file);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "--bits") == 0) {
+        struct timespec start, end;
+        plundervolt_fault_analysis_t analysis = plundervolt_fault_analysis_init();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t records = plundervolt_fault_analysis_add_log(&analysis, &log_file, 0);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%lu records analysed in %.3f s (%s).\n", records, seconds,
+            plundervolt_analysis_use_simd(1) ? "AVX2" : "scalar");
+        plundervolt_fault_analysis_sort(&analysis);
+        for (uint64_t i = 0; i < analysis.cluster_count; i++) {
+            const plundervolt_fault_cluster_t* cluster = &analysis.clusters[i];
+            char name[64];
+            const char* kernel = cluster->kernel == PLUNDERVOLT_FAULT_NO_KERNEL ? "-" : plundervolt_kernel_name(cluster->kernel);
+            if (cluster->voltage != 0) {
+                snprintf(name, sizeof name, "%s at %.4f V", kernel, cluster->voltage);
+            } else {
+                snprintf(name, sizeof name, "%s at %ld mV", kernel, cluster->undervoltage);
+            }
+            print_bits(name, &cluster->stats);
+        }
+        print_bits("all", &analysis.total);
+        plundervolt_fault_analysis_free(&analysis);
+        plundervolt_fault_log_close(&log_file);
+        return 0;
+    }
+
+    summary_t summary;
+    summary.run_count = log_file.header->runs;
+    summary.runs = calloc(summary.run_count ? summary.run_count : 1, sizeof(run_summary_t));
+    uint64_t records = plundervolt_fault_log_scan(&log_file, 0, summarise, &summary);
+    printf("%lu records of %lu slots (%lu dropped as the log was full), %u runs.\n", records,
+        plundervolt_fault_log_count(&log_file), plundervolt_fault_log_dropped(&log_file), summary.run_count);
+    for (uint32_t i = 0; i < summary.run_count; i++) {
+        run_summary_t* run = &summary.runs[i];
+        if (run->faults) {
+            printf("  run %4u: %8lu faults, %5.2f bits flipped per fault, undervoltage %ld to %ld mV, voltage %.4f V\n", i,
+                run->faults, (double) run->flipped_bits / run->faults, run->shallowest, run->deepest, run->voltage);
+        }
+    }
+    free(summary.runs);
+    plundervolt_fault_log_close(&log_file);
+    return 0;
+}
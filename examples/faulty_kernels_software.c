@@ -0,0 +1,62 @@
+/*
+NOTE:
+This program finds the undervoltage at which faults start, using one of the library's kernels
+instead of a hand-written function. Every fault is kept in kernel_faults.log; read it with
+fault_log_reader. Some tweaks may be necessary to
+    - the kernel (PLUNDERVOLT_KERNEL_IMUL works on every CPU)
+    - the undervolting start and end
+    - the coarse step
+ */
+#include "../lib/plundervolt.h"
+#include "../lib/plundervolt_kernels.h"
+
+plundervolt_specification_t spec;
+plundervolt_kernel_arguments_t kernel_arguments;
+
+int main() {
+    plundervolt_kernel_t kernel = PLUNDERVOLT_KERNEL_IMUL;
+
+    // The kernel computes its correct results here, at the normal voltage.
+    kernel_arguments.operand1 = 0xAE0000;
+    kernel_arguments.operand2 = 0x18;
+    kernel_arguments.batches = 0; // Run until the library finishes the loop.
+    if (plundervolt_kernel_prepare(&kernel_arguments, kernel)) {
+        printf("This CPU cannot run the %s kernel.\n", plundervolt_kernel_name(kernel));
+        return -1;
+    }
+
+    spec = plundervolt_init();
+    spec.function = plundervolt_kernel_function(kernel);
+    spec.arguments = &kernel_arguments; // Shared by all threads.
+    spec.integrated_loop_check = 1; // The kernel stops itself when the loop is finished.
+    spec.threads = 4;
+    spec.loop = 1;
+    spec.u_type = software;
+    spec.search = adaptive_search; // The kernel reports faults; the library brackets where they start.
+    spec.start_undervoltage = -100;
+    spec.end_undervoltage = -250;
+    spec.coarse_step = 10;
+    spec.step = 1;
+    spec.wait_time = 1000;
+    spec.fault_log = "kernel_faults.log"; // Appended to by every run.
+
+    plundervolt_error_t error_maybe = plundervolt_set_specification(spec);
+    if (!error_maybe) {
+        error_maybe = plundervolt_run();
+    }
+    if (error_maybe) {
+        plundervolt_print_error(error_maybe);
+        return -1;
+    }
+
+    printf("%s: %lu operations checked, %lu faulty.\n", plundervolt_kernel_name(kernel),
+        (uint64_t) kernel_arguments.operations, (uint64_t) kernel_arguments.faults);
+    if (plundervolt_get_fault_threshold()) {
+        printf("Faults start at %ld mV.\n", (int64_t) plundervolt_get_fault_threshold());
+    } else {
+        printf("No fault.\n");
+    }
+
+    plundervolt_cleanup();
+    return 0;
+}
@@ -7,6 +7,7 @@ The following program producess an error, but some tweeks may be necessary to
     - the duration of each stage of the attack
  */
 #include "../lib/plundervolt.h"
+#include "../lib/plundervolt_grid.h"
 #include <unistd.h>
 #include <stdlib.h>
 
@@ -14,7 +15,6 @@ The following program producess an error, but some tweeks may be necessary to
 #define num_2 0x18
 #define result num_1 * num_2;
 
-int go_on = 1;
 plundervolt_specification_t spec;
 int fault = 0;
 
@@ -47,10 +47,10 @@ void multiply() {
         
         if (in->correct_a != in->correct_b) {
             fault = 1;
-            go_on = 0;
+            plundervolt_set_loop_finished();
         }
     } while (iterations < max_iter && fault == 0
-            && go_on); // Other threads (if there are any) will stop now.
+            && plundervolt_loop_is_running()); // Other threads (if there are any) will stop now.
     plundervolt_reset_voltage(); // Set the voltage to what it was before.
     // This is a misnomer. We aren't resetting the voltage here, but the pins connected to Teensy.
     // The voltage is reset automatically.
@@ -65,6 +65,11 @@ void multiply() {
     free(in);
 }
 
+/* Show what Teensy answers to the configuration and the arming. */
+void print_teensy_response(const char* response) {
+    printf("Teensy response: %s\n", response);
+}
+
 void setup() {
     spec = plundervolt_init();
     spec.loop = 0; // The loop happens inside the multiply() function, so we don't need the library to do it.
@@ -87,42 +92,46 @@ void setup() {
     spec.trigger_serial = "/dev/ttyS0";
     spec.teensy_baudrate = 115200; // Same as default.
     spec.using_dtr = 1; // We assume the on-board trigger.
+    spec.teensy_response = print_teensy_response;
     spec.repeat = 2; // We want two tries per specification, just to make sure we don't skip the right one.
     spec.delay_before_undervolting = 200;
     spec.duration_start = 35;
     spec.duration_during = -30;
     spec.start_voltage = 1.05;
-    spec.undervolting_voltage = 0.821; // This value is to be changed. Main() decrements it, until the right voltage is found.
+    spec.undervolting_voltage = 0.821; // This value is to be changed. The grid in main() sweeps below it, until the right voltage is found.
     spec.end_voltage = spec.start_voltage; // Return to the same voltage as you started.
-    spec.tries = 1; // Since we loop ourselves, we don't need more than one try per plundervolt_run() call.
+    spec.tries = 1; // The grid runs plundervolt_run() once per voltage, so one try per run is enough.
+}
+
+/* Called by the grid after every voltage. Stops the sweep at the first fault. */
+int stop_at_fault(const plundervolt_grid_result_t* point, void* unused) {
+    printf("Iteration. Voltage: %f\n", point->value[PLUNDERVOLT_GLITCH_VOLTAGE]);
+    return fault;
 }
 
 int main() {
     setup();
-    plundervolt_error_t error_maybe;
 
     // This finds the right voltage to undervolt on. Parameters are largly arbitrary, more precisely tuned for our test PC's
-    for (int i = 0; i < 20; i++) {
-        spec.undervolting_voltage -= 0.002; // Change the voltage during undervolting
-        plundervolt_set_specification(spec); // Make library see the changes.
-
-        printf("Iteration. Voltage: %f\n", spec.undervolting_voltage);
-
-        error_maybe = plundervolt_run();
-        if (error_maybe != PLUNDERVOLT_NO_ERROR) {
-            plundervolt_print_error(error_maybe);
-            return -1;
-        }
-
-        // If the function in this iteration found a fault, stop the loop early and exit.
-        // The voltage needed to fault will be printed out.
-        if (fault) {
-            plundervolt_cleanup();
-            return 0;
-        }
+    plundervolt_grid_t grid = plundervolt_grid_init();
+    grid.axis[PLUNDERVOLT_GLITCH_VOLTAGE].first = spec.undervolting_voltage - 0.002; // Change the voltage during undervolting
+    grid.axis[PLUNDERVOLT_GLITCH_VOLTAGE].last = spec.undervolting_voltage - 0.040;
+    grid.axis[PLUNDERVOLT_GLITCH_VOLTAGE].step = -0.002;
+    grid.on_result = stop_at_fault;
+    // The other parameters keep their values from setup(). To sweep them too, set their axes; the grid orders
+    // the points so the voltage changes least often. grid.results streams every point to a CSV file.
+
+    plundervolt_error_t error_maybe = plundervolt_grid_run(&grid, spec); // Teensy and the trigger are opened by the first run only.
+    plundervolt_grid_free(&grid);
+    if (error_maybe != PLUNDERVOLT_NO_ERROR) {
+        plundervolt_print_error(error_maybe);
+        return -1;
     }
 
     plundervolt_cleanup();
-    printf("End. No fault.\n");
+    // If the function found a fault, the voltage needed to fault was printed out last.
+    if (!fault) {
+        printf("End. No fault.\n");
+    }
     return 0;
-}
\ No newline at end of file
+}
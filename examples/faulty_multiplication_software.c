@@ -13,10 +13,6 @@ The following program producess an error, but some tweeks may be necessary to
 #define num_2 0x18
 #define result num_1 * num_2;
 
-/* This controls if other threads go on.
-When one thread finds a fault, the others should stop, too,
-so they set go_on to 0. */
-int go_on = 1;
 plundervolt_specification_t spec; // This is the specification for the library.
 
 /*  This function is the loop check. It performs an operation which the user chooses, in this
@@ -26,7 +22,6 @@ plundervolt_specification_t spec; // This is the specification for the library.
 */
 int multiplication_check() {
     uint64_t volt = plundervolt_get_current_undervoltage();
-    printf("Current undervoltage: %ld\n", volt);
     uint64_t temp_res_1, temp_res_2;
     int iterations = 0;
     int max_iter = 1000000000;
@@ -48,12 +43,12 @@ int multiplication_check() {
         }
     } while (temp_res_1 == check && temp_res_2 == check // Fault hasn't occured.
             && iterations < max_iter
-            && go_on); // Other threads haven't stopped the loop.
+            && plundervolt_loop_is_running()); // Other threads haven't stopped the loop.
     
     fault = temp_res_1 != check || temp_res_2 != check;
     if (fault) {
-        printf("Fault occured.\nMultiplication 1: %016lx\nMultiplication 2: %016lx\n\
-Original result:  %016lx\nundervoltage: %ld mV\n\n", temp_res_1, temp_res_2, check, plundervolt_get_current_undervoltage());
+        // Don't print from here; the record is printed by main() once the run is over.
+        plundervolt_push_fault(check, temp_res_1 != check ? temp_res_1 : temp_res_2);
     }
     return fault;
 }
@@ -66,8 +61,7 @@ Original result:  %016lx\nundervoltage: %ld mV\n\n", temp_res_1, temp_res_2, che
 void multiply() {
     int loop_running = plundervolt_loop_is_running();
     if (multiplication_check() || !loop_running) { // This line calls the loop check function.
-        plundervolt_set_loop_finished(); // This line stops the undervolting process.
-        go_on = 0; // This is for threads. It stops all loops defined here, which plundervolt_set_loop_finished() doesn't have access to.
+        plundervolt_set_loop_finished(); // This line stops the undervolting process, and the loops of all other threads.
     }
     sleep(0.3); // This is necessary due to (we believe) some assembly-level pre-computation missteps.
 }
@@ -106,6 +100,12 @@ int main() {
         plundervolt_print_error(error_maybe);
         return -1;
     }
+    // Print the faults the threads have found.
+    plundervolt_fault_t fault;
+    while (plundervolt_pop_fault(&fault)) {
+        printf("Fault occured in thread %d on CPU %d.\nMultiplication:  %016lx\n\
+Original result: %016lx\nundervoltage: %ld mV\n\n", fault.thread, fault.cpu, fault.observed, fault.expected, fault.undervoltage);
+    }
     printf("Library finished.\nCleaning up:\n\n");
 
     plundervolt_cleanup(); // Must be called, or memory leakage may occur, and the voltage will be wrong.
@@ -0,0 +1,108 @@
+/*
+NOTE:
+This program needs no Teensy, no trigger and no msr module. It runs a software campaign on the
+memory backend with fork_server set, against a victim which crashes, faults or hangs more often
+the deeper the undervoltage, as a real one would. Every trial runs in its own child of a fork
+server, so the campaign survives the crashes and hangs, and the program prints how the trials
+ended and how long a trial takes to start.
+
+The victim's setup (a 64 MiB table) runs once per fork server in victim_init; the children
+start from it instead of building it again. The table sits on huge pages, as fork() copies the
+page tables and its cost grows with the number of pages mapped.
+ */
+#include "../lib/plundervolt.h"
+#include "../lib/plundervolt_fork_server.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <x86intrin.h>
+
+#define TABLE_SIZE (64 << 20)
+
+typedef struct victim_arguments_t {
+    uint8_t* table;
+    uint64_t seed; // 0 in every new child, so each child draws its own numbers.
+} victim_arguments_t;
+
+void victim_init(void* arguments) {
+    victim_arguments_t* victim = (victim_arguments_t*) arguments;
+    // Huge pages: fork copies the page tables, and a 2 MiB page costs it as little as a 4 KiB one.
+    victim->table = aligned_alloc(2 << 20, TABLE_SIZE);
+    madvise(victim->table, TABLE_SIZE, MADV_HUGEPAGE);
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        victim->table[i] = (uint8_t)(i * 31);
+    }
+}
+
+uint64_t next_random(victim_arguments_t* victim) {
+    if (victim->seed == 0) {
+        victim->seed = __rdtsc() | 1;
+    }
+    victim->seed ^= victim->seed << 13;
+    victim->seed ^= victim->seed >> 7;
+    victim->seed ^= victim->seed << 17;
+    return victim->seed;
+}
+
+/* One lookup. Deeper undervoltage makes faults, crashes and hangs likelier. */
+void victim(void* arguments) {
+    victim_arguments_t* victim = (victim_arguments_t*) arguments;
+    uint64_t r = next_random(victim);
+    uint64_t index = r % TABLE_SIZE;
+    uint8_t value = victim->table[index];
+    double depth = -(double)(int64_t) plundervolt_get_current_undervoltage() / 100.0; // 0.1 to 1.
+    double chance = (double)(r >> 11) / (double)(1ull << 53);
+    if (chance < depth * 1e-5) {
+        raise(SIGSEGV); // A corrupted pointer.
+    } else if (chance < depth * 1.5e-5) {
+        while (1); // A corrupted loop counter: ignores plundervolt_loop_is_running().
+    } else if (chance < depth * 1e-4) {
+        plundervolt_push_fault((uint8_t)(index * 31), value ^ 0x10);
+    }
+}
+
+int main() {
+    plundervolt_set_backend(&plundervolt_memory_backend);
+    plundervolt_instrument_enable(1);
+
+    victim_arguments_t arguments;
+    memset(&arguments, 0, sizeof arguments);
+    plundervolt_specification_t spec = plundervolt_init();
+    spec.function = victim;
+    spec.arguments = &arguments;
+    spec.integrated_loop_check = 1; // The campaign ends with the sweep.
+    spec.start_undervoltage = -10;
+    spec.end_undervoltage = -100;
+    spec.step = 10;
+    spec.wait_time = 200;
+    spec.threads = 1;
+    spec.fork_server = 1;
+    spec.victim_init = victim_init;
+    spec.trial_ms = 5;
+    spec.trial_timeout_ms = 20;
+    plundervolt_error_t error_maybe = plundervolt_set_specification(spec);
+    if (!error_maybe) {
+        error_maybe = plundervolt_run();
+    }
+    if (error_maybe) {
+        plundervolt_print_error(error_maybe);
+        return -1;
+    }
+
+    plundervolt_trial_stats_t stats;
+    plundervolt_fork_server_stats(&stats);
+    printf("%lu trials:", stats.trials);
+    for (int outcome = 0; outcome < PLUNDERVOLT_TRIAL_OUTCOMES; outcome++) {
+        printf(" %lu %s", stats.outcomes[outcome], plundervolt_trial_outcome_name(outcome));
+    }
+    printf("\nfaults reported: %lu, last crash: signal %d at %ld mV\n", plundervolt_get_fault_count(),
+        stats.last_crash_signal, (int64_t) stats.last_crash_undervoltage);
+    plundervolt_phase_summary_t start;
+    plundervolt_instrument_summary(PLUNDERVOLT_PHASE_TRIAL_START, &start);
+    printf("trial start: mean %.1f us, p50 %.1f us, p99 %.1f us\n", stats.trials ? stats.total_start_ns / 1e3 / stats.trials : 0,
+        start.p50_ns / 1e3, start.p99_ns / 1e3);
+
+    plundervolt_cleanup();
+    return 0;
+}
@@ -0,0 +1,272 @@
+/*
+NOTE:
+This program stands in for Teensy on a pseudo-terminal, so the Teensy protocols can be tried and
+benchmarked without the board. The emulator answers every text line with "ok <line>" (except the
+empty line which fires the glitch) and every binary frame except a fire with an acknowledgement (unless --lossy).
+It delays its input and output by the time the bytes would take on a serial line at the given baudrate
+(0 for no delay).
+
+    ./teensy_emulator [baudrate]            benchmark configure/arm/fire with the text and the binary protocol,
+                                            then whole runs with and without pipeline
+    ./teensy_emulator --serve [baudrate]    print the port to use as teensy_serial, and serve it until killed
+    ./teensy_emulator --lossy [baudrate]    leave every 4th frame unanswered and refuse every 10th, and check that the
+                                            library sends unanswered frames again and reports refused ones as errors
+
+The text numbers include the response timeouts of the text protocol: it reads a fixed number of
+response lines, and this emulator answers with one line per command.
+ */
+#define _GNU_SOURCE
+#include "../lib/plundervolt.h"
+#include "../lib/plundervolt_protocol.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SAMPLES 200
+
+int master; // Emulator's side of the pseudo-terminal.
+int baudrate = 115200;
+int drop_every = 0; // Leave every drop_every-th frame unanswered, as if it or its answer got lost. 0 for never.
+int refuse_every = 0; // Refuse every refuse_every-th frame. 0 for never.
+int frames = 0; // Frames answered or dropped so far, fires excepted.
+int dropped = 0;
+int refused = 0;
+
+/* Sleep for the time n bytes take on the serial line (10 bits per byte). */
+void line_delay(int n) {
+    if (baudrate > 0) {
+        usleep((useconds_t)(n * 10 * 1000000ll / baudrate));
+    }
+}
+
+void respond(const void* data, int n) {
+    line_delay(n);
+    if (write(master, data, n) != n) {
+        perror("teensy_emulator: write");
+    }
+}
+
+/* Handle the text line or frame at the start of input. Returns the bytes used, 0 if more are needed. */
+int handle(const uint8_t* input, int length) {
+    if (input[0] == PLUNDERVOLT_FRAME_START) {
+        plundervolt_frame_t frame;
+        int used = plundervolt_frame_decode(input, length, &frame);
+        if (used <= 0) {
+            return -used; // 0: wait for the rest; otherwise skip the bad bytes.
+        }
+        if (frame.type == PLUNDERVOLT_FRAME_FIRE) {
+            return used;
+        }
+        frames++;
+        if (drop_every && frames % drop_every == 0 && !(refuse_every && frames % refuse_every == 0)) {
+            dropped++;
+            return used;
+        }
+        plundervolt_frame_t answer = {.type = PLUNDERVOLT_FRAME_ACK, .sequence = frame.sequence, .length = 0};
+        plundervolt_glitch_profile_t profile;
+        if ((frame.type == PLUNDERVOLT_FRAME_CONFIGURE && plundervolt_profile_decode(frame.payload, frame.length, &profile) < 0)
+            || frame.type > PLUNDERVOLT_FRAME_SELECT || (refuse_every && frames % refuse_every == 0)) {
+            refused++;
+            answer.type = PLUNDERVOLT_FRAME_NAK;
+            answer.length = 1;
+            answer.payload[0] = frame.type;
+        }
+        uint8_t encoded[PLUNDERVOLT_FRAME_MAX];
+        respond(encoded, plundervolt_frame_encode(&answer, encoded));
+        return used;
+    }
+
+    const uint8_t* end = memchr(input, '\n', length);
+    if (end == NULL) {
+        return 0;
+    }
+    int line_length = end - input;
+    if (line_length > 0) { // The empty line fires the glitch, which is not answered.
+        char response[1024];
+        int n = snprintf(response, sizeof response, "ok %.*s\n", line_length < 1000 ? line_length : 1000, input);
+        respond(response, n);
+    }
+    return line_length + 1;
+}
+
+void* serve(void* unused) {
+    uint8_t input[4096];
+    int length = 0;
+    while (1) {
+        int n = read(master, input + length, sizeof input - length);
+        if (n <= 0) {
+            break;
+        }
+        line_delay(n);
+        length += n;
+        int used;
+        while (length > 0 && (used = handle(input, length)) > 0) {
+            memmove(input, input + used, length - used);
+            length -= used;
+        }
+        if (length == sizeof input) {
+            length = 0; // Garbage without an end; drop it.
+        }
+    }
+    return NULL;
+}
+
+/* Create the pseudo-terminal, and keep its port open in raw mode. Returns the port's name. */
+const char* open_port() {
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+        perror("teensy_emulator: posix_openpt");
+        exit(1);
+    }
+    const char* port = ptsname(master);
+    int port_fd = open(port, O_RDWR | O_NOCTTY); // Kept open, so the library's reopens never hang up the master.
+    struct termios options;
+    tcgetattr(port_fd, &options);
+    cfmakeraw(&options);
+    tcsetattr(port_fd, TCSANOW, &options);
+    return port;
+}
+
+uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int compare(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+void report(const char* name, uint64_t* samples) {
+    qsort(samples, SAMPLES, sizeof samples[0], compare);
+    printf("  %-10s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name, samples[SAMPLES / 2] / 1e3,
+        samples[SAMPLES * 99 / 100] / 1e3, samples[SAMPLES - 1] / 1e3);
+}
+
+void nothing(void* arguments) {
+}
+
+void victim(void* arguments) {
+    plundervolt_fire_glitch();
+}
+
+/* Configure and arm over a lossy line. Every try needs both, so a try fails exactly when one of its frames is refused. */
+int lossy(plundervolt_specification_t spec) {
+    spec.protocol = protocol_binary;
+    plundervolt_error_t error_maybe = plundervolt_set_specification(spec);
+    if (!error_maybe) {
+        error_maybe = plundervolt_open_file();
+    }
+    if (error_maybe) {
+        plundervolt_print_error(error_maybe);
+        return -1;
+    }
+    drop_every = 4;
+    refuse_every = 10;
+    int failed = 0, refusals_before = refused;
+    for (int i = 0; i < SAMPLES; i++) {
+        spec.undervolting_voltage = 0.8 + (i % 2) * 0.001;
+        plundervolt_set_specification(spec);
+        if (plundervolt_configure_glitch() || plundervolt_arm_glitch()) {
+            failed++;
+        }
+    }
+    drop_every = 0;
+    refuse_every = 0;
+    printf("%d tries over a lossy line: %d frames, %d left unanswered, %d refused\n", SAMPLES, frames, dropped, refused);
+    printf("tries failed: %d (refusals: %d)\n", failed, refused - refusals_before);
+    plundervolt_cleanup();
+    return failed == refused - refusals_before ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+    int serve_only = argc > 1 && strcmp(argv[1], "--serve") == 0;
+    int lossy_only = argc > 1 && strcmp(argv[1], "--lossy") == 0;
+    if (argc > 1 + serve_only + lossy_only) {
+        baudrate = atoi(argv[1 + serve_only + lossy_only]);
+    }
+    const char* port = open_port();
+    if (serve_only) {
+        printf("Teensy emulator on %s\n", port);
+        fflush(stdout);
+        serve(NULL);
+        return 0;
+    }
+    pthread_t emulator;
+    pthread_create(&emulator, NULL, serve, NULL);
+
+    plundervolt_specification_t spec = plundervolt_init();
+    spec.function = nothing;
+    spec.loop = 0;
+    spec.u_type = hardware;
+    spec.teensy_serial = (char*) port;
+    spec.trigger_serial = "unused";
+    spec.using_dtr = 0; // A pseudo-terminal has no DTR; fire with the protocol instead.
+    if (lossy_only) {
+        return lossy(spec);
+    }
+
+    protocol_type protocols[] = {protocol_text, protocol_negotiate};
+    const char* names[] = {"text", "binary"};
+    static uint64_t configure[SAMPLES], arm[SAMPLES], fire[SAMPLES];
+    printf("Emulated baudrate: %d\n", baudrate);
+    for (int p = 0; p < 2; p++) {
+        spec.protocol = protocols[p];
+        plundervolt_error_t error_maybe = plundervolt_set_specification(spec);
+        if (!error_maybe) {
+            error_maybe = plundervolt_open_file(); // Opens the session, and negotiates the protocol.
+        }
+        if (error_maybe) {
+            plundervolt_print_error(error_maybe);
+            return -1;
+        }
+
+        for (int i = 0; i < SAMPLES; i++) {
+            spec.undervolting_voltage = 0.8 + (i % 2) * 0.001; // A new configuration every try, so none is skipped.
+            plundervolt_set_specification(spec);
+            uint64_t start = now_ns();
+            plundervolt_configure_glitch();
+            uint64_t configured = now_ns();
+            plundervolt_arm_glitch();
+            uint64_t armed = now_ns();
+            plundervolt_fire_glitch();
+            fire[i] = now_ns() - armed;
+            arm[i] = armed - configured;
+            configure[i] = configured - start;
+        }
+
+        printf("%s protocol (%s):\n", names[p], plundervolt_get_session()->binary ? "frames" : "text lines");
+        report("configure", configure);
+        report("arm", arm);
+        report("fire", fire);
+    }
+
+    // Whole runs: the waits of every try, and Teensy's round trips unless they overlap them.
+    spec.protocol = protocol_text;
+    spec.function = victim;
+    spec.tries = 20;
+    spec.wait_time = 20;
+    plundervolt_set_specification(spec);
+    plundervolt_open_file(); // Reopens the session for the text protocol outside the timing.
+    for (int pipeline = 0; pipeline < 2; pipeline++) {
+        spec.pipeline = pipeline;
+        plundervolt_set_specification(spec);
+        uint64_t start = now_ns();
+        plundervolt_error_t error_maybe = plundervolt_run();
+        uint64_t took = now_ns() - start;
+        if (error_maybe) {
+            plundervolt_print_error(error_maybe);
+            return -1;
+        }
+        printf("run of %d tries, wait_time %d ms, pipeline %d: %.1f ms per try\n", spec.tries, spec.wait_time, pipeline,
+            took / 1e6 / spec.tries);
+    }
+
+    plundervolt_cleanup();
+    return 0;
+}
@@ -13,10 +13,82 @@
 #include <termios.h>  // POSIX terminal control definitions 
 #include <string.h>   // String function definitions 
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <time.h>
 
 // uncomment this to debug reads
 //#define SERIALPORTDEBUG 
 
+// Bytes read from a port but not yet returned, kept per port.
+// Reads take whatever the port has in one syscall, and lines are parsed from here.
+#define SERIALPORT_BUFFER 4096
+#define SERIALPORT_READERS 8
+
+typedef struct serialport_reader {
+    int fd;          // port, -1 if the slot is free
+    int head;        // index of the first unread byte
+    int count;       // unread bytes
+    char data[SERIALPORT_BUFFER];
+} serialport_reader;
+
+static serialport_reader readers[SERIALPORT_READERS] = {
+    [0 ... SERIALPORT_READERS - 1] = {.fd = -1}
+};
+
+// returns the reader of fd, taking a free slot on first use, or NULL if all are taken
+static serialport_reader* reader_of(int fd)
+{
+    serialport_reader* free_slot = NULL;
+    for (int i = 0; i < SERIALPORT_READERS; i++) {
+        if (readers[i].fd == fd) return &readers[i];
+        if (readers[i].fd == -1 && free_slot == NULL) free_slot = &readers[i];
+    }
+    if (free_slot != NULL) {
+        free_slot->fd = fd;
+        free_slot->head = 0;
+        free_slot->count = 0;
+    }
+    return free_slot;
+}
+
+// ms left until deadline (CLOCK_MONOTONIC), rounded up, at least 0
+static int ms_left(const struct timespec* deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ns = (deadline->tv_sec - now.tv_sec) * 1000000000l + (deadline->tv_nsec - now.tv_nsec);
+    return ns > 0 ? (int)((ns + 999999) / 1000000) : 0;  // round up, so waits never end early
+}
+
+// waits up to wait_ms for the port to be readable, then reads all it has into the ring
+// returns bytes read, 0 on timeout, -1 on error or hang-up
+static int reader_fill(serialport_reader* r, int wait_ms)
+{
+    struct pollfd p = {.fd = r->fd, .events = POLLIN};
+    int ready = poll(&p, 1, wait_ms);
+    if (ready == -1) return errno == EINTR ? 0 : -1;
+    if (ready == 0) return 0;
+    if (!(p.revents & POLLIN) && (p.revents & (POLLHUP | POLLERR | POLLNVAL))) return -1;
+
+    int total = 0;
+    while (r->count < SERIALPORT_BUFFER) {
+        int tail = (r->head + r->count) % SERIALPORT_BUFFER;
+        int room = tail >= r->head ? SERIALPORT_BUFFER - tail : r->head - tail;
+        if (room > SERIALPORT_BUFFER - r->count) room = SERIALPORT_BUFFER - r->count;
+        int n = read(r->fd, r->data + tail, room);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return total ? total : -1;
+        }
+        if (n == 0) break;
+        r->count += n;
+        total += n;
+        if (n < room) break;  // drained what the port had
+    }
+    if (total == 0 && (p.revents & POLLHUP)) return -1;  // hung up with nothing left to read
+    return total;
+}
+
 // takes the string name of the serial port (e.g. "/dev/tty.usbserial","COM1")
 // and a baud rate (bps) and connects to that port at that speed and 8N1.
 // opens the port in fully raw mode so you can send binary data.
@@ -96,6 +168,9 @@ int serialport_init(const char* serialport, int baud)
 //
 int serialport_close( int fd )
 {
+    for (int i = 0; i < SERIALPORT_READERS; i++) {
+        if (readers[i].fd == fd) readers[i].fd = -1;
+    }
     return close( fd );
 }
 
@@ -123,62 +198,85 @@ int serialport_write(int fd, const char* str)
 //
 int serialport_read_until(int fd, char* buf, char until, int buf_max, int timeout)
 {
-    char b[1];  // read expects an array, so we give it a 1-byte array
-    int i=0;
-    do { 
-        int n = read(fd, b, 1);  // read a char at a time
-        if( n==-1) return -1;    // couldn't read
-        if( n==0 ) {
-            usleep( 1 * 1000 );  // wait 1 msec try again
-            timeout--;
-            if( timeout==0 ) return -2;
-            continue;
-        }
-#ifdef SERIALPORTDEBUG  
-        printf("serialport_read_until: i=%d, n=%d b='%c'\n",i,n,b[0]); // debug
-#endif
-        buf[i] = b[0]; 
-        i++;
-    } while(b[0] != until && i < buf_max && timeout>0 );
-
-    buf[i] = 0;  // null terminate the string
-    return 0;
+    return serialport_read_lines(fd, buf, until, buf_max, timeout, 1);
 }
+
+// reads until num_lines "until" characters, buf_max - 1 bytes, or timeout ms have passed
+// returns 0 on success, -2 on timeout (buf holds what arrived), -1 on error
 int serialport_read_lines(int fd, char* buf, char until, int buf_max, int timeout, int num_lines)
 {
-    char b[1];  // read expects an array, so we give it a 1-byte array
-    memset(b,0,1); 
-    int i=0;
+    serialport_reader* r = reader_of(fd);
+    if (r == NULL) return -1;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    int i = 0;
     int line_count = 0;
-    do { 
-        int n = read(fd, b, 1);  // read a char at a time
-        if( n==-1) return -1;    // couldn't read
-        if( n==0 ) {
-            usleep( 1 * 1000 );  // wait 1 msec try again
-            timeout--;
-            if( timeout==0 ) return -2;
-            continue;
+    while (i < buf_max - 1) {
+        if (r->count == 0) {
+            int n = reader_fill(r, ms_left(&deadline));
+            if (n == -1) {
+                buf[i] = 0;
+                return -1;
+            }
+            if (n == 0) {
+                if (ms_left(&deadline) > 0) continue;  // woken early, e.g. by a signal
+                buf[i] = 0;
+                return -2;
+            }
         }
+        // take whole buffered lines at once
+        while (r->count > 0 && i < buf_max - 1) {
+            char b = r->data[r->head];
+            r->head = (r->head + 1) % SERIALPORT_BUFFER;
+            r->count--;
 #ifdef SERIALPORTDEBUG  
-        printf("serialport_read_until: i=%d, n=%d b='%c'\n",i,n,b[0]); // debug
+            printf("serialport_read_lines: i=%d, b='%c'\n",i,b); // debug
 #endif
-        buf[i] = b[0]; 
-        i++;
-        if(b[0] == until){
-            line_count ++;
-            if(line_count == num_lines)
-                break;
+            buf[i++] = b;
+            if (b == until && ++line_count == num_lines) {
+                buf[i] = 0;
+                return 0;
+            }
         }
-    } while(i < buf_max && timeout>0 );
+    }
 
     buf[i] = 0;  // null terminate the string
     return 0;
 }
 
+// returns up to buf_max bytes, waiting up to timeout ms for the first one
+// returns the number of bytes, 0 on timeout, -1 on error
+int serialport_read_bytes(int fd, char* buf, int buf_max, int timeout)
+{
+    serialport_reader* r = reader_of(fd);
+    if (r == NULL) return -1;
+    if (r->count == 0) {
+        int n = reader_fill(r, timeout);
+        if (n <= 0) return n;
+    }
+    int i = 0;
+    while (r->count > 0 && i < buf_max) {
+        buf[i++] = r->data[r->head];
+        r->head = (r->head + 1) % SERIALPORT_BUFFER;
+        r->count--;
+    }
+    return i;
+}
+
 //
 int serialport_flush(int fd)
 {
     sleep(2); //required to make flush work, for some reason
+    serialport_reader* r = reader_of(fd);
+    if (r != NULL) r->count = 0;  // drop what was read but not returned, too
     return tcflush(fd, TCIOFLUSH);
 }
 
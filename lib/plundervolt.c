@@ -19,6 +19,7 @@ Always run after "sudo modprobe msr" */
 #include <curses.h>
 #include <immintrin.h>
 #include <limits.h>
+#include <math.h>
 #include <pthread.h>
 #include <sched.h>
 #include <errno.h>
@@ -32,15 +33,92 @@ Always run after "sudo modprobe msr" */
 #include <x86intrin.h>
 #include <stdarg.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include "arduino/arduino-serial-lib.h"
 #include "plundervolt.h"
+#include "plundervolt_protocol.h"
+#include "plundervolt_telemetry.h"
+#include "plundervolt_fault_log.h"
+#include "plundervolt_fork_server.h"
+#include "plundervolt_journal.h"
+#include "plundervolt_estimate.h"
 
-int fd_teensy = 0, fd_trigger = 0, fd = 0; // Files for voltage control.
+/**
+ * @brief Threads which plundervolt_run() reuses instead of creating them for every run.
+ * Slots 0 to workers - 1 run u_spec.function, slot workers runs plundervolt_apply_undervolting().
+ * Between runs, they park until plundervolt_run() bumps generation; the run ends when all of them have checked in as finished.
+ * 
+ */
+typedef struct worker_pool_t {
+    int workers; // Number of threads running u_spec.function. 0 if the pool is not running.
+    int threads; // Threads actually created (workers + 1, unless creating them failed).
+    pthread_t* thread; // The threads.
+    int* cpus; // CPU every thread is to be pinned to. Recomputed by every run; the threads re-pin themselves when it changes.
+    pthread_mutex_t lock; // Protects generation, finished and shutdown.
+    pthread_cond_t start; // Signalled when generation changes, releasing the threads into a run.
+    pthread_cond_t done; // Signalled when the last thread of a run finishes.
+    uint64_t generation; // Incremented by every run.
+    uint64_t created; // Generation when the threads were created; the first run they take part in is the next one.
+    int finished; // Threads finished with the current run.
+    int shutdown; // Set before releasing the threads to make them exit.
+    plundervolt_error_t error; // Error of the undervolting thread in the current run.
+    uint64_t released_at; // Time stamp of the release into the current run, 0 if instrumentation is disabled.
+} worker_pool_t;
+
+/**
+ * @brief Thread which runs submitted plundervolt_request_t one after another, so the caller does not block on Teensy.
+ * 
+ */
+typedef struct io_thread_t {
+    pthread_t thread;
+    int running; // 1 once the thread is created.
+    int shutdown; // Set to make the thread exit once the queue is empty.
+    pthread_mutex_t lock; // Protects the queue, running and shutdown.
+    pthread_cond_t submitted; // Signalled when a request is queued, or shutdown is set.
+    pthread_cond_t completed; // Signalled when a request is done. Uses CLOCK_MONOTONIC, see init_io_cond().
+    plundervolt_request_t* head; // Oldest queued request, NULL if none.
+    plundervolt_request_t* tail; // Newest queued request.
+} io_thread_t;
+
+plundervolt_session_t session; // Teensy and trigger, kept open across runs. See plundervolt_init_hardware_undervolting().
+int* msr_fds = NULL; // msr file of every logical CPU, indexed by CPU. 0 if not opened yet, -1 if it failed to open.
+uint64_t undervolted_packages = 0; // Packages written to since the last reset. plundervolt_reset_voltage() resets them all.
+double core_offset[64]; // Core plane offset last written to every package, in V.
+uint32_t written_planes = 0; // Planes written since the last reset. plundervolt_reset_voltage() resets them all.
+double nominal_voltage[64]; // Core voltage of every package at no offset, read before it was undervolted. 0 if not known. Settling targets are computed from it.
+plundervolt_topology_t topology; // Filled in once by plundervolt_get_topology().
+int topology_discovered = 0;
 int initialised = 0; // Variable indicating the correct initialisation of the library (in terms of its specification).
 plundervolt_specification_t u_spec; // Specification of the library.
-uint64_t current_undervoltage; // Used in Software undervolting.
-int loop_finished = 0; // When the user wishes to stop all loops of undervolting, they set this to 1. See plundervolt_set_loop_finished().
-int DTR_flag = TIOCM_DTR; // Used in Hardware undervolting.
+plundervolt_run_state_t plundervolt_run_state; // loop_finished, current_undervoltage and fault_count. Read through the inline accessors in plundervolt.h.
+plundervolt_fault_queue_t* fault_queue; // Fault records pushed by the user's threads, drained by the controller. See plundervolt_push_fault(). Shared with forked victims.
+worker_pool_t pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .start = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER}; // Threads reused by every plundervolt_run(). See start_pool().
+pthread_once_t fault_queue_once = PTHREAD_ONCE_INIT;
+plundervolt_fork_server_t* fork_servers = NULL; // One per pool slot (slot 0 for the hardware loop) with u_spec.fork_server. See fork_trial().
+int fork_server_count = 0;
+uint64_t spec_generation = 0; // Incremented by plundervolt_set_specification(), so fork servers holding an older copy of u_spec are restarted.
+plundervolt_journal_t campaign_journal; // u_spec.journal, open during a run. See open_campaign_journal().
+int journaling = 0; // 1 while campaign_journal is open.
+plundervolt_specification_t campaign_spec; // u_spec as set, while a journaled run works on a range fitted to the journal.
+plundervolt_error_t journal_error = PLUNDERVOLT_NO_ERROR; // First failure to journal in the current run. It ends the run.
+plundervolt_fault_log_t fault_log = {.fd = -1}; // u_spec.fault_log, open from the first run with it until plundervolt_cleanup(). Shared with forked victims.
+char fault_log_path[PATH_MAX] = ""; // Path fault_log was opened with, "" if it is not open.
+int next_thread_id = 0; // Next id handed out to a thread pushing its first fault record.
+__thread int thread_id = -1; // Id of the calling thread in fault records. -1 until assigned.
+uint64_t fault_threshold = 0; // Result of adaptive_search.
+plundervolt_estimate_t run_estimate; // Fault rate of the tries of the last hardware run. See u_spec.stop_rule.
+pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER; // Protects waiting on event_cond.
+pthread_cond_t event_cond; // Signalled when the loops finish or a fault is reported. Uses CLOCK_MONOTONIC, see init_event_cond().
+pthread_once_t event_once = PTHREAD_ONCE_INIT;
+const plundervolt_backend_t* backend = &plundervolt_linux_backend; // All hardware access goes through it. See plundervolt_set_backend().
+plundervolt_glitch_profile_t glitch_profiles[PLUNDERVOLT_GLITCH_PROFILES]; // Uploaded with plundervolt_upload_glitch_profiles().
+int glitch_profile_count = 0;
+int glitch_profiles_state = 0; // 1 if Teensy holds glitch_profiles, -1 if it refused them, 0 if not uploaded on this session yet.
+int active_glitch = -1; // Profile Teensy is configured with. -1 for none or a text configuration.
+uint8_t sent_configuration[BUFMAX]; // Configuration Teensy has from this session: the text lines, or the encoded profile in binary mode. See send_configuration().
+size_t sent_configuration_length = 0; // 0 if none.
+io_thread_t io = {.lock = PTHREAD_MUTEX_INITIALIZER, .submitted = PTHREAD_COND_INITIALIZER}; // Runs Teensy commands for plundervolt_submit_request().
+pthread_once_t io_once = PTHREAD_ONCE_INIT;
 
 /**
  * @brief Run function given in u_spec.function only once.
@@ -60,12 +138,45 @@ void* run_function(void *arguments);
  */
 void* run_function_loop(void *arguments);
 /**
- * @brief Check if /dev/cpu/0/msr is accessible.
- * Attemps to open the file and gives feedback if fails.
- * Sets fd.
- * @return plundervolt_error_t PLUNDERVOLT_NO_ERROR if msr is accessible, PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if not.
+ * @brief Check if /dev/cpu/N/msr is accessible for the first CPU of every package in u_spec.packages.
+ * Attemps to open the files and gives feedback if fails.
+ * Sets msr_fds.
+ * @return plundervolt_error_t PLUNDERVOLT_NO_ERROR if msr is accessible, PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if not,
+ * PLUNDERVOLT_NO_PACKAGE_ERROR if u_spec.packages selects no existing package.
  */
 plundervolt_error_t msr_accessible_check();
+/**
+ * @brief Time between two rounds of reads while waiting for the voltage to settle, in ns.
+ * 
+ */
+#define PLUNDERVOLT_SETTLE_POLL_NS 10000
+/**
+ * @brief Return the msr file of the given logical CPU, opening it if it has not been opened before.
+ * 
+ * @param cpu Logical CPU.
+ * @return int File descriptor, or -1 if the file cannot be opened.
+ */
+int msr_fd(int cpu);
+/**
+ * @brief Read a single integer from a sysfs file.
+ * 
+ * @param path Path to the file.
+ * @param fallback Value to return if the file cannot be read.
+ * @return int The integer read, or fallback.
+ */
+int read_sysfs_int(const char* path, int fallback);
+/**
+ * @brief Restrict a package bitmask to packages which exist on this machine.
+ * 
+ * @param packages Bitmask of packages.
+ * @return uint64_t Bitmask with non-existent packages cleared.
+ */
+uint64_t existing_packages(uint64_t packages);
+/**
+ * @brief Close all msr files opened so far through the current backend.
+ * 
+ */
+void close_msr_files();
 /**
  * @brief Run function u_spec.function with arguments given number of times.
  * 
@@ -75,26 +186,655 @@ plundervolt_error_t msr_accessible_check();
  * @return Whatever the function returns.
  */
 void* run_function_times(int times, void *arguments);
+/**
+ * @brief Initialise event_cond to time out on CLOCK_MONOTONIC, so changing the wall clock does not change the waits.
+ * 
+ */
+void init_event_cond();
+/**
+ * @brief Wake up everyone waiting on event_cond.
+ * 
+ */
+void signal_event();
+/**
+ * @brief Wait for wait_ms, but return early if the loops finish or, if asked to, a fault is reported.
+ * This replaces sleeping in the undervolting thread, so a fault is reacted to in microseconds, not at the end of wait_time.
+ * 
+ * @param wait_ms How long to wait, in ms. Negative means no limit.
+ * @param wake_on_fault If not 0, also return when plundervolt_get_fault_count() changes from faults_before.
+ * @param faults_before Fault count at the start of the wait.
+ * @return int 1 if woken up early, 0 if the whole wait_ms passed.
+ */
+int wait_for_event(int wait_ms, int wake_on_fault, uint64_t faults_before);
+/**
+ * @brief Like wait_for_event(), but up to an absolute deadline, so time already spent since the event the wait counts from is not waited again.
+ * 
+ * @param deadline CLOCK_MONOTONIC time to wait until. NULL means no limit.
+ * @param wake_on_fault If not 0, also return when plundervolt_get_fault_count() changes from faults_before.
+ * @param faults_before Fault count at the start of the wait.
+ * @return int 1 if woken up early, 0 if the deadline passed.
+ */
+int wait_until_event(const struct timespec* deadline, int wake_on_fault, uint64_t faults_before);
+/**
+ * @brief Set a CLOCK_MONOTONIC deadline wait_ms from now.
+ * 
+ * @param deadline Where to store it.
+ * @param wait_ms Milliseconds from now.
+ */
+void deadline_after(struct timespec* deadline, int wait_ms);
+/**
+ * @brief Hardware. Wait until a wait_time deadline of the loop, recording the wait as PLUNDERVOLT_PHASE_WAIT.
+ * 
+ * @param deadline CLOCK_MONOTONIC time to wait until.
+ */
+void hardware_wait(const struct timespec* deadline);
+/**
+ * @brief Hardware. Run the user's function once per try, as the specification says (once, in a loop, or u_spec.loop times).
+ * 
+ */
+void run_victim();
+/**
+ * @brief Hardware. Queue getting a try ready: select u_spec.glitch_profile or configure the fields of the specification,
+ * then, if that worked, arm the glitch.
+ * 
+ * @param requests Two requests, for the configuration and the arming.
+ * @return plundervolt_error_t As plundervolt_submit_request().
+ */
+plundervolt_error_t prepare_glitch_async(plundervolt_request_t* requests);
+/**
+ * @brief Callback of the configuration request of prepare_glitch_async(): submit the arming if the configuration worked.
+ * 
+ * @param configured The configuration request.
+ * @param arm The arming request.
+ */
+void arm_when_configured(plundervolt_request_t* configured, void* arm);
+/**
+ * @brief Wait for the requests of prepare_glitch_async().
+ * 
+ * @param requests The two requests.
+ * @return plundervolt_error_t Error of the configuration, or else of the arming.
+ */
+plundervolt_error_t wait_prepared_glitch(plundervolt_request_t* requests);
+/**
+ * @brief Initialise io.completed to time out on CLOCK_MONOTONIC.
+ * 
+ */
+void init_io_cond();
+/**
+ * @brief Body of the I/O thread: run queued requests until shut down.
+ * 
+ * @param unused Unused.
+ * @return void* NULL.
+ */
+void* io_thread_main(void* unused);
+/**
+ * @brief Let the I/O thread finish the queued requests, and exit.
+ * 
+ */
+void stop_io_thread();
+/**
+ * @brief Open the session's ports as u_spec asks, closing any open ones first.
+ * 
+ * @return plundervolt_error_t PLUNDERVOLT_CONNECTION_INIT_ERROR if a port cannot be opened.
+ */
+plundervolt_error_t open_session();
+/**
+ * @brief Write to Teensy. If the write fails, reopen the session once and try again, so an unplugged and replugged Teensy does not end a campaign.
+ * 
+ * @param buf Bytes to write.
+ * @param len Number of bytes.
+ * @return int 0 on success, -1 on failure.
+ */
+int teensy_write(const char* buf, size_t len);
+/**
+ * @brief Send a configuration to Teensy: the delay line and the six-field line, or a CONFIGURE frame with the whole profile
+ * in binary mode. Skipped if it is the one sent last on this session.
+ * 
+ * @param profile The configuration. The text lines only carry the first three segments.
+ * @return plundervolt_error_t PLUNDERVOLT_WRITE_TO_TEENSY_ERROR if writing failed, or Teensy refused or never acknowledged the frame.
+ */
+plundervolt_error_t send_configuration(const plundervolt_glitch_profile_t* profile);
+/**
+ * @brief Write a line to Teensy and read one line of response.
+ * 
+ * @param line The line, ending with EOL.
+ * @return int 1 if Teensy answered "ok...", 0 if it answered something else or nothing, -1 if writing failed.
+ */
+int teensy_command(const char* line);
+/**
+ * @brief Pass a text response of Teensy to u_spec.teensy_response, if it is set.
+ * 
+ */
+void teensy_answer(const char* response);
+/**
+ * @brief Send a binary frame to Teensy and, unless it is a fire, wait up to PLUNDERVOLT_FRAME_TIMEOUT_MS for its
+ * acknowledgement. Without one, the frame is sent again, up to PLUNDERVOLT_FRAME_TRIES times in all.
+ * 
+ * @param type Frame type.
+ * @param payload Payload.
+ * @param length Payload length.
+ * @return int 1 if Teensy acknowledged it (or it is a fire), 0 if it refused it, -1 if writing failed or Teensy never answered.
+ */
+int teensy_frame(plundervolt_frame_type_t type, const uint8_t* payload, size_t length);
+/**
+ * @brief Ask Teensy for binary frames, as u_spec.protocol says. Writes directly through the backend, as the session is still being opened.
+ * 
+ * @return plundervolt_error_t PLUNDERVOLT_CONNECTION_INIT_ERROR if protocol_binary is asked for and Teensy refuses.
+ */
+plundervolt_error_t negotiate_protocol();
+/**
+ * @brief Give every cell of fault_queue its initial sequence number (its index), which marks it free.
+ * 
+ */
+void init_fault_queue();
+/**
+ * @brief Body of every thread in the pool: pin to its CPU, then wait for runs until shut down.
+ * 
+ * @param slot Index of the thread in the pool, cast to a pointer.
+ * @return void* NULL.
+ */
+void* pool_thread(void* slot);
+/**
+ * @brief Make sure the pool has u_spec.threads workers (and the undervolting thread) waiting, creating it if needed,
+ * and place them on CPUs according to the specification.
+ * 
+ * @return plundervolt_error_t PLUNDERVOLT_PLACEMENT_ERROR if the threads cannot be placed, PLUNDERVOLT_GENERIC_ERROR if they cannot be created, PLUNDERVOLT_NO_ERROR otherwise.
+ */
+plundervolt_error_t start_pool();
+/**
+ * @brief Make all pool threads exit, and free the pool.
+ * 
+ */
+void stop_pool();
+/**
+ * @brief Release the pool threads into a run (or into exiting, if pool.shutdown is set) and wait until all of them are done.
+ * 
+ */
+void release_pool();
+/**
+ * @brief Start the telemetry sampler on the first CPU of every package in u_spec.packages, pinned to controller_cpu.
+ * 
+ * @return plundervolt_error_t As plundervolt_telemetry_start().
+ */
+plundervolt_error_t start_telemetry();
+/**
+ * @brief Open u_spec.fault_log, unless it is open already (a log of another path is closed), and start a run in it.
+ * Closes the log if u_spec.fault_log is NULL.
+ *
+ * @return plundervolt_error_t PLUNDERVOLT_FAULT_LOG_ERROR if it cannot be opened.
+ */
+plundervolt_error_t open_fault_log();
+/**
+ * @brief Close fault_log, if open.
+ *
+ */
+void close_fault_log();
+/**
+ * @brief Open u_spec.journal for a run and fit the run to it: resume the journal's unfinished campaign if it has the same
+ * specification (a linear search after its last finished step, hardware after its last try), or start a new campaign;
+ * and keep a software search above every unsafe undervoltage, and a hardware glitch above every unsafe glitch voltage.
+ * Changes start_undervoltage, end_undervoltage and tries of u_spec until close_campaign_journal().
+ * 
+ * @param done Set to 1 if the resumed campaign has nothing left to do; it is ended, and the journal closed.
+ * @return plundervolt_error_t PLUNDERVOLT_JOURNAL_ERROR, or PLUNDERVOLT_UNSAFE_RANGE_ERROR if no safe undervoltage is left,
+ * or the glitch is unsafe (the journal is closed then).
+ */
+plundervolt_error_t open_campaign_journal(int* done);
+/**
+ * @brief End the campaign in the journal if the run finished, close the journal and restore u_spec.
+ * 
+ * @param finished 1 if the run finished, 0 if it failed and is to be resumed.
+ */
+void close_campaign_journal(int finished);
+/**
+ * @return uint64_t FNV-1a hash of the fields of u_spec which decide what a campaign does.
+ */
+uint64_t campaign_fingerprint();
+/**
+ * @brief Journal that an undervoltage is about to be applied. A step deeper than any before is synced first.
+ * 
+ * @return int 0 if journaled (or no journal is open), -1 if journaling failed: the loops are finished then, and the step must not be applied.
+ */
+int journal_step(int64_t undervoltage);
+/**
+ * @brief Journal the end of a step and the faults reported during it, and sync if the last sync is u_spec.journal_sync_ms ago.
+ * 
+ */
+void journal_step_done(int64_t undervoltage, uint64_t faults);
+/**
+ * @brief Hardware. Journal one more try done, and sync if the last sync is u_spec.journal_sync_ms ago.
+ * 
+ */
+void journal_try();
+/**
+ * @brief Hardware. Step of a run in the journal: the lowest voltage of the glitch it selects or configures, in 0.1 mV.
+ * 
+ */
+int64_t hardware_step();
+/**
+ * @brief Hardware. Trials of the fork server which crashed or hung so far, 0 without fork_server.
+ * 
+ */
+uint64_t hardware_crashes();
+/**
+ * @brief Remember the first journal failure of the run, and finish the loops.
+ * 
+ */
+void journal_failed(plundervolt_error_t error);
+/**
+ * @brief Publish the undervoltage the undervolting thread has just set.
+ * 
+ * @param undervoltage Undervoltage in mV.
+ */
+void set_current_undervoltage(uint64_t undervoltage);
+/**
+ * @brief Software. Lower the undervoltage by u_spec.step from start_undervoltage to end_undervoltage, as a compiled ramp.
+ * 
+ * @return plundervolt_error_t As plundervolt_compile_ramp() and plundervolt_execute_ramp().
+ */
+plundervolt_error_t search_linear();
+/**
+ * @brief Software. Wait until an absolute deadline for plundervolt_execute_ramp().
+ * 
+ * @param deadline CLOCK_MONOTONIC time, in ns.
+ * @param spin_ns Busy-wait the last spin_ns before the deadline.
+ * @return int 1 if the loops finished, 0 otherwise.
+ */
+int ramp_wait(uint64_t deadline, uint64_t spin_ns);
+/**
+ * @brief Software. Read the core voltage of a CPU from msr 0x198.
+ * 
+ * @param cpu Logical CPU.
+ * @param voltage Where to store the voltage, in V.
+ * @return int 0 on success, -1 if the msr cannot be read.
+ */
+int read_core_voltage(int cpu, double* voltage);
+/**
+ * @brief Decode the offset of an msr 0x150 word, as made by plundervolt_compute_msr_value().
+ * 
+ * @param value The word.
+ * @return double The offset, in V.
+ */
+double msr_offset_volts(uint64_t value);
+/**
+ * @brief Software. Read the core voltage of the packages not undervolted yet into nominal_voltage, before they are.
+ * 
+ * @param packages Bitmask of packages about to be written to.
+ */
+void remember_nominal_voltage(uint64_t packages);
+/**
+ * @brief Software. Write u_spec.plane_offset to every plane outside u_spec.sweep_planes which has one, or restore those planes.
+ * 
+ * @param hold 1 to apply the offsets, 0 to restore the planes.
+ */
+void hold_planes(int hold);
+/**
+ * @brief Make sure there is a fork server slot for every thread which may run trials. Call before the threads run.
+ * 
+ * @param count Number of slots.
+ */
+void prepare_fork_servers(int count);
+/**
+ * @brief Kill all fork servers.
+ * 
+ */
+void stop_fork_servers();
+/**
+ * @brief Trial run in a child of a fork server: what the thread would have run itself without fork_server.
+ * 
+ * @param unused Ignored; the function gets u_spec.arguments.
+ */
+void victim_trial(void* unused);
+/**
+ * @brief Run one trial in a child of the fork server of a slot, (re)starting the server if needed, and pass its faults
+ * and stop request on to this process.
+ * 
+ * @param slot Fork server slot.
+ * @param cpu CPU to run the child on, or -1.
+ * @return plundervolt_error_t PLUNDERVOLT_GENERIC_ERROR if the server cannot be (re)started.
+ */
+plundervolt_error_t fork_trial(int slot, int cpu);
+/**
+ * @brief Software. Poll the core voltage of some CPUs until PLUNDERVOLT_SETTLE_SAMPLES reads in a row are all within tolerance of their targets.
+ * 
+ * @param cpus Logical CPUs.
+ * @param targets Voltage every CPU is to settle at, in V.
+ * @param count Number of CPUs.
+ * @param tolerance Largest acceptable difference, in V.
+ * @param deadline CLOCK_MONOTONIC time to give up at, in ns.
+ * @param settled_at Where to store the time of the last read, in ns.
+ * @return plundervolt_error_t PLUNDERVOLT_SETTLE_TIMEOUT_ERROR if not settled by the deadline, PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if a read failed.
+ */
+plundervolt_error_t wait_settled(const int* cpus, const double* targets, int count, double tolerance, uint64_t deadline, uint64_t* settled_at);
+/**
+ * @brief Software. Find the undervoltage at which faults start: coarse steps until the first fault, then bisection,
+ * then steps of u_spec.step. After every fault, go back to the last fault-free undervoltage. Sets fault_threshold.
+ * 
+ */
+void search_adaptive();
+/**
+ * @brief Software. Undervolt, give the user's function u_spec.wait_time to run, and check if it reported a fault.
+ * If it did, back off to the fault-free undervoltage straight away.
+ * 
+ * @param undervoltage Undervoltage to try.
+ * @param fault_free Undervoltage known not to fault, to back off to.
+ * @return int 1 if a fault was reported during the wait, 0 if not.
+ */
+int try_undervoltage(int64_t undervoltage, int64_t fault_free);
+
+void set_current_undervoltage(uint64_t undervoltage) {
+    atomic_store_explicit(&plundervolt_run_state.current_undervoltage, undervoltage, memory_order_relaxed);
+}
 
-uint64_t plundervolt_get_current_undervoltage() {
-    return current_undervoltage;
+void init_event_cond() {
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&event_cond, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+void signal_event() {
+    pthread_once(&event_once, init_event_cond);
+    // Taking the lock makes sure a waiter is either before its check or already asleep, so the wake-up is not lost.
+    pthread_mutex_lock(&event_lock);
+    pthread_cond_broadcast(&event_cond);
+    pthread_mutex_unlock(&event_lock);
+}
+
+void deadline_after(struct timespec* deadline, int wait_ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += wait_ms / 1000;
+    deadline->tv_nsec += (long)(wait_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+int wait_for_event(int wait_ms, int wake_on_fault, uint64_t faults_before) {
+    struct timespec deadline;
+    deadline_after(&deadline, wait_ms);
+    return wait_until_event(wait_ms < 0 ? NULL : &deadline, wake_on_fault, faults_before);
+}
+
+int wait_until_event(const struct timespec* deadline, int wake_on_fault, uint64_t faults_before) {
+    pthread_once(&event_once, init_event_cond);
+    int woken = 0;
+    pthread_mutex_lock(&event_lock);
+    while (1) {
+        if (!plundervolt_loop_is_running()
+            || (wake_on_fault && plundervolt_get_fault_count() != faults_before)) {
+            woken = 1;
+            break;
+        }
+        int error = deadline == NULL ? pthread_cond_wait(&event_cond, &event_lock)
+                                     : pthread_cond_timedwait(&event_cond, &event_lock, deadline);
+        if (error == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event_lock);
+    return woken;
 }
 
 void plundervolt_set_loop_finished() {
-    loop_finished = 1;
+    if (plundervolt_victim_shared != NULL) { // A forked victim: end the campaign, not only this trial.
+        atomic_store_explicit(&plundervolt_victim_shared->stop, 1, memory_order_release);
+    }
+    plundervolt_instrument_stop_requested();
+    atomic_store_explicit(&plundervolt_run_state.loop_finished, 1, memory_order_release);
+    signal_event();
 }
 
-plundervolt_error_t msr_accessible_check() {
+int plundervolt_wait_loop_finished(int timeout_ms) {
+    return wait_for_event(timeout_ms, 0, 0);
+}
+
+void plundervolt_report_fault() {
+    if (plundervolt_victim_shared != NULL) {
+        atomic_fetch_add_explicit(&plundervolt_victim_shared->faults, 1, memory_order_release);
+    }
+    atomic_fetch_add_explicit(&plundervolt_run_state.fault_count, 1, memory_order_release);
+    signal_event();
+}
+
+void init_fault_queue() {
+    // Shared memory, so children of fork servers push into the same queue.
+    fault_queue = mmap(NULL, sizeof(plundervolt_fault_queue_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (fault_queue == MAP_FAILED) {
+        fault_queue = aligned_alloc(PLUNDERVOLT_CACHE_LINE, sizeof(plundervolt_fault_queue_t));
+        memset(fault_queue, 0, sizeof(plundervolt_fault_queue_t));
+    }
+    for (size_t i = 0; i < PLUNDERVOLT_FAULT_QUEUE_SIZE; i++) {
+        atomic_store_explicit(&fault_queue->cells[i].sequence, i, memory_order_relaxed);
+    }
+}
+
+int plundervolt_push_fault(uint64_t expected, uint64_t observed) {
+    return plundervolt_push_kernel_fault(expected, observed, PLUNDERVOLT_FAULT_NO_KERNEL);
+}
+
+int plundervolt_push_kernel_fault(uint64_t expected, uint64_t observed, int kernel) {
+    pthread_once(&fault_queue_once, init_fault_queue);
+    if (thread_id == -1) {
+        thread_id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    }
+    plundervolt_fault_t fault = {
+        .timestamp = __rdtsc(),
+        .undervoltage = plundervolt_get_current_undervoltage(),
+        .expected = expected,
+        .observed = observed,
+        .cpu = sched_getcpu(),
+        .thread = thread_id,
+        .kernel = kernel
+    };
+    if (fault_log.header != NULL) {
+        plundervolt_fault_record_t record = {
+            .time_ns = plundervolt_fault_log_time_ns(&fault_log, fault.timestamp),
+            .expected = expected,
+            .observed = observed,
+            .undervoltage = (int64_t) fault.undervoltage,
+            .cpu = fault.cpu,
+            .thread = fault.thread,
+            .kernel = kernel,
+            .run = atomic_load_explicit(&fault_log.header->runs, memory_order_relaxed) - 1
+        };
+        if (u_spec.u_type == hardware) {
+            record.voltage = u_spec.undervolting_voltage;
+            record.duration_start = u_spec.duration_start;
+            record.duration_during = u_spec.duration_during;
+            record.delay = u_spec.delay_before_undervolting;
+        }
+        plundervolt_fault_log_append(&fault_log, &record);
+    }
+    // Bounded multi-producer queue: a producer claims a position, then owns its cell until it publishes the sequence number.
+    size_t position = atomic_load_explicit(&fault_queue->enqueue_position, memory_order_relaxed);
+    plundervolt_fault_cell_t* cell;
+    while (1) {
+        cell = &fault_queue->cells[position & (PLUNDERVOLT_FAULT_QUEUE_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&fault_queue->enqueue_position, &position, position + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) { // Full: the controller has not drained this cell yet.
+            atomic_fetch_add_explicit(&fault_queue->dropped, 1, memory_order_relaxed);
+            plundervolt_report_fault();
+            return 0;
+        } else {
+            position = atomic_load_explicit(&fault_queue->enqueue_position, memory_order_relaxed);
+        }
+    }
+
+    cell->fault = fault;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    plundervolt_report_fault();
+    return 1;
+}
+
+int plundervolt_pop_fault(plundervolt_fault_t* fault) {
+    pthread_once(&fault_queue_once, init_fault_queue);
+    // Only one consumer, so the dequeue position needs no compare-and-swap.
+    size_t position = atomic_load_explicit(&fault_queue->dequeue_position, memory_order_relaxed);
+    plundervolt_fault_cell_t* cell = &fault_queue->cells[position & (PLUNDERVOLT_FAULT_QUEUE_SIZE - 1)];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    if (sequence != position + 1) {
+        return 0; // Empty, or the producer of this cell has not finished writing it.
+    }
+    *fault = cell->fault;
+    atomic_store_explicit(&cell->sequence, position + PLUNDERVOLT_FAULT_QUEUE_SIZE, memory_order_release);
+    atomic_store_explicit(&fault_queue->dequeue_position, position + 1, memory_order_relaxed);
+    return 1;
+}
+
+uint64_t plundervolt_get_dropped_faults() {
+    pthread_once(&fault_queue_once, init_fault_queue);
+    return atomic_load_explicit(&fault_queue->dropped, memory_order_relaxed);
+}
+
+uint64_t plundervolt_get_fault_threshold() {
+    return fault_threshold;
+}
+
+void plundervolt_get_estimate(plundervolt_estimate_t* estimate) {
+    *estimate = run_estimate;
+}
+
+int read_sysfs_int(const char* path, int fallback) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return fallback;
+    }
+    int value;
+    if (fscanf(file, "%d", &value) != 1) {
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+const plundervolt_topology_t* plundervolt_get_topology() {
+    if (topology_discovered) {
+        return &topology;
+    }
+    char path[PATH_MAX];
+    int cpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (cpus < 1) cpus = 1;
+
+    topology.cpus = cpus;
+    topology.packages = 0;
+    topology.package_of = malloc(sizeof(int) * cpus);
+    topology.core_of = malloc(sizeof(int) * cpus);
+    topology.package_cpu = malloc(sizeof(int) * 64);
+    int physical_id[64]; // Physical package id of every dense package index.
+
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        int physical = read_sysfs_int(path, 0);
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        topology.core_of[cpu] = read_sysfs_int(path, cpu);
+
+        // Map the physical package id onto a dense index.
+        int package = 0;
+        while (package < topology.packages && physical_id[package] != physical) {
+            package++;
+        }
+        if (package == topology.packages) {
+            if (package == 64) { // Cannot be selected by the bitmask; treat as the last package.
+                package = 63;
+            } else {
+                physical_id[package] = physical;
+                topology.package_cpu[package] = cpu;
+                topology.packages++;
+            }
+        }
+        topology.package_of[cpu] = package;
+    }
+
+    msr_fds = calloc(cpus, sizeof(int));
+    topology_discovered = 1;
+    return &topology;
+}
+
+uint64_t existing_packages(uint64_t packages) {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    if (topo->packages < 64) {
+        packages &= ((uint64_t)1 << topo->packages) - 1;
+    }
+    return packages;
+}
+
+int msr_fd(int cpu) {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    if (cpu < 0 || cpu >= topo->cpus) {
+        return -1;
+    }
     // Only open the file if it has not been open before.
-    if (fd == 0) {
-        fd = open("/dev/cpu/0/msr", O_RDWR);
+    if (msr_fds[cpu] == 0) {
+        msr_fds[cpu] = backend->msr_open(cpu);
     }
-    if (fd == -1) { // msr file failed to open
+    return msr_fds[cpu];
+}
+
+void close_msr_files() {
+    for (int cpu = 0; msr_fds != NULL && cpu < topology.cpus; cpu++) {
+        if (msr_fds[cpu] > 0) {
+            backend->msr_close(msr_fds[cpu]);
+        }
+        msr_fds[cpu] = 0;
+    }
+}
+
+void plundervolt_set_backend(const plundervolt_backend_t* new_backend) {
+    if (new_backend == NULL) {
+        new_backend = &plundervolt_linux_backend;
+    }
+    if (new_backend == backend) {
+        return;
+    }
+    // Handles of one backend mean nothing to another.
+    close_msr_files();
+    plundervolt_close_session();
+    backend = new_backend;
+}
+
+const plundervolt_backend_t* plundervolt_get_backend() {
+    return backend;
+}
+
+plundervolt_error_t plundervolt_msr_read(int cpu, off_t offset, uint64_t* value) {
+    int fd = msr_fd(cpu);
+    if (fd == -1 || backend->msr_read(fd, offset, value) == -1) {
+        return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_error_t plundervolt_msr_write(int cpu, off_t offset, uint64_t value) {
+    int fd = msr_fd(cpu);
+    if (fd == -1 || backend->msr_write(fd, offset, value) == -1) {
         return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
     }
     return PLUNDERVOLT_NO_ERROR;
 }
 
+plundervolt_error_t msr_accessible_check() {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    uint64_t packages = existing_packages(u_spec.packages);
+    if (packages == 0) {
+        return PLUNDERVOLT_NO_PACKAGE_ERROR;
+    }
+    for (int package = 0; package < topo->packages; package++) {
+        if ((packages >> package) & 1 && msr_fd(topo->package_cpu[package]) == -1) { // msr file failed to open
+            return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
+        }
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
 uint64_t plundervolt_compute_msr_value(int64_t value, uint64_t plane) {
     value=(value*1.024)-0.5; // -0.5 to deal with rounding issues
 	value=0xFFE00000&((value&0xFFF)<<21);
@@ -104,28 +844,52 @@ uint64_t plundervolt_compute_msr_value(int64_t value, uint64_t plane) {
 }
 
 double plundervolt_read_voltage() {
-    if (msr_accessible_check() != PLUNDERVOLT_NO_ERROR) {
+    uint64_t packages = existing_packages(u_spec.packages);
+    int package = packages ? __builtin_ctzll(packages) : 0;
+    return plundervolt_read_voltage_cpu(plundervolt_get_topology()->package_cpu[package]);
+}
+
+double plundervolt_read_voltage_cpu(int cpu) {
+    int fd = msr_fd(cpu);
+    if (fd == -1) {
         return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
     }
-    uint64_t msr;
+    uint64_t msr = 0;
     __off_t offset = 0x198;
     uint64_t number = 0xFFFF00000000;
     double magic = 8192.0;
     int shift_by = 32;
-    pread(fd, &msr, sizeof msr, offset);
+    backend->msr_read(fd, offset, &msr);
     double res = (double)((msr & number)>>shift_by);
     return res / magic;
 }
 
 void plundervolt_set_undervolting(uint64_t value) {
+    plundervolt_set_undervolting_packages(value, u_spec.packages);
+}
+
+void plundervolt_set_undervolting_packages(uint64_t value, uint64_t packages) {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
     // 0x150 is the offset of the Plane Index buffer in msr (see Plundervolt paper).
     off_t offset = 0x150;
-    pwrite(fd, &value, sizeof(value), offset);
+    packages = existing_packages(packages);
+    remember_nominal_voltage(packages);
+    undervolted_packages |= packages;
+    written_planes |= PLUNDERVOLT_PLANE_BIT((value >> 40) & 0x7);
+    // The voltage planes are shared by the whole package, so writing through its first CPU is enough.
+    for (int package = 0; package < topo->packages; package++) {
+        if ((packages >> package) & 1) {
+            backend->msr_write(msr_fd(topo->package_cpu[package]), offset, value);
+            if (((value >> 40) & 0x7) == PLUNDERVOLT_PLANE_CORE) {
+                core_offset[package] = msr_offset_volts(value);
+            }
+        }
+    }
 }
 
 void* run_function_loop (void* arguments) {
     while (true) {
-        if (loop_finished){
+        if (!plundervolt_loop_is_running()){
             break;
         }
         if (!u_spec.integrated_loop_check &&
@@ -150,8 +914,29 @@ void* run_function_times (int times, void * arguments) {
 }
 
 void plundervolt_software_undervolt(uint64_t new_undervoltage) {
-    plundervolt_set_undervolting(plundervolt_compute_msr_value(new_undervoltage, 0));
-    plundervolt_set_undervolting(plundervolt_compute_msr_value(new_undervoltage, 2));
+    uint64_t start = plundervolt_instrument_begin();
+    plundervolt_software_undervolt_packages(new_undervoltage, u_spec.packages);
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_SOFTWARE_UNDERVOLT, start);
+}
+
+void plundervolt_software_undervolt_packages(uint64_t new_undervoltage, uint64_t packages) {
+    plundervolt_software_undervolt_planes(new_undervoltage, u_spec.sweep_planes, packages);
+}
+
+void plundervolt_software_undervolt_planes(uint64_t new_undervoltage, uint32_t planes, uint64_t packages) {
+    for (int plane = 0; plane < PLUNDERVOLT_PLANES; plane++) {
+        if (planes & PLUNDERVOLT_PLANE_BIT(plane)) {
+            plundervolt_set_undervolting_packages(plundervolt_compute_msr_value(new_undervoltage, plane), packages);
+        }
+    }
+}
+
+void hold_planes(int hold) {
+    for (int plane = 0; plane < PLUNDERVOLT_PLANES; plane++) {
+        if (!(u_spec.sweep_planes & PLUNDERVOLT_PLANE_BIT(plane)) && u_spec.plane_offset[plane] != 0) {
+            plundervolt_software_undervolt_planes(hold ? u_spec.plane_offset[plane] : 0, PLUNDERVOLT_PLANE_BIT(plane), u_spec.packages);
+        }
+    }
 }
 
 void* plundervolt_apply_undervolting(void *error_maybe) {
@@ -163,92 +948,581 @@ void* plundervolt_apply_undervolting(void *error_maybe) {
         cpu_set_t cpuset;
         pthread_t thread = pthread_self();
         CPU_ZERO(&cpuset);
-        CPU_SET(0, &cpuset);
+        CPU_SET(u_spec.controller_cpu, &cpuset);
 
         int set_affinity = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
         if (set_affinity != 0) {
             *error_check_thread = PLUNDERVOLT_GENERIC_ERROR;
             plundervolt_set_loop_finished();
-            pthread_exit(NULL);
+            return NULL;
         }
 
-        // Start with the undervolting on the specified value.
-        current_undervoltage = u_spec.start_undervoltage;
-
-        while(u_spec.end_undervoltage <= current_undervoltage && !loop_finished) {
-            // Both lines are necessary.
-            plundervolt_software_undervolt(current_undervoltage);
-            msleep(u_spec.wait_time);
-            current_undervoltage -= u_spec.step;
+        hold_planes(1);
+        if (u_spec.search == adaptive_search) {
+            search_adaptive();
+        } else {
+            *error_check_thread = search_linear();
         }
+        // Restore the voltage as soon as the loops finish. plundervolt_reset_voltage() is called later, once all threads have ended.
+        plundervolt_software_undervolt(0);
+        hold_planes(0);
+        plundervolt_instrument_restored();
     } else {
         // HARDWARE undervolting
 
-        int error_check;
+        int error_check = PLUNDERVOLT_NO_ERROR;
         int iterations = 0;
+        plundervolt_estimate_start(&run_estimate, u_spec.stop_rule, u_spec.min_tries, u_spec.stop_low, u_spec.stop_high, u_spec.stop_confidence);
+        int decided = 0; // 1 once the estimate has a verdict which ends the tries.
+        plundervolt_request_t next[2]; // Configuration and arming of the next try, when u_spec.pipeline runs them during this try's wait.
+        int pending = 0; // 1 if next is submitted and not waited for yet.
+        struct timespec cooldown; // End of the wait after the last try's function.
+        clock_gettime(CLOCK_MONOTONIC, &cooldown);
+        struct timespec settled; // End of the wait after arming.
+
+        // The whole run is one step: if the machine dies in it, its glitch voltage is unsafe.
+        int64_t step = hardware_step();
+        if (journal_step(step)) {
+            return NULL;
+        }
 
         // This makes the reaction time a little smaller.
         plundervolt_reset_voltage();
         plundervolt_fire_glitch();
         plundervolt_reset_voltage();
         
-        while (!loop_finished && iterations < u_spec.tries) {
+        while (plundervolt_loop_is_running() && iterations < u_spec.tries && !decided) {
             // This will make the system respond faster
 
             iterations++;
 
-            // First configure the system.
-            error_check = plundervolt_configure_glitch();
-            if (error_check) { // If not 0
-                plundervolt_set_loop_finished(); // Stops this loop
-                *error_check_thread = error_check;
-                pthread_exit(NULL);
-            }
+            if (pending) {
+                // Configured and armed during the last wait; the waits after arming and after the last try overlap.
+                error_check = wait_prepared_glitch(next);
+                pending = 0;
+                if (error_check) {
+                    break;
+                }
+                settled.tv_sec = (next[1].completed + u_spec.wait_time * 1000000ull) / 1000000000ull;
+                settled.tv_nsec = (next[1].completed + u_spec.wait_time * 1000000ull) % 1000000000ull;
+                hardware_wait(&cooldown);
+            } else {
+                hardware_wait(&cooldown); // Give the machine time to recover from the last try.
 
-            // Second, "arm" the glitch - get it ready.
-            error_check = plundervolt_arm_glitch();
-            if (error_check) { // If not 0
-                plundervolt_set_loop_finished(); // Stops this loop
-                *error_check_thread = error_check;
-                pthread_exit(NULL);
-            }
+                // First configure the system.
+                if (u_spec.glitch_profile >= 0) {
+                    error_check = plundervolt_select_glitch_profile(u_spec.glitch_profile);
+                } else {
+                    error_check = plundervolt_configure_glitch();
+                }
+                if (error_check) { // If not 0
+                    break;
+                }
 
-            msleep(u_spec.wait_time); // Give the machine time to work.
+                // Second, "arm" the glitch - get it ready.
+                error_check = plundervolt_arm_glitch();
+                if (error_check) { // If not 0
+                    break;
+                }
+                deadline_after(&settled, u_spec.wait_time);
+            }
+            hardware_wait(&settled); // Give the machine time to work.
 
             // The function must call plundervolt_fire_glitch() itself.
             // This is done because of the timing of Teensy. We wouldn't want to undervolt
             // too soon, so we let the user decide when to run the function.
             // WARNING: The user must also reset the voltage with plundervolt_reset_voltage()!
-            if (u_spec.loop) {
-                if (u_spec.integrated_loop_check) {
-                    run_function_loop(u_spec.arguments);
-                } else {
-                    run_function_times(u_spec.loop, u_spec.arguments);
+            uint64_t faults_before = plundervolt_get_fault_count();
+            uint64_t crashes_before = hardware_crashes();
+            run_victim();
+            deadline_after(&cooldown, u_spec.wait_time);
+            journal_try(); // In the cooldown, where a sync does not disturb the victim.
+            int faulty = plundervolt_get_fault_count() != faults_before || hardware_crashes() != crashes_before;
+            decided = plundervolt_estimate_add(&run_estimate, faulty) != PLUNDERVOLT_VERDICT_UNDECIDED;
+
+            if (u_spec.pipeline && iterations < u_spec.tries && !decided && plundervolt_loop_is_running()) {
+                // Teensy is idle until the next try; get it ready while the machine recovers.
+                error_check = prepare_glitch_async(next);
+                if (error_check) {
+                    break;
                 }
-            } else {
-                run_function(u_spec.arguments);
+                pending = 1;
             }
-            msleep(u_spec.wait_time);
         }
+        if (pending) {
+            wait_prepared_glitch(next); // next lives on this stack.
+        }
+        journal_step_done(step, plundervolt_get_fault_count());
+        if (error_check) {
+            plundervolt_set_loop_finished(); // Stops this loop
+            *error_check_thread = error_check;
+            return NULL;
+        }
+        hardware_wait(&cooldown);
     }
 
     plundervolt_set_loop_finished();
     return NULL; // Must return something, as pthread_create requires a void* return value.
 }
 
-int plundervolt_loop_is_running() {
-    return !loop_finished; // Returns the opposite of loop_finished, as it is checking if loop is RUNNING.
+void run_victim() {
+    if (u_spec.fork_server && plundervolt_victim_shared == NULL) {
+        if (fork_trial(0, -1)) {
+            plundervolt_set_loop_finished();
+        }
+        return;
+    }
+    if (u_spec.loop) {
+        if (u_spec.integrated_loop_check) {
+            run_function_loop(u_spec.arguments);
+        } else {
+            run_function_times(u_spec.loop, u_spec.arguments);
+        }
+    } else {
+        run_function(u_spec.arguments);
+    }
+}
+
+int64_t hardware_step() {
+    plundervolt_glitch_profile_t profile = u_spec.glitch_profile >= 0 && u_spec.glitch_profile < glitch_profile_count
+        ? glitch_profiles[u_spec.glitch_profile] : plundervolt_glitch_profile_from_specification(u_spec, "spec");
+    double lowest = profile.voltage[0];
+    for (int segment = 1; segment < profile.segments; segment++) {
+        if (profile.voltage[segment] < lowest) {
+            lowest = profile.voltage[segment];
+        }
+    }
+    return (int64_t)(lowest * 10000 + 0.5);
+}
+
+uint64_t hardware_crashes() {
+    if (!u_spec.fork_server) {
+        return 0;
+    }
+    plundervolt_trial_stats_t stats;
+    plundervolt_fork_server_stats(&stats);
+    return stats.outcomes[PLUNDERVOLT_TRIAL_CRASH] + stats.outcomes[PLUNDERVOLT_TRIAL_HANG];
+}
+
+void prepare_fork_servers(int count) {
+    if (count > fork_server_count) {
+        fork_servers = realloc(fork_servers, sizeof(plundervolt_fork_server_t) * count);
+        memset(&fork_servers[fork_server_count], 0, sizeof(plundervolt_fork_server_t) * (count - fork_server_count));
+        fork_server_count = count;
+    }
+}
+
+void stop_fork_servers() {
+    for (int i = 0; i < fork_server_count; i++) {
+        plundervolt_fork_server_stop(&fork_servers[i]);
+    }
+    free(fork_servers);
+    fork_servers = NULL;
+    fork_server_count = 0;
+}
+
+void victim_trial(void* unused) {
+    if (u_spec.u_type == hardware) {
+        run_victim();
+    } else if (u_spec.loop) {
+        run_function_loop(u_spec.arguments);
+    } else {
+        run_function(u_spec.arguments);
+    }
+}
+
+plundervolt_error_t fork_trial(int slot, int cpu) {
+    plundervolt_fork_server_t* server = &fork_servers[slot];
+    plundervolt_trial_request_t request = {
+        .undervoltage = plundervolt_get_current_undervoltage(),
+        .cpu = cpu,
+        .trial_ms = u_spec.loop ? u_spec.trial_ms : 0,
+        .timeout_ms = u_spec.trial_timeout_ms
+    };
+    plundervolt_trial_t trial;
+    plundervolt_error_t error_check = PLUNDERVOLT_GENERIC_ERROR;
+    for (int attempt = 0; attempt < 2 && error_check; attempt++) { // A server which died is started once more.
+        if (server->pid > 0 && server->tag != spec_generation) {
+            plundervolt_fork_server_stop(server);
+        }
+        if (server->pid <= 0) {
+            if (plundervolt_fork_server_start(server, u_spec.victim_init, victim_trial, u_spec.arguments)) {
+                return PLUNDERVOLT_GENERIC_ERROR;
+            }
+            server->tag = spec_generation;
+        }
+        error_check = plundervolt_fork_server_trial(server, &request, &trial);
+    }
+    if (error_check) {
+        return error_check;
+    }
+    for (uint64_t i = 0; i < trial.faults; i++) {
+        plundervolt_report_fault();
+    }
+    if (trial.stop) {
+        plundervolt_set_loop_finished();
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void hardware_wait(const struct timespec* deadline) {
+    uint64_t start = plundervolt_instrument_begin();
+    wait_until_event(deadline, 0, 0);
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_WAIT, start);
+}
+
+void arm_when_configured(plundervolt_request_t* configured, void* arm) {
+    if (configured->error == PLUNDERVOLT_NO_ERROR
+        && plundervolt_arm_glitch_async((plundervolt_request_t*) arm) != PLUNDERVOLT_NO_ERROR) {
+        configured->error = PLUNDERVOLT_GENERIC_ERROR;
+    }
+}
+
+plundervolt_error_t prepare_glitch_async(plundervolt_request_t* requests) {
+    requests[0].callback = arm_when_configured;
+    requests[0].callback_arguments = &requests[1];
+    requests[1].callback = NULL;
+    if (u_spec.glitch_profile >= 0) {
+        return plundervolt_select_glitch_profile_async(&requests[0], u_spec.glitch_profile);
+    }
+    return plundervolt_configure_glitch_async(&requests[0]);
+}
+
+plundervolt_error_t wait_prepared_glitch(plundervolt_request_t* requests) {
+    plundervolt_error_t error_check = plundervolt_wait_request(&requests[0], -1);
+    if (error_check) {
+        return error_check; // The arming was never submitted.
+    }
+    return plundervolt_wait_request(&requests[1], -1);
+}
+
+plundervolt_error_t search_linear() {
+    plundervolt_ramp_t ramp;
+    uint64_t period_ns = u_spec.step_us > 0 ? u_spec.step_us * 1000ull : u_spec.wait_time * 1000000ull;
+    plundervolt_error_t error_check = plundervolt_compile_ramp(&ramp, (int64_t) u_spec.start_undervoltage,
+        (int64_t) u_spec.end_undervoltage, u_spec.step, period_ns, u_spec.spin_us * 1000ull, u_spec.packages, u_spec.sweep_planes);
+    if (error_check) {
+        return error_check;
+    }
+    if (u_spec.settle_steps) {
+        ramp.settle_tolerance = u_spec.settle_tolerance_mv / 1000.0;
+    }
+    error_check = plundervolt_execute_ramp(&ramp);
+    plundervolt_free_ramp(&ramp);
+    return error_check;
+}
+
+plundervolt_error_t plundervolt_compile_ramp(plundervolt_ramp_t* ramp, int64_t start, int64_t end, int64_t step,
+    uint64_t period_ns, uint64_t spin_ns, uint64_t packages, uint32_t planes) {
+    memset(ramp, 0, sizeof *ramp);
+    if (step < 1 || start < end || planes == 0 || planes >= PLUNDERVOLT_PLANE_BIT(PLUNDERVOLT_PLANES)) {
+        return PLUNDERVOLT_RANGE_ERROR;
+    }
+    for (int plane = 0; plane < PLUNDERVOLT_PLANES; plane++) {
+        if (planes & PLUNDERVOLT_PLANE_BIT(plane)) {
+            ramp->planes[ramp->plane_count++] = plane;
+        }
+    }
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    ramp->packages = existing_packages(packages);
+    if (ramp->packages == 0) {
+        return PLUNDERVOLT_NO_PACKAGE_ERROR;
+    }
+    ramp->cpus = malloc(sizeof(int) * topo->packages);
+    for (int package = 0; package < topo->packages; package++) {
+        if ((ramp->packages >> package) & 1) {
+            ramp->cpus[ramp->cpu_count++] = topo->package_cpu[package];
+        }
+    }
+
+    ramp->steps = (int)((start - end) / step) + 1;
+    ramp->undervoltage = malloc(sizeof(int64_t) * ramp->steps);
+    ramp->words = malloc(sizeof(uint64_t) * ramp->steps * ramp->plane_count);
+    for (int i = 0; i < ramp->steps; i++) {
+        ramp->undervoltage[i] = start - i * step;
+        for (int plane = 0; plane < ramp->plane_count; plane++) {
+            ramp->words[i * ramp->plane_count + plane] = plundervolt_compute_msr_value(ramp->undervoltage[i], ramp->planes[plane]);
+        }
+    }
+    ramp->period_ns = period_ns;
+    ramp->spin_ns = spin_ns < period_ns ? spin_ns : period_ns;
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void plundervolt_free_ramp(plundervolt_ramp_t* ramp) {
+    free(ramp->undervoltage);
+    free(ramp->words);
+    free(ramp->cpus);
+    ramp->undervoltage = NULL;
+    ramp->words = NULL;
+    ramp->cpus = NULL;
+    ramp->steps = 0;
+}
+
+int ramp_wait(uint64_t deadline, uint64_t spin_ns) {
+    uint64_t wake = deadline - spin_ns;
+    uint64_t now = plundervolt_monotonic_ns();
+    if (wake > now) {
+        struct timespec until = {.tv_sec = wake / 1000000000ull, .tv_nsec = wake % 1000000000ull};
+        if (wake - now > 2000000ull) {
+            // Long enough for a stop to matter; the event wait returns as soon as the loops finish.
+            if (wait_until_event(&until, 0, 0)) {
+                return 1;
+            }
+        } else {
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+        }
+    }
+    while (plundervolt_monotonic_ns() < deadline) {
+        _mm_pause();
+    }
+    return !plundervolt_loop_is_running();
+}
+
+plundervolt_error_t plundervolt_execute_ramp(plundervolt_ramp_t* ramp) {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    int fds[64];
+    for (int i = 0; i < ramp->cpu_count; i++) {
+        fds[i] = msr_fd(ramp->cpus[i]);
+        if (fds[i] == -1) {
+            return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
+        }
+    }
+    remember_nominal_voltage(ramp->packages);
+    undervolted_packages |= ramp->packages;
+    for (int plane = 0; plane < ramp->plane_count; plane++) {
+        written_planes |= PLUNDERVOLT_PLANE_BIT(ramp->planes[plane]);
+    }
+    ramp->applied = 0;
+    ramp->max_late_ns = 0;
+    ramp->total_late_ns = 0;
+    ramp->total_settle_ns = 0;
+
+    plundervolt_error_t error_check = PLUNDERVOLT_NO_ERROR;
+    uint64_t deadline = plundervolt_monotonic_ns(); // Of the next step.
+    uint64_t faults_before = 0; // Fault count when the current step was applied.
+    for (int i = 0; i < ramp->steps && plundervolt_loop_is_running(); i++) {
+        if (i > 0 && ramp_wait(deadline, ramp->spin_ns)) {
+            break;
+        }
+        if (i > 0) {
+            journal_step_done(ramp->undervoltage[i - 1], plundervolt_get_fault_count() - faults_before);
+        }
+        faults_before = plundervolt_get_fault_count();
+        if (journal_step(ramp->undervoltage[i])) {
+            break;
+        }
+        uint64_t applied_at = plundervolt_monotonic_ns();
+        uint64_t timed = plundervolt_instrument_begin();
+        set_current_undervoltage((uint64_t) ramp->undervoltage[i]);
+        const uint64_t* words = &ramp->words[i * ramp->plane_count];
+        for (int cpu = 0; cpu < ramp->cpu_count; cpu++) {
+            for (int plane = 0; plane < ramp->plane_count; plane++) {
+                if (backend->msr_write(fds[cpu], 0x150, words[plane]) == -1) {
+                    error_check = PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
+                }
+            }
+            if (ramp->planes[0] == PLUNDERVOLT_PLANE_CORE) {
+                core_offset[topo->package_of[ramp->cpus[cpu]]] = msr_offset_volts(words[0]);
+            }
+        }
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_SOFTWARE_UNDERVOLT, timed);
+        uint64_t late = applied_at > deadline ? applied_at - deadline : 0;
+        ramp->total_late_ns += late;
+        if (late > ramp->max_late_ns) {
+            ramp->max_late_ns = late;
+        }
+        ramp->applied++;
+
+        deadline += ramp->period_ns;
+        if (ramp->settle_tolerance > 0) {
+            // The step is over once the regulator is there, or at the deadline if it never gets there.
+            double targets[64];
+            for (int cpu = 0; cpu < ramp->cpu_count; cpu++) {
+                int package = topo->package_of[ramp->cpus[cpu]];
+                targets[cpu] = nominal_voltage[package] + core_offset[package]; // Unchanged if the ramp leaves the core plane alone.
+            }
+            uint64_t settled_at;
+            if (wait_settled(ramp->cpus, targets, ramp->cpu_count, ramp->settle_tolerance, deadline, &settled_at) == PLUNDERVOLT_NO_ERROR) {
+                deadline = settled_at;
+            }
+            ramp->total_settle_ns += (settled_at > applied_at ? settled_at : applied_at) - applied_at;
+        }
+    }
+    if (ramp->applied == ramp->steps) {
+        ramp_wait(deadline, ramp->spin_ns); // Hold the last step.
+    }
+    if (ramp->applied > 0) {
+        journal_step_done(ramp->undervoltage[ramp->applied - 1], plundervolt_get_fault_count() - faults_before);
+    }
+    return error_check;
+}
+
+void remember_nominal_voltage(uint64_t packages) {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    packages &= ~undervolted_packages;
+    for (int package = 0; package < topo->packages; package++) {
+        if ((packages >> package) & 1 && core_offset[package] == 0
+            && read_core_voltage(topo->package_cpu[package], &nominal_voltage[package]) == -1) {
+            nominal_voltage[package] = 0;
+        }
+    }
+}
+
+double msr_offset_volts(uint64_t value) {
+    // An 11 bit two's complement number of 1/1024 V in bits 21 to 31.
+    int64_t units = (value >> 21) & 0x7FF;
+    return (units & 0x400 ? units - 0x800 : units) / 1024.0;
+}
+
+int read_core_voltage(int cpu, double* voltage) {
+    int fd = msr_fd(cpu);
+    uint64_t msr;
+    if (fd == -1 || backend->msr_read(fd, 0x198, &msr) == -1) {
+        return -1;
+    }
+    *voltage = ((msr >> 32) & 0xFFFF) / 8192.0;
+    return 0;
+}
+
+plundervolt_error_t wait_settled(const int* cpus, const double* targets, int count, double tolerance, uint64_t deadline, uint64_t* settled_at) {
+    const struct timespec pause = {.tv_sec = 0, .tv_nsec = PLUNDERVOLT_SETTLE_POLL_NS};
+    int in_tolerance = 0; // Reads in a row with every CPU within tolerance.
+    while (1) {
+        int all = 1;
+        for (int i = 0; i < count && all; i++) {
+            double voltage;
+            if (read_core_voltage(cpus[i], &voltage) == -1) {
+                *settled_at = plundervolt_monotonic_ns();
+                return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
+            }
+            all = fabs(voltage - targets[i]) <= tolerance;
+        }
+        in_tolerance = all ? in_tolerance + 1 : 0;
+        *settled_at = plundervolt_monotonic_ns();
+        if (in_tolerance == PLUNDERVOLT_SETTLE_SAMPLES) {
+            return PLUNDERVOLT_NO_ERROR;
+        }
+        if (*settled_at >= deadline) {
+            return PLUNDERVOLT_SETTLE_TIMEOUT_ERROR;
+        }
+        nanosleep(&pause, NULL);
+    }
+}
+
+plundervolt_error_t plundervolt_wait_voltage_settled(int cpu, double target, double tolerance, uint64_t timeout_ns, uint64_t* settle_ns) {
+    uint64_t start = plundervolt_monotonic_ns();
+    uint64_t settled_at;
+    plundervolt_error_t error_check = wait_settled(&cpu, &target, 1, tolerance, start + timeout_ns, &settled_at);
+    if (settle_ns != NULL) {
+        *settle_ns = settled_at - start;
+    }
+    return error_check;
+}
+
+int try_undervoltage(int64_t undervoltage, int64_t fault_free) {
+    uint64_t faults_before = plundervolt_get_fault_count();
+    if (journal_step(undervoltage)) {
+        return 0; // The loops are finished, which ends the search.
+    }
+    set_current_undervoltage(undervoltage);
+    plundervolt_software_undervolt(undervoltage);
+    wait_for_event(u_spec.wait_time, 1, faults_before);
+    uint64_t faults = plundervolt_get_fault_count() - faults_before;
+    if (faults == 0) {
+        journal_step_done(undervoltage, 0);
+        return 0;
+    }
+    // Back off first, so the CPU spends as little time as possible at the faulting undervoltage.
+    set_current_undervoltage(fault_free);
+    plundervolt_software_undervolt(fault_free);
+    journal_step_done(undervoltage, faults);
+    return 1;
+}
+
+void search_adaptive() {
+    // Undervoltages are negative; work with signed values so the arithmetic is obvious.
+    int64_t start = (int64_t) u_spec.start_undervoltage;
+    int64_t end = (int64_t) u_spec.end_undervoltage;
+    int64_t fault_free = 0; // Nothing tried yet; no undervolting is assumed safe.
+    int64_t faulty = 0; // 0 means no fault seen yet.
+    fault_threshold = 0;
+
+    // Coarse phase: jump by coarse_step until the first fault.
+    for (int64_t undervoltage = start; plundervolt_loop_is_running(); undervoltage -= u_spec.coarse_step) {
+        if (undervoltage < end) {
+            undervoltage = end;
+        }
+        if (try_undervoltage(undervoltage, fault_free)) {
+            faulty = undervoltage;
+            break;
+        }
+        fault_free = undervoltage;
+        if (undervoltage == end) {
+            return; // No fault in the whole range.
+        }
+    }
+    if (faulty == start) {
+        fault_threshold = (uint64_t) start; // Faults from the first try: nothing shallower is in the range to bisect.
+        return;
+    }
+
+    // Bisection phase: halve the bracket until only a few fine steps are left.
+    while (faulty != 0 && plundervolt_loop_is_running() && fault_free - faulty > 4 * u_spec.step) {
+        int64_t middle = fault_free - ((fault_free - faulty) / 2 / u_spec.step) * u_spec.step;
+        if (try_undervoltage(middle, fault_free)) {
+            faulty = middle;
+        } else {
+            fault_free = middle;
+        }
+    }
+
+    // Fine phase: walk the rest of the bracket one step at a time.
+    for (int64_t undervoltage = fault_free - u_spec.step; faulty != 0 && plundervolt_loop_is_running() && undervoltage > faulty; undervoltage -= u_spec.step) {
+        if (try_undervoltage(undervoltage, fault_free)) {
+            faulty = undervoltage;
+            break;
+        }
+        fault_free = undervoltage;
+    }
+
+    fault_threshold = (uint64_t) faulty;
 }
 
 void plundervolt_reset_voltage() {
+    uint64_t start = plundervolt_instrument_begin();
     if (u_spec.u_type == hardware && u_spec.using_dtr) { // If using_dtr = 0, nothing is to be done.
-        ioctl(fd_trigger,TIOCMBIC,&DTR_flag);
+        backend->trigger_set(session.trigger, 0);
     } else if (u_spec.u_type == software) {
-        // Both lines are necessary.
-        plundervolt_set_undervolting(plundervolt_compute_msr_value(0, 0));
-        plundervolt_set_undervolting(plundervolt_compute_msr_value(0, 2));
-        sleep(3);
+        // Reset every package undervolted so far, even if u_spec.packages changed since.
+        const plundervolt_topology_t* topo = plundervolt_get_topology();
+        uint64_t packages = existing_packages(undervolted_packages | u_spec.packages);
+        int cpus[64];
+        double targets[64]; // The voltage before undervolting, or if that is not known, the voltage now without the offset.
+        int count = 0;
+        for (int package = 0; package < topo->packages; package++) {
+            if (!((packages >> package) & 1)) {
+                continue;
+            }
+            if (nominal_voltage[package] > 0) {
+                targets[count] = nominal_voltage[package];
+            } else if (read_core_voltage(topo->package_cpu[package], &targets[count]) == 0) {
+                targets[count] -= core_offset[package];
+            } else {
+                continue;
+            }
+            cpus[count++] = topo->package_cpu[package];
+        }
+        // The core and the cache plane always, and every other plane written since the last reset.
+        plundervolt_software_undervolt_planes(0, written_planes | PLUNDERVOLT_DEFAULT_SWEEP_PLANES, packages);
+        undervolted_packages = 0;
+        written_planes = 0;
+        // Wait only as long as the regulator needs, instead of a fixed 3 s.
+        uint64_t settled_at;
+        wait_settled(cpus, targets, count, u_spec.settle_tolerance_mv / 1000.0,
+            plundervolt_monotonic_ns() + u_spec.settle_timeout_ms * 1000000ull, &settled_at);
     }
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_RESET_VOLTAGE, start);
 }
 
 plundervolt_specification_t plundervolt_init () {
@@ -259,6 +1533,38 @@ plundervolt_specification_t plundervolt_init () {
     spec.threads = 1;
     spec.start_undervoltage = 0;
     spec.end_undervoltage = 0;
+    spec.packages = PLUNDERVOLT_ALL_PACKAGES;
+    spec.controller_cpu = 0;
+    spec.placement = placement_spread;
+    spec.worker_cpus = NULL;
+    spec.worker_cpus_count = 0;
+    spec.allow_smt_siblings = 1;
+    spec.same_package = 0;
+    spec.search = linear_search;
+    spec.coarse_step = 10;
+    spec.step_us = 0;
+    spec.spin_us = 0;
+    spec.settle_tolerance_mv = 3;
+    spec.settle_timeout_ms = 3000;
+    spec.settle_steps = 0;
+    spec.telemetry_us = 0;
+    spec.fork_server = 0;
+    spec.victim_init = NULL;
+    spec.trial_ms = 10;
+    spec.trial_timeout_ms = 1000;
+    spec.journal = NULL;
+    spec.journal_sync_ms = 1000;
+    spec.fault_log = NULL;
+    spec.fault_log_capacity = 1 << 20;
+    spec.stop_rule = stop_fixed;
+    spec.min_tries = 1;
+    spec.stop_low = 0.05;
+    spec.stop_high = 0.5;
+    spec.stop_confidence = 0.95;
+    spec.sweep_planes = PLUNDERVOLT_DEFAULT_SWEEP_PLANES;
+    for (int plane = 0; plane < PLUNDERVOLT_PLANES; plane++) {
+        spec.plane_offset[plane] = 0;
+    }
     spec.function = NULL;
     spec.integrated_loop_check = 0;
     spec.stop_loop = NULL;
@@ -280,6 +1586,10 @@ plundervolt_specification_t plundervolt_init () {
     spec.end_voltage = 0.900;
     spec.tries = 1;
     spec.using_dtr = 1;
+    spec.glitch_profile = -1;
+    spec.protocol = protocol_text;
+    spec.teensy_response = NULL;
+    spec.pipeline = 0;
 
     initialised = 1;
 
@@ -291,6 +1601,7 @@ plundervolt_error_t plundervolt_set_specification(plundervolt_specification_t sp
         return PLUNDERVOLT_NOT_INITIALISED_ERROR;
     }
     u_spec = spec;
+    spec_generation++;
     plundervolt_error_t error_check = plundervolt_faulty_undervolting_specification();
     if (error_check) {
         return error_check;
@@ -306,6 +1617,19 @@ plundervolt_error_t plundervolt_faulty_undervolting_specification() {
         if (u_spec.u_type == software && u_spec.start_undervoltage <= u_spec.end_undervoltage) {
             return PLUNDERVOLT_RANGE_ERROR;
         }
+        if (u_spec.u_type == software
+            && (u_spec.sweep_planes == 0 || u_spec.sweep_planes >= PLUNDERVOLT_PLANE_BIT(PLUNDERVOLT_PLANES))) {
+            return PLUNDERVOLT_RANGE_ERROR;
+        }
+        if (u_spec.u_type == hardware && u_spec.stop_rule != stop_fixed
+            && !(0 < u_spec.stop_low && u_spec.stop_low < u_spec.stop_high && u_spec.stop_high < 1
+                && 0.5 < u_spec.stop_confidence && u_spec.stop_confidence < 1)) {
+            return PLUNDERVOLT_RANGE_ERROR;
+        }
+        if (u_spec.u_type == software && u_spec.search == adaptive_search
+            && (u_spec.step < 1 || u_spec.coarse_step < u_spec.step)) {
+            return PLUNDERVOLT_RANGE_ERROR;
+        }
     }
     if (u_spec.function == NULL) {
         return PLUNDERVOLT_NO_FUNCTION_ERROR;
@@ -329,137 +1653,547 @@ plundervolt_error_t plundervolt_init_hardware_undervolting() {
         return PLUNDERVOLT_NOT_INITIALISED_ERROR;
     }
 
-    if (u_spec.using_dtr) {
-        fd_trigger = open(u_spec.trigger_serial, O_RDWR | O_NOCTTY);
-        if(fd_trigger == -1) {
-            return PLUNDERVOLT_CONNECTION_INIT_ERROR;
+    // Reuse the open session if nothing it was opened with changed and Teensy is still there.
+    if (session.teensy > 0 && session.using_dtr == u_spec.using_dtr && session.teensy_baudrate == u_spec.teensy_baudrate
+        && session.protocol == u_spec.protocol
+        && strcmp(session.teensy_serial, u_spec.teensy_serial) == 0
+        && (!u_spec.using_dtr || strcmp(session.trigger_serial, u_spec.trigger_serial) == 0)) {
+        if (plundervolt_session_alive()) {
+            return PLUNDERVOLT_NO_ERROR;
         }
+        session.recoveries++;
+    }
+    return open_session();
+}
 
-        // Create new termios struc, we call it 'tty' for convention
-        struct termios tty;
-        memset(&tty, 0, sizeof tty);
+plundervolt_error_t open_session() {
+    plundervolt_close_session();
+    // A reopened (possibly reset) Teensy has neither the profiles nor the last configuration.
+    glitch_profiles_state = 0;
+    active_glitch = -1;
+    sent_configuration_length = 0;
+    session.teensy_serial = strdup(u_spec.teensy_serial);
+    session.trigger_serial = strdup(u_spec.trigger_serial);
+    session.teensy_baudrate = u_spec.teensy_baudrate;
+    session.using_dtr = u_spec.using_dtr;
+    session.protocol = u_spec.protocol;
+    session.binary = 0;
+    session.opens++;
 
-        // Read in existing settings, and handle any error
-        if(tcgetattr(fd_trigger, &tty) != 0) {
+    if (u_spec.using_dtr) {
+        session.trigger = backend->trigger_open(u_spec.trigger_serial);
+        if(session.trigger == -1) {
+            session.trigger = 0;
+            return PLUNDERVOLT_CONNECTION_INIT_ERROR;
         }
+    }
 
-        tty.c_cflag &= ~PARENB; // Clear parity bit, disabling parity (most common)
-        tty.c_cflag &= ~CSTOPB; // Clear stop field, only one stop bit used in communication (most common)
-        tty.c_cflag |= CS8; // 8 bits per byte (most common)
-        tty.c_cflag &= CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
-        tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
-
-        tty.c_lflag &= ~ICANON;
-        tty.c_lflag &= ~ECHO; // Disable echo
-        tty.c_lflag &= ~ECHOE; // Disable erasure
-        tty.c_lflag &= ~ECHONL; // Disable new-line echo
-        tty.c_lflag &= ~ISIG; // Disable interpretation of INTR, QUIT and SUSP
-        tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
-        tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
-
-        tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
-        tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
-        //tty.c_oflag &= ~OXTABS; // Prevent conversion of tabs to spaces (NOT PRESENT ON LINUX)
-        //tty.c_oflag &= ~ONOEOT; // Prevent removal of C-d chars (0x004) in output (NOT PRESENT ON LINUX)
-
-        tty.c_cc[VTIME] = 0;    // Wait for up to 1s (10 deciseconds), returning as soon as any data is received.
-        tty.c_cc[VMIN] = 0;
+    // Open the connection to Teensy
+    session.teensy = backend->serial_open(u_spec.teensy_serial, u_spec.teensy_baudrate);
+    if (session.teensy == -1) { // Connection failed to open.
+        return PLUNDERVOLT_CONNECTION_INIT_ERROR;
+    }
+    backend->serial_flush(session.teensy);
 
-        // Set in/out baud rate to be 9600
-        cfsetispeed(&tty, B38400);
-        cfsetospeed(&tty, B38400);
+    return negotiate_protocol();
+}
 
+plundervolt_error_t negotiate_protocol() {
+    if (u_spec.protocol == protocol_text) {
+        return PLUNDERVOLT_NO_ERROR;
+    }
+    char response[BUFMAX];
+    memset(response, 0, BUFMAX);
+    if (backend->serial_write(session.teensy, "binary\n", 7) == 0) {
+        backend->serial_read_lines(session.teensy, response, EOL, BUFMAX, 10, 1);
+    }
+    session.binary = strncmp(response, "ok", 2) == 0;
+    if (!session.binary && u_spec.protocol == protocol_binary) {
+        return PLUNDERVOLT_CONNECTION_INIT_ERROR;
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
 
-        struct serial_struct kernel_serial_settings;
-        int r = ioctl(fd_trigger, TIOCGSERIAL, &kernel_serial_settings);
-        if (r >= 0) {
-            kernel_serial_settings.flags |= ASYNC_LOW_LATENCY;
-            r = ioctl(fd_trigger, TIOCSSERIAL, &kernel_serial_settings);
+int teensy_frame(plundervolt_frame_type_t type, const uint8_t* payload, size_t length) {
+    plundervolt_frame_t frame = {.type = type, .sequence = ++session.sequence, .length = length};
+    memcpy(frame.payload, payload, length);
+    uint8_t encoded[PLUNDERVOLT_FRAME_MAX];
+    size_t encoded_length = plundervolt_frame_encode(&frame, encoded);
+    uint8_t received[2 * PLUNDERVOLT_FRAME_MAX];
+    size_t have = 0;
+    for (int attempt = 0; attempt < PLUNDERVOLT_FRAME_TRIES; attempt++) {
+        if (teensy_write((const char*) encoded, encoded_length) == -1) {
+            return -1;
+        }
+        if (type == PLUNDERVOLT_FRAME_FIRE) {
+            return 1;
         }
 
-        tcsetattr(fd_trigger, TCSANOW, &tty);
-        if( tcsetattr(fd_trigger, TCSAFLUSH, &tty) < 0) {
-            perror("init_serialport: Couldn't set term attributes");
-            return PLUNDERVOLT_CONNECTION_INIT_ERROR;
+        // Wait for the answer with this sequence number; anything else is left over from before. A late answer to an
+        // earlier attempt has the same number, and counts.
+        struct timespec deadline, now;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += PLUNDERVOLT_FRAME_TIMEOUT_MS * 1000000l;
+        if (deadline.tv_nsec >= 1000000000l) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000l;
+        }
+        while (1) {
+            plundervolt_frame_t answer;
+            int used;
+            while ((used = plundervolt_frame_decode(received, have, &answer)) != 0) {
+                int decoded = used > 0;
+                used = decoded ? used : -used;
+                memmove(received, received + used, have - used);
+                have -= used;
+                if (decoded && answer.sequence == frame.sequence) {
+                    return answer.type == PLUNDERVOLT_FRAME_ACK;
+                }
+            }
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long wait_ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+            if (wait_ms <= 0) {
+                break; // Lost on the way there or back: send it again.
+            }
+            if (have == sizeof received) {
+                have = 0; // Garbage without a frame; drop it.
+            }
+            int n = backend->serial_read(session.teensy, (char*) received + have, sizeof received - have, (int) wait_ms);
+            if (n < 0) {
+                break;
+            }
+            have += n;
         }
     }
+    return -1;
+}
 
-    // If fd open, close it first - we'll restart the connection
-    if (fd_teensy != 0) {
-        serialport_close(fd_teensy);
+void plundervolt_close_session() {
+    if (session.teensy > 0) {
+        backend->serial_close(session.teensy);
+    }
+    if (session.trigger > 0) {
+        backend->trigger_close(session.trigger);
     }
+    free(session.teensy_serial);
+    free(session.trigger_serial);
+    session.teensy_serial = NULL;
+    session.trigger_serial = NULL;
+    session.teensy = 0;
+    session.trigger = 0;
+}
 
-    // Open the connection to Teensy
-    fd_teensy = serialport_init(u_spec.teensy_serial, u_spec.teensy_baudrate);
-    if (fd_teensy == -1) { // Connection failed to open.
-        return PLUNDERVOLT_CONNECTION_INIT_ERROR;
+plundervolt_error_t plundervolt_recover_session() {
+    if (!initialised) {
+        return PLUNDERVOLT_NOT_INITIALISED_ERROR;
     }
-    serialport_flush(fd_teensy);
+    session.recoveries++;
+    return open_session();
+}
 
-    return PLUNDERVOLT_NO_ERROR;
+int plundervolt_session_alive() {
+    return session.teensy > 0 && backend->serial_alive(session.teensy);
+}
+
+const plundervolt_session_t* plundervolt_get_session() {
+    return &session;
+}
+
+int teensy_write(const char* buf, size_t len) {
+    if (session.teensy > 0 && backend->serial_write(session.teensy, buf, len) == 0) {
+        return 0;
+    }
+    if (plundervolt_recover_session() != PLUNDERVOLT_NO_ERROR) {
+        return -1;
+    }
+    return backend->serial_write(session.teensy, buf, len);
 }
 
 plundervolt_error_t plundervolt_arm_glitch() {
-    int error_check = serialport_write(fd_teensy, "arm\n"); // Send Teensy the command to arm itself.
+    uint64_t start = plundervolt_instrument_begin();
+    if (session.binary) {
+        if (teensy_frame(PLUNDERVOLT_FRAME_ARM, NULL, 0) != 1) { // Refused, or never acknowledged.
+            return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
+        }
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_ARM_GLITCH, start);
+        return PLUNDERVOLT_NO_ERROR;
+    }
+    int error_check = teensy_write("arm\n", 4); // Send Teensy the command to arm itself.
     if (error_check == -1) { // Write to Teensy failed
         return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
     }
     char buf[BUFMAX];
     memset(buf,0,BUFMAX);
-	serialport_read_lines(fd_teensy, buf, EOL, BUFMAX, 10,2);
-	printf("Teensy response: %s\n", buf);
+	backend->serial_read_lines(session.teensy, buf, EOL, BUFMAX, 10,2);
+	teensy_answer(buf);
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_ARM_GLITCH, start);
     return PLUNDERVOLT_NO_ERROR;
 }
 
 plundervolt_error_t plundervolt_fire_glitch() {
+    uint64_t start = plundervolt_instrument_begin();
     if (u_spec.using_dtr) {
-        ioctl(fd_trigger, TIOCMBIS, &DTR_flag);
+        backend->trigger_set(session.trigger, 1);
+    } else if (session.binary) {
+        if (teensy_frame(PLUNDERVOLT_FRAME_FIRE, NULL, 0) == -1) {
+            return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
+        }
     } else {
-        int error_check = write(fd_teensy, "\n", 1); // Send Teensy the symbol for "end of input", i.e. "start working".
-        if (error_check != 1) { // Write to Teensy failed
+        int error_check = teensy_write("\n", 1); // Send Teensy the symbol for "end of input", i.e. "start working".
+        if (error_check == -1) { // Write to Teensy failed
             return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
         }
     }
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_FIRE_GLITCH, start);
+    plundervolt_instrument_fired();
     return PLUNDERVOLT_NO_ERROR;
 }
 
 void plundervolt_teensy_read_response() {
     char buffer[BUFMAX];
     memset(buffer, 0, BUFMAX); // Wipe buffer
-    serialport_read_lines(fd_teensy, buffer, EOL, BUFMAX, 10, 3); // Read response
-    printf("Teensy response: %s\n", buffer);
+    backend->serial_read_lines(session.teensy, buffer, EOL, BUFMAX, 10, 3); // Read response
+    teensy_answer(buffer);
+}
+
+void teensy_answer(const char* response) {
+    if (u_spec.teensy_response != NULL) {
+        u_spec.teensy_response(response);
+    }
 }
 
 plundervolt_error_t plundervolt_configure_glitch() {
-    if (fd_teensy == -1) { // Teensy not opened properly
+    if (session.teensy <= 0) { // Teensy not opened properly
         return PLUNDERVOLT_CONNECTION_INIT_ERROR;
     }
+    plundervolt_glitch_profile_t profile = plundervolt_glitch_profile_from_specification(u_spec, "spec");
+    return send_configuration(&profile);
+}
+
+plundervolt_error_t send_configuration(const plundervolt_glitch_profile_t* profile) {
+    uint64_t start = plundervolt_instrument_begin();
 
     char buffer[BUFMAX];
     memset(buffer, 0, BUFMAX); // Wipe buffer
 
-    // Send delay before undervolting
-    sprintf(buffer, ("delay %i\n"), u_spec.delay_before_undervolting);
-    
-    int error_check = serialport_write(fd_teensy, buffer);
+    // Delay before undervolting, then the glitch specification.
+    int delay_length = sprintf(buffer, ("delay %i\n"), profile->delay_before_undervolting);
+    sprintf(buffer + delay_length, ("%i %1.4f %i %1.4f %i %1.4f\n"), profile->repeat, profile->voltage[0], profile->duration[0],
+        profile->voltage[1], profile->duration[1], profile->voltage[2]);
+
+    // The binary configuration carries every segment, the text one only the three above.
+    uint8_t payload[PLUNDERVOLT_FRAME_PAYLOAD_MAX];
+    const void* configuration = buffer;
+    size_t length = strlen(buffer);
+    if (session.binary) {
+        configuration = payload;
+        length = plundervolt_profile_encode(profile, payload);
+    }
+    if (length == sent_configuration_length && memcmp(configuration, sent_configuration, length) == 0) {
+        return PLUNDERVOLT_NO_ERROR; // Teensy has it already.
+    }
+    sent_configuration_length = 0; // Unknown until it is through.
+    active_glitch = -1;
+
+    if (session.binary) {
+        if (teensy_frame(PLUNDERVOLT_FRAME_CONFIGURE, payload, length) != 1) {
+            return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR; // Refused, or never acknowledged: Teensy runs no known configuration.
+        }
+        memcpy(sent_configuration, payload, length);
+        sent_configuration_length = length;
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_CONFIGURE_GLITCH, start);
+        return PLUNDERVOLT_NO_ERROR;
+    }
+
+    int error_check = teensy_write(buffer, delay_length);
     if (error_check == -1) { // Write to Teensy failed
         return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
     }
     plundervolt_teensy_read_response();
 
-    memset(buffer, 0, BUFMAX); // Wipe buffer
-    
-    // Send glitch specification
-    sprintf(buffer, ("%i %1.4f %i %1.4f %i %1.4f\n"), u_spec.repeat, u_spec.start_voltage, u_spec.duration_start, u_spec.undervolting_voltage, u_spec.duration_during, u_spec.end_voltage);
-    error_check = serialport_write(fd_teensy, buffer);
+    error_check = teensy_write(buffer + delay_length, strlen(buffer + delay_length));
     if (error_check == -1) { // Write to Teensy failed
         return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
     }
     plundervolt_teensy_read_response();
 
+    memcpy(sent_configuration, buffer, length);
+    sent_configuration_length = length;
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_CONFIGURE_GLITCH, start);
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_glitch_profile_t plundervolt_glitch_profile_from_specification(plundervolt_specification_t spec, const char* name) {
+    plundervolt_glitch_profile_t profile;
+    memset(&profile, 0, sizeof profile);
+    snprintf(profile.name, sizeof profile.name, "%s", name);
+    profile.repeat = spec.repeat;
+    profile.delay_before_undervolting = spec.delay_before_undervolting;
+    profile.segments = 3;
+    profile.voltage[0] = spec.start_voltage;
+    profile.duration[0] = spec.duration_start;
+    profile.voltage[1] = spec.undervolting_voltage;
+    profile.duration[1] = spec.duration_during;
+    profile.voltage[2] = spec.end_voltage;
+    return profile;
+}
+
+int teensy_command(const char* line) {
+    if (teensy_write(line, strlen(line)) == -1) {
+        return -1;
+    }
+    char response[BUFMAX];
+    memset(response, 0, BUFMAX);
+    backend->serial_read_lines(session.teensy, response, EOL, BUFMAX, 10, 1);
+    return strncmp(response, "ok", 2) == 0;
+}
+
+plundervolt_error_t plundervolt_upload_glitch_profiles(const plundervolt_glitch_profile_t* profiles, int count) {
+    if (count < 0 || count > PLUNDERVOLT_GLITCH_PROFILES) {
+        return PLUNDERVOLT_GLITCH_PROFILE_ERROR;
+    }
+    for (int i = 0; i < count; i++) {
+        if (profiles[i].segments < 1 || profiles[i].segments > PLUNDERVOLT_GLITCH_SEGMENTS || strchr(profiles[i].name, ' ')) {
+            return PLUNDERVOLT_GLITCH_PROFILE_ERROR;
+        }
+    }
+    if (profiles != glitch_profiles) { // Re-uploads pass the table itself.
+        memcpy(glitch_profiles, profiles, sizeof(plundervolt_glitch_profile_t) * count);
+        glitch_profile_count = count;
+    }
+    active_glitch = -1;
+    if (session.teensy <= 0) {
+        glitch_profiles_state = 0; // Uploaded when the session opens and a profile is selected.
+        return PLUNDERVOLT_NO_ERROR;
+    }
+
+    char buffer[BUFMAX];
+    int accepted; // Of the start of the table: firmware which refuses it has no profiles.
+    if (session.binary) {
+        uint8_t payload[PLUNDERVOLT_FRAME_PAYLOAD_MAX] = {count};
+        accepted = teensy_frame(PLUNDERVOLT_FRAME_PROFILES, payload, 1);
+        for (int i = 0; accepted == 1 && i < count; i++) {
+            payload[0] = i;
+            if (teensy_frame(PLUNDERVOLT_FRAME_PROFILE, payload, 1 + plundervolt_profile_encode(&glitch_profiles[i], payload + 1)) != 1) {
+                accepted = -1; // Firmware which took the start refuses no profile of it: the table on Teensy is broken.
+            }
+        }
+    } else {
+        snprintf(buffer, BUFMAX, "profiles %i\n", count);
+        accepted = teensy_command(buffer);
+        for (int i = 0; accepted == 1 && i < count; i++) {
+            const plundervolt_glitch_profile_t* profile = &glitch_profiles[i];
+            int length = snprintf(buffer, BUFMAX, "profile %i %.*s %i %i %i", i, (int) sizeof profile->name,
+                profile->name[0] ? profile->name : "-", profile->repeat, profile->delay_before_undervolting, profile->segments);
+            for (int segment = 0; segment < profile->segments && length < BUFMAX; segment++) {
+                length += snprintf(buffer + length, BUFMAX - length, " %1.4f %i", profile->voltage[segment], profile->duration[segment]);
+            }
+            if (length < BUFMAX) {
+                length += snprintf(buffer + length, BUFMAX - length, "\n");
+            }
+            if (length >= BUFMAX) { // Cut short; Teensy would take the rest for the next line.
+                glitch_profiles_state = 0;
+                return PLUNDERVOLT_GLITCH_PROFILE_ERROR;
+            }
+            if (teensy_command(buffer) != 1) {
+                accepted = -1;
+            }
+        }
+    }
+    if (accepted == -1) {
+        glitch_profiles_state = 0;
+        return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
+    }
+    glitch_profiles_state = accepted ? 1 : -1;
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_error_t plundervolt_select_glitch_profile(int index) {
+    if (session.teensy <= 0) { // Teensy not opened properly
+        return PLUNDERVOLT_CONNECTION_INIT_ERROR;
+    }
+    if (index < 0 || index >= glitch_profile_count) {
+        return PLUNDERVOLT_GLITCH_PROFILE_ERROR;
+    }
+    if (index == active_glitch) {
+        return PLUNDERVOLT_NO_ERROR; // Nothing changed since the last try.
+    }
+    if (glitch_profiles_state == 0) {
+        plundervolt_error_t error_check = plundervolt_upload_glitch_profiles(glitch_profiles, glitch_profile_count);
+        if (error_check) {
+            return error_check;
+        }
+    }
+
+    if (glitch_profiles_state == -1) {
+        // Older firmware: send the profile as a configuration. The text one can only express three segments.
+        if (!session.binary && glitch_profiles[index].segments != 3) {
+            return PLUNDERVOLT_GLITCH_PROFILE_ERROR;
+        }
+        plundervolt_error_t error_check = send_configuration(&glitch_profiles[index]);
+        if (error_check) {
+            return error_check;
+        }
+    } else {
+        uint64_t start = plundervolt_instrument_begin();
+        int accepted;
+        if (session.binary) {
+            uint8_t payload[1] = {index};
+            accepted = teensy_frame(PLUNDERVOLT_FRAME_SELECT, payload, 1);
+        } else {
+            char buffer[BUFMAX];
+            sprintf(buffer, "select %i\n", index);
+            accepted = teensy_command(buffer);
+        }
+        if (accepted == -1) {
+            return PLUNDERVOLT_WRITE_TO_TEENSY_ERROR;
+        }
+        if (!accepted) {
+            return PLUNDERVOLT_GLITCH_PROFILE_ERROR;
+        }
+        sent_configuration_length = 0; // The configuration is no longer what Teensy runs.
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_CONFIGURE_GLITCH, start);
+    }
+    active_glitch = index;
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+int plundervolt_glitch_profiles_on_teensy() {
+    return glitch_profiles_state == 1;
+}
+
+void init_io_cond() {
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&io.completed, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+plundervolt_error_t plundervolt_submit_request(plundervolt_request_t* request) {
+    pthread_once(&io_once, init_io_cond);
+    request->error = PLUNDERVOLT_NO_ERROR;
+    request->completed = 0;
+    request->next = NULL;
+    atomic_store_explicit(&request->done, 0, memory_order_relaxed);
+    request->submitted = plundervolt_monotonic_ns();
+
+    pthread_mutex_lock(&io.lock);
+    if (!io.running) {
+        io.shutdown = 0;
+        if (pthread_create(&io.thread, NULL, io_thread_main, NULL) != 0) {
+            pthread_mutex_unlock(&io.lock);
+            return PLUNDERVOLT_GENERIC_ERROR;
+        }
+        io.running = 1;
+    }
+    if (io.tail) {
+        io.tail->next = request;
+    } else {
+        io.head = request;
+    }
+    io.tail = request;
+    pthread_cond_signal(&io.submitted);
+    pthread_mutex_unlock(&io.lock);
     return PLUNDERVOLT_NO_ERROR;
 }
 
+void* io_thread_main(void* unused) {
+    pthread_mutex_lock(&io.lock);
+    while (1) {
+        while (io.head == NULL && !io.shutdown) {
+            pthread_cond_wait(&io.submitted, &io.lock);
+        }
+        plundervolt_request_t* request = io.head;
+        if (request == NULL) {
+            break; // Shut down, and nothing left to run.
+        }
+        io.head = request->next;
+        if (io.head == NULL) {
+            io.tail = NULL;
+        }
+        pthread_mutex_unlock(&io.lock);
+
+        switch (request->kind) {
+        case PLUNDERVOLT_REQUEST_CONFIGURE:
+            request->error = session.teensy > 0 ? send_configuration(&request->profile) : PLUNDERVOLT_CONNECTION_INIT_ERROR;
+            break;
+        case PLUNDERVOLT_REQUEST_SELECT:
+            request->error = plundervolt_select_glitch_profile(request->index);
+            break;
+        case PLUNDERVOLT_REQUEST_ARM:
+            request->error = plundervolt_arm_glitch();
+            break;
+        case PLUNDERVOLT_REQUEST_FIRE:
+            request->error = plundervolt_fire_glitch();
+            break;
+        default:
+            request->error = PLUNDERVOLT_GENERIC_ERROR;
+        }
+        request->completed = plundervolt_monotonic_ns();
+        if (request->callback) {
+            request->callback(request, request->callback_arguments);
+        }
+
+        pthread_mutex_lock(&io.lock);
+        atomic_store_explicit(&request->done, 1, memory_order_release);
+        pthread_cond_broadcast(&io.completed);
+    }
+    pthread_mutex_unlock(&io.lock);
+    return NULL;
+}
+
+void stop_io_thread() {
+    pthread_mutex_lock(&io.lock);
+    if (!io.running) {
+        pthread_mutex_unlock(&io.lock);
+        return;
+    }
+    io.shutdown = 1;
+    pthread_cond_signal(&io.submitted);
+    pthread_mutex_unlock(&io.lock);
+    pthread_join(io.thread, NULL);
+    io.running = 0;
+}
+
+plundervolt_error_t plundervolt_configure_glitch_async(plundervolt_request_t* request) {
+    request->kind = PLUNDERVOLT_REQUEST_CONFIGURE;
+    request->profile = plundervolt_glitch_profile_from_specification(u_spec, "spec");
+    return plundervolt_submit_request(request);
+}
+
+plundervolt_error_t plundervolt_select_glitch_profile_async(plundervolt_request_t* request, int index) {
+    request->kind = PLUNDERVOLT_REQUEST_SELECT;
+    request->index = index;
+    return plundervolt_submit_request(request);
+}
+
+plundervolt_error_t plundervolt_arm_glitch_async(plundervolt_request_t* request) {
+    request->kind = PLUNDERVOLT_REQUEST_ARM;
+    return plundervolt_submit_request(request);
+}
+
+plundervolt_error_t plundervolt_fire_glitch_async(plundervolt_request_t* request) {
+    request->kind = PLUNDERVOLT_REQUEST_FIRE;
+    return plundervolt_submit_request(request);
+}
+
+plundervolt_error_t plundervolt_wait_request(plundervolt_request_t* request, int timeout_ms) {
+    pthread_once(&io_once, init_io_cond);
+    struct timespec deadline;
+    deadline_after(&deadline, timeout_ms);
+    pthread_mutex_lock(&io.lock);
+    while (!plundervolt_request_done(request)) {
+        int error = timeout_ms < 0 ? pthread_cond_wait(&io.completed, &io.lock)
+                                   : pthread_cond_timedwait(&io.completed, &io.lock, &deadline);
+        if (error == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&io.lock);
+    return plundervolt_request_done(request) ? request->error : PLUNDERVOLT_REQUEST_PENDING_ERROR;
+}
+
 void plundervolt_print_error(plundervolt_error_t error) {
     fprintf(stderr, "%s\n", plundervolt_error2str(error));
 }
@@ -468,9 +2202,9 @@ const char* plundervolt_error2str(plundervolt_error_t error) {
     switch (error)
     {
     case PLUNDERVOLT_RANGE_ERROR:
-        return "Start undervolting is smaller than end undervolting.";
+        return "Start undervolting is smaller than end undervolting, or the steps do not fit the range.";
     case PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR:
-        return "Could not open /dev/cpu/0/msr\n\
+        return "Could not open /dev/cpu/N/msr\n\
             Run sudo modprobe msr first, and run this function with sudo priviliges.";
     case PLUNDERVOLT_NO_FUNCTION_ERROR:
         return "No function to undervolt on is provided.";
@@ -486,6 +2220,22 @@ const char* plundervolt_error2str(plundervolt_error_t error) {
         return "No Teensy serialport provided.";
     case PLUNDERVOLT_NO_TRIGGER_SERIAL_ERROR:
         return "No trigger serialport provided.";
+    case PLUNDERVOLT_NO_PACKAGE_ERROR:
+        return "No existing CPU package is selected for undervolting.";
+    case PLUNDERVOLT_PLACEMENT_ERROR:
+        return "The threads cannot be placed on CPUs as specified.";
+    case PLUNDERVOLT_GLITCH_PROFILE_ERROR:
+        return "The glitch profile does not exist, is malformed, or cannot be sent to this Teensy.";
+    case PLUNDERVOLT_REQUEST_PENDING_ERROR:
+        return "The request to Teensy did not complete in time.";
+    case PLUNDERVOLT_SETTLE_TIMEOUT_ERROR:
+        return "The voltage did not settle at its target in time.";
+    case PLUNDERVOLT_JOURNAL_ERROR:
+        return "The journal cannot be opened, read or written.";
+    case PLUNDERVOLT_UNSAFE_RANGE_ERROR:
+        return "The journal marks every undervoltage of the range, or the glitch voltage, unsafe.";
+    case PLUNDERVOLT_FAULT_LOG_ERROR:
+        return "The fault log cannot be opened, allocated or synced, or the file is not a fault log.";
     default:
         return "Generic error occured.";
     }
@@ -518,35 +2268,58 @@ plundervolt_error_t plundervolt_run() {
         return error_check;
     }
 
-    loop_finished = 0;
+    // Counts of this run, even if the journal finds it done already.
+    atomic_store_explicit(&plundervolt_run_state.fault_count, 0, memory_order_release);
+    plundervolt_estimate_start(&run_estimate, u_spec.stop_rule, u_spec.min_tries, u_spec.stop_low, u_spec.stop_high, u_spec.stop_confidence);
+    plundervolt_fork_server_reset_stats();
+
+    journal_error = PLUNDERVOLT_NO_ERROR;
+    if (u_spec.journal != NULL && u_spec.undervolt) {
+        int done = 0;
+        error_check = open_campaign_journal(&done);
+        if (error_check || done) {
+            return error_check;
+        }
+    }
+
+    error_check = open_fault_log(); // Before the fork servers start, so they share its mapping.
+    if (error_check) {
+        close_campaign_journal(0);
+        return error_check;
+    }
+
+    uint64_t start = plundervolt_instrument_begin();
+    plundervolt_instrument_run_started();
+    atomic_store_explicit(&plundervolt_run_state.loop_finished, 0, memory_order_release);
 
     plundervolt_error_t thread_error = PLUNDERVOLT_NO_ERROR;
 
+    if (u_spec.fork_server) {
+        pthread_once(&fault_queue_once, init_fault_queue); // Mapped before the servers fork, so they share it.
+        prepare_fork_servers(u_spec.threads > 1 ? u_spec.threads : 1);
+    }
+
     if (u_spec.u_type == software) {
-        // Create threads
-        // One is for running the function, the other for undervolting.
+        // Threads for running the function, and one for undervolting. They are created by the first run only.
         if (u_spec.threads < 1) u_spec.threads = 1;
-        pthread_t* function_thread = malloc(sizeof(pthread_t) * u_spec.threads);
-        for (int i = 0; i < u_spec.threads; i++) {
-            if (u_spec.loop) {
-                pthread_create(&function_thread[i], NULL, run_function_loop, u_spec.arguments);
-            } else {
-                pthread_create(&function_thread[i], NULL, run_function, u_spec.arguments);
+        error_check = start_pool();
+        if (error_check) {
+            close_campaign_journal(0);
+            return error_check;
+        }
+        pool.error = PLUNDERVOLT_NO_ERROR;
+        if (u_spec.telemetry_us > 0) {
+            error_check = start_telemetry();
+            if (error_check) {
+                close_campaign_journal(0);
+                return error_check;
             }
         }
-    
-        if (u_spec.undervolt) {
-            // Create undervolting thread.
-            pthread_t undervolting_thread;
-            pthread_create(&undervolting_thread, NULL, plundervolt_apply_undervolting, (void *) &thread_error);
 
-            // Wait until both threads finish
-            pthread_join(undervolting_thread, NULL);
-        }
-        for (int i = 0; i < u_spec.threads; i++) {
-            pthread_join(function_thread[i], NULL); // Wait for all threads to end.
-        }
+        release_pool(); // Run the threads and wait for all of them to end.
+        thread_error = pool.error;
         plundervolt_reset_voltage();
+        plundervolt_telemetry_stop(); // After the reset, so the trace shows the voltage coming back.
     } else {
         // Since apply_undervolting calls u_spec.function itself when doing HARDWARE undervolting, we don't need to do anything else here.
         if (u_spec.undervolt) {
@@ -554,22 +2327,384 @@ plundervolt_error_t plundervolt_run() {
         }
     }
 
+    plundervolt_instrument_end(PLUNDERVOLT_PHASE_RUN, start);
+    close_campaign_journal(thread_error == PLUNDERVOLT_NO_ERROR && journal_error == PLUNDERVOLT_NO_ERROR);
+    if (fault_log.header != NULL && thread_error == PLUNDERVOLT_NO_ERROR) {
+        thread_error = plundervolt_fault_log_sync(&fault_log);
+    }
+    if (journal_error != PLUNDERVOLT_NO_ERROR) {
+        return journal_error;
+    }
     if (thread_error != PLUNDERVOLT_NO_ERROR) {
         return thread_error;
     }
     return PLUNDERVOLT_NO_ERROR;
 }
 
+plundervolt_error_t open_fault_log() {
+    if (u_spec.fault_log == NULL || strcmp(u_spec.fault_log, fault_log_path) != 0) {
+        close_fault_log();
+    }
+    if (u_spec.fault_log == NULL) {
+        return PLUNDERVOLT_NO_ERROR;
+    }
+    if (fault_log.header == NULL) {
+        if (plundervolt_fault_log_open(&fault_log, u_spec.fault_log, u_spec.fault_log_capacity)) {
+            return PLUNDERVOLT_FAULT_LOG_ERROR;
+        }
+        snprintf(fault_log_path, sizeof fault_log_path, "%s", u_spec.fault_log);
+    }
+    plundervolt_fault_log_start_run(&fault_log);
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void close_fault_log() {
+    if (fault_log.header != NULL) {
+        plundervolt_fault_log_close(&fault_log);
+    }
+    fault_log_path[0] = '\0';
+}
+
+uint64_t campaign_fingerprint() {
+    int64_t fields[] = {u_spec.u_type, u_spec.search, (int64_t) u_spec.start_undervoltage, (int64_t) u_spec.end_undervoltage,
+        u_spec.step, u_spec.coarse_step, u_spec.sweep_planes, (int64_t) u_spec.packages, u_spec.tries, 0, 0, 0, 0, 0, 0, 0, 0};
+    if (u_spec.u_type == hardware) {
+        // The glitch: a run at any other point is another campaign. Voltages to 0.1 mV.
+        int64_t glitch[] = {(int64_t)(u_spec.undervolting_voltage * 10000 + 0.5), (int64_t)(u_spec.start_voltage * 10000 + 0.5),
+            (int64_t)(u_spec.end_voltage * 10000 + 0.5), u_spec.duration_start, u_spec.duration_during,
+            u_spec.delay_before_undervolting, u_spec.repeat, u_spec.glitch_profile >= 0 ? hardware_step() : -1};
+        memcpy(fields + 9, glitch, sizeof glitch);
+    }
+    const uint8_t* bytes = (const uint8_t*) fields;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < sizeof fields; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+plundervolt_error_t open_campaign_journal(int* done) {
+    *done = 0;
+    plundervolt_error_t error_check = plundervolt_journal_open(&campaign_journal, u_spec.journal, u_spec.journal_sync_ms);
+    if (error_check) {
+        return error_check;
+    }
+    journaling = 1;
+    campaign_spec = u_spec;
+    plundervolt_journal_state_t* state = &campaign_journal.state;
+    uint64_t fingerprint = campaign_fingerprint();
+    int resume = state->open && state->fingerprint == fingerprint;
+    if (!resume) {
+        error_check = plundervolt_journal_append(&campaign_journal, PLUNDERVOLT_JOURNAL_CAMPAIGN, (int64_t) fingerprint,
+            u_spec.u_type == hardware);
+        if (error_check) {
+            close_campaign_journal(0);
+            return error_check;
+        }
+    }
+
+    if (u_spec.u_type == software) {
+        int64_t start = (int64_t) u_spec.start_undervoltage;
+        int64_t end = (int64_t) u_spec.end_undervoltage;
+        if (resume && u_spec.search == linear_search && state->has_done) {
+            start = state->last_done - u_spec.step;
+        }
+        if (start < end) {
+            *done = 1;
+        } else {
+            // Stay above the shallowest undervoltage the machine died at.
+            int64_t limit = plundervolt_journal_unsafe_limit(state);
+            if (limit != INT64_MIN && end <= limit) {
+                end = limit + 1;
+            }
+            if ((int64_t) u_spec.start_undervoltage < end) {
+                close_campaign_journal(0);
+                return PLUNDERVOLT_UNSAFE_RANGE_ERROR;
+            }
+            *done = start < end; // Resumed up to the unsafe undervoltages.
+        }
+        u_spec.start_undervoltage = (uint64_t) start;
+        u_spec.end_undervoltage = (uint64_t) end;
+    } else {
+        // Stay above the highest glitch voltage the machine died at.
+        int64_t limit = plundervolt_journal_unsafe_voltage(state);
+        if (limit != INT64_MIN && hardware_step() <= limit) {
+            close_campaign_journal(0);
+            return PLUNDERVOLT_UNSAFE_RANGE_ERROR;
+        }
+        if (resume) {
+            if (state->tries >= (uint64_t) u_spec.tries) {
+                *done = 1;
+            }
+            u_spec.tries -= (int) state->tries;
+        }
+    }
+    if (*done) {
+        close_campaign_journal(1);
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void close_campaign_journal(int finished) {
+    if (!journaling) {
+        return;
+    }
+    if (finished && plundervolt_journal_append(&campaign_journal, PLUNDERVOLT_JOURNAL_END, 0, 0) && journal_error == PLUNDERVOLT_NO_ERROR) {
+        journal_error = PLUNDERVOLT_JOURNAL_ERROR;
+    }
+    plundervolt_journal_close(&campaign_journal);
+    journaling = 0;
+    u_spec.start_undervoltage = campaign_spec.start_undervoltage;
+    u_spec.end_undervoltage = campaign_spec.end_undervoltage;
+    u_spec.tries = campaign_spec.tries;
+}
+
+void journal_failed(plundervolt_error_t error) {
+    if (journal_error == PLUNDERVOLT_NO_ERROR) {
+        journal_error = error;
+    }
+    plundervolt_set_loop_finished();
+}
+
+int journal_step(int64_t undervoltage) {
+    if (!journaling) {
+        return 0;
+    }
+    plundervolt_error_t error_check = plundervolt_journal_append(&campaign_journal, PLUNDERVOLT_JOURNAL_STEP, undervoltage, 0);
+    if (error_check) {
+        journal_failed(error_check);
+        return -1;
+    }
+    return 0;
+}
+
+void journal_step_done(int64_t undervoltage, uint64_t faults) {
+    if (!journaling) {
+        return;
+    }
+    plundervolt_error_t error_check = plundervolt_journal_append(&campaign_journal, PLUNDERVOLT_JOURNAL_STEP_DONE, undervoltage, faults);
+    if (!error_check) {
+        error_check = plundervolt_journal_checkpoint(&campaign_journal);
+    }
+    if (error_check) {
+        journal_failed(error_check);
+    }
+}
+
+void journal_try() {
+    if (!journaling) {
+        return;
+    }
+    plundervolt_error_t error_check = plundervolt_journal_append(&campaign_journal, PLUNDERVOLT_JOURNAL_TRY, 0, campaign_journal.state.tries + 1);
+    if (!error_check) {
+        error_check = plundervolt_journal_checkpoint(&campaign_journal);
+    }
+    if (error_check) {
+        journal_failed(error_check);
+    }
+}
+
+void* pool_thread(void* slot) {
+    int index = (int)(intptr_t) slot;
+    int pinned = -1; // CPU the thread is pinned to.
+    thread_id = index; // Fault records of pool threads carry their slot.
+
+    pthread_mutex_lock(&pool.lock);
+    uint64_t generation = pool.created;
+    while (1) {
+        // Park until the next run.
+        while (pool.generation == generation) {
+            pthread_cond_wait(&pool.start, &pool.lock);
+        }
+        generation = pool.generation;
+        if (pool.shutdown) {
+            break;
+        }
+        uint64_t released_at = pool.released_at;
+        pthread_mutex_unlock(&pool.lock);
+
+        if (pool.cpus[index] != pinned) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(pool.cpus[index], &cpuset);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+            pinned = pool.cpus[index];
+        }
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_RELEASE_TO_VICTIM, index < pool.workers ? released_at : 0);
+
+        if (index == pool.workers) { // The undervolting thread.
+            if (u_spec.undervolt) {
+                plundervolt_apply_undervolting((void *) &pool.error);
+            }
+        } else if (u_spec.fork_server) {
+            // Trials in forked children until the loops finish, or a single one.
+            do {
+                if (fork_trial(index, pool.cpus[index])) {
+                    pool.error = PLUNDERVOLT_GENERIC_ERROR;
+                    plundervolt_set_loop_finished();
+                    break;
+                }
+            } while (u_spec.loop && plundervolt_loop_is_running());
+        } else if (u_spec.loop) {
+            run_function_loop(u_spec.arguments);
+        } else {
+            run_function(u_spec.arguments);
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        if (++pool.finished == pool.threads) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+plundervolt_error_t plundervolt_get_worker_cpus(int* cpus, int count) {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    int controller = u_spec.controller_cpu;
+    if (controller < 0 || controller >= topo->cpus) {
+        return PLUNDERVOLT_PLACEMENT_ERROR;
+    }
+
+    if (u_spec.placement == placement_explicit) {
+        if (u_spec.worker_cpus == NULL || u_spec.worker_cpus_count < 1) {
+            return PLUNDERVOLT_PLACEMENT_ERROR;
+        }
+        for (int i = 0; i < count; i++) {
+            cpus[i] = u_spec.worker_cpus[i % u_spec.worker_cpus_count];
+            if (cpus[i] < 0 || cpus[i] >= topo->cpus) {
+                return PLUNDERVOLT_PLACEMENT_ERROR;
+            }
+        }
+        return PLUNDERVOLT_NO_ERROR;
+    }
+
+    // Collect the allowed CPUs. One per core if the threads must not share cores.
+    int one_per_core = u_spec.placement == placement_per_core || !u_spec.allow_smt_siblings;
+    int* allowed = malloc(sizeof(int) * topo->cpus);
+    int allowed_count = 0;
+    for (int cpu = 0; cpu < topo->cpus; cpu++) {
+        int package = topo->package_of[cpu];
+        int core = topo->core_of[cpu];
+        if (cpu == controller) {
+            continue;
+        }
+        if (u_spec.same_package && !((existing_packages(u_spec.packages) >> package) & 1)) {
+            continue;
+        }
+        if (!u_spec.allow_smt_siblings && package == topo->package_of[controller] && core == topo->core_of[controller]) {
+            continue; // SMT sibling of the undervolting thread.
+        }
+        int taken = 0;
+        for (int i = 0; one_per_core && i < allowed_count && !taken; i++) {
+            taken = topo->package_of[allowed[i]] == package && topo->core_of[allowed[i]] == core;
+        }
+        if (!taken) {
+            allowed[allowed_count++] = cpu;
+        }
+    }
+
+    plundervolt_error_t error_check = PLUNDERVOLT_NO_ERROR;
+    if (u_spec.placement == placement_per_core && allowed_count < count) {
+        error_check = PLUNDERVOLT_PLACEMENT_ERROR; // Not enough cores for a thread each.
+    } else if (allowed_count == 0) {
+        // Nowhere else to go (e.g. a single CPU); share the undervolting thread's CPU rather than fail.
+        for (int i = 0; i < count; i++) {
+            cpus[i] = controller;
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            cpus[i] = allowed[i % allowed_count];
+        }
+    }
+    free(allowed);
+    return error_check;
+}
+
+plundervolt_error_t start_telemetry() {
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    int cpus[PLUNDERVOLT_TELEMETRY_CPUS];
+    int count = 0;
+    for (int package = 0; package < topo->packages && count < PLUNDERVOLT_TELEMETRY_CPUS; package++) {
+        if (u_spec.packages & (1ull << package)) {
+            cpus[count++] = topo->package_cpu[package];
+        }
+    }
+    plundervolt_telemetry_reset();
+    return plundervolt_telemetry_start(cpus, count, u_spec.telemetry_us, u_spec.controller_cpu);
+}
+
+void release_pool() {
+    pthread_mutex_lock(&pool.lock);
+    pool.finished = 0;
+    pool.released_at = plundervolt_instrument_begin();
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    while (!pool.shutdown && pool.finished < pool.threads) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+plundervolt_error_t start_pool() {
+    if (pool.workers != u_spec.threads) {
+        stop_pool();
+    }
+    int workers = u_spec.threads;
+    int* cpus = pool.workers ? pool.cpus : malloc(sizeof(int) * (workers + 1));
+    plundervolt_error_t error_check = plundervolt_get_worker_cpus(cpus, workers);
+    cpus[workers] = u_spec.controller_cpu;
+    if (pool.workers) {
+        return error_check; // Already waiting. The threads re-pin themselves if the placement changed.
+    }
+    if (error_check) {
+        free(cpus);
+        return error_check;
+    }
+
+    pool.thread = malloc(sizeof(pthread_t) * (workers + 1));
+    pool.cpus = cpus;
+    pool.shutdown = 0;
+    pool.workers = workers;
+    pool.created = pool.generation;
+
+    for (pool.threads = 0; pool.threads <= workers; pool.threads++) {
+        if (pthread_create(&pool.thread[pool.threads], NULL, pool_thread, (void *)(intptr_t) pool.threads) != 0) {
+            stop_pool(); // Let the threads created so far exit.
+            return PLUNDERVOLT_GENERIC_ERROR;
+        }
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void stop_pool() {
+    if (pool.workers == 0) {
+        return;
+    }
+    pool.shutdown = 1;
+    release_pool();
+    for (int i = 0; i < pool.threads; i++) {
+        pthread_join(pool.thread[i], NULL);
+    }
+    free(pool.thread);
+    free(pool.cpus);
+    pool.workers = 0;
+    pool.threads = 0;
+}
+
 void plundervolt_cleanup() {
+    stop_pool();
+    stop_fork_servers();
+    close_fault_log();
+    stop_io_thread();
     if (u_spec.u_type == software) {
-        close(fd);
+        // Reset before closing, as the reset writes through the msr files.
         if (u_spec.undervolt) {
             plundervolt_reset_voltage();
         }
+        close_msr_files();
     }
-    close(fd_teensy);
-    if (u_spec.using_dtr) {
-        close(fd_trigger);
-    }
+    plundervolt_close_session();
 
 }
\ No newline at end of file
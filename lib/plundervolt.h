@@ -13,17 +13,69 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include "plundervolt_backend.h"
+#include "plundervolt_instrument.h"
 
 /************************************************
  ********************* General ******************
  ************************************************/
 
+/**
+ * @brief Size of a cache line. Shared state is aligned to it, so a write to one field does not slow down readers of another.
+ * 
+ */
+#define PLUNDERVOLT_CACHE_LINE 64
+
+/**
+ * @brief Accessors which must cost a load, not a call, even when the user's code is compiled without optimisation.
+ * 
+ */
+#define PLUNDERVOLT_INLINE static inline __attribute__((always_inline))
+
 /**
  * @brief Determines the type of undervolting to perform. plundervolt_specificaion_t is a type struct, which holds u_type, and that takes one of those values.
  * 
  */
 typedef enum {software, hardware} undervolting_type;
 
+/**
+ * @brief Determines how Software undervolting moves between start_undervoltage and end_undervoltage. plundervolt_specification_t holds it in search.
+ * linear_search lowers the undervoltage by step until the end or until the loop is finished.
+ * adaptive_search brackets the undervoltage where faults start (see plundervolt_specification_t.coarse_step).
+ * 
+ */
+typedef enum {linear_search, adaptive_search} search_type;
+
+/**
+ * @brief Determines which CPUs the threads running the user's function are pinned to. plundervolt_specification_t holds it in placement.
+ * placement_spread uses every allowed CPU in turn, wrapping around if there are more threads than CPUs.
+ * placement_per_core puts every thread on a different physical core, and fails if there are not enough of them.
+ * placement_explicit uses worker_cpus.
+ * 
+ */
+typedef enum {placement_spread, placement_per_core, placement_explicit} placement_type;
+
+/**
+ * @brief How the library talks to Teensy. plundervolt_specification_t holds it in protocol.
+ * protocol_text sends text lines only, as Teensy's original firmware expects.
+ * protocol_negotiate asks Teensy for binary frames (see plundervolt_protocol.h) when the session opens, and keeps to text if it refuses.
+ * protocol_binary does the same, but fails to open the session if Teensy refuses.
+ * 
+ */
+typedef enum {protocol_text, protocol_negotiate, protocol_binary} protocol_type;
+
+/**
+ * @brief Determines how many tries Hardware undervolting runs for one specification. plundervolt_specification_t holds it in stop_rule.
+ * stop_fixed runs all tries.
+ * stop_wilson stops once the Wilson score interval of the fault rate lies below stop_low or above stop_high.
+ * stop_sprt stops once a sequential probability ratio test decides between a fault rate of stop_low and one of stop_high.
+ * See plundervolt_estimate.h.
+ * 
+ */
+typedef enum {stop_fixed, stop_wilson, stop_sprt} stop_rule_type;
+
 /**
  * @brief Error codes for the library.
  * 
@@ -39,9 +91,53 @@ typedef enum {
     PLUNDERVOLT_NO_TEENSY_SERIAL_ERROR = 7,
     PLUNDERVOLT_NO_TRIGGER_SERIAL_ERROR = 8,
     PLUNDERVOLT_WRITE_TO_TEENSY_ERROR = 9,
-    PLUNDERVOLT_CONNECTION_INIT_ERROR = 10
+    PLUNDERVOLT_CONNECTION_INIT_ERROR = 10,
+    PLUNDERVOLT_NO_PACKAGE_ERROR = 11,
+    PLUNDERVOLT_PLACEMENT_ERROR = 12,
+    PLUNDERVOLT_GLITCH_PROFILE_ERROR = 13,
+    PLUNDERVOLT_REQUEST_PENDING_ERROR = 14,
+    PLUNDERVOLT_SETTLE_TIMEOUT_ERROR = 15,
+    PLUNDERVOLT_JOURNAL_ERROR = 16,
+    PLUNDERVOLT_UNSAFE_RANGE_ERROR = 17,
+    PLUNDERVOLT_FAULT_LOG_ERROR = 18
 } plundervolt_error_t;
 
+/**
+ * @brief Value of plundervolt_specification_t.packages which selects every package (socket) of the machine.
+ * 
+ */
+#define PLUNDERVOLT_ALL_PACKAGES (~(uint64_t)0)
+
+/**
+ * @brief Voltage planes of msr 0x150. Every package has its own set.
+ * 
+ */
+typedef enum plundervolt_plane_t {
+    PLUNDERVOLT_PLANE_CORE = 0,
+    PLUNDERVOLT_PLANE_GPU = 1,
+    PLUNDERVOLT_PLANE_CACHE = 2,
+    PLUNDERVOLT_PLANE_UNCORE = 3,
+    PLUNDERVOLT_PLANE_ANALOG_IO = 4
+} plundervolt_plane_t;
+
+/**
+ * @brief Number of voltage planes.
+ * 
+ */
+#define PLUNDERVOLT_PLANES 5
+
+/**
+ * @brief Bit of a plane in plundervolt_specification_t.sweep_planes.
+ * 
+ */
+#define PLUNDERVOLT_PLANE_BIT(plane) (1u << (plane))
+
+/**
+ * @brief Default plundervolt_specification_t.sweep_planes: the core and the cache plane, moved together.
+ * 
+ */
+#define PLUNDERVOLT_DEFAULT_SWEEP_PLANES (PLUNDERVOLT_PLANE_BIT(PLUNDERVOLT_PLANE_CORE) | PLUNDERVOLT_PLANE_BIT(PLUNDERVOLT_PLANE_CACHE))
+
 /**
  * @brief Structure which houses the undervolting specification, such as start and end voltage, 
  * number of threads or function to undervolt on.
@@ -101,6 +197,51 @@ typedef struct plundervolt_specification_t {
      * @brief Type of undervolting to do - Hardware or Software
      */
     undervolting_type u_type;
+    /**
+     * @brief >0 to run every trial of function in its own process, forked from a fork server (see plundervolt_fork_server.h),
+     * so a crash of the victim ends the trial instead of the campaign. Every thread running the function (software) or the
+     * hardware loop gets a server; a trial lasts trial_ms in loop mode, or one call, and the server is restarted when the
+     * specification is set again. With hardware undervolting, delay_before_undervolting must cover the fork. Default is 0.
+     * 
+     */
+    int fork_server;
+    /**
+     * @brief With fork_server, run once with arguments in every fork server before its first trial. Every trial starts
+     * from the state it leaves, instead of setting the victim up again. Optional. Default is NULL.
+     */
+    void (* victim_init)(void *);
+    /**
+     * @brief With fork_server and loop, how long a trial runs before its loops are finished, in ms. Default is 10.
+     */
+    int trial_ms;
+    /**
+     * @brief With fork_server, time a trial may take beyond trial_ms before it is killed as hung, in ms. Default is 1000.
+     */
+    int trial_timeout_ms;
+    /**
+     * @brief Path of a journal file (see plundervolt_journal.h), or NULL (default) for none. plundervolt_run() records the
+     * campaign's progress in it, durably before every deeper undervoltage, and resumes the campaign from it after a lockup
+     * of the machine; undervoltages the machine died at are skipped by later software campaigns, and hardware runs which
+     * glitch as low as a glitch voltage the machine died at are refused. A run whose campaign the journal holds as
+     * finished (the machine died after its last step) only ends it, and reports no tries and no faults.
+     * 
+     */
+    char* journal;
+    /**
+     * @brief With journal, longest time records of finished steps and tries stay in memory before they are synced, in ms.
+     * A resumed campaign may repeat what was done in this time. Default is 1000.
+     */
+    int journal_sync_ms;
+    /**
+     * @brief Path of a fault log (see plundervolt_fault_log.h), or NULL (default) for none. Every record pushed with
+     * plundervolt_push_fault() is also appended to it, with the run's glitch parameters, without a system call; it is
+     * opened by plundervolt_run(), stays open across runs, and is synced at the end of every run.
+     */
+    char* fault_log;
+    /**
+     * @brief With fault_log, records the file has room for (64 bytes each, allocated when it is opened). Default is 1048576.
+     */
+    uint64_t fault_log_capacity;
     
     /* Software */
 
@@ -126,6 +267,102 @@ typedef struct plundervolt_specification_t {
      * @brief Software. How many mV we jump by when going from start_undervoltage to end_undervoltage.
      */
     int step;
+    /**
+     * @brief Software. Bitmask of CPU packages (sockets) to undervolt. Bit n selects package n, as numbered in plundervolt_get_topology().
+     * The voltage planes are per package, so one MSR write per selected package is enough. Default is PLUNDERVOLT_ALL_PACKAGES.
+     * 
+     */
+    uint64_t packages;
+    /**
+     * @brief Software. Bitmask of the voltage planes (see PLUNDERVOLT_PLANE_BIT()) the search moves from start_undervoltage
+     * to end_undervoltage, e.g. only PLUNDERVOLT_PLANE_BIT(PLUNDERVOLT_PLANE_CACHE) to fault memory-heavy victims without lowering
+     * the core voltage. Default is PLUNDERVOLT_DEFAULT_SWEEP_PLANES.
+     * 
+     */
+    uint32_t sweep_planes;
+    /**
+     * @brief Software. Offset of every plane not in sweep_planes, held for the whole run, in mV (like start_undervoltage),
+     * indexed by plundervolt_plane_t. 0 leaves a plane alone. Default is 0 for all planes.
+     * 
+     */
+    int64_t plane_offset[PLUNDERVOLT_PLANES];
+    /**
+     * @brief Software. CPU the undervolting thread is pinned to. Default is 0. Threads running the function are kept off it (see placement).
+     * 
+     */
+    int controller_cpu;
+    /**
+     * @brief Software. How to place the threads running the function on CPUs. Default is placement_spread.
+     * 
+     */
+    placement_type placement;
+    /**
+     * @brief Software. With placement_explicit, the CPUs of the threads running the function, in order. Used in turn if there are more threads.
+     * 
+     */
+    int* worker_cpus;
+    /**
+     * @brief Software. Number of CPUs in worker_cpus.
+     * 
+     */
+    int worker_cpus_count;
+    /**
+     * @brief Software. >0 if the threads may run on SMT siblings, i.e. share a physical core with the undervolting thread or with each other. Default is 1.
+     * With 0, only one logical CPU of every core is used, and never the core of controller_cpu.
+     * 
+     */
+    int allow_smt_siblings;
+    /**
+     * @brief Software. >0 to run the threads only on packages which are undervolted (see packages). Default is 0.
+     * 
+     */
+    int same_package;
+    /**
+     * @brief Software. How to move from start_undervoltage to end_undervoltage. Default is linear_search.
+     * With adaptive_search, the undervoltage is lowered by coarse_step until a fault is reported with plundervolt_report_fault().
+     * The undervolting then backs off to the last fault-free undervoltage, bisects between the two, and walks the last few mV in steps of step.
+     * The result is read with plundervolt_get_fault_threshold(). The user's function must report faults, not stop the loop.
+     * 
+     */
+    search_type search;
+    /**
+     * @brief Software. With adaptive_search, how many mV to jump by before the first fault. Must not be smaller than step.
+     * 
+     */
+    int coarse_step;
+    /**
+     * @brief Software. With linear_search, time between two steps in µs, for steps shorter than a ms. 0 (default) uses wait_time.
+     * 
+     */
+    int step_us;
+    /**
+     * @brief Software. With linear_search, busy-wait the last spin_us before every step instead of sleeping through them,
+     * which keeps the steps within a few µs of their deadlines at the cost of a busy undervolting CPU. Default is 0.
+     * 
+     */
+    int spin_us;
+    /**
+     * @brief Software. How close (in mV) the core voltage read back from msr 0x198 must stay to its target to count as settled. Default is 3.
+     * 
+     */
+    int settle_tolerance_mv;
+    /**
+     * @brief Software. Longest wait for the voltage to settle after plundervolt_reset_voltage() restores it, in ms. Default is 3000.
+     * 
+     */
+    int settle_timeout_ms;
+    /**
+     * @brief Software. If 1, a step of linear_search lasts until the core voltage has settled at the step's undervoltage,
+     * and at most wait_time (or step_us). If 0, every step lasts the whole time. Default is 0.
+     * 
+     */
+    int settle_steps;
+    /**
+     * @brief Software. If > 0, plundervolt_run() samples voltage, frequency, temperature and package energy of the first CPU
+     * of every undervolted package every telemetry_us µs, on controller_cpu. See plundervolt_telemetry.h. Default is 0.
+     * 
+     */
+    int telemetry_us;
 
     /* Hardware */
 
@@ -190,6 +427,53 @@ typedef struct plundervolt_specification_t {
      * 
      */
     int tries;
+    /**
+     * @brief Hardware. Index of an uploaded glitch profile (see plundervolt_upload_glitch_profiles()) to select before every try,
+     * instead of sending repeat, delay_before_undervolting and the voltages and durations above. -1 sends those fields. Default is -1.
+     * 
+     */
+    int glitch_profile;
+    /**
+     * @brief Hardware. Text or binary protocol, see protocol_type. Default is protocol_text.
+     * 
+     */
+    protocol_type protocol;
+    /**
+     * @brief Hardware. Called with every text response read from Teensy (after a configuration line or an arm), from the
+     * thread which talks to Teensy (the I/O thread with pipeline). The library prints nothing itself. Optional. Default is NULL.
+     * 
+     */
+    void (* teensy_response)(const char* response);
+    /**
+     * @brief Hardware. If 1, configure (or select) and arm the glitch of the next try on the I/O thread as soon as the user's function
+     * returns, so the wait after arming overlaps the wait after the function. Each still lasts wait_time from its own event.
+     * If 0, every step follows the one before. Default is 0.
+     * 
+     */
+    int pipeline;
+    /**
+     * @brief Hardware. When to stop trying before tries, see stop_rule_type. A try counts as faulty if a fault was reported
+     * during it (or, with fork_server, its trial crashed or hung). The estimate is read with plundervolt_get_estimate(). Default is stop_fixed.
+     * 
+     */
+    stop_rule_type stop_rule;
+    /**
+     * @brief Hardware. With stop_rule, tries before the run may stop. Default is 1.
+     * 
+     */
+    int min_tries;
+    /**
+     * @brief Hardware. With stop_rule, the fault rates below which a point is clean and above which it is faulty. 0 < stop_low < stop_high < 1.
+     * Default is 0.05 and 0.5.
+     * 
+     */
+    double stop_low;
+    double stop_high;
+    /**
+     * @brief Hardware. With stop_rule, how sure a verdict must be (coverage of the Wilson interval, 1 - the error rates of the test). Default is 0.95.
+     * 
+     */
+    double stop_confidence;
 } plundervolt_specification_t;
 
 /**
@@ -199,17 +483,150 @@ typedef struct plundervolt_specification_t {
  */
 plundervolt_error_t plundervolt_faulty_undervolting_specification();
 
+/**
+ * @brief State shared by the undervolting thread and the user's threads during plundervolt_run().
+ * Every field sits on its own cache line. Use the accessors (plundervolt_loop_is_running() etc.), not the fields.
+ * 
+ */
+typedef struct plundervolt_run_state_t {
+    /**
+     * @brief 1 once plundervolt_set_loop_finished() was called.
+     */
+    _Alignas(PLUNDERVOLT_CACHE_LINE) atomic_int loop_finished;
+    /**
+     * @brief Software. Undervoltage currently set, in mV.
+     */
+    _Alignas(PLUNDERVOLT_CACHE_LINE) _Atomic uint64_t current_undervoltage;
+    /**
+     * @brief Faults reported with plundervolt_report_fault() or plundervolt_push_fault() since the start of the run.
+     */
+    _Alignas(PLUNDERVOLT_CACHE_LINE) _Atomic uint64_t fault_count;
+} plundervolt_run_state_t;
+
+/**
+ * @brief The library's run state. Private; it is only declared here so the accessors can be inlined.
+ */
+extern plundervolt_run_state_t plundervolt_run_state;
+
 /**
  * @brief This function stops the undervolting loop in all threads.
+ * The undervolting thread is woken up straight away (it does not finish its wait_time first) and restores the voltage.
  */
 void plundervolt_set_loop_finished();
 
 /**
- * @brief Returns the state of loops in the library based on the private global variable loop_finished (0 if plundervolt_set_loop_finished() was called).
+ * @brief Block until plundervolt_set_loop_finished() is called, or until the timeout runs out.
+ * Lets the user's threads sleep on the same signal the undervolting thread waits on, instead of polling.
+ * 
+ * @param timeout_ms How long to wait at most, in ms. Negative means no limit.
+ * @return int 1 if the loops are finished, 0 if the timeout ran out first.
+ */
+int plundervolt_wait_loop_finished(int timeout_ms);
+
+/**
+ * @brief Returns the state of loops in the library based on the private variable loop_finished (0 if plundervolt_set_loop_finished() was called).
+ * A single atomic load, so it can be called in the tightest loop.
  * 
  * @return int 0 if no loops are running (e.i., loop_finished is 1), 1 otherwise.
  */
-int plundervolt_loop_is_running();
+PLUNDERVOLT_INLINE int plundervolt_loop_is_running() {
+    return !atomic_load_explicit(&plundervolt_run_state.loop_finished, memory_order_acquire);
+}
+
+/**
+ * @brief Fault record pushed by the user's threads with plundervolt_push_fault(), and read by the controller with plundervolt_pop_fault().
+ * 
+ */
+typedef struct plundervolt_fault_t {
+    /**
+     * @brief Time stamp counter (rdtsc) when the fault was pushed.
+     */
+    uint64_t timestamp;
+    /**
+     * @brief Software. Undervoltage set when the fault was pushed, in mV.
+     */
+    uint64_t undervoltage;
+    /**
+     * @brief The correct result.
+     */
+    uint64_t expected;
+    /**
+     * @brief The faulty result.
+     */
+    uint64_t observed;
+    /**
+     * @brief Logical CPU the pushing thread ran on.
+     */
+    int cpu;
+    /**
+     * @brief Id of the pushing thread, given out in order of the threads' first push.
+     */
+    int thread;
+    /**
+     * @brief plundervolt_kernel_t of the kernel which pushed the fault, or PLUNDERVOLT_FAULT_NO_KERNEL.
+     */
+    int kernel;
+} plundervolt_fault_t;
+
+/**
+ * @brief plundervolt_fault_t.kernel of faults pushed with plundervolt_push_fault().
+ *
+ */
+#define PLUNDERVOLT_FAULT_NO_KERNEL 0xFFFF
+
+/**
+ * @brief Number of fault records the queue holds before plundervolt_push_fault() starts dropping them. A power of 2.
+ * 
+ */
+#define PLUNDERVOLT_FAULT_QUEUE_SIZE 4096
+
+/**
+ * @brief One cell of the fault queue. Private.
+ */
+typedef struct plundervolt_fault_cell_t {
+    atomic_size_t sequence;
+    plundervolt_fault_t fault;
+} plundervolt_fault_cell_t;
+
+/**
+ * @brief Lock-free queue of fault records, with any number of producers and one consumer. Private.
+ */
+typedef struct plundervolt_fault_queue_t {
+    _Alignas(PLUNDERVOLT_CACHE_LINE) atomic_size_t enqueue_position;
+    _Alignas(PLUNDERVOLT_CACHE_LINE) atomic_size_t dequeue_position;
+    _Alignas(PLUNDERVOLT_CACHE_LINE) atomic_uint_fast64_t dropped;
+    _Alignas(PLUNDERVOLT_CACHE_LINE) plundervolt_fault_cell_t cells[PLUNDERVOLT_FAULT_QUEUE_SIZE];
+} plundervolt_fault_queue_t;
+
+/**
+ * @brief Record a fault without locking, allocating or printing, and report it (see plundervolt_report_fault()).
+ * Meant to be called from the user's function instead of printf. Fills in the time stamp, undervoltage, CPU and thread.
+ * 
+ * @param expected The correct result.
+ * @param observed The faulty result.
+ * @return int 1 if the record was queued, 0 if the queue was full and it was dropped (the fault is still counted).
+ */
+int plundervolt_push_fault(uint64_t expected, uint64_t observed);
+
+/**
+ * @brief plundervolt_push_fault() of a kernel of plundervolt_kernels.h, which is kept in the record.
+ *
+ * @param kernel plundervolt_kernel_t of the kernel.
+ */
+int plundervolt_push_kernel_fault(uint64_t expected, uint64_t observed, int kernel);
+
+/**
+ * @brief Take the oldest fault record off the queue. Only one thread (the controller) may call this at a time.
+ * 
+ * @param fault Where to store the record.
+ * @return int 1 if a record was taken, 0 if the queue is empty.
+ */
+int plundervolt_pop_fault(plundervolt_fault_t* fault);
+
+/**
+ * @return uint64_t Number of fault records dropped because the queue was full.
+ */
+uint64_t plundervolt_get_dropped_faults();
 
 /**
  * @brief Create a plundervolt_specification_t structure and fill it with default values.
@@ -268,12 +685,26 @@ const char* plundervolt_error2str(plundervolt_error_t error);
 
 /**
  * @brief Resets the voltage to normal levels. Use if Software undervolting, or using onboard DTR Trigger when Hardware-undervolting.
+ * Software undervolting then waits until the core voltage read back has settled, at most settle_timeout_ms.
  * 
  */
 void plundervolt_reset_voltage();
 
 /**
- * @brief Sets fd, fd_teensy, and fd_trigger. If Software undervolting (u_spec.u_type = software), connect fd to /dev/cpu/0/msr. If Hardware undervolting (u_spec.u_type = hardware), connect fd_teensy to Teensy. If Hardware undervolting and also using Trigger (u_spec.using_dtr = 1), also connect fd_trigger to the onboard DTR trigger.
+ * @brief Make the library access the msr files, Teensy and the trigger through the given backend.
+ * Files opened through the previous backend are closed. Call before plundervolt_run() or plundervolt_open_file().
+ * 
+ * @param new_backend Backend to use, e.g. &plundervolt_memory_backend. NULL restores plundervolt_linux_backend.
+ */
+void plundervolt_set_backend(const plundervolt_backend_t* new_backend);
+
+/**
+ * @return const plundervolt_backend_t* The backend currently in use.
+ */
+const plundervolt_backend_t* plundervolt_get_backend();
+
+/**
+ * @brief Sets the msr files, or the hardware session. If Software undervolting (u_spec.u_type = software), open /dev/cpu/N/msr for the first CPU of every package in u_spec.packages. If Hardware undervolting (u_spec.u_type = hardware), connect to Teensy. If Hardware undervolting and also using Trigger (u_spec.using_dtr = 1), also connect to the onboard DTR trigger. An open session is reused, see plundervolt_init_hardware_undervolting().
  * 
  * @return plundervolt_error_t PLUNDERVOLT_NO_ERROR if connection(s) opened. If not, returns the appropriate error for what happened.
  */
@@ -283,6 +714,41 @@ plundervolt_error_t plundervolt_open_file();
  ************* Software undervolting ************
  ************************************************/
 
+/**
+ * @brief CPU topology of the machine. It is read from sysfs once, the first time it is needed, and never changes afterwards.
+ * Packages are numbered densely from 0, regardless of the physical package ids the kernel reports.
+ * 
+ */
+typedef struct plundervolt_topology_t {
+    /**
+     * @brief Number of logical CPUs.
+     */
+    int cpus;
+    /**
+     * @brief Number of packages (sockets). At most 64, as packages are selected by a bitmask.
+     */
+    int packages;
+    /**
+     * @brief package_of[cpu] is the package the logical CPU belongs to.
+     */
+    int* package_of;
+    /**
+     * @brief core_of[cpu] is the physical core id of the logical CPU. SMT siblings share it (within one package).
+     */
+    int* core_of;
+    /**
+     * @brief package_cpu[package] is the first logical CPU of the package. Package-wide MSRs are accessed through it.
+     */
+    int* package_cpu;
+} plundervolt_topology_t;
+
+/**
+ * @brief Discover the CPU topology (if not done before) and return it.
+ * 
+ * @return const plundervolt_topology_t* The topology. Never NULL; if sysfs cannot be read, every CPU is assumed to be its own core in package 0.
+ */
+const plundervolt_topology_t* plundervolt_get_topology();
+
 /**
  * @brief Compute the value which will be written to cpu/0/msr.
  * 
@@ -293,50 +759,384 @@ plundervolt_error_t plundervolt_open_file();
 uint64_t plundervolt_compute_msr_value(int64_t value, uint64_t plane);
 
 /**
- * @brief Software. Set new undervolting.
+ * @brief Software. Set new undervolting on all packages selected by u_spec.packages.
  * 
  * @param new_voltage Undervolting to set.
  */
 void plundervolt_software_undervolt(uint64_t new_undervoltage);
 
 /**
- * @brief Reads the current voltage if using Software undervolting.
+ * @brief Software. Set new undervolting on the given set of packages at once.
  * 
- * @return double Current voltage as read from fd.
+ * @param new_undervoltage Undervolting to set.
+ * @param packages Bitmask of packages to undervolt (see plundervolt_specification_t.packages).
+ */
+void plundervolt_software_undervolt_packages(uint64_t new_undervoltage, uint64_t packages);
+
+/**
+ * @brief Software. Set new undervolting on the given planes of the given packages.
+ * 
+ * @param new_undervoltage Undervolting to set.
+ * @param planes Bitmask of planes (see PLUNDERVOLT_PLANE_BIT()).
+ * @param packages Bitmask of packages to undervolt (see plundervolt_specification_t.packages).
+ */
+void plundervolt_software_undervolt_planes(uint64_t new_undervoltage, uint32_t planes, uint64_t packages);
+
+/**
+ * @brief Reads the current voltage of the first package selected by u_spec.packages if using Software undervolting.
+ * 
+ * @return double Current voltage as read from the msr file.
  */
 double plundervolt_read_voltage();
 
 /**
- * @brief Set new undervoltage. The parameter should be the result of plundervolt_compute_msr_value().
+ * @brief Reads the current voltage of the given logical CPU.
+ * 
+ * @param cpu Logical CPU to read the voltage of.
+ * @return double Current voltage, or PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if its msr file cannot be opened.
+ */
+double plundervolt_read_voltage_cpu(int cpu);
+
+/**
+ * @brief Compute which CPUs the threads running the function will be pinned to, according to the specification.
+ * 
+ * @param cpus Where to store the CPU of every thread.
+ * @param count Number of threads (usually u_spec.threads).
+ * @return plundervolt_error_t PLUNDERVOLT_PLACEMENT_ERROR if the placement cannot be satisfied, PLUNDERVOLT_NO_ERROR otherwise.
+ */
+plundervolt_error_t plundervolt_get_worker_cpus(int* cpus, int count);
+
+/**
+ * @brief Read an msr of the given logical CPU through the current backend.
+ * 
+ * @param cpu Logical CPU.
+ * @param offset Msr offset, e.g. 0x198.
+ * @param value Where to store the value read.
+ * @return plundervolt_error_t PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if the msr cannot be read, PLUNDERVOLT_NO_ERROR otherwise.
+ */
+plundervolt_error_t plundervolt_msr_read(int cpu, off_t offset, uint64_t* value);
+
+/**
+ * @brief Write an msr of the given logical CPU through the current backend.
+ * 
+ * @param cpu Logical CPU.
+ * @param offset Msr offset, e.g. 0x150.
+ * @param value Value to write.
+ * @return plundervolt_error_t PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if the msr cannot be written, PLUNDERVOLT_NO_ERROR otherwise.
+ */
+plundervolt_error_t plundervolt_msr_write(int cpu, off_t offset, uint64_t value);
+
+/**
+ * @brief Set new undervoltage on all packages selected by u_spec.packages. The parameter should be the result of plundervolt_compute_msr_value().
  * 
  * @param value uint64_t value of the new undervoltage.
  */
 void plundervolt_set_undervolting(uint64_t value);
 
+/**
+ * @brief Set new undervoltage on the given set of packages. The parameter should be the result of plundervolt_compute_msr_value().
+ * 
+ * @param value uint64_t value of the new undervoltage.
+ * @param packages Bitmask of packages to write to.
+ */
+void plundervolt_set_undervolting_packages(uint64_t value, uint64_t packages);
+
+/**
+ * @brief Software. A linear sweep compiled up front: the msr words of every step and plane, and the CPUs to write them through.
+ * Applying a step is then only the msr writes. See plundervolt_compile_ramp().
+ * 
+ */
+typedef struct plundervolt_ramp_t {
+    /**
+     * @brief Number of steps.
+     */
+    int steps;
+    /**
+     * @brief Undervoltage of every step, in mV.
+     */
+    int64_t* undervoltage;
+    /**
+     * @brief Planes every step writes, in increasing order.
+     */
+    int plane_count;
+    int planes[PLUNDERVOLT_PLANES];
+    /**
+     * @brief Msr 0x150 words, plane_count per step, in the order of planes.
+     */
+    uint64_t* words;
+    /**
+     * @brief Time from one step to the next, in ns. Step i is applied period_ns * i after the start, and the last one is held for period_ns.
+     */
+    uint64_t period_ns;
+    /**
+     * @brief Busy-wait before every step, in ns.
+     */
+    uint64_t spin_ns;
+    /**
+     * @brief Packages written, and the first CPU of every one of them.
+     */
+    uint64_t packages;
+    int cpu_count;
+    int* cpus;
+    /**
+     * @brief If > 0, a step ends as soon as the core voltage has settled within settle_tolerance volts of its target (see
+     * plundervolt_wait_voltage_settled()), and at the latest after period_ns. 0 after plundervolt_compile_ramp(): every step lasts period_ns.
+     */
+    double settle_tolerance;
+    /**
+     * @brief Results of the last plundervolt_execute_ramp(): steps applied, how late they were applied after their deadlines,
+     * and the time the steps took to settle (with settle_tolerance), in ns.
+     */
+    int applied;
+    uint64_t max_late_ns;
+    uint64_t total_late_ns;
+    uint64_t total_settle_ns;
+} plundervolt_ramp_t;
+
+/**
+ * @brief Software. Compile the sweep from start to end (both in mV, end included if reached) in steps of step.
+ * 
+ * @param ramp Where to store the ramp. Free it with plundervolt_free_ramp().
+ * @param start First undervoltage.
+ * @param end Last acceptable undervoltage, smaller than start.
+ * @param step How many mV to lower the undervoltage by at every step, at least 1.
+ * @param period_ns Time between steps, in ns.
+ * @param spin_ns Busy-wait before every step, in ns.
+ * @param packages Bitmask of packages to write to.
+ * @param planes Bitmask of planes to write (see PLUNDERVOLT_PLANE_BIT()).
+ * @return plundervolt_error_t PLUNDERVOLT_RANGE_ERROR if the range, step or planes are wrong, PLUNDERVOLT_NO_PACKAGE_ERROR if no package is selected.
+ */
+plundervolt_error_t plundervolt_compile_ramp(plundervolt_ramp_t* ramp, int64_t start, int64_t end, int64_t step,
+    uint64_t period_ns, uint64_t spin_ns, uint64_t packages, uint32_t planes);
+
+/**
+ * @brief Software. Apply the steps of a ramp at absolute CLOCK_MONOTONIC deadlines, so the time the writes take does not add up.
+ * Waits longer than 2 ms end early when the loops finish; shorter ones sleep with clock_nanosleep(TIMER_ABSTIME),
+ * then busy-wait for the last spin_ns. Stops when the loops finish.
+ * Sets the current undervoltage at every step, and the results in the ramp.
+ * 
+ * @param ramp A compiled ramp.
+ * @return plundervolt_error_t PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if an msr write failed.
+ */
+plundervolt_error_t plundervolt_execute_ramp(plundervolt_ramp_t* ramp);
+
+/**
+ * @brief Number of reads in a row which must be within tolerance for the voltage to count as settled.
+ * 
+ */
+#define PLUNDERVOLT_SETTLE_SAMPLES 3
+
+/**
+ * @brief Software. Poll the core voltage of a CPU (msr 0x198) until PLUNDERVOLT_SETTLE_SAMPLES reads in a row are within
+ * tolerance of a target. The target of an undervoltage is the voltage read before undervolting, plus the offset.
+ * 
+ * @param cpu Logical CPU.
+ * @param target Voltage to settle at, in V.
+ * @param tolerance Largest acceptable difference, in V.
+ * @param timeout_ns Longest wait, in ns.
+ * @param settle_ns If not NULL, where to store how long the wait took, in ns.
+ * @return plundervolt_error_t PLUNDERVOLT_SETTLE_TIMEOUT_ERROR if the voltage did not settle in time,
+ * PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if it cannot be read.
+ */
+plundervolt_error_t plundervolt_wait_voltage_settled(int cpu, double target, double tolerance, uint64_t timeout_ns, uint64_t* settle_ns);
+
+/**
+ * @brief Free what plundervolt_compile_ramp() allocated.
+ * 
+ * @param ramp The ramp.
+ */
+void plundervolt_free_ramp(plundervolt_ramp_t* ramp);
+
 /**
  * @return uint64_t Current undervoltage in mV.
  */
-uint64_t plundervolt_get_current_undervoltage();
+PLUNDERVOLT_INLINE uint64_t plundervolt_get_current_undervoltage() {
+    return atomic_load_explicit(&plundervolt_run_state.current_undervoltage, memory_order_relaxed);
+}
+
+/**
+ * @brief Tell the library a fault occured at the current undervoltage. Unlike plundervolt_set_loop_finished(), this does not stop the loops.
+ * With adaptive_search, this is what moves the search. Safe to call from any thread.
+ * 
+ */
+void plundervolt_report_fault();
+
+/**
+ * @return uint64_t Number of faults reported with plundervolt_report_fault() since the last plundervolt_run().
+ */
+PLUNDERVOLT_INLINE uint64_t plundervolt_get_fault_count() {
+    return atomic_load_explicit(&plundervolt_run_state.fault_count, memory_order_acquire);
+}
+
+/**
+ * @brief Result of adaptive_search: the smallest undervoltage (in absolute value) at which a fault was reported.
+ * 
+ * If start_undervoltage already faulted, it is start_undervoltage: faults may start at a smaller undervoltage.
+ * 
+ * @return uint64_t Undervoltage in mV, or 0 if the last search found no fault.
+ */
+uint64_t plundervolt_get_fault_threshold();
 
 /************************************************
  ************* Hardware undervolting ************
  ************************************************/
 
 /**
- * @brief Opens the serial port(s) fd_teensy (and fd_trigger if applicable - see plundervolt_specification_t), throwing the appropriate exceptions.
+ * @brief Connection to Teensy and the trigger, kept open across plundervolt_run() calls.
+ * 
+ */
+typedef struct plundervolt_session_t {
+    /**
+     * @brief Handle of Teensy's serial port. 0 if not open, -1 if opening failed.
+     */
+    int teensy;
+    /**
+     * @brief Handle of the onboard DTR trigger. 0 if not open or not used.
+     */
+    int trigger;
+    /**
+     * @brief Teensy port, trigger port, baudrate, using_dtr and protocol the session was opened with. A run with different ones reopens it.
+     */
+    char* teensy_serial;
+    char* trigger_serial;
+    int teensy_baudrate;
+    int using_dtr;
+    protocol_type protocol;
+    /**
+     * @brief >0 if Teensy agreed to binary frames on this session.
+     */
+    int binary;
+    /**
+     * @brief Sequence number of the last frame sent.
+     */
+    uint8_t sequence;
+    /**
+     * @brief How many times the ports were opened.
+     */
+    uint64_t opens;
+    /**
+     * @brief How many times a dead link was found and the ports reopened.
+     */
+    uint64_t recoveries;
+} plundervolt_session_t;
+
+/**
+ * @brief Most glitch profiles the library keeps, and most voltage segments in one profile.
+ * 
+ */
+#define PLUNDERVOLT_GLITCH_PROFILES 32
+#define PLUNDERVOLT_GLITCH_SEGMENTS 8
+
+/**
+ * @brief A glitch: the voltages Teensy steps through, and how long it holds each.
+ * The text configuration of plundervolt_configure_glitch() is the 3-segment profile start_voltage, undervolting_voltage, end_voltage.
+ * 
+ */
+typedef struct plundervolt_glitch_profile_t {
+    /**
+     * @brief Name, for messages. No spaces.
+     */
+    char name[16];
+    /**
+     * @brief How many times to repeat the glitch, like plundervolt_specification_t.repeat.
+     */
+    int repeat;
+    /**
+     * @brief Delay before the glitch starts, in ms, like plundervolt_specification_t.delay_before_undervolting.
+     */
+    int delay_before_undervolting;
+    /**
+     * @brief Number of segments used, 1 to PLUNDERVOLT_GLITCH_SEGMENTS.
+     */
+    int segments;
+    /**
+     * @brief Voltage of every segment.
+     */
+    float voltage[PLUNDERVOLT_GLITCH_SEGMENTS];
+    /**
+     * @brief How long to hold every segment's voltage, in Teensy's units (like duration_start). Ignored for the last segment.
+     */
+    int duration[PLUNDERVOLT_GLITCH_SEGMENTS];
+} plundervolt_glitch_profile_t;
+
+/**
+ * @brief Make the 3-segment profile plundervolt_configure_glitch() would send for a specification.
+ * 
+ * @param spec The specification.
+ * @param name Name of the profile.
+ * @return plundervolt_glitch_profile_t The profile.
+ */
+plundervolt_glitch_profile_t plundervolt_glitch_profile_from_specification(plundervolt_specification_t spec, const char* name);
+
+/**
+ * @brief Upload a table of glitch profiles to Teensy, once, so every try only selects one by index.
+ * Sends "profiles <count>" first. If Teensy does not answer "ok" (older firmware), the table is kept by the library only, and
+ * selecting a profile sends it as the text configuration instead, which only works for 3-segment profiles.
+ * The table is uploaded again by itself if the session is reopened.
+ * 
+ * @param profiles The profiles. Copied.
+ * @param count How many, at most PLUNDERVOLT_GLITCH_PROFILES.
+ * @return plundervolt_error_t PLUNDERVOLT_GLITCH_PROFILE_ERROR if a profile is malformed, PLUNDERVOLT_WRITE_TO_TEENSY_ERROR if
+ * writing failed, or Teensy took the start of the table but refused (or never acknowledged) one of its profiles.
+ */
+plundervolt_error_t plundervolt_upload_glitch_profiles(const plundervolt_glitch_profile_t* profiles, int count);
+
+/**
+ * @brief Make a profile the active glitch. Sends nothing if it already is; otherwise sends "select <index>", one short round trip.
+ * 
+ * @param index Index in the uploaded table.
+ * @return plundervolt_error_t PLUNDERVOLT_GLITCH_PROFILE_ERROR if there is no such profile, or Teensy refused it.
+ */
+plundervolt_error_t plundervolt_select_glitch_profile(int index);
+
+/**
+ * @return int 1 if Teensy holds the profile table, 0 if the library sends profiles as text configurations.
+ */
+int plundervolt_glitch_profiles_on_teensy();
+
+/**
+ * @brief Opens the serial port(s) of the session (Teensy, and the trigger if applicable - see plundervolt_specification_t), throwing the appropriate exceptions.
+ * If the session is already open with the same ports, baudrate and using_dtr, and Teensy is still connected, nothing is reopened or reconfigured.
+ * plundervolt_run() calls this itself.
  * 
  * @return Error message if initialisation of connection with Teensy failed.
  */
 plundervolt_error_t plundervolt_init_hardware_undervolting();
 
 /**
- * @brief Read response from Teensy and print it out.
+ * @brief Close the session's ports. plundervolt_cleanup() calls this.
+ * 
+ */
+void plundervolt_close_session();
+
+/**
+ * @brief Close and reopen the session's ports, e.g. after Teensy was unplugged. The glitch functions do this themselves when a write fails.
+ * 
+ * @return plundervolt_error_t PLUNDERVOLT_CONNECTION_INIT_ERROR if the ports cannot be reopened.
+ */
+plundervolt_error_t plundervolt_recover_session();
+
+/**
+ * @brief Check, without blocking, that the session is open and Teensy is still connected.
+ * 
+ * @return int 1 if it is, 0 if not.
+ */
+int plundervolt_session_alive();
+
+/**
+ * @return const plundervolt_session_t* The session, e.g. to read how often it was reopened.
+ */
+const plundervolt_session_t* plundervolt_get_session();
+
+/**
+ * @brief Read response from Teensy and pass it to plundervolt_specification_t.teensy_response.
  * 
  */
 void plundervolt_teensy_read_response();
 
 /**
  * @brief Send undervolting configuration to Teensy. This does not arm the glitch. Call "plundervolt_arm_glitch()" after this.
+ * Nothing is sent if Teensy already has exactly this configuration from the previous call on the same session.
  * It uses the following parameters in the user specification:
  * 
  * @param delay_before_undervolting How many miliseconds to wait before the operation is started
@@ -347,7 +1147,8 @@ void plundervolt_teensy_read_response();
  * @param duration_during Delay between undervolting_voltage and end_voltage
  * @param end_voltage Voltage at the end of the operation
  * 
- * @return Error if connection not initialised, PLUNDERVOLT_NO_ERROR if yes.
+ * @return Error if connection not initialised, PLUNDERVOLT_WRITE_TO_TEENSY_ERROR if writing failed or Teensy refused or never
+ * acknowledged the binary configuration, PLUNDERVOLT_NO_ERROR if it has it.
  */
 plundervolt_error_t plundervolt_configure_glitch();
 
@@ -356,7 +1157,8 @@ plundervolt_error_t plundervolt_configure_glitch();
  * This function prepares the glitch in the Teensy system to be used.
  * Use before plundervolt_fire_glitch().
  * 
- * @return Error if connection not initialised, PLUNDERVOLT_NO_ERROR if yes.
+ * @return Error if connection not initialised, PLUNDERVOLT_WRITE_TO_TEENSY_ERROR if writing failed or Teensy refused or never
+ * acknowledged the binary arm, PLUNDERVOLT_NO_ERROR if yes.
  */
 plundervolt_error_t plundervolt_arm_glitch();
 
@@ -367,4 +1169,117 @@ plundervolt_error_t plundervolt_arm_glitch();
  * @return Error if writing to Teensy failed.
  */
 plundervolt_error_t plundervolt_fire_glitch();
+
+/**
+ * @brief What a plundervolt_request_t asks the I/O thread to do.
+ * 
+ */
+typedef enum {
+    PLUNDERVOLT_REQUEST_CONFIGURE = 0, // Send profile as the configuration, like plundervolt_configure_glitch().
+    PLUNDERVOLT_REQUEST_SELECT = 1, // plundervolt_select_glitch_profile(index).
+    PLUNDERVOLT_REQUEST_ARM = 2, // plundervolt_arm_glitch().
+    PLUNDERVOLT_REQUEST_FIRE = 3 // plundervolt_fire_glitch().
+} plundervolt_request_kind_t;
+
+/**
+ * @brief A Teensy command run by the I/O thread, and its completion. The caller owns it; it must stay valid, and not be
+ * submitted again, until it is done.
+ * 
+ */
+typedef struct plundervolt_request_t {
+    /**
+     * @brief What to do.
+     */
+    plundervolt_request_kind_t kind;
+    /**
+     * @brief The configuration, for PLUNDERVOLT_REQUEST_CONFIGURE.
+     */
+    plundervolt_glitch_profile_t profile;
+    /**
+     * @brief Profile index, for PLUNDERVOLT_REQUEST_SELECT.
+     */
+    int index;
+    /**
+     * @brief If not NULL, called on the I/O thread when the command has run, just before the request is marked done.
+     */
+    void (* callback)(struct plundervolt_request_t* request, void* arguments);
+    void* callback_arguments;
+    /**
+     * @brief Result of the command, once done.
+     */
+    plundervolt_error_t error;
+    /**
+     * @brief CLOCK_MONOTONIC times of the submission and of the completion, in ns.
+     */
+    uint64_t submitted;
+    uint64_t completed;
+    /**
+     * @brief 1 once the command has run. Set by the I/O thread.
+     */
+    atomic_int done;
+    /**
+     * @brief Next request in the I/O thread's queue. Private.
+     */
+    struct plundervolt_request_t* next;
+} plundervolt_request_t;
+
+/**
+ * @brief Queue a request for the I/O thread, which runs the Teensy commands one after another in submission order.
+ * The thread is started by the first request, and stopped by plundervolt_cleanup().
+ * Do not call the blocking glitch functions while requests are pending; both talk to Teensy.
+ * 
+ * @param request The request. kind (and profile or index) must be filled in; callback may be.
+ * @return plundervolt_error_t PLUNDERVOLT_GENERIC_ERROR if the I/O thread cannot be started.
+ */
+plundervolt_error_t plundervolt_submit_request(plundervolt_request_t* request);
+
+/**
+ * @brief Queue plundervolt_configure_glitch() with the configuration the specification has now.
+ * 
+ * @param request Request to fill in and submit. Its callback is kept.
+ * @return plundervolt_error_t As plundervolt_submit_request().
+ */
+plundervolt_error_t plundervolt_configure_glitch_async(plundervolt_request_t* request);
+
+/**
+ * @brief Queue plundervolt_select_glitch_profile().
+ * 
+ * @param request Request to fill in and submit. Its callback is kept.
+ * @param index Index in the uploaded table.
+ * @return plundervolt_error_t As plundervolt_submit_request().
+ */
+plundervolt_error_t plundervolt_select_glitch_profile_async(plundervolt_request_t* request, int index);
+
+/**
+ * @brief Queue plundervolt_arm_glitch().
+ * 
+ * @param request Request to fill in and submit. Its callback is kept.
+ * @return plundervolt_error_t As plundervolt_submit_request().
+ */
+plundervolt_error_t plundervolt_arm_glitch_async(plundervolt_request_t* request);
+
+/**
+ * @brief Queue plundervolt_fire_glitch().
+ * 
+ * @param request Request to fill in and submit. Its callback is kept.
+ * @return plundervolt_error_t As plundervolt_submit_request().
+ */
+plundervolt_error_t plundervolt_fire_glitch_async(plundervolt_request_t* request);
+
+/**
+ * @brief Wait until a submitted request is done.
+ * 
+ * @param request The request.
+ * @param timeout_ms Longest wait, in ms. Negative means no limit.
+ * @return plundervolt_error_t The request's error, or PLUNDERVOLT_REQUEST_PENDING_ERROR if it is not done in time.
+ */
+plundervolt_error_t plundervolt_wait_request(plundervolt_request_t* request, int timeout_ms);
+
+/**
+ * @param request A submitted request.
+ * @return int 1 if it is done, 0 if not.
+ */
+PLUNDERVOLT_INLINE int plundervolt_request_done(plundervolt_request_t* request) {
+    return atomic_load_explicit(&request->done, memory_order_acquire);
+}
 #endif /* PLUNDERVOLT_H */
\ No newline at end of file
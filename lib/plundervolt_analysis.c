@@ -0,0 +1,350 @@
+/**
+ * @file plundervolt_analysis.c
+ * @brief Bit-level classification and aggregation of faults.
+ *
+ */
+
+/* Compiled with optimisation (see Makefile). The AVX2 code is compiled for it with target attributes, and only called
+if the CPU supports it. */
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plundervolt_analysis.h"
+
+/**
+ * @brief Add pairs to an aggregate, one word at a time.
+ *
+ */
+void analysis_add_scalar(plundervolt_bit_stats_t* stats, const uint64_t* expected, const uint64_t* observed, size_t n);
+/**
+ * @brief Add pairs to an aggregate, four words at a time. Needs AVX2.
+ *
+ */
+void analysis_add_avx2(plundervolt_bit_stats_t* stats, const uint64_t* expected, const uint64_t* observed, size_t n);
+/**
+ * @return uint64_t Hash of a cluster's key.
+ */
+uint64_t analysis_hash(int kernel, int64_t undervoltage, int64_t voltage);
+/**
+ * @return int64_t A voltage as the key of a cluster holds it, in 0.1 mV.
+ */
+int64_t analysis_voltage_key(double voltage);
+/**
+ * @brief Slot of the index holding a cluster's key, or the free slot where it would go.
+ *
+ */
+uint64_t* analysis_slot(const plundervolt_fault_analysis_t* analysis, int kernel, int64_t undervoltage, int64_t voltage);
+/**
+ * @brief The cluster of a key, made if there is none.
+ *
+ */
+plundervolt_fault_cluster_t* analysis_cluster(plundervolt_fault_analysis_t* analysis, int kernel, int64_t undervoltage, double voltage);
+/**
+ * @brief Rebuild the index, e.g. after the clusters were reordered or the index grown.
+ *
+ */
+void analysis_reindex(plundervolt_fault_analysis_t* analysis);
+/**
+ * @brief Order of clusters for qsort(): by kernel, then from the highest voltage down.
+ *
+ */
+int analysis_compare(const void* a, const void* b);
+
+int analysis_simd = -1; // 1 if plundervolt_bit_stats_add() uses AVX2. -1 until decided.
+
+void plundervolt_bit_stats_init(plundervolt_bit_stats_t* stats) {
+    memset(stats, 0, sizeof *stats);
+    stats->every_mask = ~0ull;
+}
+
+int plundervolt_analysis_use_simd(int simd) {
+    __builtin_cpu_init();
+    analysis_simd = simd && __builtin_cpu_supports("avx2");
+    return analysis_simd;
+}
+
+void plundervolt_bit_stats_add(plundervolt_bit_stats_t* stats, const uint64_t* expected, const uint64_t* observed, size_t n) {
+    if (analysis_simd == -1) {
+        plundervolt_analysis_use_simd(1);
+    }
+    if (analysis_simd) {
+        analysis_add_avx2(stats, expected, observed, n);
+    } else {
+        analysis_add_scalar(stats, expected, observed, n);
+    }
+}
+
+void analysis_add_scalar(plundervolt_bit_stats_t* stats, const uint64_t* expected, const uint64_t* observed, size_t n) {
+    stats->pairs += n;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t mask = expected[i] ^ observed[i];
+        int weight = __builtin_popcountll(mask);
+        stats->weight[weight]++;
+        if (mask == 0) {
+            continue;
+        }
+        stats->faults++;
+        stats->flipped_bits += weight;
+        stats->set_bits += __builtin_popcountll(mask & observed[i]);
+        stats->any_mask |= mask;
+        stats->every_mask &= mask;
+        for (uint64_t bits = mask; bits; bits &= bits - 1) {
+            stats->bit[__builtin_ctzll(bits)]++;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void analysis_add_avx2(plundervolt_bit_stats_t* stats, const uint64_t* expected, const uint64_t* observed, size_t n) {
+    // Popcount of every byte from its two nibbles, summed per word by vpsadbw.
+    const __m256i nibble_count = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    // Byte i of a counter register counts bit i (or 32 + i): spread byte i / 8 of the mask over byte i, then test bit i % 8.
+    const __m256i spread_low = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i spread_high = _mm256_add_epi8(spread_low, _mm256_set1_epi8(4));
+    const __m256i select = _mm256_set1_epi64x(0x8040201008040201ull);
+    __m256i any = zero;
+    __m256i every = _mm256_set1_epi64x(-1);
+    __m256i flipped = zero; // Per word lane, sums of the popcounts.
+    __m256i set = zero;
+    __m256i counter_low = zero; // Byte counters of bits 0 to 31 and 32 to 63, flushed before they overflow.
+    __m256i counter_high = zero;
+    int counted = 0; // Masks in the byte counters.
+    uint8_t counts[64];
+
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i e = _mm256_loadu_si256((const __m256i*)(expected + i));
+        __m256i o = _mm256_loadu_si256((const __m256i*)(observed + i));
+        __m256i mask = _mm256_xor_si256(e, o);
+        __m256i clean = _mm256_cmpeq_epi64(mask, zero);
+        if (_mm256_movemask_epi8(clean) == -1) {
+            stats->weight[0] += 4; // No fault among the four: nothing else to count.
+            continue;
+        }
+        __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(nibble_count, _mm256_and_si256(mask, low_nibble)),
+            _mm256_shuffle_epi8(nibble_count, _mm256_and_si256(_mm256_srli_epi16(mask, 4), low_nibble)));
+        __m256i weights = _mm256_sad_epu8(bytes, zero);
+        __m256i set_mask = _mm256_and_si256(mask, o);
+        __m256i set_bytes = _mm256_add_epi8(_mm256_shuffle_epi8(nibble_count, _mm256_and_si256(set_mask, low_nibble)),
+            _mm256_shuffle_epi8(nibble_count, _mm256_and_si256(_mm256_srli_epi16(set_mask, 4), low_nibble)));
+        flipped = _mm256_add_epi64(flipped, weights);
+        set = _mm256_add_epi64(set, _mm256_sad_epu8(set_bytes, zero));
+        any = _mm256_or_si256(any, mask);
+        every = _mm256_and_si256(every, _mm256_or_si256(mask, clean));
+
+        uint64_t lane_weight[4], lane_mask[4];
+        _mm256_storeu_si256((__m256i*) lane_weight, weights);
+        _mm256_storeu_si256((__m256i*) lane_mask, mask);
+        for (int lane = 0; lane < 4; lane++) {
+            stats->weight[lane_weight[lane]]++;
+            if (lane_mask[lane] == 0) {
+                continue;
+            }
+            stats->faults++;
+            __m256i word = _mm256_set1_epi64x(lane_mask[lane]);
+            __m256i low = _mm256_and_si256(_mm256_shuffle_epi8(word, spread_low), select);
+            __m256i high = _mm256_and_si256(_mm256_shuffle_epi8(word, spread_high), select);
+            counter_low = _mm256_sub_epi8(counter_low, _mm256_cmpeq_epi8(low, select)); // -(-1): one more.
+            counter_high = _mm256_sub_epi8(counter_high, _mm256_cmpeq_epi8(high, select));
+            if (++counted == 255) {
+                _mm256_storeu_si256((__m256i*) counts, counter_low);
+                _mm256_storeu_si256((__m256i*)(counts + 32), counter_high);
+                for (int bit = 0; bit < 64; bit++) {
+                    stats->bit[bit] += counts[bit];
+                }
+                counter_low = zero;
+                counter_high = zero;
+                counted = 0;
+            }
+        }
+    }
+    _mm256_storeu_si256((__m256i*) counts, counter_low);
+    _mm256_storeu_si256((__m256i*)(counts + 32), counter_high);
+    for (int bit = 0; bit < 64; bit++) {
+        stats->bit[bit] += counts[bit];
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*) lanes, flipped);
+    stats->flipped_bits += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i*) lanes, set);
+    stats->set_bits += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i*) lanes, any);
+    stats->any_mask |= lanes[0] | lanes[1] | lanes[2] | lanes[3];
+    _mm256_storeu_si256((__m256i*) lanes, every);
+    stats->every_mask &= lanes[0] & lanes[1] & lanes[2] & lanes[3];
+    stats->pairs += i;
+
+    analysis_add_scalar(stats, expected + i, observed + i, n - i);
+}
+
+void plundervolt_bit_stats_merge(plundervolt_bit_stats_t* into, const plundervolt_bit_stats_t* from) {
+    into->pairs += from->pairs;
+    into->faults += from->faults;
+    into->flipped_bits += from->flipped_bits;
+    into->set_bits += from->set_bits;
+    for (int bit = 0; bit < 64; bit++) {
+        into->bit[bit] += from->bit[bit];
+    }
+    for (int weight = 0; weight <= 64; weight++) {
+        into->weight[weight] += from->weight[weight];
+    }
+    into->any_mask |= from->any_mask;
+    into->every_mask &= from->every_mask;
+}
+
+plundervolt_fault_analysis_t plundervolt_fault_analysis_init() {
+    plundervolt_fault_analysis_t analysis;
+    memset(&analysis, 0, sizeof analysis);
+    plundervolt_bit_stats_init(&analysis.total);
+    return analysis;
+}
+
+void plundervolt_fault_analysis_free(plundervolt_fault_analysis_t* analysis) {
+    free(analysis->clusters);
+    free(analysis->index);
+    analysis->clusters = NULL;
+    analysis->index = NULL;
+    analysis->cluster_count = 0;
+    analysis->cluster_capacity = 0;
+    analysis->index_capacity = 0;
+}
+
+int64_t analysis_voltage_key(double voltage) {
+    return llround(voltage * 10000);
+}
+
+uint64_t analysis_hash(int kernel, int64_t undervoltage, int64_t voltage) {
+    int64_t fields[] = {kernel, undervoltage, voltage};
+    const uint8_t* bytes = (const uint8_t*) fields;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < sizeof fields; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+uint64_t* analysis_slot(const plundervolt_fault_analysis_t* analysis, int kernel, int64_t undervoltage, int64_t voltage) {
+    uint64_t mask = analysis->index_capacity - 1;
+    for (uint64_t slot = analysis_hash(kernel, undervoltage, voltage) & mask;; slot = (slot + 1) & mask) {
+        uint64_t entry = analysis->index[slot];
+        if (entry == 0) {
+            return &analysis->index[slot];
+        }
+        const plundervolt_fault_cluster_t* cluster = &analysis->clusters[entry - 1];
+        if (cluster->kernel == kernel && cluster->undervoltage == undervoltage && analysis_voltage_key(cluster->voltage) == voltage) {
+            return &analysis->index[slot];
+        }
+    }
+}
+
+void analysis_reindex(plundervolt_fault_analysis_t* analysis) {
+    memset(analysis->index, 0, sizeof(uint64_t) * analysis->index_capacity);
+    for (uint64_t i = 0; i < analysis->cluster_count; i++) {
+        const plundervolt_fault_cluster_t* cluster = &analysis->clusters[i];
+        *analysis_slot(analysis, cluster->kernel, cluster->undervoltage, analysis_voltage_key(cluster->voltage)) = i + 1;
+    }
+}
+
+plundervolt_fault_cluster_t* analysis_cluster(plundervolt_fault_analysis_t* analysis, int kernel, int64_t undervoltage, double voltage) {
+    int64_t key = analysis_voltage_key(voltage);
+    if (analysis->index_capacity > 0) {
+        uint64_t entry = *analysis_slot(analysis, kernel, undervoltage, key);
+        if (entry) {
+            return &analysis->clusters[entry - 1];
+        }
+    }
+    if ((analysis->cluster_count + 1) * 2 > analysis->index_capacity) {
+        analysis->index_capacity = analysis->index_capacity ? analysis->index_capacity * 2 : 64;
+        free(analysis->index);
+        analysis->index = malloc(sizeof(uint64_t) * analysis->index_capacity);
+        analysis_reindex(analysis);
+    }
+    if (analysis->cluster_count == analysis->cluster_capacity) {
+        analysis->cluster_capacity = analysis->cluster_capacity ? analysis->cluster_capacity * 2 : 16;
+        analysis->clusters = realloc(analysis->clusters, sizeof(plundervolt_fault_cluster_t) * analysis->cluster_capacity);
+    }
+    plundervolt_fault_cluster_t* cluster = &analysis->clusters[analysis->cluster_count++];
+    cluster->kernel = kernel;
+    cluster->undervoltage = undervoltage;
+    cluster->voltage = key / 10000.0;
+    plundervolt_bit_stats_init(&cluster->stats);
+    *analysis_slot(analysis, kernel, undervoltage, key) = analysis->cluster_count;
+    return cluster;
+}
+
+void plundervolt_fault_analysis_add(plundervolt_fault_analysis_t* analysis, const uint64_t* expected, const uint64_t* observed,
+    size_t n, int kernel, int64_t undervoltage, double voltage) {
+    plundervolt_fault_cluster_t* cluster = analysis_cluster(analysis, kernel, undervoltage, voltage);
+    plundervolt_bit_stats_t batch;
+    plundervolt_bit_stats_init(&batch);
+    plundervolt_bit_stats_add(&batch, expected, observed, n);
+    plundervolt_bit_stats_merge(&cluster->stats, &batch);
+    plundervolt_bit_stats_merge(&analysis->total, &batch);
+}
+
+uint64_t plundervolt_fault_analysis_add_log(plundervolt_fault_analysis_t* analysis, const plundervolt_fault_log_t* log, uint64_t first) {
+    // The records are gathered into arrays, so every batch of the same cluster goes through plundervolt_bit_stats_add() at once.
+    enum { BATCH = 1024 };
+    uint64_t expected[BATCH], observed[BATCH];
+    size_t n = 0;
+    int kernel = 0;
+    int64_t undervoltage = 0;
+    double voltage = 0;
+    uint64_t added = 0;
+    uint64_t count = plundervolt_fault_log_count(log);
+    for (uint64_t index = first; index < count; index++) {
+        const plundervolt_fault_record_t* record = plundervolt_fault_log_record(log, index);
+        if (record == NULL) {
+            continue;
+        }
+        if (n == BATCH || (n > 0 && (record->kernel != kernel || record->undervoltage != undervoltage || record->voltage != voltage))) {
+            plundervolt_fault_analysis_add(analysis, expected, observed, n, kernel, undervoltage, voltage);
+            n = 0;
+        }
+        kernel = record->kernel;
+        undervoltage = record->undervoltage;
+        voltage = record->voltage;
+        expected[n] = record->expected;
+        observed[n] = record->observed;
+        n++;
+        added++;
+    }
+    if (n > 0) {
+        plundervolt_fault_analysis_add(analysis, expected, observed, n, kernel, undervoltage, voltage);
+    }
+    return added;
+}
+
+int analysis_compare(const void* a, const void* b) {
+    const plundervolt_fault_cluster_t* x = (const plundervolt_fault_cluster_t*) a;
+    const plundervolt_fault_cluster_t* y = (const plundervolt_fault_cluster_t*) b;
+    if (x->kernel != y->kernel) {
+        return x->kernel < y->kernel ? -1 : 1;
+    }
+    if (x->voltage != y->voltage) {
+        return x->voltage > y->voltage ? -1 : 1;
+    }
+    return (x->undervoltage < y->undervoltage) - (x->undervoltage > y->undervoltage);
+}
+
+void plundervolt_fault_analysis_sort(plundervolt_fault_analysis_t* analysis) {
+    qsort(analysis->clusters, analysis->cluster_count, sizeof(plundervolt_fault_cluster_t), analysis_compare);
+    if (analysis->index_capacity > 0) {
+        analysis_reindex(analysis);
+    }
+}
+
+const plundervolt_fault_cluster_t* plundervolt_fault_analysis_find(const plundervolt_fault_analysis_t* analysis, int kernel,
+    int64_t undervoltage, double voltage) {
+    if (analysis->index_capacity == 0) {
+        return NULL;
+    }
+    uint64_t entry = *analysis_slot(analysis, kernel, undervoltage, analysis_voltage_key(voltage));
+    return entry ? &analysis->clusters[entry - 1] : NULL;
+}
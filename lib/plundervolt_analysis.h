@@ -0,0 +1,177 @@
+/**
+ * @file plundervolt_analysis.h
+ * @brief Bit-level classification and aggregation of faults: which bits flip, how many, in which direction, at which
+ * voltage and in which kernel.
+ *
+ * A fault is a pair of 64-bit words, the expected result and the observed one; their XOR is the mask of flipped bits.
+ * plundervolt_bit_stats_t aggregates pairs: the number of faulty ones, a histogram of the flips over the 64 bit
+ * positions, a histogram of the Hamming weights of the masks, the flips from 0 to 1 and from 1 to 0, and the bits which
+ * flipped in any fault and in every fault. plundervolt_fault_analysis_t keeps one of them for all pairs and one for every
+ * cluster of pairs with the same kernel and voltage, from arrays in memory or from a fault log (see
+ * plundervolt_fault_log.h).
+ *
+ * Pairs are processed in batches by AVX2 code where the CPU has it: XOR, compare against zero, popcount by nibble lookup,
+ * and the position histogram by expanding every mask to 64 byte counters. Elsewhere, scalar code gives the same results.
+ *
+ */
+/* plundervolt_analysis.h */
+
+#ifndef PLUNDERVOLT_ANALYSIS_H
+#define PLUNDERVOLT_ANALYSIS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "plundervolt.h"
+#include "plundervolt_fault_log.h"
+
+/**
+ * @brief Aggregate of pairs of expected and observed words.
+ *
+ */
+typedef struct plundervolt_bit_stats_t {
+    /**
+     * @brief Pairs added, and those of them which differ.
+     */
+    uint64_t pairs;
+    uint64_t faults;
+    /**
+     * @brief Flipped bits in all pairs (the sum of the Hamming weights), of them the ones which flipped from 0 to 1.
+     * The others flipped from 1 to 0.
+     */
+    uint64_t flipped_bits;
+    uint64_t set_bits;
+    /**
+     * @brief Flips of every bit position, 0 the least significant.
+     */
+    uint64_t bit[64];
+    /**
+     * @brief Pairs by the Hamming weight of their mask; weight[0] counts the pairs which do not differ.
+     */
+    uint64_t weight[65];
+    /**
+     * @brief Bits which flipped in any faulty pair, and in every faulty pair (all ones before the first fault).
+     */
+    uint64_t any_mask;
+    uint64_t every_mask;
+} plundervolt_bit_stats_t;
+
+/**
+ * @brief Faults with the same kernel and voltage.
+ *
+ */
+typedef struct plundervolt_fault_cluster_t {
+    /**
+     * @brief plundervolt_kernel_t, or PLUNDERVOLT_FAULT_NO_KERNEL.
+     */
+    int kernel;
+    /**
+     * @brief Software: the undervoltage, in mV, and voltage 0. Hardware: the voltage, in V (to 0.1 mV).
+     */
+    int64_t undervoltage;
+    double voltage;
+    plundervolt_bit_stats_t stats;
+} plundervolt_fault_cluster_t;
+
+/**
+ * @brief An analysis. Made by plundervolt_fault_analysis_init(), freed by plundervolt_fault_analysis_free().
+ *
+ */
+typedef struct plundervolt_fault_analysis_t {
+    /**
+     * @brief All pairs added.
+     */
+    plundervolt_bit_stats_t total;
+    /**
+     * @brief Clusters, in the order their first pair was added. See plundervolt_fault_analysis_sort().
+     */
+    plundervolt_fault_cluster_t* clusters;
+    uint64_t cluster_count;
+    uint64_t cluster_capacity;
+    /**
+     * @brief Open-addressing hash table of the clusters: index + 1 of a cluster, 0 for a free slot. index_capacity
+     * is a power of 2. Private.
+     */
+    uint64_t* index;
+    uint64_t index_capacity;
+} plundervolt_fault_analysis_t;
+
+/**
+ * @brief Clear an aggregate.
+ *
+ */
+void plundervolt_bit_stats_init(plundervolt_bit_stats_t* stats);
+
+/**
+ * @brief Add pairs to an aggregate, with AVX2 if the CPU has it (see plundervolt_analysis_use_simd()).
+ *
+ * @param stats The aggregate.
+ * @param expected The correct words.
+ * @param observed The words observed, n of each.
+ * @param n Number of pairs.
+ */
+void plundervolt_bit_stats_add(plundervolt_bit_stats_t* stats, const uint64_t* expected, const uint64_t* observed, size_t n);
+
+/**
+ * @brief Add one aggregate to another.
+ *
+ */
+void plundervolt_bit_stats_merge(plundervolt_bit_stats_t* into, const plundervolt_bit_stats_t* from);
+
+/**
+ * @brief Choose the code plundervolt_bit_stats_add() uses, e.g. to compare them.
+ *
+ * @param simd 1 for AVX2 if the CPU has it, 0 for scalar.
+ * @return int 1 if AVX2 is used from now on.
+ */
+int plundervolt_analysis_use_simd(int simd);
+
+/**
+ * @brief Make an empty analysis.
+ *
+ * @return plundervolt_fault_analysis_t The analysis.
+ */
+plundervolt_fault_analysis_t plundervolt_fault_analysis_init();
+
+/**
+ * @brief Free the clusters of an analysis.
+ *
+ */
+void plundervolt_fault_analysis_free(plundervolt_fault_analysis_t* analysis);
+
+/**
+ * @brief Add pairs of the same kernel and voltage.
+ *
+ * @param analysis The analysis.
+ * @param expected The correct words.
+ * @param observed The words observed, n of each.
+ * @param n Number of pairs.
+ * @param kernel plundervolt_kernel_t, or PLUNDERVOLT_FAULT_NO_KERNEL.
+ * @param undervoltage Software. Undervoltage, in mV; 0 for hardware.
+ * @param voltage Hardware. Voltage, in V; 0 for software.
+ */
+void plundervolt_fault_analysis_add(plundervolt_fault_analysis_t* analysis, const uint64_t* expected, const uint64_t* observed,
+    size_t n, int kernel, int64_t undervoltage, double voltage);
+
+/**
+ * @brief Add every record of a fault log from first on. Records in a row with the same kernel and voltage are added
+ * as one batch.
+ *
+ * @return uint64_t Records added.
+ */
+uint64_t plundervolt_fault_analysis_add_log(plundervolt_fault_analysis_t* analysis, const plundervolt_fault_log_t* log, uint64_t first);
+
+/**
+ * @brief Sort the clusters by kernel, then from the highest voltage (shallowest undervoltage) down.
+ *
+ */
+void plundervolt_fault_analysis_sort(plundervolt_fault_analysis_t* analysis);
+
+/**
+ * @brief Cluster of a kernel and voltage.
+ *
+ * @return const plundervolt_fault_cluster_t* The cluster, or NULL if no pair of it was added.
+ */
+const plundervolt_fault_cluster_t* plundervolt_fault_analysis_find(const plundervolt_fault_analysis_t* analysis, int kernel,
+    int64_t undervoltage, double voltage);
+
+#endif /* PLUNDERVOLT_ANALYSIS_H */
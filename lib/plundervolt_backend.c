@@ -0,0 +1,531 @@
+/**
+ * @file plundervolt_backend.c
+ * @brief I/O backends of the undervolting library.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/serial.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "arduino/arduino-serial-lib.h"
+#include "plundervolt_backend.h"
+#include "plundervolt_instrument.h"
+#include "plundervolt_protocol.h"
+
+#define MEMORY_MSRS 4096 // Number of distinct (cpu, offset) pairs the memory backend can hold.
+#define MEMORY_SERIALS 8 // Number of serial ports the memory backend can have open at once.
+#define MEMORY_RESPONSE_MAX 4096 // Bytes of pending responses per memory serial port.
+#define MEMORY_NOMINAL_VOLTAGE 1.0 // Voltage the memory backend reports at no undervolting.
+#define MEMORY_SETTLE_NS 250000 // Time the modelled voltage regulator takes to move to a new voltage.
+
+/************************************************
+ ****************** Linux backend ***************
+ ************************************************/
+
+int linux_msr_open(int cpu) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof path, "/dev/cpu/%d/msr", cpu);
+    return open(path, O_RDWR);
+}
+
+int linux_msr_read(int handle, off_t offset, uint64_t* value) {
+    return pread(handle, value, sizeof *value, offset) == sizeof *value ? 0 : -1;
+}
+
+int linux_msr_write(int handle, off_t offset, uint64_t value) {
+    return pwrite(handle, &value, sizeof value, offset) == sizeof value ? 0 : -1;
+}
+
+int linux_close(int handle) {
+    return close(handle);
+}
+
+int linux_serial_write(int handle, const char* buf, size_t len) {
+    return write(handle, buf, len) == (ssize_t) len ? 0 : -1;
+}
+
+int linux_serial_alive(int handle) {
+    // Hang-ups and errors are reported even when no event is asked for.
+    struct pollfd p = {.fd = handle, .events = 0};
+    if (poll(&p, 1, 0) == -1) {
+        return 0;
+    }
+    return !(p.revents & (POLLHUP | POLLERR | POLLNVAL));
+}
+
+int linux_trigger_open(const char* port) {
+    int fd_trigger = open(port, O_RDWR | O_NOCTTY);
+    if(fd_trigger == -1) {
+        return -1;
+    }
+
+    // Create new termios struc, we call it 'tty' for convention
+    struct termios tty;
+    memset(&tty, 0, sizeof tty);
+
+    // Read in existing settings, and handle any error
+    if(tcgetattr(fd_trigger, &tty) != 0) {
+    }
+
+    tty.c_cflag &= ~PARENB; // Clear parity bit, disabling parity (most common)
+    tty.c_cflag &= ~CSTOPB; // Clear stop field, only one stop bit used in communication (most common)
+    tty.c_cflag |= CS8; // 8 bits per byte (most common)
+    tty.c_cflag &= CRTSCTS; // Disable RTS/CTS hardware flow control (most common)
+    tty.c_cflag |= CREAD | CLOCAL; // Turn on READ & ignore ctrl lines (CLOCAL = 1)
+
+    tty.c_lflag &= ~ICANON;
+    tty.c_lflag &= ~ECHO; // Disable echo
+    tty.c_lflag &= ~ECHOE; // Disable erasure
+    tty.c_lflag &= ~ECHONL; // Disable new-line echo
+    tty.c_lflag &= ~ISIG; // Disable interpretation of INTR, QUIT and SUSP
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // Turn off s/w flow ctrl
+    tty.c_iflag &= ~(IGNBRK|BRKINT|PARMRK|ISTRIP|INLCR|IGNCR|ICRNL); // Disable any special handling of received bytes
+
+    tty.c_oflag &= ~OPOST; // Prevent special interpretation of output bytes (e.g. newline chars)
+    tty.c_oflag &= ~ONLCR; // Prevent conversion of newline to carriage return/line feed
+    //tty.c_oflag &= ~OXTABS; // Prevent conversion of tabs to spaces (NOT PRESENT ON LINUX)
+    //tty.c_oflag &= ~ONOEOT; // Prevent removal of C-d chars (0x004) in output (NOT PRESENT ON LINUX)
+
+    tty.c_cc[VTIME] = 0;    // Wait for up to 1s (10 deciseconds), returning as soon as any data is received.
+    tty.c_cc[VMIN] = 0;
+
+    // Set in/out baud rate to be 9600
+    cfsetispeed(&tty, B38400);
+    cfsetospeed(&tty, B38400);
+
+
+    struct serial_struct kernel_serial_settings;
+    int r = ioctl(fd_trigger, TIOCGSERIAL, &kernel_serial_settings);
+    if (r >= 0) {
+        kernel_serial_settings.flags |= ASYNC_LOW_LATENCY;
+        r = ioctl(fd_trigger, TIOCSSERIAL, &kernel_serial_settings);
+    }
+
+    tcsetattr(fd_trigger, TCSANOW, &tty);
+    if( tcsetattr(fd_trigger, TCSAFLUSH, &tty) < 0) {
+        perror("init_serialport: Couldn't set term attributes");
+        close(fd_trigger);
+        return -1;
+    }
+    return fd_trigger;
+}
+
+int linux_trigger_set(int handle, int level) {
+    int DTR_flag = TIOCM_DTR;
+    return ioctl(handle, level ? TIOCMBIS : TIOCMBIC, &DTR_flag) == -1 ? -1 : 0;
+}
+
+const plundervolt_backend_t plundervolt_linux_backend = {
+    .name = "linux",
+    .msr_open = linux_msr_open,
+    .msr_read = linux_msr_read,
+    .msr_write = linux_msr_write,
+    .msr_close = linux_close,
+    .serial_open = serialport_init,
+    .serial_write = linux_serial_write,
+    .serial_read_lines = serialport_read_lines,
+    .serial_read = serialport_read_bytes,
+    .serial_alive = linux_serial_alive,
+    .serial_flush = serialport_flush,
+    .serial_close = serialport_close,
+    .trigger_open = linux_trigger_open,
+    .trigger_set = linux_trigger_set,
+    .trigger_close = linux_close
+};
+
+/************************************************
+ ****************** Memory backend **************
+ ************************************************/
+
+/**
+ * @brief One msr held by the memory backend.
+ *
+ */
+typedef struct memory_msr_t {
+    int cpu;
+    off_t offset;
+    uint64_t value;
+    double from; // 0x198 only: the readback moves linearly from from to to in MEMORY_SETTLE_NS after since.
+    double to;
+    uint64_t since;
+} memory_msr_t;
+
+/**
+ * @brief One serial port of the memory backend, with the responses not read yet.
+ *
+ */
+typedef struct memory_serial_t {
+    int open;
+    int hung_up; // Set by plundervolt_memory_backend_hang_up().
+    char pending[MEMORY_RESPONSE_MAX]; // Responses not read yet.
+    int pending_length;
+    char line[BUFSIZ]; // Line being written, until its EOL arrives.
+    int line_length;
+} memory_serial_t;
+
+plundervolt_backend_record_t memory_records[PLUNDERVOLT_MEMORY_BACKEND_RECORDS];
+uint64_t memory_record_count = 0; // Incremented atomically, as msr and serial writes may come from different threads.
+memory_msr_t memory_msrs[MEMORY_MSRS];
+int memory_msr_count = 0;
+memory_serial_t memory_serials[MEMORY_SERIALS];
+pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER; // Protects memory_msrs and memory_serials.
+
+/**
+ * @brief Append a record of a write.
+ *
+ * @return plundervolt_backend_record_t* The record to fill in. Its timestamp and kind are already set.
+ */
+plundervolt_backend_record_t* memory_record(plundervolt_backend_record_kind_t kind, int target) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    uint64_t index = __atomic_fetch_add(&memory_record_count, 1, __ATOMIC_RELAXED);
+    plundervolt_backend_record_t* record = &memory_records[index % PLUNDERVOLT_MEMORY_BACKEND_RECORDS];
+    memset(record, 0, sizeof *record);
+    record->timestamp = (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+    record->kind = kind;
+    record->target = target;
+    return record;
+}
+
+/**
+ * @brief Find the slot holding an msr, creating it if asked to.
+ *
+ * @return memory_msr_t* The slot, or NULL if it does not exist (or there is no room for it). Call with memory_lock held.
+ */
+memory_msr_t* memory_find_msr(int cpu, off_t offset, int create) {
+    for (int i = 0; i < memory_msr_count; i++) {
+        if (memory_msrs[i].cpu == cpu && memory_msrs[i].offset == offset) {
+            return &memory_msrs[i];
+        }
+    }
+    if (!create || memory_msr_count == MEMORY_MSRS) {
+        return NULL;
+    }
+    memory_msr_t* msr = &memory_msrs[memory_msr_count++];
+    msr->cpu = cpu;
+    msr->offset = offset;
+    msr->value = 0;
+    msr->from = 0;
+    msr->to = 0;
+    msr->since = 0;
+    return msr;
+}
+
+/**
+ * @brief Voltage the modelled regulator is at now.
+ * Call with memory_lock held.
+ */
+double memory_voltage(const memory_msr_t* readback) {
+    uint64_t elapsed = plundervolt_monotonic_ns() - readback->since;
+    if (elapsed >= MEMORY_SETTLE_NS) {
+        return readback->to;
+    }
+    return readback->from + (readback->to - readback->from) * elapsed / MEMORY_SETTLE_NS;
+}
+
+/**
+ * @brief Model the voltage regulator: a write to the core plane (0) through msr 0x150 moves the readback of msr 0x198
+ * to the new voltage over MEMORY_SETTLE_NS. Call with memory_lock held.
+ */
+void memory_apply_plane_write(int cpu, uint64_t value) {
+    int plane = (value >> 40) & 0x7;
+    int write = (value >> 32) & 0x1;
+    if (!write || plane != 0) {
+        return;
+    }
+    // Offset is an 11 bit two's complement number of 1/1024 V units in bits 21 to 31.
+    int64_t units = (value >> 21) & 0x7FF;
+    if (units & 0x400) {
+        units -= 0x800;
+    }
+    double voltage = MEMORY_NOMINAL_VOLTAGE + units / 1024.0;
+    memory_msr_t* readback = memory_find_msr(cpu, 0x198, 0);
+    if (readback == NULL) {
+        readback = memory_find_msr(cpu, 0x198, 1);
+        if (readback == NULL) {
+            return;
+        }
+        readback->to = MEMORY_NOMINAL_VOLTAGE;
+    }
+    readback->from = memory_voltage(readback);
+    readback->to = voltage;
+    readback->since = plundervolt_monotonic_ns();
+}
+
+/**
+ * @brief Value of an msr nothing was written to. The msrs the telemetry sampler reads model a machine at a base ratio of 20,
+ * running at base frequency, 40 degrees below a TjMax of 100, using 1 W per package; all others read 0.
+ */
+uint64_t memory_msr_default(off_t offset) {
+    uint64_t ns = plundervolt_monotonic_ns();
+    switch (offset) {
+        case 0xCE: // MSR_PLATFORM_INFO: base ratio.
+            return 20 << 8;
+        case 0xE7: // MPERF and APERF count at 2 GHz.
+        case 0xE8:
+            return ns * 2;
+        case 0x19C: // IA32_THERM_STATUS: digital readout.
+            return (40 << 16) | (1ull << 31);
+        case 0x1A2: // MSR_TEMPERATURE_TARGET: TjMax.
+            return 100 << 16;
+        case 0x606: // MSR_RAPL_POWER_UNIT: energy in 1/2^14 J.
+            return 0xA0E03;
+        case 0x611: // MSR_PKG_ENERGY_STATUS: 1 W.
+            return (ns * 16384 / 1000000000ull) & 0xFFFFFFFF;
+        default:
+            return 0;
+    }
+}
+
+int memory_msr_open(int cpu) {
+    return cpu + 1; // Handles must be > 0.
+}
+
+int memory_msr_read(int handle, off_t offset, uint64_t* value) {
+    pthread_mutex_lock(&memory_lock);
+    if (offset == 0x198 && memory_find_msr(handle - 1, 0x198, 0) == NULL) {
+        memory_apply_plane_write(handle - 1, 0x8000001100000000); // Nothing written yet: nominal voltage.
+    }
+    memory_msr_t* msr = memory_find_msr(handle - 1, offset, 0);
+    if (msr && offset == 0x198) {
+        msr->value = ((uint64_t)(memory_voltage(msr) * 8192.0) & 0xFFFF) << 32;
+    }
+    *value = msr ? msr->value : memory_msr_default(offset);
+    pthread_mutex_unlock(&memory_lock);
+    return 0;
+}
+
+int memory_msr_write(int handle, off_t offset, uint64_t value) {
+    plundervolt_backend_record_t* record = memory_record(PLUNDERVOLT_RECORD_MSR_WRITE, handle - 1);
+    record->offset = offset;
+    record->value = value;
+
+    pthread_mutex_lock(&memory_lock);
+    memory_msr_t* msr = memory_find_msr(handle - 1, offset, 1);
+    if (msr != NULL) {
+        msr->value = value;
+    }
+    if (offset == 0x150) {
+        memory_apply_plane_write(handle - 1, value);
+    }
+    pthread_mutex_unlock(&memory_lock);
+    return msr ? 0 : -1;
+}
+
+int memory_close(int handle) {
+    return 0;
+}
+
+int memory_serial_open(const char* port, int baud) {
+    pthread_mutex_lock(&memory_lock);
+    int handle = -1;
+    for (int i = 0; i < MEMORY_SERIALS; i++) {
+        if (!memory_serials[i].open) {
+            memset(&memory_serials[i], 0, sizeof memory_serials[i]);
+            memory_serials[i].open = 1;
+            handle = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&memory_lock);
+    return handle;
+}
+
+/**
+ * @brief Acknowledge every frame in buf but fires, as Teensy does. Called with memory_lock held.
+ *
+ */
+void memory_serial_frames(memory_serial_t* serial, const uint8_t* buf, size_t len) {
+    plundervolt_frame_t frame;
+    int used;
+    while (len > 0 && (used = plundervolt_frame_decode(buf, len, &frame)) != 0) {
+        if (used > 0 && frame.type != PLUNDERVOLT_FRAME_FIRE
+            && serial->pending_length + PLUNDERVOLT_FRAME_MAX <= MEMORY_RESPONSE_MAX) {
+            plundervolt_frame_t ack = {.type = PLUNDERVOLT_FRAME_ACK, .sequence = frame.sequence, .length = 0};
+            serial->pending_length += plundervolt_frame_encode(&ack, (uint8_t*) serial->pending + serial->pending_length);
+        }
+        used = used > 0 ? used : -used;
+        buf += used;
+        len -= used;
+    }
+}
+
+int memory_serial_write(int handle, const char* buf, size_t len) {
+    if (handle < 1 || handle > MEMORY_SERIALS) {
+        return -1;
+    }
+    if (__atomic_load_n(&memory_serials[handle - 1].hung_up, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    plundervolt_backend_record_t* record = memory_record(PLUNDERVOLT_RECORD_SERIAL_WRITE, handle);
+    record->offset = len;
+    memcpy(record->data, buf, len < sizeof record->data - 1 ? len : sizeof record->data - 1);
+
+    pthread_mutex_lock(&memory_lock);
+    memory_serial_t* serial = &memory_serials[handle - 1];
+    if (len > 0 && (uint8_t) buf[0] == PLUNDERVOLT_FRAME_START) {
+        memory_serial_frames(serial, (const uint8_t*) buf, len);
+        pthread_mutex_unlock(&memory_lock);
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != '\n') {
+            if (serial->line_length < (int) sizeof serial->line - 1) {
+                serial->line[serial->line_length++] = buf[i];
+            }
+            continue;
+        }
+        // Answer every non-empty line. An empty line fires the glitch, which Teensy does not answer.
+        serial->line[serial->line_length] = 0;
+        if (serial->line_length > 0 && serial->pending_length < MEMORY_RESPONSE_MAX - 1) {
+            int room = MEMORY_RESPONSE_MAX - serial->pending_length;
+            int n = snprintf(serial->pending + serial->pending_length, room, "ok %s\n", serial->line);
+            serial->pending_length += n < room ? n : room - 1;
+        }
+        serial->line_length = 0;
+    }
+    pthread_mutex_unlock(&memory_lock);
+    return 0;
+}
+
+int memory_serial_read_lines(int handle, char* buf, char until, int buf_max, int timeout, int num_lines) {
+    if (handle < 1 || handle > MEMORY_SERIALS) {
+        return -1;
+    }
+    pthread_mutex_lock(&memory_lock);
+    memory_serial_t* serial = &memory_serials[handle - 1];
+    int i = 0;
+    int line_count = 0;
+    while (i < serial->pending_length && i < buf_max - 1 && line_count < num_lines) {
+        buf[i] = serial->pending[i];
+        if (buf[i++] == until) {
+            line_count++;
+        }
+    }
+    buf[i] = 0;
+    memmove(serial->pending, serial->pending + i, serial->pending_length - i);
+    serial->pending_length -= i;
+    pthread_mutex_unlock(&memory_lock);
+    // Nothing more will arrive, so running out of lines is a timeout - but an immediate one.
+    return line_count == num_lines ? 0 : -2;
+}
+
+int memory_serial_read(int handle, char* buf, int buf_max, int timeout) {
+    if (handle < 1 || handle > MEMORY_SERIALS) {
+        return -1;
+    }
+    pthread_mutex_lock(&memory_lock);
+    memory_serial_t* serial = &memory_serials[handle - 1];
+    int n = serial->pending_length < buf_max ? serial->pending_length : buf_max;
+    memcpy(buf, serial->pending, n);
+    memmove(serial->pending, serial->pending + n, serial->pending_length - n);
+    serial->pending_length -= n;
+    pthread_mutex_unlock(&memory_lock);
+    return n; // Nothing more will arrive, so 0 is an immediate timeout.
+}
+
+int memory_serial_alive(int handle) {
+    if (handle < 1 || handle > MEMORY_SERIALS) {
+        return 0;
+    }
+    pthread_mutex_lock(&memory_lock);
+    int alive = memory_serials[handle - 1].open && !memory_serials[handle - 1].hung_up;
+    pthread_mutex_unlock(&memory_lock);
+    return alive;
+}
+
+int memory_serial_flush(int handle) {
+    if (handle < 1 || handle > MEMORY_SERIALS) {
+        return -1;
+    }
+    pthread_mutex_lock(&memory_lock);
+    memory_serials[handle - 1].pending_length = 0;
+    memory_serials[handle - 1].line_length = 0;
+    pthread_mutex_unlock(&memory_lock);
+    return 0;
+}
+
+int memory_serial_close(int handle) {
+    if (handle < 1 || handle > MEMORY_SERIALS) {
+        return -1;
+    }
+    pthread_mutex_lock(&memory_lock);
+    memory_serials[handle - 1].open = 0;
+    pthread_mutex_unlock(&memory_lock);
+    return 0;
+}
+
+int memory_trigger_open(const char* port) {
+    return 1;
+}
+
+int memory_trigger_set(int handle, int level) {
+    plundervolt_backend_record_t* record = memory_record(PLUNDERVOLT_RECORD_TRIGGER_SET, handle);
+    record->value = level > 0;
+    return 0;
+}
+
+const plundervolt_backend_t plundervolt_memory_backend = {
+    .name = "memory",
+    .msr_open = memory_msr_open,
+    .msr_read = memory_msr_read,
+    .msr_write = memory_msr_write,
+    .msr_close = memory_close,
+    .serial_open = memory_serial_open,
+    .serial_write = memory_serial_write,
+    .serial_read_lines = memory_serial_read_lines,
+    .serial_read = memory_serial_read,
+    .serial_alive = memory_serial_alive,
+    .serial_flush = memory_serial_flush,
+    .serial_close = memory_serial_close,
+    .trigger_open = memory_trigger_open,
+    .trigger_set = memory_trigger_set,
+    .trigger_close = memory_close
+};
+
+void plundervolt_memory_backend_reset() {
+    pthread_mutex_lock(&memory_lock);
+    memory_msr_count = 0;
+    __atomic_store_n(&memory_record_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&memory_lock);
+}
+
+uint64_t plundervolt_memory_backend_record_count() {
+    return __atomic_load_n(&memory_record_count, __ATOMIC_RELAXED);
+}
+
+const plundervolt_backend_record_t* plundervolt_memory_backend_record(uint64_t index) {
+    uint64_t count = plundervolt_memory_backend_record_count();
+    if (index >= count || count - index > PLUNDERVOLT_MEMORY_BACKEND_RECORDS) {
+        return NULL;
+    }
+    return &memory_records[index % PLUNDERVOLT_MEMORY_BACKEND_RECORDS];
+}
+
+uint64_t plundervolt_memory_backend_msr(int cpu, off_t offset) {
+    pthread_mutex_lock(&memory_lock);
+    memory_msr_t* msr = memory_find_msr(cpu, offset, 0);
+    uint64_t value = msr ? msr->value : 0;
+    pthread_mutex_unlock(&memory_lock);
+    return value;
+}
+
+void plundervolt_memory_backend_hang_up() {
+    pthread_mutex_lock(&memory_lock);
+    for (int i = 0; i < MEMORY_SERIALS; i++) {
+        if (memory_serials[i].open) {
+            memory_serials[i].hung_up = 1;
+        }
+    }
+    pthread_mutex_unlock(&memory_lock);
+}
@@ -0,0 +1,183 @@
+/**
+ * @file plundervolt_backend.h
+ * @brief I/O backends of the undervolting library.
+ *
+ * Every access to the msr files, to Teensy and to the onboard trigger goes through a plundervolt_backend_t.
+ * The default is plundervolt_linux_backend, which talks to the real devices. plundervolt_memory_backend
+ * stands in for them in memory and records every write with a timestamp, so the control paths can be
+ * measured and checked on any Linux machine.
+ *
+ */
+/* plundervolt_backend.h */
+
+#ifndef PLUNDERVOLT_BACKEND_H
+#define PLUNDERVOLT_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Set of functions through which the library touches the hardware.
+ * Handles returned by the open functions are > 0 on success and -1 on failure.
+ *
+ */
+typedef struct plundervolt_backend_t {
+    /**
+     * @brief Name of the backend, for messages.
+     */
+    const char* name;
+    /**
+     * @brief Open the msr file of the given logical CPU.
+     */
+    int (* msr_open)(int cpu);
+    /**
+     * @brief Read the msr at offset. Returns 0 on success, -1 on failure.
+     */
+    int (* msr_read)(int handle, off_t offset, uint64_t* value);
+    /**
+     * @brief Write value to the msr at offset. Returns 0 on success, -1 on failure.
+     */
+    int (* msr_write)(int handle, off_t offset, uint64_t value);
+    /**
+     * @brief Close a handle returned by msr_open.
+     */
+    int (* msr_close)(int handle);
+    /**
+     * @brief Open the serial port connected to Teensy at the given baudrate.
+     */
+    int (* serial_open)(const char* port, int baud);
+    /**
+     * @brief Write len bytes to Teensy. Returns 0 on success, -1 on failure.
+     */
+    int (* serial_write)(int handle, const char* buf, size_t len);
+    /**
+     * @brief Read up to num_lines lines ending in until from Teensy. Same semantics as serialport_read_lines().
+     */
+    int (* serial_read_lines)(int handle, char* buf, char until, int buf_max, int timeout, int num_lines);
+    /**
+     * @brief Read the bytes Teensy sent, up to buf_max, waiting up to timeout ms for the first. Returns the number of bytes, 0 on timeout, -1 on error.
+     */
+    int (* serial_read)(int handle, char* buf, int buf_max, int timeout);
+    /**
+     * @brief Check, without blocking, that the Teensy port is still connected. Returns 1 if it is, 0 if it hung up or failed.
+     */
+    int (* serial_alive)(int handle);
+    /**
+     * @brief Throw away anything pending on the Teensy port.
+     */
+    int (* serial_flush)(int handle);
+    /**
+     * @brief Close a handle returned by serial_open.
+     */
+    int (* serial_close)(int handle);
+    /**
+     * @brief Open and configure the onboard DTR trigger port.
+     */
+    int (* trigger_open)(const char* port);
+    /**
+     * @brief Raise (level > 0) or lower (level = 0) DTR on the trigger port. Returns 0 on success, -1 on failure.
+     */
+    int (* trigger_set)(int handle, int level);
+    /**
+     * @brief Close a handle returned by trigger_open.
+     */
+    int (* trigger_close)(int handle);
+} plundervolt_backend_t;
+
+/**
+ * @brief Backend which uses /dev/cpu/N/msr, the Teensy tty and the trigger tty. This is the default.
+ */
+extern const plundervolt_backend_t plundervolt_linux_backend;
+
+/**
+ * @brief Backend which keeps the msr values in memory and records every write.
+ * Writes to msr 0x150 are decoded, and msr 0x198 reads back a nominal 1.0 V plus the core plane offset,
+ * reached linearly 250 µs after the write, like a voltage regulator slewing. The frequency, temperature and RAPL msrs
+ * read by plundervolt_telemetry.h model a steady machine until written.
+ * Every line written to Teensy is answered with "ok <line>", and every binary frame but a fire with an acknowledgement.
+ */
+extern const plundervolt_backend_t plundervolt_memory_backend;
+
+/**
+ * @brief Kind of operation recorded by plundervolt_memory_backend.
+ *
+ */
+typedef enum {
+    PLUNDERVOLT_RECORD_MSR_WRITE = 0,
+    PLUNDERVOLT_RECORD_SERIAL_WRITE = 1,
+    PLUNDERVOLT_RECORD_TRIGGER_SET = 2
+} plundervolt_backend_record_kind_t;
+
+/**
+ * @brief One write recorded by plundervolt_memory_backend.
+ *
+ */
+typedef struct plundervolt_backend_record_t {
+    /**
+     * @brief CLOCK_MONOTONIC_RAW time of the write, in ns.
+     */
+    uint64_t timestamp;
+    /**
+     * @brief What was written to.
+     */
+    plundervolt_backend_record_kind_t kind;
+    /**
+     * @brief Logical CPU for msr writes, handle for serial and trigger writes.
+     */
+    int target;
+    /**
+     * @brief Msr offset for msr writes, number of bytes for serial writes, 0 for trigger writes.
+     */
+    uint64_t offset;
+    /**
+     * @brief Value written to the msr, or the DTR level.
+     */
+    uint64_t value;
+    /**
+     * @brief Beginning of the bytes written to Teensy, zero-terminated.
+     */
+    char data[32];
+} plundervolt_backend_record_t;
+
+/**
+ * @brief Maximum number of records kept by plundervolt_memory_backend. Older records are overwritten.
+ */
+#define PLUNDERVOLT_MEMORY_BACKEND_RECORDS 65536
+
+/**
+ * @brief Forget all records and msr values of plundervolt_memory_backend.
+ *
+ */
+void plundervolt_memory_backend_reset();
+
+/**
+ * @return uint64_t Number of writes recorded since the last reset, including those already overwritten.
+ */
+uint64_t plundervolt_memory_backend_record_count();
+
+/**
+ * @brief Return a recorded write.
+ *
+ * @param index Index of the write since the last reset. Only the last PLUNDERVOLT_MEMORY_BACKEND_RECORDS are kept.
+ * @return const plundervolt_backend_record_t* The record, or NULL if it is out of range or overwritten.
+ */
+const plundervolt_backend_record_t* plundervolt_memory_backend_record(uint64_t index);
+
+/**
+ * @brief Read the value plundervolt_memory_backend holds for an msr, without recording anything.
+ *
+ * @param cpu Logical CPU.
+ * @param offset Msr offset.
+ * @return uint64_t The value, 0 if never written.
+ */
+uint64_t plundervolt_memory_backend_msr(int cpu, off_t offset);
+
+/**
+ * @brief Make every open serial port of plundervolt_memory_backend behave like an unplugged Teensy:
+ * writes fail and serial_alive reports it dead, until the port is closed and opened again.
+ *
+ */
+void plundervolt_memory_backend_hang_up();
+
+#endif /* PLUNDERVOLT_BACKEND_H */
@@ -0,0 +1,104 @@
+/**
+ * @file plundervolt_estimate.c
+ * @brief Sequential estimate of the fault probability of a parameter point, and early stopping once it is confident.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include "plundervolt_estimate.h"
+
+void plundervolt_estimate_start(plundervolt_estimate_t* estimate, stop_rule_type rule, int min_trials, double low, double high, double confidence) {
+    memset(estimate, 0, sizeof *estimate);
+    estimate->rule = rule;
+    estimate->min_trials = min_trials;
+    estimate->low = low;
+    estimate->high = high;
+    estimate->confidence = confidence;
+    estimate->z = plundervolt_normal_quantile(1 - (1 - confidence) / 2);
+    // Wald's bounds, with both error rates 1 - confidence.
+    double error = 1 - confidence;
+    estimate->accept_faulty = (1 - error) / error;
+    estimate->accept_clean = error / (1 - error);
+    estimate->upper = 1;
+    estimate->ratio = 1;
+}
+
+plundervolt_verdict_t plundervolt_estimate_add(plundervolt_estimate_t* estimate, int event) {
+    estimate->trials++;
+    if (event) {
+        estimate->events++;
+        estimate->ratio *= estimate->high / estimate->low;
+    } else {
+        estimate->ratio *= (1 - estimate->high) / (1 - estimate->low);
+    }
+    estimate->rate = (double) estimate->events / estimate->trials;
+    plundervolt_wilson_interval(estimate->events, estimate->trials, estimate->z, &estimate->lower, &estimate->upper);
+
+    if (estimate->verdict != PLUNDERVOLT_VERDICT_UNDECIDED || estimate->trials < (uint64_t) estimate->min_trials) {
+        return estimate->verdict;
+    }
+    if (estimate->rule == stop_wilson) {
+        if (estimate->upper < estimate->low) {
+            estimate->verdict = PLUNDERVOLT_VERDICT_CLEAN;
+        } else if (estimate->lower > estimate->high) {
+            estimate->verdict = PLUNDERVOLT_VERDICT_FAULTY;
+        }
+    } else if (estimate->rule == stop_sprt) {
+        if (estimate->ratio <= estimate->accept_clean) {
+            estimate->verdict = PLUNDERVOLT_VERDICT_CLEAN;
+        } else if (estimate->ratio >= estimate->accept_faulty) {
+            estimate->verdict = PLUNDERVOLT_VERDICT_FAULTY;
+        }
+    }
+    return estimate->verdict;
+}
+
+void plundervolt_wilson_interval(uint64_t events, uint64_t trials, double z, double* lower, double* upper) {
+    double n = (double) trials;
+    double p = events / n;
+    double z2 = z * z;
+    double center = (p + z2 / (2 * n)) / (1 + z2 / n);
+    double half = z / (1 + z2 / n) * sqrt(p * (1 - p) / n + z2 / (4 * n * n));
+    *lower = center - half > 0 ? center - half : 0;
+    *upper = center + half < 1 ? center + half : 1;
+}
+
+double plundervolt_normal_quantile(double p) {
+    // Acklam's rational approximation, refined by one step of Halley's method.
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+        1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+        6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+        -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00};
+    double x;
+    if (p < 0.02425) {
+        double q = sqrt(-2 * log(p));
+        x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    } else if (p > 1 - 0.02425) {
+        double q = sqrt(-2 * log(1 - p));
+        x = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    } else {
+        double q = p - 0.5;
+        double r = q * q;
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+    }
+    double e = 0.5 * erfc(-x / sqrt(2)) - p;
+    double u = e * sqrt(2 * M_PI) * exp(x * x / 2);
+    return x - u / (1 + x * u / 2);
+}
+
+const char* plundervolt_verdict_name(plundervolt_verdict_t verdict) {
+    switch (verdict) {
+        case PLUNDERVOLT_VERDICT_UNDECIDED:
+            return "undecided";
+        case PLUNDERVOLT_VERDICT_CLEAN:
+            return "clean";
+        case PLUNDERVOLT_VERDICT_FAULTY:
+            return "faulty";
+        default:
+            return "unknown";
+    }
+}
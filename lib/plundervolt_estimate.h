@@ -0,0 +1,121 @@
+/**
+ * @file plundervolt_estimate.h
+ * @brief Sequential estimate of the fault probability of a parameter point, and early stopping once it is confident.
+ *
+ * Every try of a point is a Bernoulli trial: it faulted (reported a fault, or with fork_server crashed or hung) or not.
+ * The estimate keeps the fault rate and its Wilson score interval up to date as the tries come in, and decides as soon
+ * as the point is confidently clean (fault rate below low) or confidently faulty (above high):
+ *  - stop_wilson decides when the whole interval lies below low or above high. Points in between, on the boundary,
+ *    get every try.
+ *  - stop_sprt runs Wald's sequential probability ratio test of p = low against p = high, with both error rates
+ *    1 - confidence. It needs the fewest tries on average, and also ends on boundary points, with the likelier verdict.
+ * See plundervolt_specification_t.stop_rule for the way plundervolt_run() uses it.
+ *
+ */
+/* plundervolt_estimate.h */
+
+#ifndef PLUNDERVOLT_ESTIMATE_H
+#define PLUNDERVOLT_ESTIMATE_H
+
+#include <stdint.h>
+#include "plundervolt.h"
+
+/**
+ * @brief What an estimate says about its point.
+ *
+ */
+typedef enum plundervolt_verdict_t {
+    PLUNDERVOLT_VERDICT_UNDECIDED = 0, // Not confident yet, or stop_fixed.
+    PLUNDERVOLT_VERDICT_CLEAN = 1, // The fault rate is below low.
+    PLUNDERVOLT_VERDICT_FAULTY = 2 // The fault rate is above high.
+} plundervolt_verdict_t;
+
+/**
+ * @brief Estimate of the fault rate of one point.
+ *
+ */
+typedef struct plundervolt_estimate_t {
+    /**
+     * @brief Settings, see plundervolt_estimate_start().
+     */
+    stop_rule_type rule;
+    int min_trials;
+    double low;
+    double high;
+    double confidence;
+    /**
+     * @brief Normal quantile of the two-sided confidence, and the likelihood ratios which end the SPRT. Private.
+     */
+    double z;
+    double accept_faulty;
+    double accept_clean;
+    /**
+     * @brief Trials so far, and how many of them faulted.
+     */
+    uint64_t trials;
+    uint64_t events;
+    /**
+     * @brief events / trials, and its Wilson score interval at confidence. 0, 0 and 1 before the first trial.
+     */
+    double rate;
+    double lower;
+    double upper;
+    /**
+     * @brief With stop_sprt, the likelihood ratio of p = high against p = low after the trials so far.
+     */
+    double ratio;
+    /**
+     * @brief Verdict so far. Once decided, it does not change with more trials.
+     */
+    plundervolt_verdict_t verdict;
+} plundervolt_estimate_t;
+
+/**
+ * @brief Start an estimate with no trials.
+ *
+ * @param estimate Where to store the estimate.
+ * @param rule stop_fixed never decides, stop_wilson and stop_sprt as described above.
+ * @param min_trials Trials before any verdict.
+ * @param low Fault rate below which a point is clean, e.g. 0.05. 0 < low < high.
+ * @param high Fault rate above which a point is faulty, e.g. 0.5. high < 1.
+ * @param confidence e.g. 0.95: the coverage of the Wilson interval, and 1 - the error rates of the SPRT.
+ */
+void plundervolt_estimate_start(plundervolt_estimate_t* estimate, stop_rule_type rule, int min_trials, double low, double high, double confidence);
+
+/**
+ * @brief Add the outcome of one trial.
+ *
+ * @param estimate The estimate.
+ * @param event 1 if the trial faulted.
+ * @return plundervolt_verdict_t The verdict after it.
+ */
+plundervolt_verdict_t plundervolt_estimate_add(plundervolt_estimate_t* estimate, int event);
+
+/**
+ * @brief Wilson score interval of a proportion.
+ *
+ * @param events Successes.
+ * @param trials Trials, > 0.
+ * @param z Normal quantile, e.g. 1.96 for 95 %.
+ * @param lower Where to store the lower bound.
+ * @param upper Where to store the upper bound.
+ */
+void plundervolt_wilson_interval(uint64_t events, uint64_t trials, double z, double* lower, double* upper);
+
+/**
+ * @return double The p-quantile of the standard normal distribution, 0 < p < 1 (to about 1e-9).
+ */
+double plundervolt_normal_quantile(double p);
+
+/**
+ * @return const char* Name of a verdict, e.g. "clean".
+ */
+const char* plundervolt_verdict_name(plundervolt_verdict_t verdict);
+
+/**
+ * @brief Copy the estimate of the last hardware plundervolt_run(): every try is one trial.
+ *
+ */
+void plundervolt_get_estimate(plundervolt_estimate_t* estimate);
+
+#endif /* PLUNDERVOLT_ESTIMATE_H */
@@ -0,0 +1,218 @@
+/**
+ * @file plundervolt_fault_log.c
+ * @brief Memory-mapped, preallocated, append-only file of binary fault records, for offline analysis.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include "plundervolt_fault_log.h"
+
+_Static_assert(sizeof(plundervolt_fault_record_t) == 64, "A fault record is one cache line.");
+_Static_assert(sizeof(plundervolt_fault_log_header_t) == 64, "The header is one cache line.");
+
+/**
+ * @brief Map the file of a log, of length bytes, and point the header and records into it.
+ *
+ * @return plundervolt_error_t PLUNDERVOLT_FAULT_LOG_ERROR if mmap() failed (the file is closed).
+ */
+plundervolt_error_t fault_log_map(plundervolt_fault_log_t* log, size_t length);
+/**
+ * @return int 1 if the header is one this library can read.
+ */
+int fault_log_valid(const plundervolt_fault_log_header_t* header);
+/**
+ * @brief Set the log's time anchor: the time stamp counter against CLOCK_REALTIME, over about 10 ms.
+ *
+ */
+void fault_log_anchor(plundervolt_fault_log_t* log);
+
+plundervolt_error_t fault_log_map(plundervolt_fault_log_t* log, size_t length) {
+    int protection = log->writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    int flags = log->writable ? MAP_SHARED | MAP_POPULATE : MAP_SHARED;
+    void* mapping = mmap(NULL, length, protection, flags, log->fd, 0);
+    if (mapping == MAP_FAILED) {
+        close(log->fd);
+        log->fd = -1;
+        return PLUNDERVOLT_FAULT_LOG_ERROR;
+    }
+    log->header = (plundervolt_fault_log_header_t*) mapping;
+    log->records = (plundervolt_fault_record_t*)((char*) mapping + sizeof(plundervolt_fault_log_header_t));
+    log->length = length;
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+int fault_log_valid(const plundervolt_fault_log_header_t* header) {
+    return header->magic == PLUNDERVOLT_FAULT_LOG_MAGIC && header->version == 2
+        && header->record_size == sizeof(plundervolt_fault_record_t);
+}
+
+void fault_log_anchor(plundervolt_fault_log_t* log) {
+    struct timespec start, end, now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    uint64_t start_ticks = __rdtsc();
+    do {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    } while ((end.tv_sec - start.tv_sec) * 1000000000l + (end.tv_nsec - start.tv_nsec) < 10000000l);
+    uint64_t ticks = __rdtsc();
+    clock_gettime(CLOCK_REALTIME, &now);
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    log->ns_per_tick = ticks > start_ticks ? ns / (ticks - start_ticks) : 1.0;
+    log->anchor_tsc = ticks;
+    log->anchor_ns = (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+plundervolt_error_t plundervolt_fault_log_open(plundervolt_fault_log_t* log, const char* path, uint64_t capacity) {
+    memset(log, 0, sizeof *log);
+    log->writable = 1;
+    log->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (log->fd < 0 || capacity == 0) {
+        if (log->fd >= 0) {
+            close(log->fd);
+        }
+        log->fd = -1;
+        return PLUNDERVOLT_FAULT_LOG_ERROR;
+    }
+    struct stat status;
+    plundervolt_fault_log_header_t header;
+    int created = fstat(log->fd, &status) == 0 && status.st_size == 0;
+    if (created) {
+        memset(&header, 0, sizeof header);
+        header.magic = PLUNDERVOLT_FAULT_LOG_MAGIC;
+        header.version = 2;
+        header.record_size = sizeof(plundervolt_fault_record_t);
+    } else if (pread(log->fd, &header, sizeof header, 0) != sizeof header || !fault_log_valid(&header)) {
+        close(log->fd);
+        log->fd = -1;
+        return PLUNDERVOLT_FAULT_LOG_ERROR;
+    }
+    if (header.capacity > capacity) {
+        capacity = header.capacity;
+    }
+    // Allocate every block now: a write to a hole of the mapping on a full disk would be a SIGBUS in the victim.
+    size_t length = sizeof(plundervolt_fault_log_header_t) + capacity * sizeof(plundervolt_fault_record_t);
+    if (posix_fallocate(log->fd, 0, length) != 0) {
+        close(log->fd);
+        log->fd = -1;
+        return PLUNDERVOLT_FAULT_LOG_ERROR;
+    }
+    plundervolt_error_t error_check = fault_log_map(log, length);
+    if (error_check) {
+        return error_check;
+    }
+    if (created) {
+        memcpy(log->header, &header, sizeof header);
+    }
+    // Slots claimed beyond the old capacity were drops, not records.
+    if (log->header->count > log->header->capacity) {
+        log->header->count = log->header->capacity;
+    }
+    log->header->capacity = capacity;
+    fault_log_anchor(log);
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+int plundervolt_fault_log_append(plundervolt_fault_log_t* log, const plundervolt_fault_record_t* record) {
+    uint64_t index = atomic_fetch_add_explicit(&log->header->count, 1, memory_order_relaxed);
+    if (index >= log->header->capacity) {
+        atomic_fetch_add_explicit(&log->header->dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+    plundervolt_fault_record_t* slot = &log->records[index];
+    memcpy(slot, record, offsetof(plundervolt_fault_record_t, committed));
+    slot->run = record->run;
+    __atomic_store_n(&slot->committed, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+uint32_t plundervolt_fault_log_start_run(plundervolt_fault_log_t* log) {
+    return atomic_fetch_add_explicit(&log->header->runs, 1, memory_order_relaxed);
+}
+
+plundervolt_error_t plundervolt_fault_log_sync(plundervolt_fault_log_t* log) {
+    return msync(log->header, log->length, MS_SYNC) ? PLUNDERVOLT_FAULT_LOG_ERROR : PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_error_t plundervolt_fault_log_open_read(plundervolt_fault_log_t* log, const char* path) {
+    memset(log, 0, sizeof *log);
+    log->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (log->fd < 0 || fstat(log->fd, &status) != 0 || (size_t) status.st_size < sizeof(plundervolt_fault_log_header_t)) {
+        if (log->fd >= 0) {
+            close(log->fd);
+        }
+        log->fd = -1;
+        return PLUNDERVOLT_FAULT_LOG_ERROR;
+    }
+    plundervolt_error_t error_check = fault_log_map(log, status.st_size);
+    if (error_check) {
+        return error_check;
+    }
+    if (!fault_log_valid(log->header)) {
+        plundervolt_fault_log_close(log);
+        return PLUNDERVOLT_FAULT_LOG_ERROR;
+    }
+    madvise(log->header, log->length, MADV_SEQUENTIAL);
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+uint64_t plundervolt_fault_log_count(const plundervolt_fault_log_t* log) {
+    uint64_t count = atomic_load_explicit(&log->header->count, memory_order_acquire);
+    uint64_t fits = (log->length - sizeof(plundervolt_fault_log_header_t)) / sizeof(plundervolt_fault_record_t);
+    if (count > log->header->capacity) {
+        count = log->header->capacity;
+    }
+    return count < fits ? count : fits; // A file cut short holds fewer than its header says.
+}
+
+uint64_t plundervolt_fault_log_dropped(const plundervolt_fault_log_t* log) {
+    return atomic_load_explicit(&log->header->dropped, memory_order_relaxed);
+}
+
+const plundervolt_fault_record_t* plundervolt_fault_log_record(const plundervolt_fault_log_t* log, uint64_t index) {
+    const plundervolt_fault_record_t* record = &log->records[index];
+    return __atomic_load_n(&record->committed, __ATOMIC_ACQUIRE) == 1 ? record : NULL;
+}
+
+uint64_t plundervolt_fault_log_scan(const plundervolt_fault_log_t* log, uint64_t first,
+    int (* visit)(const plundervolt_fault_record_t* record, void* context), void* context) {
+    uint64_t count = plundervolt_fault_log_count(log);
+    uint64_t visited = 0;
+    for (uint64_t index = first; index < count; index++) {
+        const plundervolt_fault_record_t* record = plundervolt_fault_log_record(log, index);
+        if (record == NULL) {
+            continue;
+        }
+        visited++;
+        if (visit(record, context)) {
+            break;
+        }
+    }
+    return visited;
+}
+
+uint64_t plundervolt_fault_log_time_ns(const plundervolt_fault_log_t* log, uint64_t tsc) {
+    double ticks = (double)(int64_t)(tsc - log->anchor_tsc);
+    return log->anchor_ns + (int64_t)(ticks * log->ns_per_tick);
+}
+
+void plundervolt_fault_log_close(plundervolt_fault_log_t* log) {
+    if (log->header != NULL) {
+        if (log->writable) {
+            plundervolt_fault_log_sync(log);
+        }
+        munmap(log->header, log->length);
+        log->header = NULL;
+        log->records = NULL;
+    }
+    if (log->fd >= 0) {
+        close(log->fd);
+    }
+    log->fd = -1;
+}
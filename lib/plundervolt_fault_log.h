@@ -0,0 +1,210 @@
+/**
+ * @file plundervolt_fault_log.h
+ * @brief Memory-mapped, preallocated, append-only file of binary fault records, for offline analysis.
+ *
+ * The file is a 64-byte header followed by room for capacity records of 64 bytes each, all allocated on disk when it is
+ * opened. It is mapped shared and prefaulted, so an append is an atomic increment of the header's count (which claims
+ * a slot), a copy of the record into it, and a store of its committed flag: no lock, no allocation, no formatting and
+ * no system call. Any number of threads, and processes sharing the mapping (e.g. children of fork servers), append at
+ * once. When the file is full, records are dropped and counted. A record whose writer died before committing it is a
+ * hole readers skip.
+ *
+ * The reader maps the whole file read-only and hands out pointers to the records in place, so scanning millions of
+ * them costs as much as reading the file. See plundervolt_specification_t.fault_log for the way plundervolt_run() and
+ * plundervolt_push_fault() use it.
+ *
+ */
+/* plundervolt_fault_log.h */
+
+#ifndef PLUNDERVOLT_FAULT_LOG_H
+#define PLUNDERVOLT_FAULT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "plundervolt.h"
+
+/**
+ * @brief First field of the header.
+ *
+ */
+#define PLUNDERVOLT_FAULT_LOG_MAGIC 0x31465650 // "PVF1"
+
+/**
+ * @brief One fault as stored in the file (little endian, 64 bytes).
+ *
+ */
+typedef struct plundervolt_fault_record_t {
+    /**
+     * @brief CLOCK_REALTIME when the fault was pushed, in ns: its time stamp counter value, converted by the anchor of
+     * the writer's log (see plundervolt_fault_log_time_ns()). Stored as a time, so records stay right across reboots.
+     */
+    uint64_t time_ns;
+    /**
+     * @brief The correct result, and the faulty one.
+     */
+    uint64_t expected;
+    uint64_t observed;
+    /**
+     * @brief Software. Undervoltage set when the fault was pushed, in mV.
+     */
+    int64_t undervoltage;
+    /**
+     * @brief Hardware. undervolting_voltage, duration_start, duration_during and delay_before_undervolting of the run.
+     */
+    double voltage;
+    int32_t duration_start;
+    int32_t duration_during;
+    int32_t delay;
+    /**
+     * @brief Logical CPU the pushing thread ran on (-1 if unknown), and the thread's id (see plundervolt_fault_t).
+     */
+    int16_t cpu;
+    int16_t thread;
+    /**
+     * @brief plundervolt_kernel_t of the kernel which pushed the fault, or PLUNDERVOLT_FAULT_NO_KERNEL.
+     */
+    uint16_t kernel;
+    /**
+     * @brief 1 once the record is complete. Written last.
+     */
+    uint16_t committed;
+    /**
+     * @brief Number of the plundervolt_run() the fault happened in, from 0 when the file was created.
+     */
+    uint32_t run;
+} plundervolt_fault_record_t;
+
+/**
+ * @brief Header at the start of the file (64 bytes).
+ *
+ */
+typedef struct plundervolt_fault_log_header_t {
+    uint32_t magic; // PLUNDERVOLT_FAULT_LOG_MAGIC.
+    uint16_t version; // 2.
+    uint16_t record_size; // sizeof(plundervolt_fault_record_t).
+    uint64_t capacity; // Records the file has room for.
+    /**
+     * @brief Slots claimed so far (records, and holes of writers which died), and appends dropped as the file was full.
+     */
+    _Atomic uint64_t count;
+    _Atomic uint64_t dropped;
+    /**
+     * @brief Runs started, see plundervolt_fault_record_t.run.
+     */
+    _Atomic uint32_t runs;
+    uint32_t reserved;
+    uint64_t reserved2[3];
+} plundervolt_fault_log_header_t;
+
+/**
+ * @brief An open fault log, for writing or reading.
+ *
+ */
+typedef struct plundervolt_fault_log_t {
+    int fd;
+    int writable;
+    /**
+     * @brief The mapping: the header, and the records right behind it.
+     */
+    plundervolt_fault_log_header_t* header;
+    plundervolt_fault_record_t* records;
+    size_t length;
+    /**
+     * @brief Open for appending: time stamp counter and CLOCK_REALTIME (in ns) when the log was opened, and the length
+     * of a tick in ns, to turn time stamps into times. Never stored: the counter starts again at every boot.
+     */
+    uint64_t anchor_tsc;
+    uint64_t anchor_ns;
+    double ns_per_tick;
+} plundervolt_fault_log_t;
+
+/**
+ * @brief Open a fault log for appending, creating it if it does not exist. The file is grown to capacity records
+ * (if it holds fewer), allocated on disk, mapped and prefaulted, so appends never wait for the file system.
+ *
+ * @param log Where to store the log.
+ * @param path File of the log.
+ * @param capacity Records the file must have room for, > 0.
+ * @return plundervolt_error_t PLUNDERVOLT_FAULT_LOG_ERROR if the file cannot be opened, allocated or mapped, or is not a fault log.
+ */
+plundervolt_error_t plundervolt_fault_log_open(plundervolt_fault_log_t* log, const char* path, uint64_t capacity);
+
+/**
+ * @brief Append a record. Lock-free and async-signal-safe; the committed field of record is ignored.
+ *
+ * @param log A log open for appending.
+ * @param record The record.
+ * @return int 1 if it was appended, 0 if the file is full and it was dropped.
+ */
+int plundervolt_fault_log_append(plundervolt_fault_log_t* log, const plundervolt_fault_record_t* record);
+
+/**
+ * @brief Count one more run; records appended after it carry its number.
+ *
+ * @return uint32_t Number of the new run.
+ */
+uint32_t plundervolt_fault_log_start_run(plundervolt_fault_log_t* log);
+
+/**
+ * @brief Write the records appended so far to disk. Call outside the glitch window.
+ *
+ * @return plundervolt_error_t PLUNDERVOLT_FAULT_LOG_ERROR if msync() failed.
+ */
+plundervolt_error_t plundervolt_fault_log_sync(plundervolt_fault_log_t* log);
+
+/**
+ * @brief Open a fault log for reading. The whole file is mapped read-only.
+ *
+ * @param log Where to store the log.
+ * @param path File of the log.
+ * @return plundervolt_error_t PLUNDERVOLT_FAULT_LOG_ERROR if the file cannot be opened or mapped, or is not a fault log.
+ */
+plundervolt_error_t plundervolt_fault_log_open_read(plundervolt_fault_log_t* log, const char* path);
+
+/**
+ * @return uint64_t Slots of the log filled so far, holes included: records have indexes 0 to this - 1.
+ */
+uint64_t plundervolt_fault_log_count(const plundervolt_fault_log_t* log);
+
+/**
+ * @return uint64_t Records dropped as the log was full.
+ */
+uint64_t plundervolt_fault_log_dropped(const plundervolt_fault_log_t* log);
+
+/**
+ * @brief A record, in place in the mapping.
+ *
+ * @param log An open log.
+ * @param index Index of the record, below plundervolt_fault_log_count().
+ * @return const plundervolt_fault_record_t* The record, or NULL if the slot is a hole.
+ */
+const plundervolt_fault_record_t* plundervolt_fault_log_record(const plundervolt_fault_log_t* log, uint64_t index);
+
+/**
+ * @brief Call visit with every record from first on, in order, skipping holes, until it returns != 0.
+ *
+ * @param log An open log.
+ * @param first Index of the first record.
+ * @param visit Called with every record and context.
+ * @param context Passed to visit.
+ * @return uint64_t Records visited.
+ */
+uint64_t plundervolt_fault_log_scan(const plundervolt_fault_log_t* log, uint64_t first,
+    int (* visit)(const plundervolt_fault_record_t* record, void* context), void* context);
+
+/**
+ * @brief Turn a time stamp counter value (rdtsc) of this boot into a time, for plundervolt_fault_record_t.time_ns.
+ *
+ * @param log A log open for appending.
+ * @param tsc The time stamp counter value.
+ * @return uint64_t CLOCK_REALTIME, in ns, by the log's anchor.
+ */
+uint64_t plundervolt_fault_log_time_ns(const plundervolt_fault_log_t* log, uint64_t tsc);
+
+/**
+ * @brief Unmap and close the log. A log open for appending is synced first.
+ *
+ */
+void plundervolt_fault_log_close(plundervolt_fault_log_t* log);
+
+#endif /* PLUNDERVOLT_FAULT_LOG_H */
@@ -0,0 +1,267 @@
+/**
+ * @file plundervolt_fork_server.c
+ * @brief Running every trial of the victim in its own process, forked from a warm fork server.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include "plundervolt_fork_server.h"
+
+plundervolt_fork_shared_t* plundervolt_victim_shared = NULL;
+plundervolt_trial_stats_t fork_server_trial_stats; // Counts of all servers.
+pthread_mutex_t fork_server_trial_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Body of the server process: initialise, then fork a child for every request. Never returns.
+ *
+ */
+void fork_server_serve(int channel, plundervolt_fork_shared_t* shared, void (* init)(void*), void (* trial)(void*), void* arguments);
+/**
+ * @brief Body of a child: look like a fresh run of the loops, run the trial, exit. Never returns.
+ *
+ */
+void fork_server_child(const plundervolt_trial_request_t* request, plundervolt_fork_shared_t* shared, void (* trial)(void*), void* arguments);
+/**
+ * @brief SIGALRM handler of a child: finish its loops at the end of the trial.
+ *
+ */
+void fork_server_end_trial(int signal);
+/**
+ * @brief Receive exactly size bytes, waiting at most timeout_ms (negative for no limit).
+ *
+ * @return int 1 if received, 0 on timeout, -1 if the other end is gone.
+ */
+int fork_server_receive(int channel, void* data, size_t size, int timeout_ms);
+
+plundervolt_error_t plundervolt_fork_server_start(plundervolt_fork_server_t* server, void (* init)(void*), void (* trial)(void*), void* arguments) {
+    memset(server, 0, sizeof *server);
+    server->shared = mmap(NULL, sizeof(plundervolt_fork_shared_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (server->shared == MAP_FAILED) {
+        server->shared = NULL;
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    int channels[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, channels) == -1) {
+        munmap(server->shared, sizeof(plundervolt_fork_shared_t));
+        server->shared = NULL;
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(channels[0]);
+        fork_server_serve(channels[1], server->shared, init, trial, arguments);
+    }
+    close(channels[1]);
+    server->channel = channels[0];
+    server->pid = pid;
+    char ready;
+    if (pid == -1 || fork_server_receive(server->channel, &ready, 1, -1) != 1) { // Wait for init, so the first trial does not pay for it.
+        plundervolt_fork_server_stop(server);
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void fork_server_serve(int channel, plundervolt_fork_shared_t* shared, void (* init)(void*), void (* trial)(void*), void* arguments) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL); // Do not outlive the controller.
+    if (init != NULL) {
+        init(arguments);
+    }
+    char ready = 1;
+    send(channel, &ready, 1, MSG_NOSIGNAL);
+
+    plundervolt_trial_request_t request;
+    while (fork_server_receive(channel, &request, sizeof request, -1) == 1) {
+        pid_t child = fork();
+        if (child == 0) {
+            close(channel);
+            fork_server_child(&request, shared, trial, arguments);
+        }
+        if (send(channel, &child, sizeof child, MSG_NOSIGNAL) != sizeof child || child == -1) {
+            break;
+        }
+        int status;
+        while (waitpid(child, &status, 0) == -1 && errno == EINTR);
+        if (send(channel, &status, sizeof status, MSG_NOSIGNAL) != sizeof status) {
+            break;
+        }
+    }
+    _exit(0);
+}
+
+void fork_server_end_trial(int signal) {
+    atomic_store_explicit(&plundervolt_run_state.loop_finished, 1, memory_order_release);
+}
+
+void fork_server_child(const plundervolt_trial_request_t* request, plundervolt_fork_shared_t* shared, void (* trial)(void*), void* arguments) {
+    plundervolt_victim_shared = shared;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (request->cpu >= 0) {
+        // The child, not the server, moves: a server sharing the CPU would wait for the child to answer the controller.
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(request->cpu, &cpuset);
+        sched_setaffinity(0, sizeof(cpu_set_t), &cpuset);
+    }
+    atomic_store_explicit(&plundervolt_run_state.loop_finished, 0, memory_order_relaxed);
+    atomic_store_explicit(&plundervolt_run_state.current_undervoltage, request->undervoltage, memory_order_relaxed);
+    if (request->trial_ms > 0) {
+        struct sigaction action;
+        memset(&action, 0, sizeof action);
+        action.sa_handler = fork_server_end_trial;
+        sigaction(SIGALRM, &action, NULL);
+        struct itimerval timer = {.it_value = {.tv_sec = request->trial_ms / 1000, .tv_usec = (request->trial_ms % 1000) * 1000}};
+        setitimer(ITIMER_REAL, &timer, NULL);
+    }
+    atomic_store_explicit(&shared->started_cycles, __rdtsc(), memory_order_relaxed);
+    atomic_store_explicit(&shared->started_ns, plundervolt_monotonic_ns(), memory_order_release);
+    trial(arguments);
+    _exit(0); // No atexit handlers or stdio flushes of the controller's state.
+}
+
+int fork_server_receive(int channel, void* data, size_t size, int timeout_ms) {
+    size_t received = 0;
+    while (received < size) {
+        if (timeout_ms >= 0) {
+            struct pollfd ready = {.fd = channel, .events = POLLIN};
+            int polled = poll(&ready, 1, timeout_ms);
+            if (polled == 0) {
+                return 0;
+            }
+            if (polled == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+        }
+        ssize_t n = recv(channel, (char*) data + received, size - received, 0);
+        if (n == 0 || (n == -1 && errno != EINTR)) {
+            return -1;
+        }
+        if (n > 0) {
+            received += n;
+        }
+    }
+    return 1;
+}
+
+plundervolt_error_t plundervolt_fork_server_trial(plundervolt_fork_server_t* server, const plundervolt_trial_request_t* request, plundervolt_trial_t* result) {
+    memset(result, 0, sizeof *result);
+    if (server->pid <= 0) {
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    atomic_store_explicit(&server->shared->stop, 0, memory_order_relaxed);
+    atomic_store_explicit(&server->shared->started_ns, 0, memory_order_relaxed);
+    uint64_t faults_before = atomic_load_explicit(&server->shared->faults, memory_order_acquire);
+
+    uint64_t timed = plundervolt_instrument_begin();
+    uint64_t sent = plundervolt_monotonic_ns();
+    pid_t child;
+    if (send(server->channel, request, sizeof *request, MSG_NOSIGNAL) != sizeof *request
+        || fork_server_receive(server->channel, &child, sizeof child, -1) != 1 || child == -1) {
+        plundervolt_fork_server_stop(server);
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+
+    int status;
+    int received = fork_server_receive(server->channel, &status, sizeof status, request->trial_ms + request->timeout_ms);
+    if (received == 0) {
+        kill(child, SIGKILL);
+        received = fork_server_receive(server->channel, &status, sizeof status, -1);
+        result->outcome = PLUNDERVOLT_TRIAL_HANG;
+    }
+    if (received != 1) {
+        plundervolt_fork_server_stop(server);
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    uint64_t started = atomic_load_explicit(&server->shared->started_ns, memory_order_acquire);
+    if (started == 0) { // Killed before it got to the trial.
+        started = plundervolt_monotonic_ns();
+    } else if (timed != 0) {
+        plundervolt_instrument_record(PLUNDERVOLT_PHASE_TRIAL_START, atomic_load_explicit(&server->shared->started_cycles, memory_order_relaxed) - timed);
+    }
+    result->start_ns = started - sent;
+    result->duration_ns = plundervolt_monotonic_ns() - started;
+    result->faults = atomic_load_explicit(&server->shared->faults, memory_order_acquire) - faults_before;
+    result->stop = atomic_load_explicit(&server->shared->stop, memory_order_acquire);
+    if (result->outcome != PLUNDERVOLT_TRIAL_HANG) {
+        if (WIFSIGNALED(status)) {
+            result->outcome = PLUNDERVOLT_TRIAL_CRASH;
+            result->signal = WTERMSIG(status);
+        } else if (WEXITSTATUS(status) != 0) {
+            result->outcome = PLUNDERVOLT_TRIAL_CRASH;
+            result->status = WEXITSTATUS(status);
+        } else {
+            result->outcome = result->faults ? PLUNDERVOLT_TRIAL_FAULT : PLUNDERVOLT_TRIAL_CLEAN;
+        }
+    }
+
+    pthread_mutex_lock(&fork_server_trial_stats_lock);
+    fork_server_trial_stats.trials++;
+    fork_server_trial_stats.outcomes[result->outcome]++;
+    fork_server_trial_stats.total_start_ns += result->start_ns;
+    if (result->outcome == PLUNDERVOLT_TRIAL_CRASH) {
+        fork_server_trial_stats.last_crash_signal = result->signal;
+        fork_server_trial_stats.last_crash_undervoltage = request->undervoltage;
+    }
+    pthread_mutex_unlock(&fork_server_trial_stats_lock);
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void plundervolt_fork_server_stop(plundervolt_fork_server_t* server) {
+    if (server->pid > 0) {
+        // Killed rather than asked: other servers hold copies of this server's channel, so it would never see the end of it.
+        kill(server->pid, SIGKILL);
+        while (waitpid(server->pid, NULL, 0) == -1 && errno == EINTR);
+    }
+    if (server->pid != 0) {
+        close(server->channel);
+    }
+    if (server->shared != NULL) {
+        munmap(server->shared, sizeof(plundervolt_fork_shared_t));
+    }
+    server->pid = 0;
+    server->shared = NULL;
+}
+
+void plundervolt_fork_server_stats(plundervolt_trial_stats_t* stats) {
+    pthread_mutex_lock(&fork_server_trial_stats_lock);
+    *stats = fork_server_trial_stats;
+    pthread_mutex_unlock(&fork_server_trial_stats_lock);
+}
+
+void plundervolt_fork_server_reset_stats() {
+    pthread_mutex_lock(&fork_server_trial_stats_lock);
+    memset(&fork_server_trial_stats, 0, sizeof fork_server_trial_stats);
+    pthread_mutex_unlock(&fork_server_trial_stats_lock);
+}
+
+const char* plundervolt_trial_outcome_name(plundervolt_trial_outcome_t outcome) {
+    switch (outcome) {
+        case PLUNDERVOLT_TRIAL_CLEAN:
+            return "clean";
+        case PLUNDERVOLT_TRIAL_FAULT:
+            return "fault";
+        case PLUNDERVOLT_TRIAL_CRASH:
+            return "crash";
+        case PLUNDERVOLT_TRIAL_HANG:
+            return "hang";
+        default:
+            return "unknown";
+    }
+}
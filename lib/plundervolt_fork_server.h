@@ -0,0 +1,195 @@
+/**
+ * @file plundervolt_fork_server.h
+ * @brief Running every trial of the victim in its own process, forked from a warm fork server.
+ *
+ * A fork server is a process forked from the controller which runs an optional initialisation of the victim once,
+ * then waits for trials. For every trial it forks a child from its own (initialised) state, and the child runs the
+ * trial and exits. A crash of the child (a corrupted pointer, an illegal instruction, ...) only ends that child, so the
+ * controller keeps the campaign, and its voltage control, alive, and classifies the trial as a crash.
+ *
+ * Fault records pushed by the children with plundervolt_push_fault() go straight into the controller's fault queue,
+ * which lives in shared memory; faults they report and stops they request reach the controller through a small shared
+ * block of the server. See plundervolt_specification_t.fork_server for the way plundervolt_run() uses fork servers.
+ *
+ */
+/* plundervolt_fork_server.h */
+
+#ifndef PLUNDERVOLT_FORK_SERVER_H
+#define PLUNDERVOLT_FORK_SERVER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "plundervolt.h"
+
+/**
+ * @brief What became of a trial.
+ *
+ */
+typedef enum plundervolt_trial_outcome_t {
+    PLUNDERVOLT_TRIAL_CLEAN = 0, // The child exited normally and reported no fault.
+    PLUNDERVOLT_TRIAL_FAULT = 1, // The child exited normally and reported faults.
+    PLUNDERVOLT_TRIAL_CRASH = 2, // The child was killed by a signal, or exited with a status other than 0.
+    PLUNDERVOLT_TRIAL_HANG = 3, // The child did not end in time and was killed.
+    PLUNDERVOLT_TRIAL_OUTCOMES = 4 // Number of outcomes.
+} plundervolt_trial_outcome_t;
+
+/**
+ * @brief Block shared by a fork server, its children and the controller. Private.
+ *
+ */
+typedef struct plundervolt_fork_shared_t {
+    _Atomic uint64_t faults; // Faults reported by the children so far.
+    atomic_int stop; // Set by a child calling plundervolt_set_loop_finished().
+    _Atomic uint64_t started_ns; // CLOCK_MONOTONIC time and time stamp counter when the last child started its trial.
+    _Atomic uint64_t started_cycles;
+} plundervolt_fork_shared_t;
+
+/**
+ * @brief A fork server, as seen by the controller.
+ *
+ */
+typedef struct plundervolt_fork_server_t {
+    /**
+     * @brief Process id of the server, 0 if it is not running.
+     */
+    pid_t pid;
+    /**
+     * @brief Controller's end of the socket to the server. Private.
+     */
+    int channel;
+    /**
+     * @brief Shared with the server and its children. Private.
+     */
+    plundervolt_fork_shared_t* shared;
+    /**
+     * @brief Anything the owner wants to remember about the server, e.g. what it was started for.
+     */
+    uint64_t tag;
+} plundervolt_fork_server_t;
+
+/**
+ * @brief One trial to run.
+ *
+ */
+typedef struct plundervolt_trial_request_t {
+    /**
+     * @brief Undervoltage the child sees as plundervolt_get_current_undervoltage(), e.g. in its fault records, in mV.
+     */
+    uint64_t undervoltage;
+    /**
+     * @brief CPU the child pins itself to, or -1 to leave it where the server is.
+     */
+    int cpu;
+    /**
+     * @brief If > 0, the child's loops are finished after trial_ms ms (see plundervolt_loop_is_running()), which ends
+     * looping victims. This only ends the trial, not the campaign.
+     */
+    int trial_ms;
+    /**
+     * @brief Time the child may take beyond trial_ms before it is killed as hung, in ms.
+     */
+    int timeout_ms;
+} plundervolt_trial_request_t;
+
+/**
+ * @brief What a trial did.
+ *
+ */
+typedef struct plundervolt_trial_t {
+    plundervolt_trial_outcome_t outcome;
+    /**
+     * @brief With PLUNDERVOLT_TRIAL_CRASH, the signal which killed the child, or 0 if it exited with a status other than 0.
+     */
+    int signal;
+    /**
+     * @brief With PLUNDERVOLT_TRIAL_CRASH and no signal, the child's exit status.
+     */
+    int status;
+    /**
+     * @brief Faults the child reported.
+     */
+    uint64_t faults;
+    /**
+     * @brief 1 if the child asked for the loops to finish with plundervolt_set_loop_finished().
+     */
+    int stop;
+    /**
+     * @brief Time from sending the request to the child starting its trial, and from there to its end, in ns.
+     */
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} plundervolt_trial_t;
+
+/**
+ * @brief Trials counted by outcome since the last plundervolt_fork_server_reset_stats().
+ *
+ */
+typedef struct plundervolt_trial_stats_t {
+    uint64_t trials;
+    uint64_t outcomes[PLUNDERVOLT_TRIAL_OUTCOMES];
+    /**
+     * @brief Signal of the last crash, and the undervoltage it happened at.
+     */
+    int last_crash_signal;
+    uint64_t last_crash_undervoltage;
+    /**
+     * @brief Sum of plundervolt_trial_t.start_ns, for the mean time it takes to start a trial.
+     */
+    uint64_t total_start_ns;
+} plundervolt_trial_stats_t;
+
+/**
+ * @brief In a child of a fork server, the server's shared block; NULL in every other process. Private.
+ *
+ */
+extern plundervolt_fork_shared_t* plundervolt_victim_shared;
+
+/**
+ * @brief Fork a server. It runs init(arguments) once (if init is not NULL),
+ * then forks a child running trial(arguments) for every request. The server gets a copy of the calling process,
+ * so everything trial needs must be set up before.
+ * Only the calling thread lives on in the server and its children; glibc keeps malloc usable there.
+ *
+ * @param server Where to store the server.
+ * @param init Initialisation of the victim, or NULL.
+ * @param trial The trial, run in every child.
+ * @param arguments Passed to init and trial.
+ * @return plundervolt_error_t PLUNDERVOLT_GENERIC_ERROR if the server cannot be created.
+ */
+plundervolt_error_t plundervolt_fork_server_start(plundervolt_fork_server_t* server, void (* init)(void*), void (* trial)(void*), void* arguments);
+
+/**
+ * @brief Run one trial in a new child of the server and wait for its end. Counts it in the stats.
+ *
+ * @param server A running server.
+ * @param request The trial.
+ * @param result Where to store what the trial did.
+ * @return plundervolt_error_t PLUNDERVOLT_GENERIC_ERROR if the server itself is gone (it is stopped then, and can be started again).
+ */
+plundervolt_error_t plundervolt_fork_server_trial(plundervolt_fork_server_t* server, const plundervolt_trial_request_t* request, plundervolt_trial_t* result);
+
+/**
+ * @brief Stop the server and wait for it. Does nothing if it is not running.
+ *
+ */
+void plundervolt_fork_server_stop(plundervolt_fork_server_t* server);
+
+/**
+ * @brief Copy the trial counts of all servers.
+ *
+ */
+void plundervolt_fork_server_stats(plundervolt_trial_stats_t* stats);
+
+/**
+ * @brief Zero the trial counts.
+ *
+ */
+void plundervolt_fork_server_reset_stats();
+
+/**
+ * @return const char* Name of an outcome, e.g. "crash".
+ */
+const char* plundervolt_trial_outcome_name(plundervolt_trial_outcome_t outcome);
+
+#endif /* PLUNDERVOLT_FORK_SERVER_H */
@@ -0,0 +1,296 @@
+/**
+ * @file plundervolt_grid.c
+ * @brief Parameter-grid campaigns over the hardware glitch.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "plundervolt_grid.h"
+#include "plundervolt_fork_server.h"
+
+/**
+ * @brief Number of values of an axis.
+ *
+ */
+uint64_t grid_axis_count(const plundervolt_grid_axis_t* axis);
+/**
+ * @brief Value of a parameter at a position of its axis, rounded as the specification holds it.
+ *
+ */
+double grid_axis_value(const plundervolt_grid_t* grid, const plundervolt_specification_t* base, int parameter, uint64_t position);
+/**
+ * @brief The parameters from the dearest to change to the cheapest, i.e. from the outermost loop to the innermost.
+ *
+ */
+void grid_order(const plundervolt_grid_t* grid, int* order);
+/**
+ * @brief Key of a point, as compared for duplicates.
+ *
+ */
+plundervolt_grid_key_t grid_key(const double* value);
+/**
+ * @return plundervolt_grid_key_t* Slot of the table holding the key, or the free slot where it belongs.
+ */
+plundervolt_grid_key_t* grid_slot(plundervolt_grid_key_t* table, uint64_t capacity, const plundervolt_grid_key_t* key);
+
+plundervolt_grid_t plundervolt_grid_init() {
+    plundervolt_grid_t grid;
+    memset(&grid, 0, sizeof grid);
+    grid.change_cost[PLUNDERVOLT_GLITCH_VOLTAGE] = 8;
+    grid.change_cost[PLUNDERVOLT_GLITCH_DURATION_START] = 4;
+    grid.change_cost[PLUNDERVOLT_GLITCH_DURATION_DURING] = 2;
+    grid.change_cost[PLUNDERVOLT_GLITCH_DELAY] = 1;
+    return grid;
+}
+
+void plundervolt_grid_free(plundervolt_grid_t* grid) {
+    free(grid->measured);
+    grid->measured = NULL;
+    grid->measured_count = 0;
+    grid->capacity = 0;
+}
+
+uint64_t grid_axis_count(const plundervolt_grid_axis_t* axis) {
+    if (axis->step == 0) {
+        return 1;
+    }
+    double steps = (axis->last - axis->first) / axis->step;
+    if (steps < 0) {
+        return 1; // last is the wrong way from first.
+    }
+    return (uint64_t) floor(steps + 1e-9) + 1;
+}
+
+double grid_axis_value(const plundervolt_grid_t* grid, const plundervolt_specification_t* base, int parameter, uint64_t position) {
+    const plundervolt_grid_axis_t* axis = &grid->axis[parameter];
+    if (axis->first == 0 && axis->last == 0 && axis->step == 0) {
+        switch (parameter) {
+            case PLUNDERVOLT_GLITCH_VOLTAGE:
+                return base->undervolting_voltage;
+            case PLUNDERVOLT_GLITCH_DURATION_START:
+                return base->duration_start;
+            case PLUNDERVOLT_GLITCH_DURATION_DURING:
+                return base->duration_during;
+            default:
+                return base->delay_before_undervolting;
+        }
+    }
+    double value = axis->first + position * axis->step;
+    if (parameter == PLUNDERVOLT_GLITCH_VOLTAGE) {
+        return round(value * 10000) / 10000; // 0.1 mV, so the sum of steps does not drift.
+    }
+    return round(value);
+}
+
+uint64_t plundervolt_grid_points(const plundervolt_grid_t* grid) {
+    uint64_t points = 1;
+    for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        points *= grid_axis_count(&grid->axis[parameter]);
+    }
+    return points;
+}
+
+void grid_order(const plundervolt_grid_t* grid, int* order) {
+    // Insertion sort of 4, stable, so equal costs keep the order of plundervolt_glitch_parameter_t.
+    for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        int i = parameter;
+        while (i > 0 && grid->change_cost[order[i - 1]] < grid->change_cost[parameter]) {
+            order[i] = order[i - 1];
+            i--;
+        }
+        order[i] = parameter;
+    }
+}
+
+void plundervolt_grid_point(const plundervolt_grid_t* grid, const plundervolt_specification_t* base, uint64_t index, double* value) {
+    int order[PLUNDERVOLT_GLITCH_PARAMETERS];
+    grid_order(grid, order);
+    uint64_t inner = plundervolt_grid_points(grid); // Points in one pass of the current loop, and the loops inside it.
+    for (int level = 0; level < PLUNDERVOLT_GLITCH_PARAMETERS; level++) {
+        int parameter = order[level];
+        uint64_t count = grid_axis_count(&grid->axis[parameter]);
+        uint64_t pass = index / inner; // Passes of this loop before the point.
+        inner /= count;
+        uint64_t position = (index / inner) % count;
+        if (pass & 1) { // Every other pass runs backwards, so the loop starts where the last pass ended.
+            position = count - 1 - position;
+        }
+        value[parameter] = grid_axis_value(grid, base, parameter, position);
+    }
+}
+
+plundervolt_grid_key_t grid_key(const double* value) {
+    plundervolt_grid_key_t key;
+    key.value[PLUNDERVOLT_GLITCH_VOLTAGE] = llround(value[PLUNDERVOLT_GLITCH_VOLTAGE] * 10000);
+    for (int parameter = 1; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        key.value[parameter] = llround(value[parameter]);
+    }
+    key.used = 1;
+    return key;
+}
+
+plundervolt_grid_key_t* grid_slot(plundervolt_grid_key_t* table, uint64_t capacity, const plundervolt_grid_key_t* key) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    const uint8_t* bytes = (const uint8_t*) key->value;
+    for (size_t i = 0; i < sizeof key->value; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    }
+    for (uint64_t slot = hash & (capacity - 1);; slot = (slot + 1) & (capacity - 1)) {
+        if (!table[slot].used || memcmp(table[slot].value, key->value, sizeof key->value) == 0) {
+            return &table[slot];
+        }
+    }
+}
+
+int plundervolt_grid_is_measured(const plundervolt_grid_t* grid, const double* value) {
+    if (grid->measured_count == 0) {
+        return 0;
+    }
+    plundervolt_grid_key_t key = grid_key(value);
+    return grid_slot(grid->measured, grid->capacity, &key)->used;
+}
+
+void plundervolt_grid_mark_measured(plundervolt_grid_t* grid, const double* value) {
+    if ((grid->measured_count + 1) * 2 > grid->capacity) {
+        // Keep the table at most half full, so the probes stay short.
+        uint64_t capacity = grid->capacity ? grid->capacity * 2 : 1024;
+        plundervolt_grid_key_t* table = calloc(capacity, sizeof(plundervolt_grid_key_t));
+        for (uint64_t slot = 0; slot < grid->capacity; slot++) {
+            if (grid->measured[slot].used) {
+                *grid_slot(table, capacity, &grid->measured[slot]) = grid->measured[slot];
+            }
+        }
+        free(grid->measured);
+        grid->measured = table;
+        grid->capacity = capacity;
+    }
+    plundervolt_grid_key_t key = grid_key(value);
+    plundervolt_grid_key_t* slot = grid_slot(grid->measured, grid->capacity, &key);
+    if (!slot->used) {
+        *slot = key;
+        grid->measured_count++;
+    }
+}
+
+plundervolt_error_t plundervolt_grid_load_results(plundervolt_grid_t* grid, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    char line[256];
+    while (fgets(line, sizeof line, file) != NULL) {
+        double value[PLUNDERVOLT_GLITCH_PARAMETERS];
+        if (sscanf(line, "%lf,%lf,%lf,%lf", &value[0], &value[1], &value[2], &value[3]) == PLUNDERVOLT_GLITCH_PARAMETERS) {
+            plundervolt_grid_mark_measured(grid, value); // The header does not scan.
+        }
+    }
+    fclose(file);
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_error_t plundervolt_grid_measure(plundervolt_specification_t* spec, plundervolt_grid_result_t* result) {
+    spec->undervolting_voltage = (float) result->value[PLUNDERVOLT_GLITCH_VOLTAGE];
+    spec->duration_start = (int) result->value[PLUNDERVOLT_GLITCH_DURATION_START];
+    spec->duration_during = (int) result->value[PLUNDERVOLT_GLITCH_DURATION_DURING];
+    spec->delay_before_undervolting = (int) result->value[PLUNDERVOLT_GLITCH_DELAY];
+    plundervolt_error_t error_check = plundervolt_set_specification(*spec);
+    if (error_check) {
+        return error_check;
+    }
+    uint64_t start = plundervolt_monotonic_ns();
+    error_check = plundervolt_run();
+    if (error_check) {
+        return error_check;
+    }
+    plundervolt_estimate_t estimate;
+    plundervolt_get_estimate(&estimate);
+    if (spec->journal != NULL && estimate.trials == 0) {
+        // The journal held the point's campaign as finished, but its result was lost: the run only ended it, so measure again.
+        start = plundervolt_monotonic_ns();
+        error_check = plundervolt_run();
+        if (error_check) {
+            return error_check;
+        }
+        plundervolt_get_estimate(&estimate);
+    }
+    result->duration_ns = plundervolt_monotonic_ns() - start;
+    result->tries = estimate.trials;
+    result->faulty_tries = estimate.events;
+    result->fault_rate = estimate.rate;
+    result->lower = estimate.lower;
+    result->upper = estimate.upper;
+    result->verdict = estimate.verdict;
+    result->faults = plundervolt_get_fault_count();
+    result->crashes = 0;
+    if (spec->fork_server) {
+        plundervolt_trial_stats_t stats;
+        plundervolt_fork_server_stats(&stats);
+        result->crashes = stats.outcomes[PLUNDERVOLT_TRIAL_CRASH] + stats.outcomes[PLUNDERVOLT_TRIAL_HANG];
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void plundervolt_grid_write_result(FILE* results, const plundervolt_grid_result_t* result) {
+    if (fseek(results, 0, SEEK_END) != 0 || ftell(results) <= 0) {
+        fprintf(results, "undervolting_voltage,duration_start,duration_during,delay_before_undervolting,tries,faults,crashes,duration_us,fault_rate,lower,upper,verdict\n");
+    }
+    fprintf(results, "%.4f,%d,%d,%d,%lu,%lu,%lu,%lu,%.4f,%.4f,%.4f,%s\n", result->value[PLUNDERVOLT_GLITCH_VOLTAGE],
+        (int) result->value[PLUNDERVOLT_GLITCH_DURATION_START], (int) result->value[PLUNDERVOLT_GLITCH_DURATION_DURING],
+        (int) result->value[PLUNDERVOLT_GLITCH_DELAY], result->tries, result->faults, result->crashes, result->duration_ns / 1000,
+        result->fault_rate, result->lower, result->upper, plundervolt_verdict_name(result->verdict));
+    fflush(results);
+}
+
+plundervolt_error_t plundervolt_grid_run(plundervolt_grid_t* grid, plundervolt_specification_t spec) {
+    grid->points_run = 0;
+    grid->points_skipped = 0;
+    grid->points_unsafe = 0;
+    grid->tries_run = 0;
+    grid->change_cost_total = 0;
+
+    uint64_t points = plundervolt_grid_points(grid);
+    double previous[PLUNDERVOLT_GLITCH_PARAMETERS];
+    for (uint64_t index = 0; index < points; index++) {
+        plundervolt_grid_result_t result;
+        memset(&result, 0, sizeof result);
+        result.index = index;
+        plundervolt_grid_point(grid, &spec, index, result.value);
+        if (plundervolt_grid_is_measured(grid, result.value)) {
+            grid->points_skipped++;
+            continue;
+        }
+        if (grid->budget > 0 && grid->tries_run + spec.tries > grid->budget) {
+            break;
+        }
+        plundervolt_error_t error_check = plundervolt_grid_measure(&spec, &result);
+        if (error_check == PLUNDERVOLT_UNSAFE_RANGE_ERROR) {
+            grid->points_unsafe++; // The machine died as low before; the rest of the grid may still be safe.
+            continue;
+        }
+        if (error_check) {
+            return error_check;
+        }
+
+        plundervolt_grid_mark_measured(grid, result.value);
+        for (int parameter = 0; grid->points_run > 0 && parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+            if (result.value[parameter] != previous[parameter]) {
+                grid->change_cost_total += grid->change_cost[parameter];
+            }
+        }
+        memcpy(previous, result.value, sizeof previous);
+        grid->points_run++;
+        grid->tries_run += result.tries;
+
+        if (grid->results != NULL) {
+            plundervolt_grid_write_result(grid->results, &result);
+        }
+        if (grid->on_result != NULL && grid->on_result(&result, grid->context)) {
+            break;
+        }
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
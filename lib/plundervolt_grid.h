@@ -0,0 +1,221 @@
+/**
+ * @file plundervolt_grid.h
+ * @brief Parameter-grid campaigns over the hardware glitch: undervolting_voltage, duration_start, duration_during and
+ * delay_before_undervolting.
+ *
+ * plundervolt_grid_run() runs plundervolt_run() once for every point of the grid. The points are ordered so the
+ * parameters which are expensive to change (by change_cost, e.g. the voltage, which the regulator has to slew to)
+ * change as rarely as possible: the most expensive parameter is the outermost loop, and every inner loop runs back and
+ * forth, so two points in a row differ in one parameter, by one step. Points measured before (in this grid, or loaded
+ * from an earlier results file) are skipped, the campaign stops at its budget of tries, and every result is streamed to
+ * a callback and a CSV file as soon as it is measured.
+ *
+ */
+/* plundervolt_grid.h */
+
+#ifndef PLUNDERVOLT_GRID_H
+#define PLUNDERVOLT_GRID_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "plundervolt.h"
+#include "plundervolt_estimate.h"
+
+/**
+ * @brief Glitch parameters a grid can sweep, i.e. fields of plundervolt_specification_t.
+ *
+ */
+typedef enum plundervolt_glitch_parameter_t {
+    PLUNDERVOLT_GLITCH_VOLTAGE = 0, // undervolting_voltage, in V.
+    PLUNDERVOLT_GLITCH_DURATION_START = 1, // duration_start.
+    PLUNDERVOLT_GLITCH_DURATION_DURING = 2, // duration_during.
+    PLUNDERVOLT_GLITCH_DELAY = 3, // delay_before_undervolting, in ms.
+    PLUNDERVOLT_GLITCH_PARAMETERS = 4 // Number of parameters.
+} plundervolt_glitch_parameter_t;
+
+/**
+ * @brief Values of one parameter: first, first + step, ... up to last (inclusive). step may be negative, e.g. to
+ * lower the voltage. With step 0, only first. An axis with first, last and step all 0 keeps the value of the
+ * specification passed to plundervolt_grid_run().
+ *
+ */
+typedef struct plundervolt_grid_axis_t {
+    double first;
+    double last;
+    double step;
+} plundervolt_grid_axis_t;
+
+/**
+ * @brief What one point of the grid did.
+ *
+ */
+typedef struct plundervolt_grid_result_t {
+    /**
+     * @brief Position of the point in the schedule, from 0, counting the skipped ones.
+     */
+    uint64_t index;
+    /**
+     * @brief The point, indexed by plundervolt_glitch_parameter_t.
+     */
+    double value[PLUNDERVOLT_GLITCH_PARAMETERS];
+    /**
+     * @brief Tries run (fewer than the specification's tries if its stop_rule decided early), faults reported with
+     * plundervolt_report_fault(), and, with fork_server, trials which crashed or hung.
+     */
+    uint64_t tries;
+    uint64_t faults;
+    uint64_t crashes;
+    /**
+     * @brief Tries which counted as faulty (see plundervolt_specification_t.stop_rule).
+     */
+    uint64_t faulty_tries;
+    /**
+     * @brief Fault rate of the tries, its Wilson interval, and the verdict (see plundervolt_estimate.h).
+     */
+    double fault_rate;
+    double lower;
+    double upper;
+    plundervolt_verdict_t verdict;
+    /**
+     * @brief Time plundervolt_run() took, in ns.
+     */
+    uint64_t duration_ns;
+} plundervolt_grid_result_t;
+
+/**
+ * @brief Point of a grid, as it is compared for duplicates: the voltage in 0.1 mV, the others as the ints the
+ * specification holds. Private.
+ *
+ */
+typedef struct plundervolt_grid_key_t {
+    int64_t value[PLUNDERVOLT_GLITCH_PARAMETERS];
+    int used; // 1 if the slot of the table holds a key.
+} plundervolt_grid_key_t;
+
+/**
+ * @brief A grid campaign. Made by plundervolt_grid_init(), freed by plundervolt_grid_free().
+ *
+ */
+typedef struct plundervolt_grid_t {
+    /**
+     * @brief Values of every parameter, indexed by plundervolt_glitch_parameter_t.
+     */
+    plundervolt_grid_axis_t axis[PLUNDERVOLT_GLITCH_PARAMETERS];
+    /**
+     * @brief Relative cost of changing every parameter between two points. The dearest parameter changes least often.
+     * Default: the voltage 8, duration_start 4, duration_during 2, the delay 1.
+     */
+    double change_cost[PLUNDERVOLT_GLITCH_PARAMETERS];
+    /**
+     * @brief Most tries to run in the campaign; a point which may not fit (with all the specification's tries) is not run.
+     * 0 for no limit. Default is 0. With a stop_rule, points which are clearly clean or faulty use fewer tries, and more are left for the others.
+     */
+    uint64_t budget;
+    /**
+     * @brief If not NULL, a CSV line is written and flushed for every result (with a header if the file is empty).
+     * plundervolt_grid_load_results() reads it back. Default is NULL.
+     */
+    FILE* results;
+    /**
+     * @brief If not NULL, called with every result as soon as it is measured. Returning != 0 stops the campaign,
+     * e.g. at the first fault. Default is NULL.
+     */
+    int (* on_result)(const plundervolt_grid_result_t* result, void* context);
+    void* context;
+
+    /**
+     * @brief After plundervolt_grid_run(): points run, points skipped as measured before, points skipped as the
+     * journal marks their glitch voltage unsafe, tries run, and the sum of change_cost over all changes of parameter
+     * between two points run in a row.
+     */
+    uint64_t points_run;
+    uint64_t points_skipped;
+    uint64_t points_unsafe;
+    uint64_t tries_run;
+    double change_cost_total;
+
+    /**
+     * @brief Points measured so far: an open-addressing hash table of capacity slots (a power of 2). Private.
+     */
+    plundervolt_grid_key_t* measured;
+    uint64_t measured_count;
+    uint64_t capacity;
+} plundervolt_grid_t;
+
+/**
+ * @brief Make a grid with default settings and no axis set.
+ *
+ * @return plundervolt_grid_t The grid.
+ */
+plundervolt_grid_t plundervolt_grid_init();
+
+/**
+ * @brief Free the measured points of a grid.
+ *
+ */
+void plundervolt_grid_free(plundervolt_grid_t* grid);
+
+/**
+ * @brief Number of points in the grid, measured or not.
+ *
+ */
+uint64_t plundervolt_grid_points(const plundervolt_grid_t* grid);
+
+/**
+ * @brief The point at a position of the schedule.
+ *
+ * @param grid The grid.
+ * @param base Specification the values of the unset axes come from.
+ * @param index Position, from 0 to plundervolt_grid_points() - 1.
+ * @param value Where to store the point, indexed by plundervolt_glitch_parameter_t.
+ */
+void plundervolt_grid_point(const plundervolt_grid_t* grid, const plundervolt_specification_t* base, uint64_t index, double* value);
+
+/**
+ * @brief Remember a point as measured, so plundervolt_grid_run() skips it.
+ *
+ */
+void plundervolt_grid_mark_measured(plundervolt_grid_t* grid, const double* value);
+
+/**
+ * @return int 1 if the point is measured.
+ */
+int plundervolt_grid_is_measured(const plundervolt_grid_t* grid, const double* value);
+
+/**
+ * @brief Mark every point of a results file (see plundervolt_grid_t.results) as measured, e.g. the one of an
+ * interrupted campaign before it is run again.
+ *
+ * @return plundervolt_error_t PLUNDERVOLT_GENERIC_ERROR if the file cannot be read.
+ */
+plundervolt_error_t plundervolt_grid_load_results(plundervolt_grid_t* grid, const char* path);
+
+/**
+ * @brief Measure one point: set its parameters in spec, set spec as the specification, and run it. If the journal holds
+ * the point's campaign as finished (its result was lost, e.g. the machine died before it was written), that run only
+ * ends it, and the point is run again.
+ *
+ * @param spec Specification of the point but the parameters of the grid. Its parameters are changed.
+ * @param result value holds the point; the rest is filled in.
+ * @return plundervolt_error_t As plundervolt_set_specification() and plundervolt_run().
+ */
+plundervolt_error_t plundervolt_grid_measure(plundervolt_specification_t* spec, plundervolt_grid_result_t* result);
+
+/**
+ * @brief Write a result as a CSV line, after a header if the file is empty, and flush it.
+ *
+ */
+void plundervolt_grid_write_result(FILE* results, const plundervolt_grid_result_t* result);
+
+/**
+ * @brief Run the campaign: set the parameters of every point in spec, set it as the specification, and run it.
+ * The library must be initialised, and spec a valid hardware specification.
+ *
+ * @param grid The grid.
+ * @param spec Specification of every point but the parameters of the grid.
+ * @return plundervolt_error_t The first error of plundervolt_set_specification() or plundervolt_run(), which ends the campaign.
+ * Points which get PLUNDERVOLT_UNSAFE_RANGE_ERROR (see plundervolt_specification_t.journal) are skipped instead.
+ */
+plundervolt_error_t plundervolt_grid_run(plundervolt_grid_t* grid, plundervolt_specification_t spec);
+
+#endif /* PLUNDERVOLT_GRID_H */
@@ -0,0 +1,203 @@
+/**
+ * @file plundervolt_instrument.c
+ * @brief Timing of every phase of a run.
+ *
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include "plundervolt_instrument.h"
+
+/**
+ * @brief Histograms of one thread. Aligned, so threads never share a cache line.
+ *
+ */
+typedef struct thread_histograms_t {
+    _Alignas(64) uint64_t buckets[PLUNDERVOLT_PHASES][PLUNDERVOLT_INSTRUMENT_BUCKETS];
+    uint64_t min[PLUNDERVOLT_PHASES];
+    uint64_t max[PLUNDERVOLT_PHASES];
+} thread_histograms_t;
+
+int plundervolt_instrument_enabled = 0;
+thread_histograms_t instrument_histograms[PLUNDERVOLT_INSTRUMENT_THREADS]; // Preallocated; only the pages of threads which record are touched.
+atomic_int instrument_next_slot = 0; // Next histogram set to hand out.
+__thread int instrument_slot = -1; // Histogram set of the calling thread.
+double instrument_ns_per_cycle = 1.0; // Set by instrument_calibrate().
+_Atomic uint64_t instrument_fired_at = 0; // Time stamp of the last fire not yet matched by a victim start.
+_Atomic uint64_t instrument_stopped_at = 0; // Time stamp of the last stop not yet matched by a restore.
+
+/**
+ * @brief Measure the time stamp counter frequency against CLOCK_MONOTONIC_RAW.
+ *
+ */
+void instrument_calibrate();
+/**
+ * @brief Map a duration to its histogram bucket: exact below 16, then 16 buckets per power of 2.
+ *
+ */
+int instrument_bucket_of(uint64_t cycles);
+/**
+ * @brief Middle of the durations falling into a bucket.
+ *
+ */
+uint64_t instrument_bucket_middle(int bucket);
+
+void instrument_calibrate() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    uint64_t start_cycles = __rdtsc();
+    do {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    } while ((end.tv_sec - start.tv_sec) * 1000000000l + (end.tv_nsec - start.tv_nsec) < 10000000l);
+    uint64_t cycles = __rdtsc() - start_cycles;
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    instrument_ns_per_cycle = cycles ? ns / cycles : 1.0;
+}
+
+int instrument_bucket_of(uint64_t cycles) {
+    if (cycles < 16) {
+        return (int) cycles;
+    }
+    int msb = 63 - __builtin_clzll(cycles);
+    return (msb - 3) * 16 + (int)((cycles >> (msb - 4)) & 15);
+}
+
+uint64_t instrument_bucket_middle(int bucket) {
+    if (bucket < 16) {
+        return bucket;
+    }
+    int msb = bucket / 16 + 3;
+    uint64_t start = (uint64_t)(16 + bucket % 16) << (msb - 4);
+    return start + ((1ul << (msb - 4)) >> 1);
+}
+
+void plundervolt_instrument_enable(int enable) {
+    if (enable && !plundervolt_instrument_enabled) {
+        instrument_calibrate();
+    }
+    plundervolt_instrument_enabled = enable;
+}
+
+void plundervolt_instrument_reset() {
+    int used = atomic_load(&instrument_next_slot);
+    for (int i = 0; i < used && i < PLUNDERVOLT_INSTRUMENT_THREADS; i++) {
+        memset(&instrument_histograms[i], 0, sizeof instrument_histograms[i]);
+    }
+}
+
+void plundervolt_instrument_record(plundervolt_phase_t phase, uint64_t cycles) {
+    if (instrument_slot == -1) {
+        instrument_slot = atomic_fetch_add(&instrument_next_slot, 1);
+        if (instrument_slot >= PLUNDERVOLT_INSTRUMENT_THREADS) {
+            instrument_slot = PLUNDERVOLT_INSTRUMENT_THREADS - 1;
+        }
+    }
+    thread_histograms_t* own = &instrument_histograms[instrument_slot];
+    own->buckets[phase][instrument_bucket_of(cycles)]++;
+    if (own->min[phase] == 0 || cycles < own->min[phase]) {
+        own->min[phase] = cycles ? cycles : 1;
+    }
+    if (cycles > own->max[phase]) {
+        own->max[phase] = cycles;
+    }
+}
+
+void plundervolt_instrument_summary(plundervolt_phase_t phase, plundervolt_phase_summary_t* summary) {
+    static uint64_t merged[PLUNDERVOLT_INSTRUMENT_BUCKETS];
+    memset(merged, 0, sizeof merged);
+    memset(summary, 0, sizeof *summary);
+    uint64_t min = 0, max = 0;
+
+    int used = atomic_load(&instrument_next_slot);
+    for (int i = 0; i < used && i < PLUNDERVOLT_INSTRUMENT_THREADS; i++) {
+        for (int bucket = 0; bucket < PLUNDERVOLT_INSTRUMENT_BUCKETS; bucket++) {
+            merged[bucket] += instrument_histograms[i].buckets[phase][bucket];
+            summary->count += instrument_histograms[i].buckets[phase][bucket];
+        }
+        if (instrument_histograms[i].min[phase] && (min == 0 || instrument_histograms[i].min[phase] < min)) {
+            min = instrument_histograms[i].min[phase];
+        }
+        if (instrument_histograms[i].max[phase] > max) {
+            max = instrument_histograms[i].max[phase];
+        }
+    }
+    if (summary->count == 0) {
+        return;
+    }
+
+    double* percentiles[] = {&summary->p50_ns, &summary->p90_ns, &summary->p99_ns};
+    double fractions[] = {0.50, 0.90, 0.99};
+    uint64_t seen = 0;
+    int next = 0;
+    for (int bucket = 0; bucket < PLUNDERVOLT_INSTRUMENT_BUCKETS && next < 3; bucket++) {
+        seen += merged[bucket];
+        while (next < 3 && seen >= fractions[next] * summary->count) {
+            // The exact extremes are known; keep the bucket estimate within them.
+            uint64_t cycles = instrument_bucket_middle(bucket);
+            cycles = cycles < min ? min : cycles > max ? max : cycles;
+            *percentiles[next++] = cycles * instrument_ns_per_cycle;
+        }
+    }
+    summary->min_ns = min * instrument_ns_per_cycle;
+    summary->max_ns = max * instrument_ns_per_cycle;
+}
+
+void plundervolt_instrument_dump(FILE* file) {
+    const char* names[PLUNDERVOLT_PHASES] = {
+        "run", "release to victim", "fire to victim", "software undervolt", "configure glitch",
+        "arm glitch", "fire glitch", "stop to restore", "reset voltage", "wait",
+        "trial start"
+    };
+    fprintf(file, "%-20s %10s %12s %12s %12s %12s %12s\n", "phase", "count", "min ns", "p50 ns", "p90 ns", "p99 ns", "max ns");
+    for (int phase = 0; phase < PLUNDERVOLT_PHASES; phase++) {
+        plundervolt_phase_summary_t summary;
+        plundervolt_instrument_summary(phase, &summary);
+        if (summary.count == 0) {
+            continue;
+        }
+        fprintf(file, "%-20s %10lu %12.0f %12.0f %12.0f %12.0f %12.0f\n", names[phase], summary.count,
+            summary.min_ns, summary.p50_ns, summary.p90_ns, summary.p99_ns, summary.max_ns);
+    }
+}
+
+void plundervolt_instrument_run_started() {
+    // Marks left over from the previous run, e.g. its final stop, must not end a phase in this one.
+    atomic_store_explicit(&instrument_fired_at, 0, memory_order_relaxed);
+    atomic_store_explicit(&instrument_stopped_at, 0, memory_order_relaxed);
+}
+
+void plundervolt_instrument_fired() {
+    if (plundervolt_instrument_enabled) {
+        atomic_store_explicit(&instrument_fired_at, __rdtsc(), memory_order_relaxed);
+    }
+}
+
+void plundervolt_instrument_victim_started() {
+    if (plundervolt_instrument_enabled) {
+        // Only the first victim to start after a fire ends the phase.
+        uint64_t fired = atomic_exchange_explicit(&instrument_fired_at, 0, memory_order_relaxed);
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_FIRE_TO_VICTIM, fired);
+    }
+}
+
+void plundervolt_instrument_stop_requested() {
+    if (plundervolt_instrument_enabled) {
+        uint64_t expected = 0;
+        // Keep the first stop; later ones are the other threads agreeing.
+        atomic_compare_exchange_strong_explicit(&instrument_stopped_at, &expected, __rdtsc(), memory_order_relaxed, memory_order_relaxed);
+    }
+}
+
+void plundervolt_instrument_restored() {
+    if (plundervolt_instrument_enabled) {
+        uint64_t stopped = atomic_exchange_explicit(&instrument_stopped_at, 0, memory_order_relaxed);
+        plundervolt_instrument_end(PLUNDERVOLT_PHASE_STOP_TO_RESTORE, stopped);
+    }
+}
+
+uint64_t plundervolt_monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file plundervolt_instrument.h
+ * @brief Timing of every phase of a run.
+ *
+ * When enabled, the library takes a time stamp counter (rdtsc) reading at the boundaries of every phase
+ * listed in plundervolt_phase_t and adds the duration to a histogram. Histograms are preallocated per
+ * thread, so recording never allocates, locks or shares a cache line with another thread. They are
+ * log-linear (16 buckets per power of 2, about 6% resolution), like HDR histograms.
+ * When disabled (the default), every boundary costs one load and a predicted branch.
+ *
+ */
+/* plundervolt_instrument.h */
+
+#ifndef PLUNDERVOLT_INSTRUMENT_H
+#define PLUNDERVOLT_INSTRUMENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <x86intrin.h>
+
+/**
+ * @brief Phases the library times.
+ *
+ */
+typedef enum {
+    PLUNDERVOLT_PHASE_RUN = 0, // Whole plundervolt_run().
+    PLUNDERVOLT_PHASE_RELEASE_TO_VICTIM = 1, // plundervolt_run() releasing the threads, to a thread starting the function.
+    PLUNDERVOLT_PHASE_FIRE_TO_VICTIM = 2, // plundervolt_fire_glitch(), to plundervolt_instrument_victim_started().
+    PLUNDERVOLT_PHASE_SOFTWARE_UNDERVOLT = 3, // plundervolt_software_undervolt(), i.e. its msr writes.
+    PLUNDERVOLT_PHASE_CONFIGURE_GLITCH = 4, // plundervolt_configure_glitch(), including Teensy's responses.
+    PLUNDERVOLT_PHASE_ARM_GLITCH = 5, // plundervolt_arm_glitch(), including Teensy's response.
+    PLUNDERVOLT_PHASE_FIRE_GLITCH = 6, // plundervolt_fire_glitch().
+    PLUNDERVOLT_PHASE_STOP_TO_RESTORE = 7, // plundervolt_set_loop_finished(), to the undervolting thread restoring the voltage.
+    PLUNDERVOLT_PHASE_RESET_VOLTAGE = 8, // plundervolt_reset_voltage().
+    PLUNDERVOLT_PHASE_WAIT = 9, // A wait of the hardware loop for its wait_time deadline, cut short when the loops finish.
+    PLUNDERVOLT_PHASE_TRIAL_START = 10, // A fork server trial being requested, to its child being forked.
+    PLUNDERVOLT_PHASES = 11 // Number of phases.
+} plundervolt_phase_t;
+
+/**
+ * @brief Number of threads which can record. Further threads share the last histogram set (and may race on it).
+ *
+ */
+#define PLUNDERVOLT_INSTRUMENT_THREADS 32
+
+/**
+ * @brief Number of buckets of every histogram.
+ *
+ */
+#define PLUNDERVOLT_INSTRUMENT_BUCKETS 1024
+
+/**
+ * @brief >0 if instrumentation is enabled. Private; use plundervolt_instrument_enable().
+ */
+extern int plundervolt_instrument_enabled;
+
+/**
+ * @brief Enable or disable instrumentation. Enabling calibrates the time stamp counter against CLOCK_MONOTONIC_RAW (takes about 10 ms).
+ *
+ * @param enable >0 to enable, 0 to disable.
+ */
+void plundervolt_instrument_enable(int enable);
+
+/**
+ * @brief Empty all histograms.
+ *
+ */
+void plundervolt_instrument_reset();
+
+/**
+ * @brief Print count, minimum, percentiles and maximum of every phase, in ns, merged over all threads.
+ *
+ * @param file Where to print, e.g. stdout.
+ */
+void plundervolt_instrument_dump(FILE* file);
+
+/**
+ * @brief Summary of one phase, merged over all threads.
+ *
+ */
+typedef struct plundervolt_phase_summary_t {
+    uint64_t count;
+    double min_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double max_ns;
+} plundervolt_phase_summary_t;
+
+/**
+ * @brief Summarise the histograms of one phase.
+ *
+ * @param phase The phase.
+ * @param summary Where to store the summary.
+ */
+void plundervolt_instrument_summary(plundervolt_phase_t phase, plundervolt_phase_summary_t* summary);
+
+/**
+ * @brief Add a duration to the calling thread's histogram of a phase. Usually called through plundervolt_instrument_end().
+ *
+ * @param phase The phase.
+ * @param cycles Duration in time stamp counter cycles.
+ */
+void plundervolt_instrument_record(plundervolt_phase_t phase, uint64_t cycles);
+
+/**
+ * @brief Take the time stamp at which a phase starts.
+ *
+ * @return uint64_t The time stamp, or 0 if instrumentation is disabled.
+ */
+static inline __attribute__((always_inline)) uint64_t plundervolt_instrument_begin() {
+    return __builtin_expect(plundervolt_instrument_enabled, 0) ? __rdtsc() : 0;
+}
+
+/**
+ * @brief Record the end of a phase started with plundervolt_instrument_begin(). Does nothing if the start was not taken.
+ *
+ * @param phase The phase.
+ * @param start What plundervolt_instrument_begin() returned.
+ */
+static inline __attribute__((always_inline)) void plundervolt_instrument_end(plundervolt_phase_t phase, uint64_t start) {
+    if (__builtin_expect(start != 0, 0)) {
+        plundervolt_instrument_record(phase, __rdtsc() - start);
+    }
+}
+
+/**
+ * @brief Mark that the user's function has started its first iteration after plundervolt_fire_glitch(), ending PLUNDERVOLT_PHASE_FIRE_TO_VICTIM.
+ * The library's kernels call this themselves.
+ *
+ */
+void plundervolt_instrument_victim_started();
+
+/**
+ * @brief Mark that the loops were told to stop, starting PLUNDERVOLT_PHASE_STOP_TO_RESTORE. Called by plundervolt_set_loop_finished().
+ *
+ */
+void plundervolt_instrument_stop_requested();
+
+/**
+ * @brief Mark that the voltage was restored after a stop, ending PLUNDERVOLT_PHASE_STOP_TO_RESTORE.
+ *
+ */
+void plundervolt_instrument_restored();
+
+/**
+ * @brief Forget the fire and stop marks of the previous run. Called by plundervolt_run().
+ *
+ */
+void plundervolt_instrument_run_started();
+
+/**
+ * @brief Mark that plundervolt_fire_glitch() fired, starting PLUNDERVOLT_PHASE_FIRE_TO_VICTIM.
+ *
+ */
+void plundervolt_instrument_fired();
+
+/**
+ * @brief The library's clock for waits and durations, which changes of the wall clock do not move.
+ *
+ * @return uint64_t CLOCK_MONOTONIC time, in ns.
+ */
+uint64_t plundervolt_monotonic_ns();
+
+#endif /* PLUNDERVOLT_INSTRUMENT_H */
@@ -0,0 +1,233 @@
+/**
+ * @file plundervolt_journal.c
+ * @brief Append-only, checksummed on-disk journal of campaign progress, to resume after the machine locks up.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "plundervolt_journal.h"
+
+/**
+ * @brief Update the state with a record, as if it had just been read back.
+ *
+ */
+void journal_apply(plundervolt_journal_state_t* state, const plundervolt_journal_record_t* record);
+/**
+ * @brief Write all of a buffer, retrying short writes.
+ *
+ * @return int 0 on success, -1 on error.
+ */
+int journal_write(int fd, const void* data, size_t length);
+/**
+ * @return int64_t Highest of count values, or INT64_MIN if there are none.
+ */
+int64_t journal_highest(const int64_t* values, int count);
+
+uint32_t plundervolt_journal_crc32(const void* data, size_t length) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void journal_apply(plundervolt_journal_state_t* state, const plundervolt_journal_record_t* record) {
+    state->records++;
+    switch (record->type) {
+        case PLUNDERVOLT_JOURNAL_CAMPAIGN:
+            state->has_campaign = 1;
+            state->fingerprint = (uint64_t) record->value;
+            state->hardware = record->count != 0;
+            state->open = 1;
+            state->has_step = 0;
+            state->has_done = 0;
+            state->in_step = 0;
+            state->tries = 0;
+            state->faults = 0;
+            break;
+        case PLUNDERVOLT_JOURNAL_STEP:
+            state->has_step = 1;
+            state->last_step = record->value;
+            state->in_step = 1;
+            break;
+        case PLUNDERVOLT_JOURNAL_STEP_DONE:
+            state->has_done = 1;
+            state->last_done = record->value;
+            state->faults += record->count;
+            state->in_step = 0;
+            break;
+        case PLUNDERVOLT_JOURNAL_TRY:
+            state->tries = record->count;
+            break;
+        case PLUNDERVOLT_JOURNAL_UNSAFE:
+            if (state->hardware && state->unsafe_voltage_count < PLUNDERVOLT_JOURNAL_UNSAFE_MAX) {
+                state->unsafe_voltage[state->unsafe_voltage_count++] = record->value;
+            } else if (!state->hardware && state->unsafe_count < PLUNDERVOLT_JOURNAL_UNSAFE_MAX) {
+                state->unsafe[state->unsafe_count++] = record->value;
+            }
+            if (state->in_step && state->last_step == record->value) { // The crashed step counts as not started.
+                state->in_step = 0;
+                state->has_step = state->has_done;
+                state->last_step = state->last_done;
+            }
+            break;
+        case PLUNDERVOLT_JOURNAL_END:
+            state->open = 0;
+            state->in_step = 0;
+            break;
+    }
+}
+
+int journal_write(int fd, const void* data, size_t length) {
+    const char* bytes = (const char*) data;
+    while (length > 0) {
+        ssize_t n = write(fd, bytes, length);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += n;
+        length -= n;
+    }
+    return 0;
+}
+
+plundervolt_error_t plundervolt_journal_open(plundervolt_journal_t* journal, const char* path, int sync_ms) {
+    memset(journal, 0, sizeof *journal);
+    journal->sync_ns = sync_ms > 0 ? sync_ms * 1000000ull : 0;
+    journal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (journal->fd == -1) {
+        return PLUNDERVOLT_JOURNAL_ERROR;
+    }
+
+    // Read back every record up to the first one which is torn or does not check out.
+    plundervolt_journal_record_t record;
+    off_t valid = 0;
+    while (pread(journal->fd, &record, sizeof record, valid) == sizeof record
+        && record.magic == PLUNDERVOLT_JOURNAL_MAGIC && record.sequence == journal->state.records
+        && record.crc == plundervolt_journal_crc32(&record, offsetof(plundervolt_journal_record_t, crc))) {
+        journal_apply(&journal->state, &record);
+        valid += sizeof record;
+    }
+    struct stat file;
+    if (fstat(journal->fd, &file) == -1) {
+        plundervolt_journal_close(journal);
+        return PLUNDERVOLT_JOURNAL_ERROR;
+    }
+    if (file.st_size > valid) {
+        journal->state.truncated_bytes = file.st_size - valid;
+        if (ftruncate(journal->fd, valid) == -1) {
+            plundervolt_journal_close(journal);
+            return PLUNDERVOLT_JOURNAL_ERROR;
+        }
+    }
+    if (lseek(journal->fd, valid, SEEK_SET) == -1) {
+        plundervolt_journal_close(journal);
+        return PLUNDERVOLT_JOURNAL_ERROR;
+    }
+    journal->synced_at = plundervolt_monotonic_ns();
+
+    // The machine died inside a step: that undervoltage is unsafe.
+    plundervolt_journal_state_t* state = &journal->state;
+    if (state->open && state->in_step) {
+        plundervolt_error_t error_check = plundervolt_journal_append(journal, PLUNDERVOLT_JOURNAL_UNSAFE, state->last_step, 0);
+        if (error_check) {
+            plundervolt_journal_close(journal);
+            return error_check;
+        }
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_error_t plundervolt_journal_append(plundervolt_journal_t* journal, plundervolt_journal_record_type_t type, int64_t value, uint64_t count) {
+    if (journal->pending == PLUNDERVOLT_JOURNAL_BUFFER && plundervolt_journal_sync(journal)) {
+        return PLUNDERVOLT_JOURNAL_ERROR;
+    }
+    plundervolt_journal_record_t* record = &journal->buffer[journal->pending++];
+    memset(record, 0, sizeof *record);
+    record->magic = PLUNDERVOLT_JOURNAL_MAGIC;
+    record->type = type;
+    record->sequence = journal->state.records;
+    record->value = value;
+    record->count = count;
+    record->time = (uint64_t) time(NULL);
+    record->crc = plundervolt_journal_crc32(record, offsetof(plundervolt_journal_record_t, crc));
+    journal_apply(&journal->state, record);
+
+    int durable = type == PLUNDERVOLT_JOURNAL_CAMPAIGN || type == PLUNDERVOLT_JOURNAL_UNSAFE || type == PLUNDERVOLT_JOURNAL_END
+        || (type == PLUNDERVOLT_JOURNAL_STEP && (journal->durable_step == 0 || value < journal->durable_step));
+    if (type == PLUNDERVOLT_JOURNAL_CAMPAIGN) {
+        journal->durable_step = 0; // A new campaign starts shallow again.
+    }
+    if (!durable) {
+        return PLUNDERVOLT_NO_ERROR;
+    }
+    if (plundervolt_journal_sync(journal)) {
+        return PLUNDERVOLT_JOURNAL_ERROR;
+    }
+    if (type == PLUNDERVOLT_JOURNAL_STEP) {
+        journal->durable_step = value;
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+plundervolt_error_t plundervolt_journal_checkpoint(plundervolt_journal_t* journal) {
+    if (journal->pending == 0 || plundervolt_monotonic_ns() - journal->synced_at < journal->sync_ns) {
+        return PLUNDERVOLT_NO_ERROR;
+    }
+    return plundervolt_journal_sync(journal);
+}
+
+plundervolt_error_t plundervolt_journal_sync(plundervolt_journal_t* journal) {
+    if (journal->pending > 0) {
+        if (journal_write(journal->fd, journal->buffer, sizeof(plundervolt_journal_record_t) * journal->pending) == -1) {
+            return PLUNDERVOLT_JOURNAL_ERROR;
+        }
+        journal->pending = 0;
+    }
+    if (fdatasync(journal->fd) == -1) {
+        return PLUNDERVOLT_JOURNAL_ERROR;
+    }
+    journal->syncs++;
+    journal->synced_at = plundervolt_monotonic_ns();
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void plundervolt_journal_close(plundervolt_journal_t* journal) {
+    if (journal->fd >= 0) {
+        plundervolt_journal_sync(journal);
+        close(journal->fd);
+    }
+    journal->fd = -1;
+}
+
+int64_t journal_highest(const int64_t* values, int count) {
+    int64_t highest = INT64_MIN;
+    for (int i = 0; i < count; i++) {
+        if (values[i] > highest) {
+            highest = values[i];
+        }
+    }
+    return highest;
+}
+
+int64_t plundervolt_journal_unsafe_limit(const plundervolt_journal_state_t* state) {
+    return journal_highest(state->unsafe, state->unsafe_count);
+}
+
+int64_t plundervolt_journal_unsafe_voltage(const plundervolt_journal_state_t* state) {
+    return journal_highest(state->unsafe_voltage, state->unsafe_voltage_count);
+}
@@ -0,0 +1,218 @@
+/**
+ * @file plundervolt_journal.h
+ * @brief Append-only, checksummed on-disk journal of campaign progress, to resume after the machine locks up.
+ *
+ * The journal is a file of fixed-size records, each with its own CRC-32. A campaign starts with a
+ * PLUNDERVOLT_JOURNAL_CAMPAIGN record carrying a fingerprint of its specification. Before an undervoltage deeper than
+ * any durable one is applied, a PLUNDERVOLT_JOURNAL_STEP record for it is written and synced; when the step is over,
+ * a PLUNDERVOLT_JOURNAL_STEP_DONE record with its faults follows. Bookkeeping records (steps done, tries) are only
+ * synced in batches, at most every sync interval, at points the caller chooses outside the glitch window.
+ *
+ * Opening a journal reads it back, cuts off a torn last record, and finds where the last campaign stopped. If it
+ * stopped inside a step (a STEP without its STEP_DONE and no PLUNDERVOLT_JOURNAL_END), the machine died at that
+ * undervoltage: it is marked unsafe with a PLUNDERVOLT_JOURNAL_UNSAFE record. See plundervolt_specification_t.journal.
+ *
+ * The steps of a hardware campaign are glitch voltages, in 0.1 mV, instead of undervoltages in mV; a run is one step.
+ * Their unsafe voltages are kept apart from the software ones.
+ *
+ */
+/* plundervolt_journal.h */
+
+#ifndef PLUNDERVOLT_JOURNAL_H
+#define PLUNDERVOLT_JOURNAL_H
+
+#include <stdint.h>
+#include "plundervolt.h"
+
+/**
+ * @brief Kind of a journal record.
+ *
+ */
+typedef enum plundervolt_journal_record_type_t {
+    PLUNDERVOLT_JOURNAL_CAMPAIGN = 1, // A campaign starts. value: fingerprint of its specification; count: 1 for hardware.
+    PLUNDERVOLT_JOURNAL_STEP = 2, // An undervoltage (value, in mV; hardware: a glitch voltage, in 0.1 mV) is about to be applied.
+    PLUNDERVOLT_JOURNAL_STEP_DONE = 3, // The step at value is over; count: faults reported during it.
+    PLUNDERVOLT_JOURNAL_TRY = 4, // Hardware. count: tries done in the campaign so far.
+    PLUNDERVOLT_JOURNAL_UNSAFE = 5, // The machine died at the step value of the last campaign.
+    PLUNDERVOLT_JOURNAL_END = 6 // The campaign ended normally.
+} plundervolt_journal_record_type_t;
+
+/**
+ * @brief One record as stored on disk (little endian, 48 bytes).
+ *
+ */
+typedef struct plundervolt_journal_record_t {
+    uint32_t magic; // PLUNDERVOLT_JOURNAL_MAGIC.
+    uint16_t type; // plundervolt_journal_record_type_t.
+    uint16_t reserved;
+    uint64_t sequence; // Position of the record in the journal, from 0.
+    int64_t value;
+    uint64_t count;
+    uint64_t time; // CLOCK_REALTIME when the record was made, in s.
+    uint32_t reserved2;
+    uint32_t crc; // CRC-32 of all bytes before it.
+} plundervolt_journal_record_t;
+
+/**
+ * @brief First field of every record.
+ *
+ */
+#define PLUNDERVOLT_JOURNAL_MAGIC 0x314A5650 // "PVJ1"
+
+/**
+ * @brief Records kept in memory until the next sync.
+ *
+ */
+#define PLUNDERVOLT_JOURNAL_BUFFER 64
+
+/**
+ * @brief Most unsafe undervoltages remembered.
+ *
+ */
+#define PLUNDERVOLT_JOURNAL_UNSAFE_MAX 64
+
+/**
+ * @brief What the journal says about the last campaign in it, and the unsafe undervoltages of all campaigns.
+ *
+ */
+typedef struct plundervolt_journal_state_t {
+    /**
+     * @brief Valid records in the file, and bytes cut off behind them when it was opened.
+     */
+    uint64_t records;
+    uint64_t truncated_bytes;
+    /**
+     * @brief 1 if there is a campaign, and its fingerprint.
+     */
+    int has_campaign;
+    uint64_t fingerprint;
+    /**
+     * @brief 1 if the last campaign is a hardware one.
+     */
+    int hardware;
+    /**
+     * @brief 1 if the last campaign has no PLUNDERVOLT_JOURNAL_END, i.e. it can be resumed.
+     */
+    int open;
+    /**
+     * @brief Of the last campaign: 1 if a step was started, and the last one; 1 if a step was finished, and the last one.
+     */
+    int has_step;
+    int64_t last_step;
+    int has_done;
+    int64_t last_done;
+    /**
+     * @brief 1 if the last campaign's last step has no PLUNDERVOLT_JOURNAL_STEP_DONE.
+     */
+    int in_step;
+    /**
+     * @brief Of the last campaign: tries done (hardware), and faults reported in finished steps.
+     */
+    uint64_t tries;
+    uint64_t faults;
+    /**
+     * @brief Undervoltages the machine died at, in mV, in the order they were found.
+     */
+    int unsafe_count;
+    int64_t unsafe[PLUNDERVOLT_JOURNAL_UNSAFE_MAX];
+    /**
+     * @brief Hardware. Glitch voltages the machine died at, in 0.1 mV, in the order they were found.
+     */
+    int unsafe_voltage_count;
+    int64_t unsafe_voltage[PLUNDERVOLT_JOURNAL_UNSAFE_MAX];
+} plundervolt_journal_state_t;
+
+/**
+ * @brief An open journal.
+ *
+ */
+typedef struct plundervolt_journal_t {
+    int fd;
+    /**
+     * @brief State read at opening, kept up to date by the appends.
+     */
+    plundervolt_journal_state_t state;
+    /**
+     * @brief Longest time bookkeeping records stay in memory, in ns. 0 syncs at every plundervolt_journal_checkpoint().
+     */
+    uint64_t sync_ns;
+    /**
+     * @brief Deepest undervoltage with a durable PLUNDERVOLT_JOURNAL_STEP record, 0 if none.
+     */
+    int64_t durable_step;
+    /**
+     * @brief Records not written yet, and CLOCK_MONOTONIC time of the last sync, in ns.
+     */
+    int pending;
+    plundervolt_journal_record_t buffer[PLUNDERVOLT_JOURNAL_BUFFER];
+    uint64_t synced_at;
+    /**
+     * @brief fdatasync() calls so far.
+     */
+    uint64_t syncs;
+} plundervolt_journal_t;
+
+/**
+ * @brief Open (or create) a journal and read it back. A torn or corrupted tail is cut off. If the last campaign
+ * stopped inside a step, that step's undervoltage is marked unsafe (and the record synced).
+ *
+ * @param journal Where to store the journal.
+ * @param path File of the journal.
+ * @param sync_ms Longest time bookkeeping records stay in memory, in ms.
+ * @return plundervolt_error_t PLUNDERVOLT_JOURNAL_ERROR if the file cannot be opened, read or written.
+ */
+plundervolt_error_t plundervolt_journal_open(plundervolt_journal_t* journal, const char* path, int sync_ms);
+
+/**
+ * @brief Append a record. PLUNDERVOLT_JOURNAL_STEP records deeper than durable_step, and PLUNDERVOLT_JOURNAL_CAMPAIGN,
+ * PLUNDERVOLT_JOURNAL_UNSAFE and PLUNDERVOLT_JOURNAL_END records, are synced before this returns; others wait for a checkpoint.
+ *
+ * @param journal An open journal.
+ * @param type Kind of record.
+ * @param value See plundervolt_journal_record_type_t.
+ * @param count See plundervolt_journal_record_type_t.
+ * @return plundervolt_error_t PLUNDERVOLT_JOURNAL_ERROR if a write or sync failed.
+ */
+plundervolt_error_t plundervolt_journal_append(plundervolt_journal_t* journal, plundervolt_journal_record_type_t type, int64_t value, uint64_t count);
+
+/**
+ * @brief Write and sync the records in memory if the last sync is sync_ms ago. Call where a sync does not disturb
+ * the victim, e.g. in the wait after a try.
+ *
+ * @return plundervolt_error_t PLUNDERVOLT_JOURNAL_ERROR if a write or sync failed.
+ */
+plundervolt_error_t plundervolt_journal_checkpoint(plundervolt_journal_t* journal);
+
+/**
+ * @brief Write and sync the records in memory now.
+ *
+ * @return plundervolt_error_t PLUNDERVOLT_JOURNAL_ERROR if a write or sync failed.
+ */
+plundervolt_error_t plundervolt_journal_sync(plundervolt_journal_t* journal);
+
+/**
+ * @brief Sync and close the journal.
+ *
+ */
+void plundervolt_journal_close(plundervolt_journal_t* journal);
+
+/**
+ * @brief Shallowest unsafe undervoltage of the journal, i.e. the limit a sweep must stay above.
+ *
+ * @return int64_t The undervoltage in mV, or INT64_MIN if none is unsafe.
+ */
+int64_t plundervolt_journal_unsafe_limit(const plundervolt_journal_state_t* state);
+
+/**
+ * @brief Hardware. Highest unsafe glitch voltage of the journal, i.e. the limit a glitch must stay above.
+ *
+ * @return int64_t The voltage in 0.1 mV, or INT64_MIN if none is unsafe.
+ */
+int64_t plundervolt_journal_unsafe_voltage(const plundervolt_journal_state_t* state);
+
+/**
+ * @return uint32_t CRC-32 (IEEE 802.3) of the bytes.
+ */
+uint32_t plundervolt_journal_crc32(const void* data, size_t length);
+
+#endif /* PLUNDERVOLT_JOURNAL_H */
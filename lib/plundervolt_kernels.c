@@ -0,0 +1,319 @@
+/**
+ * @file plundervolt_kernels.c
+ * @brief Ready-made functions to undervolt on.
+ *
+ */
+
+/* Compiled with optimisation (see Makefile); the kernels are useless at -O0.
+Vector kernels are compiled for their instruction sets with target attributes, and only called if the CPU supports them. */
+
+#include <immintrin.h>
+#include "plundervolt.h"
+#include "plundervolt_kernels.h"
+
+/* Hide values from the compiler, so it cannot tell the copies are equal and merge the operations on them. */
+#define HIDE(constraint, a, b, c, d, e, f, g, h) \
+    __asm__ volatile("" : "+" constraint (a), "+" constraint (b), "+" constraint (c), "+" constraint (d), \
+                          "+" constraint (e), "+" constraint (f), "+" constraint (g), "+" constraint (h))
+
+/**
+ * @brief Slow path of every kernel: push a fault record for every 64 bit word of a batch which differs.
+ * As the batch only keeps the OR of all differences, the observed value is exact for a single fault per word and batch.
+ *
+ * @param args Arguments of the kernel.
+ * @param difference Bits which differed, for every word.
+ * @param words Number of words in difference.
+ */
+void kernel_fault(plundervolt_kernel_arguments_t* args, const uint64_t* difference, int words);
+/**
+ * @brief Check if a kernel should run another batch.
+ *
+ * @param args Arguments of the kernel.
+ * @param batch Batches done so far in this call.
+ * @return int 1 if it should.
+ */
+int kernel_continue(plundervolt_kernel_arguments_t* args, uint64_t batch);
+
+void kernel_fault(plundervolt_kernel_arguments_t* args, const uint64_t* difference, int words) {
+    int expected_words = args->kernel == PLUNDERVOLT_KERNEL_AESNI ? 2 : 1;
+    for (int word = 0; word < words; word++) {
+        if (difference[word]) {
+            uint64_t expected = args->expected[word % expected_words];
+            plundervolt_push_kernel_fault(expected, expected ^ difference[word], args->kernel);
+            atomic_fetch_add_explicit(&args->faults, 1, memory_order_relaxed);
+        }
+    }
+    if (args->stop_on_fault) {
+        plundervolt_set_loop_finished();
+    }
+}
+
+int kernel_continue(plundervolt_kernel_arguments_t* args, uint64_t batch) {
+    return args->batches ? batch < args->batches : plundervolt_loop_is_running();
+}
+
+void plundervolt_kernel_imul(void* arguments) {
+    plundervolt_kernel_arguments_t* args = (plundervolt_kernel_arguments_t *) arguments;
+    plundervolt_instrument_victim_started();
+    uint64_t b = args->operand2;
+    uint64_t expected = args->expected[0];
+    uint64_t batch;
+
+    for (batch = 0; kernel_continue(args, batch); batch++) {
+        uint64_t difference = 0;
+        for (int round = 0; round < PLUNDERVOLT_KERNEL_ROUNDS; round++) {
+            uint64_t p0 = args->operand1, p1 = p0, p2 = p0, p3 = p0, p4 = p0, p5 = p0, p6 = p0, p7 = p0;
+            // Eight independent multiplications; volatile, so they are executed every round.
+            __asm__ volatile(
+                "imul %8, %0\n\t" "imul %8, %1\n\t" "imul %8, %2\n\t" "imul %8, %3\n\t"
+                "imul %8, %4\n\t" "imul %8, %5\n\t" "imul %8, %6\n\t" "imul %8, %7"
+                : "+r"(p0), "+r"(p1), "+r"(p2), "+r"(p3), "+r"(p4), "+r"(p5), "+r"(p6), "+r"(p7)
+                : "r"(b));
+            difference |= (p0 ^ expected) | (p1 ^ expected) | (p2 ^ expected) | (p3 ^ expected)
+                        | (p4 ^ expected) | (p5 ^ expected) | (p6 ^ expected) | (p7 ^ expected);
+        }
+        if (__builtin_expect(difference != 0, 0)) {
+            kernel_fault(args, &difference, 1);
+        }
+    }
+    atomic_fetch_add_explicit(&args->operations, batch * PLUNDERVOLT_KERNEL_ROUNDS * 8, memory_order_relaxed);
+}
+
+__attribute__((target("avx2")))
+void plundervolt_kernel_avx2_mul(void* arguments) {
+    plundervolt_kernel_arguments_t* args = (plundervolt_kernel_arguments_t *) arguments;
+    plundervolt_instrument_victim_started();
+    __m256i a = _mm256_set1_epi64x(args->operand1 & 0xFFFFFFFF);
+    __m256i b = _mm256_set1_epi64x(args->operand2 & 0xFFFFFFFF);
+    __m256i expected = _mm256_set1_epi64x(args->expected[0]);
+    uint64_t batch;
+
+    for (batch = 0; kernel_continue(args, batch); batch++) {
+        __m256i difference = _mm256_setzero_si256();
+        for (int round = 0; round < PLUNDERVOLT_KERNEL_ROUNDS; round++) {
+            __m256i a0 = a, a1 = a, a2 = a, a3 = a, a4 = a, a5 = a, a6 = a, a7 = a;
+            HIDE("x", a0, a1, a2, a3, a4, a5, a6, a7);
+            __m256i p0 = _mm256_xor_si256(_mm256_mul_epu32(a0, b), expected);
+            __m256i p1 = _mm256_xor_si256(_mm256_mul_epu32(a1, b), expected);
+            __m256i p2 = _mm256_xor_si256(_mm256_mul_epu32(a2, b), expected);
+            __m256i p3 = _mm256_xor_si256(_mm256_mul_epu32(a3, b), expected);
+            __m256i p4 = _mm256_xor_si256(_mm256_mul_epu32(a4, b), expected);
+            __m256i p5 = _mm256_xor_si256(_mm256_mul_epu32(a5, b), expected);
+            __m256i p6 = _mm256_xor_si256(_mm256_mul_epu32(a6, b), expected);
+            __m256i p7 = _mm256_xor_si256(_mm256_mul_epu32(a7, b), expected);
+            difference = _mm256_or_si256(difference, _mm256_or_si256(
+                _mm256_or_si256(_mm256_or_si256(p0, p1), _mm256_or_si256(p2, p3)),
+                _mm256_or_si256(_mm256_or_si256(p4, p5), _mm256_or_si256(p6, p7))));
+        }
+        if (__builtin_expect(!_mm256_testz_si256(difference, difference), 0)) {
+            uint64_t words[4];
+            _mm256_storeu_si256((__m256i *) words, difference);
+            kernel_fault(args, words, 4);
+        }
+    }
+    atomic_fetch_add_explicit(&args->operations, batch * PLUNDERVOLT_KERNEL_ROUNDS * 8 * 4, memory_order_relaxed);
+}
+
+__attribute__((target("avx2,fma")))
+void plundervolt_kernel_avx2_fma(void* arguments) {
+    plundervolt_kernel_arguments_t* args = (plundervolt_kernel_arguments_t *) arguments;
+    plundervolt_instrument_victim_started();
+    // Operands of at most 20 bits: the result is exact, so it can be compared bit for bit.
+    __m256d a = _mm256_set1_pd((double)(args->operand1 & 0xFFFFF));
+    __m256d b = _mm256_set1_pd((double)(args->operand2 & 0xFFFFF));
+    __m256d c = _mm256_set1_pd(1.0);
+    __m256i expected = _mm256_set1_epi64x(args->expected[0]);
+    uint64_t batch;
+
+    for (batch = 0; kernel_continue(args, batch); batch++) {
+        __m256i difference = _mm256_setzero_si256();
+        for (int round = 0; round < PLUNDERVOLT_KERNEL_ROUNDS; round++) {
+            __m256d a0 = a, a1 = a, a2 = a, a3 = a, a4 = a, a5 = a, a6 = a, a7 = a;
+            HIDE("x", a0, a1, a2, a3, a4, a5, a6, a7);
+            __m256i p0 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a0, b, c)), expected);
+            __m256i p1 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a1, b, c)), expected);
+            __m256i p2 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a2, b, c)), expected);
+            __m256i p3 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a3, b, c)), expected);
+            __m256i p4 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a4, b, c)), expected);
+            __m256i p5 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a5, b, c)), expected);
+            __m256i p6 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a6, b, c)), expected);
+            __m256i p7 = _mm256_xor_si256(_mm256_castpd_si256(_mm256_fmadd_pd(a7, b, c)), expected);
+            difference = _mm256_or_si256(difference, _mm256_or_si256(
+                _mm256_or_si256(_mm256_or_si256(p0, p1), _mm256_or_si256(p2, p3)),
+                _mm256_or_si256(_mm256_or_si256(p4, p5), _mm256_or_si256(p6, p7))));
+        }
+        if (__builtin_expect(!_mm256_testz_si256(difference, difference), 0)) {
+            uint64_t words[4];
+            _mm256_storeu_si256((__m256i *) words, difference);
+            kernel_fault(args, words, 4);
+        }
+    }
+    atomic_fetch_add_explicit(&args->operations, batch * PLUNDERVOLT_KERNEL_ROUNDS * 8 * 4, memory_order_relaxed);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+void plundervolt_kernel_avx512_mul(void* arguments) {
+    plundervolt_kernel_arguments_t* args = (plundervolt_kernel_arguments_t *) arguments;
+    plundervolt_instrument_victim_started();
+    __m512i a = _mm512_set1_epi64(args->operand1);
+    __m512i b = _mm512_set1_epi64(args->operand2);
+    __m512i expected = _mm512_set1_epi64(args->expected[0]);
+    uint64_t batch;
+
+    for (batch = 0; kernel_continue(args, batch); batch++) {
+        __m512i difference = _mm512_setzero_si512();
+        for (int round = 0; round < PLUNDERVOLT_KERNEL_ROUNDS; round++) {
+            __m512i a0 = a, a1 = a, a2 = a, a3 = a, a4 = a, a5 = a, a6 = a, a7 = a;
+            HIDE("v", a0, a1, a2, a3, a4, a5, a6, a7);
+            __m512i p0 = _mm512_xor_si512(_mm512_mullo_epi64(a0, b), expected);
+            __m512i p1 = _mm512_xor_si512(_mm512_mullo_epi64(a1, b), expected);
+            __m512i p2 = _mm512_xor_si512(_mm512_mullo_epi64(a2, b), expected);
+            __m512i p3 = _mm512_xor_si512(_mm512_mullo_epi64(a3, b), expected);
+            __m512i p4 = _mm512_xor_si512(_mm512_mullo_epi64(a4, b), expected);
+            __m512i p5 = _mm512_xor_si512(_mm512_mullo_epi64(a5, b), expected);
+            __m512i p6 = _mm512_xor_si512(_mm512_mullo_epi64(a6, b), expected);
+            __m512i p7 = _mm512_xor_si512(_mm512_mullo_epi64(a7, b), expected);
+            difference = _mm512_or_si512(difference, _mm512_or_si512(
+                _mm512_or_si512(_mm512_or_si512(p0, p1), _mm512_or_si512(p2, p3)),
+                _mm512_or_si512(_mm512_or_si512(p4, p5), _mm512_or_si512(p6, p7))));
+        }
+        if (__builtin_expect(_mm512_test_epi64_mask(difference, difference) != 0, 0)) {
+            uint64_t words[8];
+            _mm512_storeu_si512((void *) words, difference);
+            kernel_fault(args, words, 8);
+        }
+    }
+    atomic_fetch_add_explicit(&args->operations, batch * PLUNDERVOLT_KERNEL_ROUNDS * 8 * 8, memory_order_relaxed);
+}
+
+__attribute__((target("aes,sse4.1")))
+void plundervolt_kernel_aesni(void* arguments) {
+    plundervolt_kernel_arguments_t* args = (plundervolt_kernel_arguments_t *) arguments;
+    plundervolt_instrument_victim_started();
+    __m128i key = _mm_set_epi64x(args->operand1, args->operand2);
+    __m128i block = _mm_set_epi64x(args->operand2, args->operand1);
+    __m128i expected = _mm_set_epi64x(args->expected[1], args->expected[0]);
+    uint64_t batch;
+
+    for (batch = 0; kernel_continue(args, batch); batch++) {
+        __m128i difference = _mm_setzero_si128();
+        for (int round = 0; round < PLUNDERVOLT_KERNEL_ROUNDS; round++) {
+            __m128i s0 = block, s1 = block, s2 = block, s3 = block, s4 = block, s5 = block, s6 = block, s7 = block;
+            HIDE("x", s0, s1, s2, s3, s4, s5, s6, s7);
+            __m128i p0 = _mm_xor_si128(_mm_aesenc_si128(s0, key), expected);
+            __m128i p1 = _mm_xor_si128(_mm_aesenc_si128(s1, key), expected);
+            __m128i p2 = _mm_xor_si128(_mm_aesenc_si128(s2, key), expected);
+            __m128i p3 = _mm_xor_si128(_mm_aesenc_si128(s3, key), expected);
+            __m128i p4 = _mm_xor_si128(_mm_aesenc_si128(s4, key), expected);
+            __m128i p5 = _mm_xor_si128(_mm_aesenc_si128(s5, key), expected);
+            __m128i p6 = _mm_xor_si128(_mm_aesenc_si128(s6, key), expected);
+            __m128i p7 = _mm_xor_si128(_mm_aesenc_si128(s7, key), expected);
+            difference = _mm_or_si128(difference, _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(p0, p1), _mm_or_si128(p2, p3)),
+                _mm_or_si128(_mm_or_si128(p4, p5), _mm_or_si128(p6, p7))));
+        }
+        if (__builtin_expect(!_mm_testz_si128(difference, difference), 0)) {
+            uint64_t words[2];
+            _mm_storeu_si128((__m128i *) words, difference);
+            kernel_fault(args, words, 2);
+        }
+    }
+    atomic_fetch_add_explicit(&args->operations, batch * PLUNDERVOLT_KERNEL_ROUNDS * 8, memory_order_relaxed);
+}
+
+/**
+ * @brief Compute the correct result of one AES-NI round. Separate, so it is only compiled for AES-NI.
+ *
+ */
+__attribute__((target("aes")))
+void kernel_aesni_expected(plundervolt_kernel_arguments_t* args) {
+    __m128i key = _mm_set_epi64x(args->operand1, args->operand2);
+    __m128i block = _mm_set_epi64x(args->operand2, args->operand1);
+    _mm_storeu_si128((__m128i *) args->expected, _mm_aesenc_si128(block, key));
+}
+
+int plundervolt_kernel_supported(plundervolt_kernel_t kernel) {
+    __builtin_cpu_init();
+    switch (kernel) {
+    case PLUNDERVOLT_KERNEL_IMUL:
+        return 1;
+    case PLUNDERVOLT_KERNEL_AVX2_MUL:
+        return __builtin_cpu_supports("avx2");
+    case PLUNDERVOLT_KERNEL_AVX2_FMA:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case PLUNDERVOLT_KERNEL_AVX512_MUL:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+    case PLUNDERVOLT_KERNEL_AESNI:
+        return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+    default:
+        return 0;
+    }
+}
+
+void (* plundervolt_kernel_function(plundervolt_kernel_t kernel))(void *) {
+    if (!plundervolt_kernel_supported(kernel)) {
+        return NULL;
+    }
+    switch (kernel) {
+    case PLUNDERVOLT_KERNEL_IMUL:
+        return plundervolt_kernel_imul;
+    case PLUNDERVOLT_KERNEL_AVX2_MUL:
+        return plundervolt_kernel_avx2_mul;
+    case PLUNDERVOLT_KERNEL_AVX2_FMA:
+        return plundervolt_kernel_avx2_fma;
+    case PLUNDERVOLT_KERNEL_AVX512_MUL:
+        return plundervolt_kernel_avx512_mul;
+    case PLUNDERVOLT_KERNEL_AESNI:
+        return plundervolt_kernel_aesni;
+    default:
+        return NULL;
+    }
+}
+
+const char* plundervolt_kernel_name(plundervolt_kernel_t kernel) {
+    switch (kernel) {
+    case PLUNDERVOLT_KERNEL_IMUL:
+        return "imul";
+    case PLUNDERVOLT_KERNEL_AVX2_MUL:
+        return "avx2-mul";
+    case PLUNDERVOLT_KERNEL_AVX2_FMA:
+        return "avx2-fma";
+    case PLUNDERVOLT_KERNEL_AVX512_MUL:
+        return "avx512-mul";
+    case PLUNDERVOLT_KERNEL_AESNI:
+        return "aesni";
+    default:
+        return "unknown";
+    }
+}
+
+int plundervolt_kernel_prepare(plundervolt_kernel_arguments_t* arguments, plundervolt_kernel_t kernel) {
+    if (!plundervolt_kernel_supported(kernel)) {
+        return -1;
+    }
+    arguments->kernel = kernel;
+    atomic_store(&arguments->operations, 0);
+    atomic_store(&arguments->faults, 0);
+    arguments->expected[1] = 0;
+
+    switch (kernel) {
+    case PLUNDERVOLT_KERNEL_IMUL:
+    case PLUNDERVOLT_KERNEL_AVX512_MUL:
+        arguments->expected[0] = arguments->operand1 * arguments->operand2;
+        break;
+    case PLUNDERVOLT_KERNEL_AVX2_MUL:
+        arguments->expected[0] = (arguments->operand1 & 0xFFFFFFFF) * (arguments->operand2 & 0xFFFFFFFF);
+        break;
+    case PLUNDERVOLT_KERNEL_AVX2_FMA: {
+        double result = (double)(arguments->operand1 & 0xFFFFF) * (double)(arguments->operand2 & 0xFFFFF) + 1.0;
+        __builtin_memcpy(&arguments->expected[0], &result, sizeof result);
+        break;
+    }
+    case PLUNDERVOLT_KERNEL_AESNI:
+        kernel_aesni_expected(arguments);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * @file plundervolt_kernels.h
+ * @brief Ready-made functions to undervolt on.
+ *
+ * Every kernel is a void (*)(void *) which can be set as plundervolt_specification_t.function, with a
+ * plundervolt_kernel_arguments_t as its arguments. A kernel executes rounds of independent operations
+ * (so no operation waits for the result of another), compares all results of a batch of rounds against
+ * the correct one at once, and only branches when something differs. The operations are hidden from the
+ * compiler, so they cannot be merged, hoisted out of the loop or constant-folded.
+ *
+ * Faults are pushed with plundervolt_push_kernel_fault(), tagged with the kernel, and so also reported with plundervolt_report_fault().
+ *
+ */
+/* plundervolt_kernels.h */
+
+#ifndef PLUNDERVOLT_KERNELS_H
+#define PLUNDERVOLT_KERNELS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * @brief Available kernels.
+ *
+ */
+typedef enum {
+    PLUNDERVOLT_KERNEL_IMUL = 0, // 64 bit imul, 8 independent per round.
+    PLUNDERVOLT_KERNEL_AVX2_MUL = 1, // vpmuludq on 256 bit vectors, 8 independent per round.
+    PLUNDERVOLT_KERNEL_AVX2_FMA = 2, // vfmadd on 256 bit vectors of doubles, 8 independent per round.
+    PLUNDERVOLT_KERNEL_AVX512_MUL = 3, // vpmullq on 512 bit vectors, 8 independent per round.
+    PLUNDERVOLT_KERNEL_AESNI = 4, // aesenc rounds, 8 independent per round.
+    PLUNDERVOLT_KERNELS = 5 // Number of kernels.
+} plundervolt_kernel_t;
+
+/**
+ * @brief Number of rounds a kernel executes between two checks of the results.
+ *
+ */
+#define PLUNDERVOLT_KERNEL_ROUNDS 16
+
+/**
+ * @brief Arguments of every kernel. Set the operands, call plundervolt_kernel_prepare(), then pass a pointer to this structure as
+ * plundervolt_specification_t.arguments. Can be shared by all threads.
+ *
+ */
+typedef struct plundervolt_kernel_arguments_t {
+    /**
+     * @brief Which kernel the arguments are prepared for.
+     */
+    plundervolt_kernel_t kernel;
+    /**
+     * @brief First operand. The vector multiplication uses its low 32 bits, the FMA its low 20 bits, AES-NI uses it as half of the key and block.
+     */
+    uint64_t operand1;
+    /**
+     * @brief Second operand. Same use as operand1.
+     */
+    uint64_t operand2;
+    /**
+     * @brief How many batches of PLUNDERVOLT_KERNEL_ROUNDS rounds one call executes. 0 means until plundervolt_set_loop_finished() is called.
+     */
+    uint64_t batches;
+    /**
+     * @brief >0 to call plundervolt_set_loop_finished() on the first fault.
+     */
+    int stop_on_fault;
+    /**
+     * @brief Operations checked so far, by all threads.
+     */
+    _Atomic uint64_t operations;
+    /**
+     * @brief Faulty operations seen so far, by all threads.
+     */
+    _Atomic uint64_t faults;
+    /**
+     * @brief Correct results, computed by plundervolt_kernel_prepare(). Two 64 bit words (the AES-NI result needs both).
+     */
+    uint64_t expected[2];
+} plundervolt_kernel_arguments_t;
+
+/**
+ * @brief Check if the CPU can execute a kernel.
+ *
+ * @param kernel The kernel.
+ * @return int 1 if it can, 0 if it lacks the instructions.
+ */
+int plundervolt_kernel_supported(plundervolt_kernel_t kernel);
+
+/**
+ * @brief Return a kernel as a function to set as plundervolt_specification_t.function.
+ *
+ * @param kernel The kernel.
+ * @return void(*)(void*) The function, or NULL if the CPU cannot execute it.
+ */
+void (* plundervolt_kernel_function(plundervolt_kernel_t kernel))(void *);
+
+/**
+ * @return const char* Name of the kernel, e.g. "imul".
+ */
+const char* plundervolt_kernel_name(plundervolt_kernel_t kernel);
+
+/**
+ * @brief Fill in the arguments for a kernel: compute the correct results and clear the counters.
+ * Call before undervolting, so the correct results are computed at the normal voltage.
+ *
+ * @param arguments Arguments with operand1 and operand2 set.
+ * @param kernel The kernel to prepare for.
+ * @return int 0 on success, -1 if the CPU cannot execute the kernel.
+ */
+int plundervolt_kernel_prepare(plundervolt_kernel_arguments_t* arguments, plundervolt_kernel_t kernel);
+
+/**
+ * @brief The kernels. They can be used directly as plundervolt_specification_t.function, but only on CPUs which support them.
+ *
+ * @param arguments Pointer to a prepared plundervolt_kernel_arguments_t.
+ */
+void plundervolt_kernel_imul(void* arguments);
+void plundervolt_kernel_avx2_mul(void* arguments);
+void plundervolt_kernel_avx2_fma(void* arguments);
+void plundervolt_kernel_avx512_mul(void* arguments);
+void plundervolt_kernel_aesni(void* arguments);
+
+#endif /* PLUNDERVOLT_KERNELS_H */
@@ -0,0 +1,341 @@
+/**
+ * @file plundervolt_optimizer.c
+ * @brief Surrogate-model search over the hardware glitch parameters.
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plundervolt_optimizer.h"
+
+/**
+ * @brief Features of the trend: 1, every scaled parameter, and its square.
+ *
+ */
+#define OPTIMIZER_FEATURES (1 + 2 * PLUNDERVOLT_GLITCH_PARAMETERS)
+
+/**
+ * @brief Tries the trend counts as at every point, next to the measured tries near it.
+ *
+ */
+#define OPTIMIZER_PRIOR_TRIES 2.0
+
+/**
+ * @return uint64_t Next number of the optimizer's xorshift64* generator.
+ */
+uint64_t optimizer_next(plundervolt_optimizer_t* optimizer);
+/**
+ * @return double Uniform in [0, 1).
+ */
+double optimizer_uniform(plundervolt_optimizer_t* optimizer);
+/**
+ * @return double Standard normal.
+ */
+double optimizer_normal(plundervolt_optimizer_t* optimizer);
+/**
+ * @return int 1 if the parameter is searched, i.e. its bounds differ.
+ */
+int optimizer_searched(const plundervolt_optimizer_t* optimizer, int parameter);
+/**
+ * @brief Scale a point to [0, 1] on every searched axis (0 on the others).
+ *
+ */
+void optimizer_scale(const plundervolt_optimizer_t* optimizer, const double* value, double* scaled);
+/**
+ * @brief Turn a scaled point back into parameters, rounded as the specification holds them.
+ *
+ */
+void optimizer_unscale(const plundervolt_optimizer_t* optimizer, const plundervolt_specification_t* base, const double* scaled, double* value);
+/**
+ * @brief Trend features of a scaled point.
+ *
+ */
+void optimizer_features(const double* scaled, double* features);
+/**
+ * @return double Logistic trend at the features.
+ */
+double optimizer_trend_at(const double* coefficients, const double* features);
+/**
+ * @brief Fit the coefficients of a logistic trend to the observations by iteratively reweighted least squares, with a
+ * small ridge so few or separable observations still give a finite fit.
+ *
+ * @param crashes 1 to fit the crash rate, 0 the fault rate.
+ */
+void optimizer_fit(const plundervolt_optimizer_t* optimizer, double* coefficients, int crashes);
+/**
+ * @brief plundervolt_optimizer_predict() of a scaled point.
+ *
+ */
+double optimizer_score(const plundervolt_optimizer_t* optimizer, const double* scaled, double* fault_rate, double* crash_rate, double* uncertainty);
+
+uint64_t optimizer_next(plundervolt_optimizer_t* optimizer) {
+    optimizer->random ^= optimizer->random >> 12;
+    optimizer->random ^= optimizer->random << 25;
+    optimizer->random ^= optimizer->random >> 27;
+    return optimizer->random * 0x2545F4914F6CDD1Dull;
+}
+
+double optimizer_uniform(plundervolt_optimizer_t* optimizer) {
+    return (optimizer_next(optimizer) >> 11) * (1.0 / (1ull << 53));
+}
+
+double optimizer_normal(plundervolt_optimizer_t* optimizer) {
+    double u = optimizer_uniform(optimizer);
+    double v = optimizer_uniform(optimizer);
+    return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+plundervolt_optimizer_t plundervolt_optimizer_init() {
+    plundervolt_optimizer_t optimizer;
+    memset(&optimizer, 0, sizeof optimizer);
+    optimizer.bandwidth = 0.1;
+    optimizer.exploration = 1;
+    optimizer.candidates = 512;
+    optimizer.initial = 8;
+    optimizer.seed = 1;
+    optimizer.fault_trend[0] = -2; // A rare event until the first fit.
+    optimizer.crash_trend[0] = -2;
+    return optimizer;
+}
+
+void plundervolt_optimizer_free(plundervolt_optimizer_t* optimizer) {
+    free(optimizer->observations);
+    optimizer->observations = NULL;
+    optimizer->observation_count = 0;
+    optimizer->capacity = 0;
+}
+
+int optimizer_searched(const plundervolt_optimizer_t* optimizer, int parameter) {
+    return optimizer->lower[parameter] != optimizer->upper[parameter];
+}
+
+void optimizer_scale(const plundervolt_optimizer_t* optimizer, const double* value, double* scaled) {
+    for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        scaled[parameter] = optimizer_searched(optimizer, parameter)
+            ? (value[parameter] - optimizer->lower[parameter]) / (optimizer->upper[parameter] - optimizer->lower[parameter]) : 0;
+    }
+}
+
+void optimizer_unscale(const plundervolt_optimizer_t* optimizer, const plundervolt_specification_t* base, const double* scaled, double* value) {
+    double fixed[PLUNDERVOLT_GLITCH_PARAMETERS] = {base->undervolting_voltage, base->duration_start, base->duration_during, base->delay_before_undervolting};
+    for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        double lower = optimizer->lower[parameter];
+        double upper = optimizer->upper[parameter];
+        double x = lower == 0 && upper == 0 ? fixed[parameter] : lower + scaled[parameter] * (upper - lower);
+        value[parameter] = parameter == PLUNDERVOLT_GLITCH_VOLTAGE ? round(x * 10000) / 10000 : round(x); // As a grid rounds.
+    }
+}
+
+void optimizer_features(const double* scaled, double* features) {
+    features[0] = 1;
+    for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+        features[1 + parameter] = scaled[parameter];
+        features[1 + PLUNDERVOLT_GLITCH_PARAMETERS + parameter] = scaled[parameter] * scaled[parameter];
+    }
+}
+
+double optimizer_trend_at(const double* coefficients, const double* features) {
+    double z = 0;
+    for (int i = 0; i < OPTIMIZER_FEATURES; i++) {
+        z += coefficients[i] * features[i];
+    }
+    return 1 / (1 + exp(-z));
+}
+
+void optimizer_fit(const plundervolt_optimizer_t* optimizer, double* coefficients, int crashes) {
+    const double ridge = 0.1;
+    memset(coefficients, 0, sizeof(double) * OPTIMIZER_FEATURES);
+    coefficients[0] = -2; // Start from a rare event.
+    for (int iteration = 0; iteration < 10; iteration++) {
+        double hessian[OPTIMIZER_FEATURES][OPTIMIZER_FEATURES + 1]; // With the gradient as the last column.
+        memset(hessian, 0, sizeof hessian);
+        for (int i = 0; i < OPTIMIZER_FEATURES; i++) {
+            hessian[i][i] = ridge;
+            hessian[i][OPTIMIZER_FEATURES] = -ridge * coefficients[i];
+        }
+        for (uint64_t o = 0; o < optimizer->observation_count; o++) {
+            const plundervolt_observation_t* observation = &optimizer->observations[o];
+            double features[OPTIMIZER_FEATURES];
+            optimizer_features(observation->scaled, features);
+            double p = optimizer_trend_at(coefficients, features);
+            double n = (double) observation->tries;
+            double k = (double)(crashes ? observation->crashes : observation->faulty_tries);
+            for (int i = 0; i < OPTIMIZER_FEATURES; i++) {
+                hessian[i][OPTIMIZER_FEATURES] += (k - n * p) * features[i];
+                for (int j = 0; j < OPTIMIZER_FEATURES; j++) {
+                    hessian[i][j] += n * p * (1 - p) * features[i] * features[j];
+                }
+            }
+        }
+        // Solve for the Newton step by Gaussian elimination with partial pivoting.
+        for (int column = 0; column < OPTIMIZER_FEATURES; column++) {
+            int pivot = column;
+            for (int row = column + 1; row < OPTIMIZER_FEATURES; row++) {
+                if (fabs(hessian[row][column]) > fabs(hessian[pivot][column])) {
+                    pivot = row;
+                }
+            }
+            for (int j = 0; j <= OPTIMIZER_FEATURES; j++) {
+                double swap = hessian[column][j];
+                hessian[column][j] = hessian[pivot][j];
+                hessian[pivot][j] = swap;
+            }
+            for (int row = column + 1; row < OPTIMIZER_FEATURES; row++) {
+                double factor = hessian[row][column] / hessian[column][column];
+                for (int j = column; j <= OPTIMIZER_FEATURES; j++) {
+                    hessian[row][j] -= factor * hessian[column][j];
+                }
+            }
+        }
+        double largest = 0;
+        for (int row = OPTIMIZER_FEATURES - 1; row >= 0; row--) {
+            double step = hessian[row][OPTIMIZER_FEATURES];
+            for (int j = row + 1; j < OPTIMIZER_FEATURES; j++) {
+                step -= hessian[row][j] * hessian[j][OPTIMIZER_FEATURES];
+            }
+            step /= hessian[row][row];
+            hessian[row][OPTIMIZER_FEATURES] = step;
+            coefficients[row] += step;
+            largest = fmax(largest, fabs(step));
+        }
+        if (largest < 1e-6) {
+            break;
+        }
+    }
+}
+
+double optimizer_score(const plundervolt_optimizer_t* optimizer, const double* scaled, double* fault_rate, double* crash_rate, double* uncertainty) {
+    // Tries near the point, weighted by a Gaussian kernel of their distance.
+    double tries = 0, faulty = 0, crashes = 0;
+    double scale = -1 / (2 * optimizer->bandwidth * optimizer->bandwidth);
+    for (uint64_t o = 0; o < optimizer->observation_count; o++) {
+        const plundervolt_observation_t* observation = &optimizer->observations[o];
+        double distance = 0;
+        for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+            double d = scaled[parameter] - observation->scaled[parameter];
+            distance += d * d;
+        }
+        double weight = exp(distance * scale);
+        tries += weight * observation->tries;
+        faulty += weight * observation->faulty_tries;
+        crashes += weight * observation->crashes;
+    }
+    // The trend fills in where there are few tries nearby.
+    double features[OPTIMIZER_FEATURES];
+    optimizer_features(scaled, features);
+    double fault = (faulty + OPTIMIZER_PRIOR_TRIES * optimizer_trend_at(optimizer->fault_trend, features)) / (tries + OPTIMIZER_PRIOR_TRIES);
+    double crash = (crashes + OPTIMIZER_PRIOR_TRIES * optimizer_trend_at(optimizer->crash_trend, features)) / (tries + OPTIMIZER_PRIOR_TRIES);
+    double error = sqrt(fault * (1 - fault) / (tries + OPTIMIZER_PRIOR_TRIES));
+    if (fault_rate != NULL) {
+        *fault_rate = fault;
+    }
+    if (crash_rate != NULL) {
+        *crash_rate = crash;
+    }
+    if (uncertainty != NULL) {
+        *uncertainty = error;
+    }
+    return (fault + optimizer->exploration * error) * (1 - crash);
+}
+
+double plundervolt_optimizer_predict(const plundervolt_optimizer_t* optimizer, const double* value, double* fault_rate, double* crash_rate, double* uncertainty) {
+    double scaled[PLUNDERVOLT_GLITCH_PARAMETERS];
+    optimizer_scale(optimizer, value, scaled);
+    return optimizer_score(optimizer, scaled, fault_rate, crash_rate, uncertainty);
+}
+
+void plundervolt_optimizer_observe(plundervolt_optimizer_t* optimizer, const double* value, uint64_t tries, uint64_t faulty_tries, uint64_t crashes) {
+    if (optimizer->observation_count == optimizer->capacity) {
+        optimizer->capacity = optimizer->capacity ? optimizer->capacity * 2 : 64;
+        optimizer->observations = realloc(optimizer->observations, sizeof(plundervolt_observation_t) * optimizer->capacity);
+    }
+    plundervolt_observation_t* observation = &optimizer->observations[optimizer->observation_count++];
+    memcpy(observation->value, value, sizeof observation->value);
+    optimizer_scale(optimizer, value, observation->scaled);
+    observation->tries = tries;
+    observation->faulty_tries = faulty_tries;
+    observation->crashes = crashes;
+}
+
+void plundervolt_optimizer_propose(plundervolt_optimizer_t* optimizer, const plundervolt_specification_t* base, double* value) {
+    if (optimizer->random == 0) {
+        optimizer->random = optimizer->seed ? optimizer->seed : 1;
+    }
+    double best[PLUNDERVOLT_GLITCH_PARAMETERS] = {0};
+    if (optimizer->observation_count < (uint64_t) optimizer->initial) {
+        for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+            best[parameter] = optimizer_searched(optimizer, parameter) ? optimizer_uniform(optimizer) : 0;
+        }
+        optimizer_unscale(optimizer, base, best, value);
+        return;
+    }
+
+    optimizer_fit(optimizer, optimizer->fault_trend, 0);
+    optimizer_fit(optimizer, optimizer->crash_trend, 1);
+    // The observed point which scores best is the centre of the local candidates.
+    const double* centre = NULL;
+    double centre_score = -1;
+    for (uint64_t o = 0; o < optimizer->observation_count; o++) {
+        double score = optimizer_score(optimizer, optimizer->observations[o].scaled, NULL, NULL, NULL);
+        if (score > centre_score) {
+            centre_score = score;
+            centre = optimizer->observations[o].scaled;
+        }
+    }
+    double best_score = -1;
+    for (int candidate = 0; candidate < optimizer->candidates; candidate++) {
+        double scaled[PLUNDERVOLT_GLITCH_PARAMETERS];
+        for (int parameter = 0; parameter < PLUNDERVOLT_GLITCH_PARAMETERS; parameter++) {
+            if (!optimizer_searched(optimizer, parameter)) {
+                scaled[parameter] = 0;
+            } else if (candidate & 1) { // Half of them around the centre, half anywhere.
+                scaled[parameter] = fmin(1, fmax(0, centre[parameter] + optimizer->bandwidth * optimizer_normal(optimizer)));
+            } else {
+                scaled[parameter] = optimizer_uniform(optimizer);
+            }
+        }
+        double score = optimizer_score(optimizer, scaled, NULL, NULL, NULL);
+        if (score > best_score) {
+            best_score = score;
+            memcpy(best, scaled, sizeof best);
+        }
+    }
+    optimizer_unscale(optimizer, base, best, value);
+}
+
+plundervolt_error_t plundervolt_optimizer_run(plundervolt_optimizer_t* optimizer, plundervolt_specification_t spec, uint64_t points) {
+    optimizer->points_run = 0;
+    optimizer->tries_run = 0;
+    optimizer->points_unsafe = 0;
+    while (points == 0 || optimizer->points_run < points) {
+        if (optimizer->budget > 0 && optimizer->tries_run + spec.tries > optimizer->budget) {
+            break;
+        }
+        plundervolt_grid_result_t result;
+        memset(&result, 0, sizeof result);
+        result.index = optimizer->points_run;
+        plundervolt_optimizer_propose(optimizer, &spec, result.value);
+        plundervolt_error_t error_check = plundervolt_grid_measure(&spec, &result);
+        if (error_check == PLUNDERVOLT_UNSAFE_RANGE_ERROR) {
+            // The machine died as low before: count it as a try which crashed, without a try on the machine.
+            result.tries = 1; // The rest is as plundervolt_grid_measure() left it: 0.
+            result.crashes = 1;
+            result.upper = 1;
+            optimizer->points_unsafe++;
+        } else if (error_check) {
+            return error_check;
+        }
+        plundervolt_optimizer_observe(optimizer, result.value, result.tries, result.faulty_tries, result.crashes);
+        optimizer->points_run++;
+        optimizer->tries_run += result.tries;
+
+        if (optimizer->results != NULL) {
+            plundervolt_grid_write_result(optimizer->results, &result);
+        }
+        if (optimizer->on_result != NULL && optimizer->on_result(&result, optimizer->context)) {
+            break;
+        }
+    }
+    return PLUNDERVOLT_NO_ERROR;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file plundervolt_optimizer.h
+ * @brief Surrogate-model search over the hardware glitch parameters, for when a grid over them is too slow.
+ *
+ * The optimizer keeps every point measured so far (its tries, faulty tries and crashes) and fits a cheap surrogate of
+ * the fault rate and the crash rate over the parameter space: a Gaussian kernel regression, in which every measured
+ * point counts towards its neighbours by its distance (on axes scaled to [0, 1] by the bounds). Where few tries are
+ * near, it falls back on a quadratic logistic trend fitted to all of them, so e.g. "faults get likelier as the voltage
+ * drops" carries over to points far from any measured one. From the number of tries near a point the surrogate also
+ * knows how uncertain it is there. The next point to measure is the candidate with the
+ * best upper confidence bound on the fault rate, times the chance of not crashing:
+ *
+ *     score = (fault_rate + exploration * uncertainty) * (1 - crash_rate)
+ *
+ * so the search goes where faults are likely, or where too little is known to tell, and stays away from crashes.
+ * Candidates are drawn at random in the bounds, and around the best points so far.
+ *
+ */
+/* plundervolt_optimizer.h */
+
+#ifndef PLUNDERVOLT_OPTIMIZER_H
+#define PLUNDERVOLT_OPTIMIZER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "plundervolt.h"
+#include "plundervolt_grid.h"
+
+/**
+ * @brief One measured point.
+ *
+ */
+typedef struct plundervolt_observation_t {
+    /**
+     * @brief The point, indexed by plundervolt_glitch_parameter_t, and scaled to [0, 1] by the bounds.
+     */
+    double value[PLUNDERVOLT_GLITCH_PARAMETERS];
+    double scaled[PLUNDERVOLT_GLITCH_PARAMETERS];
+    uint64_t tries;
+    uint64_t faulty_tries;
+    uint64_t crashes;
+} plundervolt_observation_t;
+
+/**
+ * @brief An optimizer. Made by plundervolt_optimizer_init(), freed by plundervolt_optimizer_free().
+ *
+ */
+typedef struct plundervolt_optimizer_t {
+    /**
+     * @brief Bounds of every parameter, indexed by plundervolt_glitch_parameter_t. A parameter with lower == upper
+     * is not searched; with both 0, it keeps the value of the specification passed to plundervolt_optimizer_run().
+     */
+    double lower[PLUNDERVOLT_GLITCH_PARAMETERS];
+    double upper[PLUNDERVOLT_GLITCH_PARAMETERS];
+    /**
+     * @brief Width of the kernel on the scaled axes. Smaller fits narrow fault regions, larger generalises from fewer
+     * points. Default is 0.1.
+     */
+    double bandwidth;
+    /**
+     * @brief Weight of the uncertainty in the score; 0 only exploits. Default is 1.
+     */
+    double exploration;
+    /**
+     * @brief Candidates scored for every proposal. Default is 512.
+     */
+    int candidates;
+    /**
+     * @brief Points drawn at random before the surrogate is used. Default is 8.
+     */
+    int initial;
+    /**
+     * @brief Seed of the optimizer's own random numbers. Default is 1.
+     */
+    uint64_t seed;
+    /**
+     * @brief Most tries plundervolt_optimizer_run() runs, 0 for no limit. Default is 0.
+     */
+    uint64_t budget;
+    /**
+     * @brief As plundervolt_grid_t.results and plundervolt_grid_t.on_result.
+     */
+    FILE* results;
+    int (* on_result)(const plundervolt_grid_result_t* result, void* context);
+    void* context;
+
+    /**
+     * @brief Measured points, in the order they were observed.
+     */
+    plundervolt_observation_t* observations;
+    uint64_t observation_count;
+    uint64_t capacity;
+    /**
+     * @brief After plundervolt_optimizer_run(): points run and tries run, points refused as unsafe among them.
+     */
+    uint64_t points_run;
+    uint64_t tries_run;
+    uint64_t points_unsafe;
+    /**
+     * @brief State of the random numbers. Private.
+     */
+    uint64_t random;
+    /**
+     * @brief Coefficients of the logistic trends of the fault and crash rates, on 1, every scaled parameter and its
+     * square. Refitted by every proposal. Private.
+     */
+    double fault_trend[1 + 2 * PLUNDERVOLT_GLITCH_PARAMETERS];
+    double crash_trend[1 + 2 * PLUNDERVOLT_GLITCH_PARAMETERS];
+} plundervolt_optimizer_t;
+
+/**
+ * @brief Make an optimizer with default settings, no bounds and no observations.
+ *
+ * @return plundervolt_optimizer_t The optimizer.
+ */
+plundervolt_optimizer_t plundervolt_optimizer_init();
+
+/**
+ * @brief Free the observations of an optimizer.
+ *
+ */
+void plundervolt_optimizer_free(plundervolt_optimizer_t* optimizer);
+
+/**
+ * @brief Add a measured point.
+ *
+ * @param optimizer The optimizer.
+ * @param value The point, indexed by plundervolt_glitch_parameter_t.
+ * @param tries Tries run.
+ * @param faulty_tries Tries which faulted.
+ * @param crashes Tries which crashed (or hung).
+ */
+void plundervolt_optimizer_observe(plundervolt_optimizer_t* optimizer, const double* value, uint64_t tries, uint64_t faulty_tries, uint64_t crashes);
+
+/**
+ * @brief Surrogate at a point.
+ *
+ * @param optimizer The optimizer.
+ * @param value The point.
+ * @param fault_rate Where to store the fault rate per try, or NULL.
+ * @param crash_rate Where to store the crash rate per try, or NULL.
+ * @param uncertainty Where to store the standard error of the fault rate, or NULL.
+ * @return double The score of the point.
+ */
+double plundervolt_optimizer_predict(const plundervolt_optimizer_t* optimizer, const double* value, double* fault_rate, double* crash_rate, double* uncertainty);
+
+/**
+ * @brief Propose the next point to measure: a random one for the first initial points, then the best scoring candidate.
+ *
+ * @param optimizer The optimizer.
+ * @param base Specification the values of the parameters without bounds come from.
+ * @param value Where to store the point, rounded as the specification holds it.
+ */
+void plundervolt_optimizer_propose(plundervolt_optimizer_t* optimizer, const plundervolt_specification_t* base, double* value);
+
+/**
+ * @brief Propose, measure (see plundervolt_grid_measure()) and observe points until points are run, the budget is
+ * used, or on_result asks to stop.
+ *
+ * @param optimizer The optimizer.
+ * @param spec Specification of every point but the searched parameters.
+ * @param points Most points to run, 0 for no limit (then budget or on_result must end the search).
+ * @return plundervolt_error_t The first error of plundervolt_grid_measure(), which ends the search. A point which gets
+ * PLUNDERVOLT_UNSAFE_RANGE_ERROR (see plundervolt_specification_t.journal) is not run, but observed, counted in the
+ * budget and reported as one try which crashed, so the surrogate steers away from it and refusals end the search too.
+ */
+plundervolt_error_t plundervolt_optimizer_run(plundervolt_optimizer_t* optimizer, plundervolt_specification_t spec, uint64_t points);
+
+#endif /* PLUNDERVOLT_OPTIMIZER_H */
@@ -0,0 +1,96 @@
+/**
+ * @file plundervolt_protocol.c
+ * @brief Binary protocol between the library and Teensy.
+ *
+ */
+
+#include <string.h>
+#include "plundervolt_protocol.h"
+
+uint16_t plundervolt_crc16(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+size_t plundervolt_frame_encode(const plundervolt_frame_t* frame, uint8_t* out) {
+    out[0] = PLUNDERVOLT_FRAME_START;
+    out[1] = frame->type;
+    out[2] = frame->sequence;
+    out[3] = frame->length;
+    memcpy(out + 4, frame->payload, frame->length);
+    uint16_t crc = plundervolt_crc16(out + 1, 3 + frame->length);
+    out[4 + frame->length] = crc & 0xFF;
+    out[5 + frame->length] = crc >> 8;
+    return 6 + frame->length;
+}
+
+int plundervolt_frame_decode(const uint8_t* in, size_t length, plundervolt_frame_t* frame) {
+    if (length == 0) {
+        return 0;
+    }
+    if (in[0] != PLUNDERVOLT_FRAME_START) {
+        // Skip to the next possible start.
+        const uint8_t* next = memchr(in + 1, PLUNDERVOLT_FRAME_START, length - 1);
+        return next ? -(int)(next - in) : -(int) length;
+    }
+    if (length < 4) {
+        return 0;
+    }
+    if (in[3] > PLUNDERVOLT_FRAME_PAYLOAD_MAX) {
+        return -1;
+    }
+    size_t frame_length = 6 + in[3];
+    if (length < frame_length) {
+        return 0;
+    }
+    uint16_t crc = in[frame_length - 2] | (uint16_t) in[frame_length - 1] << 8;
+    if (crc != plundervolt_crc16(in + 1, 3 + in[3])) {
+        return -1; // Only the start byte is known to be bad; a real frame may begin inside.
+    }
+    frame->type = in[1];
+    frame->sequence = in[2];
+    frame->length = in[3];
+    memcpy(frame->payload, in + 4, in[3]);
+    return (int) frame_length;
+}
+
+size_t plundervolt_profile_encode(const plundervolt_glitch_profile_t* profile, uint8_t* out) {
+    size_t i = 0;
+    out[i++] = profile->repeat & 0xFF;
+    out[i++] = (profile->repeat >> 8) & 0xFF;
+    out[i++] = profile->delay_before_undervolting & 0xFF;
+    out[i++] = (profile->delay_before_undervolting >> 8) & 0xFF;
+    out[i++] = profile->segments;
+    for (int segment = 0; segment < profile->segments; segment++) {
+        uint16_t voltage = (uint16_t)(profile->voltage[segment] * 10000.0f + 0.5f);
+        int16_t duration = (int16_t) profile->duration[segment];
+        out[i++] = voltage & 0xFF;
+        out[i++] = voltage >> 8;
+        out[i++] = (uint16_t) duration & 0xFF;
+        out[i++] = (uint16_t) duration >> 8;
+    }
+    return i;
+}
+
+int plundervolt_profile_decode(const uint8_t* in, size_t length, plundervolt_glitch_profile_t* profile) {
+    if (length < 5 || in[4] < 1 || in[4] > PLUNDERVOLT_GLITCH_SEGMENTS || length < 5 + 4 * (size_t) in[4]) {
+        return -1;
+    }
+    memset(profile, 0, sizeof *profile);
+    profile->repeat = in[0] | in[1] << 8;
+    profile->delay_before_undervolting = in[2] | in[3] << 8;
+    profile->segments = in[4];
+    size_t i = 5;
+    for (int segment = 0; segment < profile->segments; segment++) {
+        profile->voltage[segment] = (in[i] | in[i + 1] << 8) / 10000.0f;
+        profile->duration[segment] = (int16_t)(in[i + 2] | in[i + 3] << 8);
+        i += 4;
+    }
+    return (int) i;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file plundervolt_protocol.h
+ * @brief Binary protocol between the library and Teensy.
+ *
+ * A frame is: PLUNDERVOLT_FRAME_START, type, sequence number, payload length, payload, CRC-16/CCITT-FALSE of
+ * type to payload (little endian). Teensy acknowledges every frame except PLUNDERVOLT_FRAME_FIRE with an
+ * PLUNDERVOLT_FRAME_ACK (or PLUNDERVOLT_FRAME_NAK) carrying the same sequence number.
+ * A configuration is about a third of the bytes of the text one, and has a definite end instead of a timeout.
+ *
+ * The library switches a session to frames by sending the text line "binary". Firmware which answers "ok"
+ * understands frames from then on; anything else keeps the text protocol. See plundervolt_specification_t.protocol.
+ *
+ */
+/* plundervolt_protocol.h */
+
+#ifndef PLUNDERVOLT_PROTOCOL_H
+#define PLUNDERVOLT_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "plundervolt.h"
+
+/**
+ * @brief First byte of every frame.
+ *
+ */
+#define PLUNDERVOLT_FRAME_START 0xA5
+
+/**
+ * @brief Longest payload, and longest encoded frame.
+ *
+ */
+#define PLUNDERVOLT_FRAME_PAYLOAD_MAX 64
+#define PLUNDERVOLT_FRAME_MAX (PLUNDERVOLT_FRAME_PAYLOAD_MAX + 6)
+
+/**
+ * @brief Time the library waits for the acknowledgement of a frame, in ms, and times it sends a frame before giving
+ * up. A frame sent again keeps its sequence number, so firmware can tell a repeat from a new frame.
+ *
+ */
+#define PLUNDERVOLT_FRAME_TIMEOUT_MS 10
+#define PLUNDERVOLT_FRAME_TRIES 3
+
+/**
+ * @brief Frame types. Payloads are little endian.
+ *
+ */
+typedef enum {
+    PLUNDERVOLT_FRAME_CONFIGURE = 0x01, // Payload: a profile, see plundervolt_profile_encode(). Replaces the text configuration.
+    PLUNDERVOLT_FRAME_ARM = 0x02, // No payload.
+    PLUNDERVOLT_FRAME_FIRE = 0x03, // No payload. Not acknowledged.
+    PLUNDERVOLT_FRAME_PROFILES = 0x04, // Payload: number of profiles (1 byte). Starts a profile table upload.
+    PLUNDERVOLT_FRAME_PROFILE = 0x05, // Payload: index (1 byte), then a profile.
+    PLUNDERVOLT_FRAME_SELECT = 0x06, // Payload: index (1 byte).
+    PLUNDERVOLT_FRAME_ACK = 0x80, // No payload.
+    PLUNDERVOLT_FRAME_NAK = 0x81 // Payload: the type of the refused frame (1 byte).
+} plundervolt_frame_type_t;
+
+/**
+ * @brief A decoded frame.
+ *
+ */
+typedef struct plundervolt_frame_t {
+    uint8_t type;
+    uint8_t sequence;
+    uint8_t length;
+    uint8_t payload[PLUNDERVOLT_FRAME_PAYLOAD_MAX];
+} plundervolt_frame_t;
+
+/**
+ * @brief CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF).
+ *
+ * @param data Bytes.
+ * @param length Number of bytes.
+ * @return uint16_t The CRC.
+ */
+uint16_t plundervolt_crc16(const uint8_t* data, size_t length);
+
+/**
+ * @brief Encode a frame.
+ *
+ * @param frame The frame. length must be at most PLUNDERVOLT_FRAME_PAYLOAD_MAX.
+ * @param out At least PLUNDERVOLT_FRAME_MAX bytes.
+ * @return size_t Number of bytes written to out.
+ */
+size_t plundervolt_frame_encode(const plundervolt_frame_t* frame, uint8_t* out);
+
+/**
+ * @brief Decode the frame at the start of a buffer.
+ *
+ * @param in Received bytes.
+ * @param length Number of bytes.
+ * @param frame Where to store the frame.
+ * @return int Bytes the frame took (> 0) if one was decoded; 0 if more bytes are needed;
+ * -n if the first n bytes are not a valid frame (no start byte, or a CRC mismatch) and must be skipped.
+ */
+int plundervolt_frame_decode(const uint8_t* in, size_t length, plundervolt_frame_t* frame);
+
+/**
+ * @brief Encode a glitch profile as a payload: repeat (2 bytes), delay (2 bytes), segments (1 byte),
+ * then every segment's voltage in units of 0.1 mV (2 bytes) and duration (2 bytes, signed). The name is not sent.
+ *
+ * @param profile The profile.
+ * @param out At least 5 + 4 * PLUNDERVOLT_GLITCH_SEGMENTS bytes.
+ * @return size_t Number of bytes written to out.
+ */
+size_t plundervolt_profile_encode(const plundervolt_glitch_profile_t* profile, uint8_t* out);
+
+/**
+ * @brief Decode a payload written by plundervolt_profile_encode().
+ *
+ * @param in The payload.
+ * @param length Its length.
+ * @param profile Where to store the profile. The name is left empty.
+ * @return int Bytes used, or -1 if the payload is malformed.
+ */
+int plundervolt_profile_decode(const uint8_t* in, size_t length, plundervolt_glitch_profile_t* profile);
+
+#endif /* PLUNDERVOLT_PROTOCOL_H */
@@ -0,0 +1,275 @@
+/**
+ * @file plundervolt_telemetry.c
+ * @brief Background sampling of voltage, frequency, temperature and package energy.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <x86intrin.h>
+#include "plundervolt_telemetry.h"
+
+/**
+ * @brief A slot of the ring. sequence is 2 * index + 1 while sample index is written, and 2 * index + 2 once it is complete.
+ *
+ */
+typedef struct telemetry_slot_t {
+    atomic_uint_fast64_t sequence;
+    plundervolt_telemetry_sample_t sample;
+} telemetry_slot_t;
+
+/**
+ * @brief What the sampler keeps about every CPU it reads.
+ *
+ */
+typedef struct telemetry_cpu_t {
+    int cpu;
+    int package; // Index in topology.
+    uint64_t aperf; // Counters of the previous sample.
+    uint64_t mperf;
+    int sampled; // 1 once the CPU has a previous sample.
+} telemetry_cpu_t;
+
+telemetry_slot_t telemetry_ring[PLUNDERVOLT_TELEMETRY_SAMPLES]; // Preallocated; pages are only touched as the ring fills.
+atomic_uint_fast64_t telemetry_taken = 0; // Samples written since the last reset.
+telemetry_cpu_t telemetry_watched[PLUNDERVOLT_TELEMETRY_CPUS];
+int telemetry_watched_count = 0;
+int telemetry_period_us = 0;
+int telemetry_pin_to = -1; // CPU the sampler is pinned to, -1 for none.
+pthread_t telemetry_sampler;
+int telemetry_running = 0;
+atomic_int telemetry_stop_requested = 0;
+double telemetry_base_mhz = 0; // Frequency at which MPERF counts, from MSR_PLATFORM_INFO. 0 if unknown.
+int telemetry_tjmax = 0; // From MSR_TEMPERATURE_TARGET. 0 if unknown.
+double telemetry_joules_per_unit = 0; // From MSR_RAPL_POWER_UNIT. 0 if RAPL cannot be read.
+uint64_t telemetry_energy_raw[64]; // Last 32 bit energy counter of every package.
+double telemetry_energy[64]; // Energy of every package since the sampler started, in J.
+uint64_t telemetry_started_cycles = 0; // Time stamp counter and CLOCK_MONOTONIC time when the sampler started, for cycles per µs.
+uint64_t telemetry_started_ns = 0;
+_Atomic double telemetry_cycles_per_us = 0;
+
+/**
+ * @brief Body of the sampler thread.
+ *
+ */
+void* telemetry_loop(void* unused);
+/**
+ * @brief Read every watched CPU once, and append the samples to the ring.
+ *
+ */
+void telemetry_sample_all();
+
+plundervolt_error_t plundervolt_telemetry_start(const int* cpus, int count, int period, int sampler_cpu) {
+    if (telemetry_running) {
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    if (count < 1 || count > PLUNDERVOLT_TELEMETRY_CPUS || period < 1) {
+        return PLUNDERVOLT_RANGE_ERROR;
+    }
+    const plundervolt_topology_t* topo = plundervolt_get_topology();
+    uint64_t value;
+    for (int i = 0; i < count; i++) {
+        if (cpus[i] < 0 || cpus[i] >= topo->cpus || plundervolt_msr_read(cpus[i], 0x198, &value)) {
+            return PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR;
+        }
+        telemetry_watched[i].cpu = cpus[i];
+        telemetry_watched[i].package = topo->package_of[cpus[i]];
+        telemetry_watched[i].sampled = 0;
+    }
+    telemetry_watched_count = count;
+    telemetry_period_us = period;
+    telemetry_pin_to = sampler_cpu;
+
+    // Constants of the machine, read once.
+    telemetry_base_mhz = plundervolt_msr_read(cpus[0], 0xCE, &value) ? 0 : ((value >> 8) & 0xFF) * 100.0;
+    telemetry_tjmax = plundervolt_msr_read(cpus[0], 0x1A2, &value) ? 0 : (value >> 16) & 0xFF;
+    telemetry_joules_per_unit = plundervolt_msr_read(cpus[0], 0x606, &value) ? 0 : 1.0 / (1ull << ((value >> 8) & 0x1F));
+    for (int i = 0; i < count; i++) {
+        int package = telemetry_watched[i].package;
+        telemetry_energy[package] = 0;
+        telemetry_energy_raw[package] = plundervolt_msr_read(cpus[i], 0x611, &value) ? 0 : value & 0xFFFFFFFF;
+    }
+
+    telemetry_started_cycles = __rdtsc();
+    telemetry_started_ns = plundervolt_monotonic_ns();
+    atomic_store(&telemetry_stop_requested, 0);
+    if (pthread_create(&telemetry_sampler, NULL, telemetry_loop, NULL) != 0) {
+        return PLUNDERVOLT_GENERIC_ERROR;
+    }
+    telemetry_running = 1;
+    return PLUNDERVOLT_NO_ERROR;
+}
+
+void plundervolt_telemetry_stop() {
+    if (!telemetry_running) {
+        return;
+    }
+    atomic_store(&telemetry_stop_requested, 1);
+    pthread_join(telemetry_sampler, NULL);
+    telemetry_running = 0;
+}
+
+int plundervolt_telemetry_running() {
+    return telemetry_running;
+}
+
+void* telemetry_loop(void* unused) {
+    if (telemetry_pin_to >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(telemetry_pin_to, &cpuset);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    }
+    // Absolute deadlines, so the time the reads take does not add up.
+    uint64_t deadline = plundervolt_monotonic_ns();
+    while (!atomic_load(&telemetry_stop_requested)) {
+        telemetry_sample_all();
+        uint64_t now = plundervolt_monotonic_ns();
+        if (now > telemetry_started_ns) {
+            atomic_store(&telemetry_cycles_per_us, (__rdtsc() - telemetry_started_cycles) * 1000.0 / (now - telemetry_started_ns));
+        }
+        deadline += telemetry_period_us * 1000ull;
+        if (deadline < now) {
+            deadline = now; // Fell behind; skip the missed rounds instead of catching up in a burst.
+        }
+        struct timespec until = {.tv_sec = deadline / 1000000000ull, .tv_nsec = deadline % 1000000000ull};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+    }
+    return NULL;
+}
+
+void telemetry_sample_all() {
+    for (int i = 0; i < telemetry_watched_count; i++) {
+        telemetry_cpu_t* watch = &telemetry_watched[i];
+        plundervolt_telemetry_sample_t sample;
+        memset(&sample, 0, sizeof sample);
+        uint64_t value;
+        sample.timestamp = __rdtsc();
+        sample.cpu = watch->cpu;
+        if (!plundervolt_msr_read(watch->cpu, 0x198, &value)) {
+            sample.voltage = ((value >> 32) & 0xFFFF) / 8192.0;
+        }
+        if (!plundervolt_msr_read(watch->cpu, 0xE8, &sample.aperf) && !plundervolt_msr_read(watch->cpu, 0xE7, &sample.mperf)) {
+            if (watch->sampled && sample.mperf != watch->mperf) {
+                sample.frequency_mhz = telemetry_base_mhz * (double)(sample.aperf - watch->aperf) / (double)(sample.mperf - watch->mperf);
+            }
+            watch->aperf = sample.aperf;
+            watch->mperf = sample.mperf;
+            watch->sampled = 1;
+        }
+        if (!plundervolt_msr_read(watch->cpu, 0x19C, &value)) {
+            int below_tjmax = (value >> 16) & 0x7F; // Digital readout: degrees below TjMax.
+            sample.temperature = telemetry_tjmax - below_tjmax;
+        }
+        if (telemetry_joules_per_unit > 0 && !plundervolt_msr_read(watch->cpu, 0x611, &value)) {
+            int package = watch->package;
+            value &= 0xFFFFFFFF;
+            telemetry_energy[package] += ((value - telemetry_energy_raw[package]) & 0xFFFFFFFF) * telemetry_joules_per_unit; // The counter wraps at 32 bits.
+            telemetry_energy_raw[package] = value;
+            sample.energy = telemetry_energy[package];
+        }
+
+        // Single writer: claim the next slot, mark it busy, fill it, publish it.
+        uint64_t index = atomic_load_explicit(&telemetry_taken, memory_order_relaxed);
+        telemetry_slot_t* slot = &telemetry_ring[index & (PLUNDERVOLT_TELEMETRY_SAMPLES - 1)];
+        atomic_store_explicit(&slot->sequence, 2 * index + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot->sample = sample;
+        atomic_store_explicit(&slot->sequence, 2 * index + 2, memory_order_release);
+        atomic_store_explicit(&telemetry_taken, index + 1, memory_order_release);
+    }
+}
+
+void plundervolt_telemetry_reset() {
+    if (telemetry_running) {
+        return;
+    }
+    for (size_t i = 0; i < PLUNDERVOLT_TELEMETRY_SAMPLES; i++) {
+        if (atomic_load_explicit(&telemetry_ring[i].sequence, memory_order_relaxed)) { // Leave untouched pages untouched.
+            atomic_store_explicit(&telemetry_ring[i].sequence, 0, memory_order_relaxed);
+        }
+    }
+    atomic_store(&telemetry_taken, 0);
+}
+
+uint64_t plundervolt_telemetry_count() {
+    return atomic_load_explicit(&telemetry_taken, memory_order_acquire);
+}
+
+int plundervolt_telemetry_sample(uint64_t index, plundervolt_telemetry_sample_t* sample) {
+    telemetry_slot_t* slot = &telemetry_ring[index & (PLUNDERVOLT_TELEMETRY_SAMPLES - 1)];
+    uint64_t before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (before != 2 * index + 2) {
+        return 0;
+    }
+    *sample = slot->sample;
+    atomic_thread_fence(memory_order_acquire);
+    // Overwritten while copying if the sequence moved on.
+    return atomic_load_explicit(&slot->sequence, memory_order_relaxed) == before;
+}
+
+int plundervolt_telemetry_window(uint64_t timestamp, uint64_t before, uint64_t after, plundervolt_telemetry_sample_t* samples, int max) {
+    uint64_t count = plundervolt_telemetry_count();
+    uint64_t oldest = count > PLUNDERVOLT_TELEMETRY_SAMPLES ? count - PLUNDERVOLT_TELEMETRY_SAMPLES : 0;
+    uint64_t from = timestamp > before ? timestamp - before : 0;
+    uint64_t to = timestamp + after;
+    if (max < 1 || count == 0) {
+        return 0;
+    }
+
+    // Walk back from the newest sample to find the window [first, last] and the first sample at or after timestamp.
+    plundervolt_telemetry_sample_t sample;
+    uint64_t last = count; // count means none found yet.
+    uint64_t first = count;
+    uint64_t split = count;
+    for (uint64_t index = count; index-- > oldest; ) {
+        if (!plundervolt_telemetry_sample(index, &sample)) {
+            break; // Overwritten from here on.
+        }
+        if (sample.timestamp < from) {
+            break;
+        }
+        if (sample.timestamp > to) {
+            continue;
+        }
+        if (last == count) {
+            last = index;
+        }
+        first = index;
+        if (sample.timestamp >= timestamp) {
+            split = index;
+        }
+    }
+    if (first == count) {
+        return 0;
+    }
+    if (split == count) {
+        split = last + 1;
+    }
+
+    // Too many: keep max around the split, half before it.
+    if (last - first + 1 > (uint64_t) max) {
+        uint64_t start = split > first + max / 2 ? split - max / 2 : first;
+        if (start + max - 1 > last) {
+            start = last - max + 1;
+        }
+        first = start;
+        last = start + max - 1;
+    }
+    int stored = 0;
+    for (uint64_t index = first; index <= last; index++) {
+        if (plundervolt_telemetry_sample(index, &samples[stored])) {
+            stored++;
+        }
+    }
+    return stored;
+}
+
+double plundervolt_telemetry_cycles_per_us() {
+    return atomic_load(&telemetry_cycles_per_us);
+}
@@ -0,0 +1,129 @@
+/**
+ * @file plundervolt_telemetry.h
+ * @brief Background sampling of voltage, frequency, temperature and package energy.
+ *
+ * A sampler thread reads, for every CPU it watches, msr 0x198 (core voltage), APERF/MPERF (effective frequency),
+ * IA32_THERM_STATUS (temperature) and the RAPL package energy counter at a fixed rate. Samples go into a preallocated
+ * ring with time stamp counter timestamps, the same clock as plundervolt_fault_t.timestamp, so the trace around every
+ * fault can be cut out afterwards with plundervolt_telemetry_window(). The victim threads make no extra system calls.
+ *
+ */
+/* plundervolt_telemetry.h */
+
+#ifndef PLUNDERVOLT_TELEMETRY_H
+#define PLUNDERVOLT_TELEMETRY_H
+
+#include <stdint.h>
+#include "plundervolt.h"
+
+/**
+ * @brief Number of samples the ring holds. Older samples are overwritten. A power of 2.
+ *
+ */
+#define PLUNDERVOLT_TELEMETRY_SAMPLES 65536
+
+/**
+ * @brief Most CPUs the sampler can watch.
+ *
+ */
+#define PLUNDERVOLT_TELEMETRY_CPUS 64
+
+/**
+ * @brief One reading of one CPU.
+ *
+ */
+typedef struct plundervolt_telemetry_sample_t {
+    /**
+     * @brief Time stamp counter when the reading started.
+     */
+    uint64_t timestamp;
+    /**
+     * @brief Logical CPU read.
+     */
+    int cpu;
+    /**
+     * @brief Core voltage, in V.
+     */
+    double voltage;
+    /**
+     * @brief Effective frequency since the CPU's previous sample, in MHz: base frequency * delta APERF / delta MPERF.
+     * 0 for the first sample, or if the base frequency is unknown.
+     */
+    double frequency_mhz;
+    /**
+     * @brief Temperature, in degrees Celsius. If the TjMax is unknown, minus the distance to it.
+     */
+    int temperature;
+    /**
+     * @brief Energy used by the CPU's package since the sampler started, in J. 0 if RAPL cannot be read.
+     */
+    double energy;
+    /**
+     * @brief Raw APERF and MPERF.
+     */
+    uint64_t aperf;
+    uint64_t mperf;
+} plundervolt_telemetry_sample_t;
+
+/**
+ * @brief Start the sampler thread.
+ *
+ * @param cpus CPUs to read, e.g. the first CPU of every undervolted package. Copied.
+ * @param count Number of CPUs, 1 to PLUNDERVOLT_TELEMETRY_CPUS.
+ * @param period_us Time between two readings of all CPUs, in µs.
+ * @param sampler_cpu CPU to pin the sampler to, or -1 for none.
+ * @return plundervolt_error_t PLUNDERVOLT_RANGE_ERROR if count or period_us is wrong, PLUNDERVOLT_CANNOT_ACCESS_MSR_ERROR if
+ * msr 0x198 of a CPU cannot be read, PLUNDERVOLT_GENERIC_ERROR if the sampler is running already or cannot be started.
+ */
+plundervolt_error_t plundervolt_telemetry_start(const int* cpus, int count, int period_us, int sampler_cpu);
+
+/**
+ * @brief Stop the sampler thread and wait for it. The samples stay.
+ *
+ */
+void plundervolt_telemetry_stop();
+
+/**
+ * @return int 1 if the sampler is running, 0 if not.
+ */
+int plundervolt_telemetry_running();
+
+/**
+ * @brief Forget all samples. Only while the sampler is stopped.
+ *
+ */
+void plundervolt_telemetry_reset();
+
+/**
+ * @return uint64_t Number of samples taken since the last reset, including those already overwritten.
+ */
+uint64_t plundervolt_telemetry_count();
+
+/**
+ * @brief Copy a sample out of the ring. Safe while the sampler runs.
+ *
+ * @param index Index of the sample since the last reset.
+ * @param sample Where to store it.
+ * @return int 1 if copied, 0 if the sample is not taken yet or already overwritten.
+ */
+int plundervolt_telemetry_sample(uint64_t index, plundervolt_telemetry_sample_t* sample);
+
+/**
+ * @brief Copy the samples taken from before cycles before to after cycles after a time stamp, oldest first,
+ * e.g. the trace around a fault with its plundervolt_fault_t.timestamp.
+ *
+ * @param timestamp Time stamp counter value.
+ * @param before How far back to go, in time stamp counter cycles.
+ * @param after How far forward to go, in time stamp counter cycles.
+ * @param samples Where to store the samples.
+ * @param max Room in samples. The samples closest to timestamp are kept if there are more.
+ * @return int Number of samples stored.
+ */
+int plundervolt_telemetry_window(uint64_t timestamp, uint64_t before, uint64_t after, plundervolt_telemetry_sample_t* samples, int max);
+
+/**
+ * @return double Time stamp counter cycles per µs, measured by the sampler since it started; 0 before its second round.
+ */
+double plundervolt_telemetry_cycles_per_us();
+
+#endif /* PLUNDERVOLT_TELEMETRY_H */